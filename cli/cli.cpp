@@ -0,0 +1,768 @@
+// Command line driver of the download engine. Progress is written to stdout as one JSON object per line,
+// so scripts and other programs can follow the downloads; messages for people go to stderr.
+#include "Download.h"
+#include "DownloadManager.h"
+#include "Metalink.h"
+#include "ZsyncIndex.h"
+#include "ZipArchive.h"
+#include "BufferPool.h"
+#include "RateLimiter.h"
+#include "Util.h"
+#include <windows.h>
+#include <shlwapi.h>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct Options
+{
+	std::vector<std::wstring> Urls;
+	// more URLs of the same file, only with a single download
+	std::vector<std::wstring> Mirrors;
+	std::wstring DownloadFolder = L".";
+	long long Start = 0;
+	long long End = (-1);
+	// only these parts of the file, written at their offsets in it or to a file each
+	std::vector<ByteRange> Ranges;
+	std::wstring RangesText;
+	bool FilePerRange = false;
+	// an existing copy of the file, only the parts which differ from the server are rewritten
+	std::wstring RepairFileName;
+	// BLAKE3 digest the file has to match
+	std::wstring Digest;
+	// URLs and piece hashes of the file, corrupt pieces are downloaded again
+	std::wstring MetalinkFileName;
+	PieceList Pieces;
+	// the file to repair has been found intact
+	bool NothingToDownload = false;
+	// an older copy of the file and the zsync index of the new one, file name or URL. Only the blocks not in the seed are downloaded.
+	std::wstring SeedFileName;
+	std::wstring IndexName;
+	std::vector<SeedBlock> SeedBlocks;
+	std::vector<BYTE> Sha1;
+	// only these members of a remote ZIP archive, a name ending in / takes a whole folder. The list just prints the members.
+	std::vector<std::wstring> ZipMemberNames;
+	bool ZipList = false;
+	std::vector<ZipMember> ZipMembers;
+	// the file goes to stdout in order while it downloads, sections get at most StreamWindow bytes ahead of it
+	bool Stream = false;
+	long long StreamWindow = 67108864;
+	// zero lets the scheduler find out how many connections are worth it
+	int NoDownloader = 5;
+	std::wstring UserName;
+	std::wstring Password;
+	int MaxActiveDownloads = 4;
+	int MaxConnections = 32;
+	int MaxConnectionsPerHost = 8;
+	size_t MemoryBudget = BufferPool::DefaultBudget;
+	// bytes per second, zero for no limit
+	long long Rate = 0;
+	long long HostRate = 0;
+	long long TotalRate = 0;
+};
+
+volatile sig_atomic_t stopRequested = 0;
+// progress goes to stderr when stdout carries the file
+FILE* progressOutput = stdout;
+
+#ifdef _WIN32
+BOOL WINAPI ConsoleCtrlHandler(DWORD)
+{
+	stopRequested = 1;
+	return TRUE;
+}
+#else
+void SignalHandler(int)
+{
+	stopRequested = 1;
+}
+#endif
+
+void PrintUsage()
+{
+	fprintf(stderr, "Usage: pdcli [options] <url> [<url> ...]\n"
+		"  -m, --mirror <url>          another URL of the same file, can be repeated, with one <url> only\n"
+		"      --metalink <file>       Metalink file giving the URLs of the file, which then needs no <url>,\n"
+		"                              and hashes of its pieces; corrupt pieces are downloaded again and\n"
+		"                              with --repair only the corrupt pieces of the file are downloaded\n"
+		"  -o, --output <folder>       download folder, the current folder by default\n"
+		"      --start <byte>          first byte to download\n"
+		"      --end <byte>            last byte to download, to the end of the file by default\n"
+		"      --ranges <a-b,-n,...>   download only these byte ranges, -n is the last n bytes of the file\n"
+		"      --range-output <mode>   sparse: one file with the ranges at their offsets (default),\n"
+		"                              files: a folder with one file per range\n"
+		"      --repair <file>         fix an existing copy of the file in place, writing only the blocks\n"
+		"                              which differ from the downloaded data, with one <url> only\n"
+		"      --seed <file>           older copy of the file, the blocks it has in common with the new one\n"
+		"                              are copied from it and only the others downloaded; needs --zsync\n"
+		"      --zsync <file|url>      zsync index of the file, which then needs no <url> if it has one\n"
+		"      --zip-member <name>     download only this member of a ZIP archive, written out as a smaller\n"
+		"                              archive of the members asked for; can be repeated, a name ending\n"
+		"                              in / takes everything in that folder\n"
+		"      --zip-list              print the members of a ZIP archive as JSON lines and download nothing\n"
+		"      --stream                write the file to stdout in order while it downloads, progress then\n"
+		"                              goes to stderr; the file is not kept and cannot be resumed\n"
+		"      --stream-window <MB>    how far sections may get ahead of the stream (default 64)\n"
+		"      --blake3 <digest>       BLAKE3 digest the file has to match, hex or base64; one sent by the\n"
+		"                              server in a Repr-Digest header is checked as well\n"
+		"  -c, --connections <n>       connections per download, 0 tunes them automatically (default 5)\n"
+		"  -u, --user <name>           user name for basic authentication\n"
+		"  -p, --password <password>   password for basic authentication\n"
+		"      --max-downloads <n>     downloads running at the same time (default 4)\n"
+		"      --max-connections <n>   connections shared by all downloads (default 32)\n"
+		"      --max-per-host <n>      connections to one server (default 8)\n"
+		"      --memory <MB>           memory for transfer buffers (default 8)\n"
+		"      --rate <KB/s>           speed limit of each download\n"
+		"      --host-rate <KB/s>      speed limit of the downloads from one server together\n"
+		"      --total-rate <KB/s>     speed limit of all downloads together\n"
+		"Progress is printed as JSON lines. Interrupting keeps the downloaded part, running the same\n"
+		"command again resumes it.\n");
+}
+
+bool ParseNumber(std::wstring text, long long* value)
+{
+	LONGLONG ll;
+	if (text.empty() || !StrToInt64ExW(text.c_str(), STIF_DEFAULT, &ll)) return false;
+	*value = ll;
+	return true;
+}
+
+std::string JsonString(std::wstring text)
+{
+	std::string utf8 = Util::ToUtf8(text);
+	std::string ret = "\"";
+	for (char c : utf8)
+	{
+		if (c == '"' || c == '\\')
+		{
+			ret += '\\';
+			ret += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			ret += escaped;
+		}
+		else ret += c;
+	}
+	return ret + "\"";
+}
+
+// the first URL of the Metalink file is downloaded from unless one is given, the others are mirrors
+bool LoadMetalink(Options& options)
+{
+	Metalink metalink;
+	std::wstring error;
+	if (!metalink.Load(options.MetalinkFileName, error))
+	{
+		fprintf(stderr, "%s\n", Util::ToUtf8(error).c_str());
+		return false;
+	}
+	if (options.Urls.size() > 1)
+	{
+		fprintf(stderr, "A Metalink file describes a single download.\n");
+		return false;
+	}
+	if (options.Urls.empty()) options.Urls.push_back(metalink.Urls[0]);
+	for (std::wstring url : metalink.Urls)
+	{
+		if (url != options.Urls[0]) options.Mirrors.push_back(url);
+	}
+	options.Pieces = metalink.Pieces;
+	return true;
+}
+
+void SelectCorruptPieces(Options& options)
+{
+	HANDLE hFile = CreateFileW(options.RepairFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return;
+	LARGE_INTEGER fileSize;
+	// a file longer than the one described is repaired as a whole, which cuts it to its size
+	if (!GetFileSizeEx(hFile, &fileSize) || options.Pieces.FileSize < 0 || fileSize.QuadPart > options.Pieces.FileSize)
+	{
+		CloseHandle(hFile);
+		return;
+	}
+	std::vector<BYTE> buffer(1048576);
+	size_t corruptPieces = 0;
+	for (long long i = 0; i < (long long)options.Pieces.Hashes.size(); i++)
+	{
+		options.Pieces.CheckFile(hFile, i, &buffer[0], (DWORD)buffer.size());
+		if (options.Pieces.GetState(i) != PieceList::Corrupt) continue;
+		corruptPieces++;
+		ByteRange range;
+		range.Start = i * options.Pieces.PieceLength;
+		range.End = options.Pieces.GetPieceEnd(i) - 1;
+		if (!options.Ranges.empty() && options.Ranges.back().End + 1 == range.Start) options.Ranges.back().End = range.End;
+		else options.Ranges.push_back(range);
+	}
+	CloseHandle(hFile);
+	options.Pieces.States.assign(options.Pieces.Hashes.size(), PieceList::Unchecked);
+	fprintf(stderr, "%zu of %zu pieces of the file to repair are corrupt.\n", corruptPieces, options.Pieces.Hashes.size());
+	if (options.Ranges.empty())
+	{
+		options.NothingToDownload = true;
+		return;
+	}
+	options.RangesText = Download::FormatRanges(options.Ranges);
+	options.Start = options.Ranges.front().Start;
+	options.End = options.Ranges.back().End;
+}
+
+// downloads a small file, or these ranges of one at their offsets, into the download folder over one connection.
+// The caller deletes the file once it is read.
+bool FetchFile(Options& options, std::wstring url, std::vector<ByteRange> ranges, std::wstring& fileName, std::wstring& error)
+{
+	DownloadSection* ds = new DownloadSection;
+	ds->Url = url;
+	ds->End = (-1);
+	ds->Ranges = ranges;
+	if (!ranges.empty() && ranges.front().Start >= 0) ds->Start = ranges.front().Start;
+	if (!ranges.empty() && ranges.back().Start >= 0) ds->End = ranges.back().End;
+	DownloadSection* ss = ds->Copy();
+	Download* d = new Download();
+	d->DownloadFolder = options.DownloadFolder;
+	d->SummarySection = ss;
+	d->Sections.push_back(ds);
+	d->EnableDirectWrite();
+	d->NoDownloader = 1;
+	d->SetCredentials(options.UserName, options.Password);
+	Scheduler s(d);
+	s.Start();
+	s.WaitForFinish();
+	if (s.GetDownloadStatus() != DownloadStatus::Finished)
+	{
+		error = s.GetError();
+		return false;
+	}
+	fileName = s.GetFileName();
+	return true;
+}
+
+// an index on a server is downloaded into the download folder first, and deleted once read
+bool LoadZsyncIndex(Options& options, ZsyncIndex& index)
+{
+	std::wstring indexFileName = options.IndexName;
+	bool remote = indexFileName.compare(0, 7, L"http://") == 0 || indexFileName.compare(0, 8, L"https://") == 0;
+	std::wstring error;
+	if (remote && !FetchFile(options, options.IndexName, std::vector<ByteRange>(), indexFileName, error))
+	{
+		fprintf(stderr, "zsync index cannot be downloaded: %s\n", Util::ToUtf8(error).c_str());
+		return false;
+	}
+	bool loaded = index.Load(indexFileName, error);
+	if (remote) DeleteFileW(indexFileName.c_str());
+	if (!loaded) fprintf(stderr, "%s\n", Util::ToUtf8(error).c_str());
+	return loaded;
+}
+
+// only the blocks of the file not found in the seed are downloaded, as a sparse download of one file
+bool MatchSeed(Options& options)
+{
+	ZsyncIndex index;
+	if (!LoadZsyncIndex(options, index)) return false;
+	// URLs in the index may be relative to the index itself
+	std::wstring indexFolder = options.IndexName.substr(0, options.IndexName.rfind(L'/') + 1);
+	bool remote = indexFolder.find(L"://") != std::wstring::npos;
+	for (std::wstring url : index.Urls)
+	{
+		if (url.find(L"://") == std::wstring::npos)
+		{
+			if (!remote) continue;
+			url = indexFolder + url;
+		}
+		if (options.Urls.empty()) options.Urls.push_back(url);
+		else if (url != options.Urls[0]) options.Mirrors.push_back(url);
+	}
+	if (options.Urls.empty())
+	{
+		fprintf(stderr, "The zsync index has no URL of the file, give it after the options.\n");
+		return false;
+	}
+	std::wstring error;
+	if (!index.MatchSeed(options.SeedFileName, options.SeedBlocks, options.Ranges, error))
+	{
+		fprintf(stderr, "%s\n", Util::ToUtf8(error).c_str());
+		return false;
+	}
+	long long bytesReused = 0;
+	for (SeedBlock& block : options.SeedBlocks) bytesReused += block.Length;
+	fprintf(stderr, "%lld of %lld bytes of the file are in the seed file.\n", bytesReused, index.Length);
+	options.RangesText = Download::FormatRanges(options.Ranges);
+	options.Start = options.Ranges.front().Start;
+	options.End = options.Ranges.back().End;
+	options.Sha1 = index.Sha1;
+	return true;
+}
+
+// reads length bytes from position of a downloaded file, or the last length bytes if position is negative, and deletes it
+bool ReadFetchedFile(std::wstring fileName, long long position, long long length, std::string& content, long long& fileSize)
+{
+	HANDLE hFile = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return false;
+	LARGE_INTEGER li;
+	BOOL bResults = GetFileSizeEx(hFile, &li);
+	fileSize = li.QuadPart;
+	if (bResults && position < 0)
+	{
+		if (length > fileSize) length = fileSize;
+		position = fileSize - length;
+	}
+	bResults = bResults && position + length <= fileSize && length < 0x7FFFFFFF;
+	if (bResults)
+	{
+		li.QuadPart = position;
+		bResults = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN);
+	}
+	if (bResults)
+	{
+		DWORD dwNumberOfBytesRead = 0;
+		content.resize((size_t)length);
+		bResults = length == 0 || (ReadFile(hFile, &content[0], (DWORD)length, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead == length);
+	}
+	CloseHandle(hFile);
+	DeleteFileW(fileName.c_str());
+	return bResults;
+}
+
+// the end of the archive is fetched for the end of central directory record, then the central directory unless it was
+// in the end already. The members asked for become the ranges of a sparse download.
+bool SelectZipMembers(Options& options)
+{
+	ZipArchive archive;
+	std::wstring fileName, error;
+	std::string tail, directory;
+	long long archiveSize = 0;
+	std::vector<ByteRange> ranges(1);
+	ranges[0].Start = -(long long)ZipArchive::TailSize;
+	ranges[0].End = (-1);
+	bool bResults = FetchFile(options, options.Urls[0], ranges, fileName, error);
+	if (bResults && !ReadFetchedFile(fileName, -1, ZipArchive::TailSize, tail, archiveSize)) error = L"End of the archive cannot be read.";
+	bResults = bResults && error.empty() && archive.ParseTail(tail, archiveSize, error);
+	if (bResults && archive.DirectoryOffset >= archiveSize - (long long)tail.length())
+	{
+		directory = tail.substr((size_t)(archive.DirectoryOffset - (archiveSize - (long long)tail.length())), (size_t)archive.DirectorySize);
+	}
+	else if (bResults)
+	{
+		ranges[0].Start = archive.DirectoryOffset;
+		ranges[0].End = archive.DirectoryOffset + archive.DirectorySize - 1;
+		long long fileSize = 0;
+		bResults = FetchFile(options, options.Urls[0], ranges, fileName, error);
+		if (bResults && !ReadFetchedFile(fileName, archive.DirectoryOffset, archive.DirectorySize, directory, fileSize)) error = L"Central directory cannot be read.";
+		bResults = bResults && error.empty();
+	}
+	bResults = bResults && archive.ParseDirectory(directory, error);
+	if (!bResults)
+	{
+		fprintf(stderr, "ZIP archive cannot be read: %s\n", Util::ToUtf8(error).c_str());
+		return false;
+	}
+
+	if (options.ZipList)
+	{
+		for (ZipMember& member : archive.Members)
+		{
+			std::string line = "{\"event\":\"member\",\"name\":" + JsonString(member.Name);
+			line += ",\"size\":" + std::to_string(member.UncompressedSize);
+			line += ",\"compressed\":" + std::to_string(member.CompressedSize);
+			line += ",\"offset\":" + std::to_string(member.LocalHeaderOffset) + "}\n";
+			fputs(line.c_str(), stdout);
+		}
+		fflush(stdout);
+		return true;
+	}
+	for (std::wstring name : options.ZipMemberNames)
+	{
+		size_t selected = options.ZipMembers.size();
+		for (ZipMember& member : archive.Members)
+		{
+			if (member.Name == name || (!name.empty() && name.back() == L'/' && member.Name.compare(0, name.length(), name) == 0))
+			{
+				options.ZipMembers.push_back(member);
+			}
+		}
+		if (options.ZipMembers.size() == selected)
+		{
+			fprintf(stderr, "The archive has no member %s\n", Util::ToUtf8(name).c_str());
+			return false;
+		}
+	}
+	options.Ranges = ZipArchive::GetRanges(options.ZipMembers);
+	long long bytes = 0;
+	for (ByteRange& range : options.Ranges) bytes += range.End - range.Start + 1;
+	fprintf(stderr, "%zu of %zu members selected, %lld of %lld bytes to download.\n", options.ZipMembers.size(), archive.Members.size(), bytes, archiveSize);
+	options.RangesText = Download::FormatRanges(options.Ranges);
+	options.Start = options.Ranges.front().Start;
+	options.End = options.Ranges.back().End;
+	return true;
+}
+
+// returns false on a usage error, which has been reported
+bool ParseOptions(int argc, std::vector<std::wstring>& args, Options& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::wstring arg = args[i];
+		if (arg.empty() || arg[0] != L'-')
+		{
+			options.Urls.push_back(arg);
+			continue;
+		}
+		if (arg == L"--zip-list")
+		{
+			options.ZipList = true;
+			continue;
+		}
+		if (arg == L"--stream")
+		{
+			options.Stream = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value of %s\n", Util::ToUtf8(arg).c_str());
+			return false;
+		}
+		std::wstring value = args[++i];
+		long long number = 0;
+		BYTE digest[TreeHash::DigestSize];
+		bool isNumber = ParseNumber(value, &number);
+		if (arg == L"-o" || arg == L"--output") options.DownloadFolder = value;
+		else if (arg == L"-u" || arg == L"--user") options.UserName = value;
+		else if (arg == L"-p" || arg == L"--password") options.Password = value;
+		else if (arg == L"-m" || arg == L"--mirror") options.Mirrors.push_back(value);
+		else if (arg == L"--start" && isNumber && number >= 0) options.Start = number;
+		else if (arg == L"--end" && isNumber && number >= 0) options.End = number;
+		else if (arg == L"--ranges" && Download::ParseRanges(value, options.Ranges)) options.RangesText = value;
+		else if (arg == L"--range-output" && (value == L"sparse" || value == L"files")) options.FilePerRange = value == L"files";
+		else if (arg == L"--repair") options.RepairFileName = value;
+		else if (arg == L"--blake3" && TreeHash::ParseDigest(value, digest)) options.Digest = value;
+		else if (arg == L"--metalink") options.MetalinkFileName = value;
+		else if (arg == L"--seed") options.SeedFileName = value;
+		else if (arg == L"--zsync") options.IndexName = value;
+		else if (arg == L"--zip-member") options.ZipMemberNames.push_back(value);
+		else if (arg == L"--stream-window" && isNumber && number > 0) options.StreamWindow = number * 1048576;
+		else if ((arg == L"-c" || arg == L"--connections") && isNumber && number >= 0 && number <= 64) options.NoDownloader = (int)number;
+		else if (arg == L"--max-downloads" && isNumber && number > 0) options.MaxActiveDownloads = (int)number;
+		else if (arg == L"--max-connections" && isNumber && number > 0) options.MaxConnections = (int)number;
+		else if (arg == L"--max-per-host" && isNumber && number > 0) options.MaxConnectionsPerHost = (int)number;
+		else if (arg == L"--memory" && isNumber && number > 0) options.MemoryBudget = (size_t)number * 1048576;
+		else if (arg == L"--rate" && isNumber && number >= 0) options.Rate = number * 1024;
+		else if (arg == L"--host-rate" && isNumber && number >= 0) options.HostRate = number * 1024;
+		else if (arg == L"--total-rate" && isNumber && number >= 0) options.TotalRate = number * 1024;
+		else
+		{
+			fprintf(stderr, "Invalid option %s %s\n", Util::ToUtf8(arg).c_str(), Util::ToUtf8(value).c_str());
+			return false;
+		}
+	}
+	if (!options.MetalinkFileName.empty() && !LoadMetalink(options)) return false;
+	if (options.SeedFileName.empty() != options.IndexName.empty())
+	{
+		fprintf(stderr, "A seed file and a zsync index are given together.\n");
+		return false;
+	}
+	// the seed is matched once downloading can start, the URL may come from the index then
+	if (!options.SeedFileName.empty() && (options.Urls.size() > 1 || !options.RepairFileName.empty() || !options.Ranges.empty() ||
+		options.Start != 0 || options.End >= 0 || options.FilePerRange || !options.Digest.empty()))
+	{
+		fprintf(stderr, "A seed file needs a single download of a whole file written to one file.\n");
+		return false;
+	}
+	if (options.Urls.empty() && options.IndexName.empty())
+	{
+		PrintUsage();
+		return false;
+	}
+	if (options.Stream && (options.Urls.size() != 1 || !options.RepairFileName.empty() || !options.Ranges.empty() ||
+		options.FilePerRange || !options.Digest.empty() || !options.SeedFileName.empty() || !options.Pieces.Hashes.empty() ||
+		options.ZipList || !options.ZipMemberNames.empty()))
+	{
+		fprintf(stderr, "Streaming needs a single download of one part of a file, without ranges, repair or hashes.\n");
+		return false;
+	}
+	// the members are picked once downloading can start, their ranges then make a sparse download
+	if ((options.ZipList || !options.ZipMemberNames.empty()) && (options.Urls.size() > 1 || !options.RepairFileName.empty() ||
+		!options.Ranges.empty() || options.Start != 0 || options.End >= 0 || options.FilePerRange || !options.Digest.empty() ||
+		!options.SeedFileName.empty() || !options.Pieces.Hashes.empty()))
+	{
+		fprintf(stderr, "Members of a ZIP archive are taken from a single download of a whole archive.\n");
+		return false;
+	}
+	if (!options.Mirrors.empty() && options.Urls.size() > 1)
+	{
+		fprintf(stderr, "Mirrors can only be given for a single download.\n");
+		return false;
+	}
+	if (!options.RepairFileName.empty())
+	{
+		if (options.Urls.size() > 1 || options.FilePerRange)
+		{
+			fprintf(stderr, "Repair needs a single download written to one file.\n");
+			return false;
+		}
+		if (!PathFileExistsW(options.RepairFileName.c_str()))
+		{
+			fprintf(stderr, "File to repair does not exist.\n");
+			return false;
+		}
+	}
+	if (!options.Ranges.empty())
+	{
+		if (options.Start != 0 || options.End >= 0)
+		{
+			fprintf(stderr, "Ranges cannot be combined with start and end positions.\n");
+			return false;
+		}
+		// ranges from the end of the file come last, the end is only known once the server has told the size
+		options.Start = options.Ranges.front().Start >= 0 ? options.Ranges.front().Start : 0;
+		options.End = options.Ranges.back().Start >= 0 ? options.Ranges.back().End : (-1);
+	}
+	if (!options.Digest.empty() && (options.Urls.size() > 1 || options.Start != 0 || options.End >= 0 || !options.Ranges.empty()))
+	{
+		fprintf(stderr, "A digest can only be checked for a single download of a whole file.\n");
+		return false;
+	}
+	if (!options.Pieces.Hashes.empty() && (options.FilePerRange || (options.Ranges.empty() && options.Start != 0)))
+	{
+		fprintf(stderr, "Pieces can only be checked in a download written to one file from its start.\n");
+		return false;
+	}
+	// only the corrupt pieces of the file to repair are downloaded, a digest needs the whole file though
+	if (!options.Pieces.Hashes.empty() && !options.RepairFileName.empty() && options.Ranges.empty() && options.End < 0 && options.Digest.empty())
+	{
+		SelectCorruptPieces(options);
+	}
+	if (options.End >= 0 && options.End < options.Start)
+	{
+		fprintf(stderr, "End position is before start position.\n");
+		return false;
+	}
+	if (!PathFileExistsW(options.DownloadFolder.c_str()))
+	{
+		fprintf(stderr, "Download folder does not exist.\n");
+		return false;
+	}
+	return true;
+}
+
+const char* StatusName(DownloadStatus status)
+{
+	switch (status)
+	{
+	case DownloadStatus::Stopped: return "stopped";
+	case DownloadStatus::Downloading: return "downloading";
+	case DownloadStatus::Finished: return "finished";
+	case DownloadStatus::DownloadError: return "error";
+	default: return "failed";
+	}
+}
+
+Download* CreateDownload(Options& options, std::wstring url)
+{
+	// pick up where an earlier run of the same download left off, a stream always starts over
+	std::wstring manifestFileName = options.Stream ? L"" : Download::FindManifest(options.DownloadFolder, url, options.Start, options.End, options.RangesText, options.RepairFileName);
+	Download* d = manifestFileName.empty() ? NULL : Download::LoadManifest(manifestFileName);
+	if (!d)
+	{
+		DownloadSection* ds = new DownloadSection;
+		ds->Url = url;
+		ds->Start = options.Start;
+		ds->End = options.End;
+		ds->Ranges = options.Ranges;
+
+		DownloadSection* ss = ds->Copy();
+
+		d = new Download();
+		d->DownloadFolder = options.DownloadFolder;
+		d->SummarySection = ss;
+		d->Sections.push_back(ds);
+		d->FilePerRange = options.FilePerRange;
+		if (options.Stream) d->EnableStreaming(GetStdHandle(STD_OUTPUT_HANDLE), options.StreamWindow);
+		else if (options.RepairFileName.empty()) d->EnableDirectWrite();
+		else d->EnableRepair(options.RepairFileName);
+	}
+	// mirrors given now replace the ones of an earlier run
+	if (!options.Mirrors.empty()) d->Mirrors = options.Mirrors;
+	d->AutoNoDownloader = options.NoDownloader == 0;
+	d->NoDownloader = options.NoDownloader == 0 ? 2 : options.NoDownloader;
+	d->SetCredentials(options.UserName, options.Password);
+	d->MaxBytesPerSecond = options.Rate;
+	d->ExpectedDigest = options.Digest;
+	d->Pieces = options.Pieces;
+	d->SeedFileName = options.SeedFileName;
+	d->SeedBlocks = options.SeedBlocks;
+	d->ExpectedSha1 = options.Sha1;
+	d->ZipMembers = options.ZipMembers;
+	// sections small enough for all connections to share the window
+	long long windowSection = options.StreamWindow / (2 * (long long)d->NoDownloader);
+	if (options.Stream && windowSection < d->MinSectionSize) d->MinSectionSize = windowSection > 262144 ? windowSection : 262144;
+	if (options.HostRate > 0) RateLimiter::SetHostLimit(Util::UrlGetHostName(url), options.HostRate);
+	return d;
+}
+
+struct Progress
+{
+	long long LastBytes = 0;
+	ULONGLONG LastTime = 0;
+	bool Reported = false;
+};
+
+void ReportProgress(int id, Scheduler* s, Progress& progress, const char* event, bool repair)
+{
+	ULONGLONG now = GetTickCount64();
+	long long total = s->GetTotalSize();
+	long long downloaded = s->GetBytesDownloaded();
+	if (total > 0 && downloaded > total) downloaded = total;
+	double speed = 0;
+	if (progress.LastTime && now > progress.LastTime) speed = (double)(downloaded - progress.LastBytes) * 1000 / (now - progress.LastTime);
+	if (speed < 0) speed = 0;
+	progress.LastBytes = downloaded;
+	progress.LastTime = now;
+
+	std::string line = "{\"event\":\"";
+	line += event;
+	line += "\",\"id\":" + std::to_string(id);
+	line += ",\"url\":" + JsonString(s->GetUrl());
+	line += ",\"status\":\"" + std::string(StatusName(s->GetDownloadStatus())) + "\"";
+	line += ",\"total\":" + std::to_string(total > 0 ? total : 0);
+	line += ",\"downloaded\":" + std::to_string(downloaded);
+	line += ",\"speed\":" + std::to_string((long long)speed);
+	line += ",\"connections\":" + std::to_string(s->GetActiveConnections());
+	if (s->GetDownloadStatus() == DownloadStatus::Finished && !s->GetFileName().empty()) line += ",\"file\":" + JsonString(s->GetFileName());
+	if (s->GetBytesStreamed() > 0) line += ",\"streamed\":" + std::to_string(s->GetBytesStreamed());
+	if (!s->GetDigest().empty()) line += ",\"blake3\":" + JsonString(s->GetDigest());
+	if (s->GetBytesReused() > 0) line += ",\"reused\":" + std::to_string(s->GetBytesReused());
+	if (s->GetPiecesRefetched() > 0) line += ",\"pieces_refetched\":" + std::to_string(s->GetPiecesRefetched());
+	if (repair) line += ",\"repaired\":" + std::to_string(s->GetBytesRepaired());
+	if (repair && s->GetDownloadStatus() == DownloadStatus::Finished)
+	{
+		// offset and length of every part of the file which was rewritten
+		line += ",\"repaired_ranges\":[";
+		std::vector<ByteRange> ranges = s->GetRepairedRanges();
+		for (size_t i = 0; i < ranges.size(); i++)
+		{
+			if (i > 0) line += ",";
+			line += "[" + std::to_string(ranges[i].Start) + "," + std::to_string(ranges[i].End - ranges[i].Start + 1) + "]";
+		}
+		line += "]";
+	}
+	// failed sections are retried, their error shows up here in the meantime
+	std::wstring error = s->GetError();
+	if (!error.empty()) line += ",\"error\":" + JsonString(error);
+	line += "}\n";
+	fputs(line.c_str(), progressOutput);
+	fflush(progressOutput);
+}
+
+int RunDownloads(Options& options)
+{
+	if (!BufferPool::SetBudget(options.MemoryBudget))
+	{
+		fprintf(stderr, "Memory budget cannot be changed.\n");
+		return 2;
+	}
+
+	RateLimiter::SetGlobalLimit(options.TotalRate);
+	if (!options.SeedFileName.empty() && !MatchSeed(options)) return 1;
+	if ((options.ZipList || !options.ZipMemberNames.empty()) && !SelectZipMembers(options)) return 1;
+	if (options.ZipList) return 0;
+
+	DownloadManager manager;
+	manager.MaxActiveDownloads = options.MaxActiveDownloads;
+	manager.MaxConnections = options.MaxConnections;
+	// a single download should get the connections asked for
+	manager.MaxConnectionsPerHost = options.MaxConnectionsPerHost;
+	if (options.Urls.size() == 1 && options.NoDownloader > manager.MaxConnectionsPerHost) manager.MaxConnectionsPerHost = options.NoDownloader;
+	if (options.Urls.size() == 1 && options.NoDownloader > manager.MaxConnections) manager.MaxConnections = options.NoDownloader;
+
+	for (std::wstring url : options.Urls)
+	{
+		try
+		{
+			manager.AddDownload(CreateDownload(options, url));
+		}
+		catch (...)
+		{
+			fprintf(stderr, "Cannot start downloading %s\n", Util::ToUtf8(url).c_str());
+			return 1;
+		}
+	}
+
+	std::vector<int> ids = manager.GetDownloadIds();
+	std::vector<Progress> progress(ids.size());
+	manager.Start();
+	while (!stopRequested)
+	{
+		// sleep in short steps to react to interruption quickly
+		for (int i = 0; i < 10 && !stopRequested; i++) Sleep(100);
+		bool finished = manager.IsFinished();
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			Scheduler* s = manager.GetScheduler(ids[i]);
+			DownloadStatus status = s->GetDownloadStatus();
+			bool done = status == DownloadStatus::Finished || status == DownloadStatus::DownloadError || status == DownloadStatus::LogicalError;
+			if (progress[i].Reported) continue;
+			// errors are final only once the manager has given up on the download
+			if (status == DownloadStatus::Finished || (done && finished))
+			{
+				ReportProgress(ids[i], s, progress[i], status == DownloadStatus::Finished ? "finished" : "error", !options.RepairFileName.empty());
+				progress[i].Reported = true;
+			}
+			else ReportProgress(ids[i], s, progress[i], "progress", !options.RepairFileName.empty());
+		}
+		if (finished) break;
+	}
+
+	int exitCode = 0;
+	if (stopRequested)
+	{
+		// the manifest is saved when a scheduler stops, running the same command again resumes the download
+		fprintf(stderr, "Stopping, the downloaded part is kept.\n");
+		manager.Stop(false, true);
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			if (!progress[i].Reported) ReportProgress(ids[i], manager.GetScheduler(ids[i]), progress[i], "stopped", !options.RepairFileName.empty());
+		}
+	}
+	manager.WaitForFinish();
+	for (int id : ids)
+	{
+		if (manager.GetDownloadStatus(id) != DownloadStatus::Finished) exitCode = 1;
+	}
+	return exitCode;
+}
+
+int RunCommandLine(std::vector<std::wstring>& args)
+{
+	Options options;
+	if (!ParseOptions((int)args.size(), args, options)) return 2;
+	if (options.NothingToDownload) return 0;
+	if (options.Stream) progressOutput = stderr;
+#ifdef _WIN32
+	SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+#else
+	signal(SIGINT, SignalHandler);
+	signal(SIGTERM, SignalHandler);
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	return RunDownloads(options);
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[])
+{
+	std::vector<std::wstring> args(argv, argv + argc);
+	return RunCommandLine(args);
+}
+#else
+int main(int argc, char* argv[])
+{
+	std::vector<std::wstring> args;
+	for (int i = 0; i < argc; i++) args.push_back(Util::FromUtf8(argv[i]));
+	return RunCommandLine(args);
+}
+#endif
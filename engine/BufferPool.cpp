@@ -0,0 +1,157 @@
+#include "BufferPool.h"
+#include <psapi.h>
+
+SRWLOCK BufferPool::poolLock = SRWLOCK_INIT;
+CONDITION_VARIABLE BufferPool::bufferReturned = CONDITION_VARIABLE_INIT;
+size_t BufferPool::budget = BufferPool::DefaultBudget;
+LPBYTE BufferPool::memory = NULL;
+std::vector<LPBYTE> BufferPool::freeBuffers;
+std::deque<std::pair<PTP_SIMPLE_CALLBACK, PVOID>> BufferPool::waiters;
+size_t BufferPool::buffersInUse = 0;
+size_t BufferPool::peakBuffersInUse = 0;
+long long BufferPool::throttledReads = 0;
+
+bool BufferPool::SetBudget(size_t bytes)
+{
+	bool bResults = false;
+	AcquireSRWLockExclusive(&poolLock);
+	// the pool is allocated once, the budget can only change before that
+	if (!memory)
+	{
+		budget = bytes < BufferSize ? BufferSize : bytes - bytes % BufferSize;
+		bResults = true;
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	return bResults;
+};
+
+bool BufferPool::Allocate()
+{
+	AcquireSRWLockExclusive(&poolLock);
+	if (!memory)
+	{
+		// page aligned, so buffers can also be used for unbuffered file I/O
+		memory = (LPBYTE)VirtualAlloc(NULL, budget, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (memory)
+		{
+			for (size_t offset = 0; offset + BufferSize <= budget; offset += BufferSize)
+			{
+				freeBuffers.push_back(memory + offset);
+			}
+		}
+	}
+	bool bResults = memory != NULL;
+	ReleaseSRWLockExclusive(&poolLock);
+	return bResults;
+};
+
+LPBYTE BufferPool::Lease(PTP_SIMPLE_CALLBACK callback, PVOID context)
+{
+	LPBYTE buffer = NULL;
+	AcquireSRWLockExclusive(&poolLock);
+	if (!freeBuffers.empty())
+	{
+		buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+		buffersInUse++;
+		if (buffersInUse > peakBuffersInUse) peakBuffersInUse = buffersInUse;
+	}
+	else if (callback)
+	{
+		// called on the thread pool when a buffer comes back, the caller then asks again
+		waiters.push_back(std::make_pair(callback, context));
+		throttledReads++;
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	return buffer;
+};
+
+LPBYTE BufferPool::LeaseWait()
+{
+	LPBYTE buffer = NULL;
+	AcquireSRWLockExclusive(&poolLock);
+	while (memory && freeBuffers.empty())
+	{
+		SleepConditionVariableSRW(&bufferReturned, &poolLock, INFINITE, 0);
+	}
+	if (!freeBuffers.empty())
+	{
+		buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+		buffersInUse++;
+		if (buffersInUse > peakBuffersInUse) peakBuffersInUse = buffersInUse;
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	return buffer;
+};
+
+bool BufferPool::CancelWait(PVOID context)
+{
+	bool bResults = false;
+	AcquireSRWLockExclusive(&poolLock);
+	for (auto it = waiters.begin(); it != waiters.end(); it++)
+	{
+		if (it->second == context)
+		{
+			waiters.erase(it);
+			bResults = true;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	// false means the callback has already been submitted and is on its way
+	return bResults;
+};
+
+void BufferPool::Return(LPBYTE buffer)
+{
+	if (!buffer) return;
+	std::pair<PTP_SIMPLE_CALLBACK, PVOID> waiter(NULL, NULL);
+	AcquireSRWLockExclusive(&poolLock);
+	freeBuffers.push_back(buffer);
+	buffersInUse--;
+	if (!waiters.empty())
+	{
+		waiter = waiters.front();
+		waiters.pop_front();
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	WakeConditionVariable(&bufferReturned);
+	// the waiter runs on another thread, the caller may hold locks the waiter needs
+	if (waiter.first) TrySubmitThreadpoolCallback(waiter.first, waiter.second, NULL);
+};
+
+size_t BufferPool::GetPeakMemoryUsage()
+{
+	AcquireSRWLockShared(&poolLock);
+	size_t peak = peakBuffersInUse * BufferSize;
+	ReleaseSRWLockShared(&poolLock);
+	return peak;
+};
+
+std::wstring BufferPool::GetStatisticsDescription()
+{
+	std::wstring statusStr;
+	AcquireSRWLockShared(&poolLock);
+	if (memory)
+	{
+		statusStr.append(L"Buffer memory: ");
+		statusStr.append(std::to_wstring(buffersInUse * BufferSize / 1024));
+		statusStr.append(L" KB in use, ");
+		statusStr.append(std::to_wstring(peakBuffersInUse * BufferSize / 1024));
+		statusStr.append(L" KB peak of ");
+		statusStr.append(std::to_wstring(budget / 1024));
+		statusStr.append(L" KB budget, reads waited for a buffer ");
+		statusStr.append(std::to_wstring(throttledReads));
+		statusStr.append(L" times.\r\n");
+	}
+	ReleaseSRWLockShared(&poolLock);
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		statusStr.append(L"Peak process memory: ");
+		statusStr.append(std::to_wstring(counters.PeakWorkingSetSize / 1024));
+		statusStr.append(L" KB.\r\n");
+	}
+	return statusStr;
+};
\ No newline at end of file
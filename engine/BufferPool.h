@@ -0,0 +1,35 @@
+#pragma once
+#include <windows.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// I/O buffers shared by all transfers, carved out of one allocation made up front.
+// The budget bounds the memory used for received data however many connections run,
+// transfers which find the pool empty wait for a buffer instead of allocating one.
+class BufferPool
+{
+private:
+	static SRWLOCK poolLock;
+	static CONDITION_VARIABLE bufferReturned;
+	static size_t budget;
+	static LPBYTE memory;
+	static std::vector<LPBYTE> freeBuffers;
+	// callbacks of transfers waiting for a buffer, in the order they asked for one
+	static std::deque<std::pair<PTP_SIMPLE_CALLBACK, PVOID>> waiters;
+	static size_t buffersInUse;
+	static size_t peakBuffersInUse;
+	static long long throttledReads;
+public:
+	static const DWORD BufferSize = 131072;
+	static const size_t DefaultBudget = 8388608;
+	static bool SetBudget(size_t bytes);
+	static bool Allocate();
+	static LPBYTE Lease(PTP_SIMPLE_CALLBACK callback = NULL, PVOID context = NULL);
+	static LPBYTE LeaseWait();
+	static bool CancelWait(PVOID context);
+	static void Return(LPBYTE buffer);
+	static size_t GetPeakMemoryUsage();
+	static std::wstring GetStatisticsDescription();
+};
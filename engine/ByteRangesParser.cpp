@@ -0,0 +1,197 @@
+#include "ByteRangesParser.h"
+#include <cctype>
+#include <cstring>
+
+static std::string ToLower(std::string text)
+{
+	for (char& c : text) c = (char)tolower((unsigned char)c);
+	return text;
+}
+
+static std::string Trim(std::string text)
+{
+	size_t first = text.find_first_not_of(" \t");
+	if (first == std::string::npos) return std::string();
+	size_t last = text.find_last_not_of(" \t");
+	return text.substr(first, last - first + 1);
+}
+
+void ByteRangesParser::Reset(std::vector<ByteRange> wantedRanges)
+{
+	wanted = wantedRanges;
+	wantedIndex = 0;
+	nextWanted = wanted.empty() ? 0 : wanted[0].Start;
+	state = State::Done;
+	boundary.clear();
+	line.clear();
+	partFirst = partLast = (-1);
+	failed = false;
+	missedData = false;
+};
+
+void ByteRangesParser::StartPart(long long first, long long last)
+{
+	partPosition = first;
+	partEnd = last;
+	state = State::Body;
+};
+
+void ByteRangesParser::StartMultipart(std::string boundary)
+{
+	this->boundary = boundary;
+	line.clear();
+	state = State::Boundary;
+};
+
+bool ByteRangesParser::ReadLine(LPBYTE data, DWORD length, DWORD& index)
+{
+	// collects a line which may arrive in pieces, returns true once it is complete
+	while (index < length)
+	{
+		char c = (char)data[index++];
+		if (c == '\n')
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			return true;
+		}
+		line += c;
+		if (line.length() > maxLineLength)
+		{
+			failed = true;
+			return false;
+		}
+	}
+	return false;
+};
+
+void ByteRangesParser::OnLine()
+{
+	if (state == State::Boundary)
+	{
+		// the preamble and the line breaks around boundaries are skipped
+		if (line == "--" + boundary) state = State::Headers;
+		else if (line == "--" + boundary + "--") state = State::Done;
+	}
+	else if (state == State::Headers)
+	{
+		if (line.empty())
+		{
+			// every part has to say where its bytes belong
+			if (partFirst < 0)
+			{
+				failed = true;
+				return;
+			}
+			StartPart(partFirst, partLast);
+			partFirst = partLast = (-1);
+			return;
+		}
+		size_t colon = line.find(':');
+		if (colon != std::string::npos && ToLower(Trim(line.substr(0, colon))) == "content-range")
+		{
+			if (!ParseContentRange(Trim(line.substr(colon + 1)), partFirst, partLast)) failed = true;
+		}
+	}
+	line.clear();
+};
+
+DWORD ByteRangesParser::OnBody(LPBYTE data, DWORD length, DWORD index, DWORD& outLength)
+{
+	// returns the index after the bytes of the part in this piece
+	long long available = partEnd - partPosition + 1;
+	if (available > length - index) available = length - index;
+	long long position = partPosition;
+	long long pieceEnd = partPosition + available - 1;
+	while (!missedData && wantedIndex < wanted.size() && position <= pieceEnd)
+	{
+		// bytes before the next wanted one are gaps, or arrived already
+		if (position < nextWanted) position = nextWanted;
+		if (position > pieceEnd) break;
+		if (position > nextWanted)
+		{
+			missedData = true;
+			break;
+		}
+		long long last = wanted[wantedIndex].End < pieceEnd ? wanted[wantedIndex].End : pieceEnd;
+		DWORD count = (DWORD)(last - position + 1);
+		memmove(data + outLength, data + index + (position - partPosition), count);
+		outLength += count;
+		position = last + 1;
+		nextWanted = position;
+		if (nextWanted > wanted[wantedIndex].End && ++wantedIndex < wanted.size()) nextWanted = wanted[wantedIndex].Start;
+	}
+	partPosition += available;
+	if (partPosition > partEnd)
+	{
+		line.clear();
+		state = boundary.empty() ? State::Done : State::Boundary;
+	}
+	return index + (DWORD)available;
+};
+
+DWORD ByteRangesParser::Parse(LPBYTE data, DWORD length)
+{
+	DWORD index = 0;
+	DWORD outLength = 0;
+	while (index < length && !failed && state != State::Done)
+	{
+		if (state == State::Body) index = OnBody(data, length, index, outLength);
+		else if (ReadLine(data, length, index)) OnLine();
+	}
+	return outLength;
+};
+
+bool ByteRangesParser::IsDone()
+{
+	return state == State::Done;
+};
+
+bool ByteRangesParser::IsComplete()
+{
+	return wantedIndex >= wanted.size();
+};
+
+bool ByteRangesParser::HasFailed()
+{
+	return failed;
+};
+
+bool ByteRangesParser::HasMissedData()
+{
+	return missedData;
+};
+
+bool ByteRangesParser::ParseContentRange(std::string contentRange, long long& first, long long& last)
+{
+	if (ToLower(contentRange.substr(0, 6)) != "bytes ") return false;
+	size_t dash = contentRange.find('-', 6);
+	size_t slash = contentRange.find('/', 6);
+	if (dash == std::string::npos || slash == std::string::npos || slash < dash) return false;
+	char* end = NULL;
+	std::string firstStr = Trim(contentRange.substr(6, dash - 6));
+	std::string lastStr = Trim(contentRange.substr(dash + 1, slash - dash - 1));
+	if (firstStr.empty() || lastStr.empty()) return false;
+	first = strtoll(firstStr.c_str(), &end, 10);
+	if (*end) return false;
+	last = strtoll(lastStr.c_str(), &end, 10);
+	if (*end) return false;
+	return first >= 0 && last >= first;
+};
+
+std::string ByteRangesParser::GetBoundary(std::string contentType)
+{
+	std::string lower = ToLower(contentType);
+	if (Trim(lower).compare(0, 20, "multipart/byteranges") != 0) return std::string();
+	size_t index = lower.find("boundary=");
+	if (index == std::string::npos) return std::string();
+	std::string boundary = contentType.substr(index + 9);
+	if (!boundary.empty() && boundary[0] == '"')
+	{
+		size_t quote = boundary.find('"', 1);
+		if (quote == std::string::npos) return std::string();
+		return boundary.substr(1, quote - 1);
+	}
+	size_t end = boundary.find_first_of("; \t");
+	if (end != std::string::npos) boundary = boundary.substr(0, end);
+	return boundary;
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include "DownloadSection.h"
+#include <windows.h>
+#include <string>
+#include <vector>
+
+// Picks the wanted bytes out of the body of a response to a range request, while it streams in.
+// A response with several ranges is a multipart/byteranges body, every part with its own Content-Range;
+// a response with one range is the bytes of its Content-Range. Requests may cover small gaps between the
+// wanted ranges, so fewer of them are needed, and those bytes are dropped here.
+class ByteRangesParser
+{
+private:
+	enum class State { Boundary, Headers, Body, Done };
+	static const size_t maxLineLength = 1024;
+	State state = State::Done;
+	std::string boundary;
+	std::string line;
+	// wanted ranges of the request, and the next wanted position within them
+	std::vector<ByteRange> wanted;
+	size_t wantedIndex = 0;
+	long long nextWanted = 0;
+	// the part being received, and the position of its next byte
+	long long partPosition = 0;
+	long long partEnd = (-1);
+	long long partFirst = (-1);
+	long long partLast = (-1);
+	bool failed = false;
+	bool missedData = false;
+	bool ReadLine(LPBYTE data, DWORD length, DWORD& index);
+	void OnLine();
+	DWORD OnBody(LPBYTE data, DWORD length, DWORD index, DWORD& outLength);
+public:
+	void Reset(std::vector<ByteRange> wantedRanges);
+	// the response is a single part holding first..last
+	void StartPart(long long first, long long last);
+	// the response is multipart/byteranges separated by this boundary
+	void StartMultipart(std::string boundary);
+	// moves the wanted bytes of this piece of the body to its start, returns how many there are
+	DWORD Parse(LPBYTE data, DWORD length);
+	// the whole body has been parsed
+	bool IsDone();
+	// every wanted byte has been received
+	bool IsComplete();
+	bool HasFailed();
+	// the server left out wanted bytes, what follows cannot be written in order
+	bool HasMissedData();
+	// parses "bytes first-last/size", size may be *
+	static bool ParseContentRange(std::string contentRange, long long& first, long long& last);
+	// boundary of a multipart/byteranges Content-Type, empty if it is something else
+	static std::string GetBoundary(std::string contentType);
+};
@@ -0,0 +1,16 @@
+#include "Clock.h"
+
+ULONGLONG Clock::Now()
+{
+	return GetTickCount64();
+};
+
+time_t Clock::Time()
+{
+	return time(NULL);
+};
+
+DWORD Clock::Wait(HANDLE hEvent, DWORD dwMilliseconds)
+{
+	return WaitForSingleObject(hEvent, dwMilliseconds);
+};
\ No newline at end of file
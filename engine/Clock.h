@@ -0,0 +1,15 @@
+#pragma once
+#include <windows.h>
+#include <ctime>
+
+// time source of Scheduler and Downloader, the simulator links its own virtual time implementation instead
+class Clock
+{
+public:
+	// milliseconds, like GetTickCount64
+	static ULONGLONG Now();
+	// seconds, like time(NULL)
+	static time_t Time();
+	// like WaitForSingleObject, returns WAIT_OBJECT_0 or WAIT_TIMEOUT
+	static DWORD Wait(HANDLE hEvent, DWORD dwMilliseconds);
+};
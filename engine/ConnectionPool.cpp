@@ -0,0 +1,100 @@
+#include "ConnectionPool.h"
+
+HINTERNET ConnectionPool::hSession = NULL;
+SRWLOCK ConnectionPool::poolLock = SRWLOCK_INIT;
+std::map<std::wstring, HINTERNET> ConnectionPool::connections;
+long long ConnectionPool::newConnections = 0;
+long long ConnectionPool::reusedConnections = 0;
+unsigned long long ConnectionPool::handshakeTime = 0;
+
+HINTERNET ConnectionPool::OpenSession(std::wstring userAgent, WINHTTP_STATUS_CALLBACK callback)
+{
+	AcquireSRWLockExclusive(&poolLock);
+	if (!hSession)
+	{
+		// all transfers run as asynchronous requests, driven by WinHTTP's own small pool of worker threads.
+		// WinHTTP keeps idle keep-alive connections of a session and hands them to the next request to the same server.
+		hSession = WinHttpOpen(userAgent.c_str(),
+			WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,
+			WINHTTP_NO_PROXY_NAME,
+			WINHTTP_NO_PROXY_BYPASS, WINHTTP_FLAG_ASYNC);
+		if (hSession)
+		{
+			WinHttpSetStatusCallback(hSession, callback,
+				WINHTTP_CALLBACK_FLAG_ALL_COMPLETIONS | WINHTTP_CALLBACK_FLAG_HANDLES | WINHTTP_CALLBACK_FLAG_CONNECT_TO_SERVER, 0);
+		}
+	}
+	HINTERNET ret = hSession;
+	ReleaseSRWLockExclusive(&poolLock);
+	return ret;
+};
+
+HINTERNET ConnectionPool::GetConnection(std::wstring hostName, INTERNET_PORT port)
+{
+	std::wstring key = hostName + L':' + std::to_wstring(port);
+	HINTERNET hConnect = NULL;
+	AcquireSRWLockExclusive(&poolLock);
+	if (hSession)
+	{
+		auto it = connections.find(key);
+		if (it != connections.end())
+		{
+			hConnect = it->second;
+		}
+		else
+		{
+			hConnect = WinHttpConnect(hSession, hostName.c_str(), port, 0);
+			if (hConnect) connections[key] = hConnect;
+		}
+	}
+	ReleaseSRWLockExclusive(&poolLock);
+	return hConnect;
+};
+
+void ConnectionPool::ReportNewConnection(unsigned long long handshakeMilliseconds)
+{
+	AcquireSRWLockExclusive(&poolLock);
+	newConnections++;
+	handshakeTime += handshakeMilliseconds;
+	ReleaseSRWLockExclusive(&poolLock);
+};
+
+void ConnectionPool::ReportReusedConnection()
+{
+	AcquireSRWLockExclusive(&poolLock);
+	reusedConnections++;
+	ReleaseSRWLockExclusive(&poolLock);
+};
+
+std::wstring ConnectionPool::GetStatisticsDescription()
+{
+	std::wstring statusStr;
+	AcquireSRWLockShared(&poolLock);
+	if (newConnections > 0)
+	{
+		// every reused connection saves one average handshake
+		unsigned long long timeSaved = handshakeTime / newConnections * reusedConnections;
+		statusStr.append(L"Connections: ");
+		statusStr.append(std::to_wstring(newConnections));
+		statusStr.append(L" new, ");
+		statusStr.append(std::to_wstring(reusedConnections));
+		statusStr.append(L" reused, ");
+		statusStr.append(std::to_wstring(timeSaved));
+		statusStr.append(L" ms of handshakes saved.\r\n");
+	}
+	ReleaseSRWLockShared(&poolLock);
+	return statusStr;
+};
+
+void ConnectionPool::Close()
+{
+	AcquireSRWLockExclusive(&poolLock);
+	for (auto& connection : connections)
+	{
+		WinHttpCloseHandle(connection.second);
+	}
+	connections.clear();
+	if (hSession) WinHttpCloseHandle(hSession);
+	hSession = NULL;
+	ReleaseSRWLockExclusive(&poolLock);
+};
\ No newline at end of file
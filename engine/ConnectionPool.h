@@ -0,0 +1,25 @@
+#pragma once
+#include <windows.h>
+#include <winhttp.h>
+#include <map>
+#include <string>
+
+// Transport state shared by all Downloaders: the WinHTTP session, one connection handle per server,
+// and statistics about how often requests could go out on a warm keep-alive connection.
+class ConnectionPool
+{
+private:
+	static HINTERNET hSession;
+	static SRWLOCK poolLock;
+	static std::map<std::wstring, HINTERNET> connections;
+	static long long newConnections;
+	static long long reusedConnections;
+	static unsigned long long handshakeTime;
+public:
+	static HINTERNET OpenSession(std::wstring userAgent, WINHTTP_STATUS_CALLBACK callback);
+	static HINTERNET GetConnection(std::wstring hostName, INTERNET_PORT port);
+	static void ReportNewConnection(unsigned long long handshakeMilliseconds);
+	static void ReportReusedConnection();
+	static std::wstring GetStatisticsDescription();
+	static void Close();
+};
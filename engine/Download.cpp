@@ -0,0 +1,346 @@
+#include "Download.h"
+#include "Util.h"
+#include <windows.h>
+#include <stdexcept>
+
+const std::string Download::manifestHeader = "partialdownload manifest 1";
+
+Download::~Download()
+{
+	for (DownloadSection* section : Sections)
+	{
+		delete section;
+	}
+	delete SummarySection;
+};
+
+void Download::SetCredentials(std::wstring userName, std::wstring password)
+{
+	SummarySection->UserName = userName;
+	SummarySection->Password = password;
+	for (DownloadSection* section : Sections)
+	{
+		section->UserName = userName;
+		section->Password = password;
+	}
+};
+
+void Download::EnableDirectWrite()
+{
+	// all sections write into one file in the download folder, which is renamed when finished
+	std::wstring fileName = Util::CombinePathAndFileName(DownloadFolder, Util::CreateGuid() + L".partial");
+	DirectWrite = true;
+	for (DownloadSection* section : Sections)
+	{
+		section->FileName = fileName;
+		section->SharedFile = true;
+		// a sparse download keeps the offsets of the file on the server, the gaps are left as holes
+		section->FileOrigin = SummarySection->Ranges.empty() ? SummarySection->Start : 0;
+	}
+	ManifestFileName = fileName + L".manifest";
+};
+
+void Download::EnableStreaming(HANDLE hStream, long long window)
+{
+	// what has gone to the stream is not kept in the file, there is nothing to resume from
+	EnableDirectWrite();
+	StreamHandle = hStream;
+	StreamWindow = window;
+	ManifestFileName.clear();
+};
+
+void Download::EnableRepair(std::wstring fileName)
+{
+	// all sections write into the existing file at the offsets of the server, which stays where it is when finished
+	RepairFileName = fileName;
+	DirectWrite = true;
+	for (DownloadSection* section : Sections)
+	{
+		section->FileName = fileName;
+		section->SharedFile = true;
+		section->FileOrigin = 0;
+	}
+	ManifestFileName = Util::CombinePathAndFileName(DownloadFolder, Util::CreateGuid() + L".partial.manifest");
+};
+
+std::wstring Download::SectionToManifestLine(std::wstring recordType, DownloadSection* section, int nextSection)
+{
+	long long bytesDownloaded = section->BytesDownloaded;
+	long long end = section->End;
+	if (end >= 0 && bytesDownloaded > section->GetTotal()) bytesDownloaded = section->GetTotal();
+	std::wstring line = recordType;
+	line += L'\t' + std::to_wstring(section->Start);
+	line += L'\t' + std::to_wstring(end);
+	line += L'\t' + std::to_wstring(bytesDownloaded);
+	line += section->DownloadStatus == DownloadStatus::Finished ? L"\t1" : L"\t0";
+	line += section->SharedFile ? L"\t1" : L"\t0";
+	line += L'\t' + std::to_wstring(section->FileOrigin);
+	line += L'\t' + std::to_wstring(nextSection);
+	line += L'\t' + section->LastModified;
+	line += L'\t' + section->Url;
+	line += L'\t' + section->FileName;
+	if (!section->Ranges.empty())
+	{
+		// a-b,c-d of the ranges wanted, only written for sparse downloads
+		line += L'\t' + FormatRanges(section->Ranges);
+	}
+	line += L'\n';
+	return line;
+};
+
+DownloadSection* Download::SectionFromManifestLine(std::vector<std::wstring>& fields, int* nextSection)
+{
+	if (fields.size() != 11 && fields.size() != 12) return NULL;
+	DownloadSection* section = new DownloadSection();
+	try
+	{
+		section->Start = std::stoll(fields[1]);
+		section->End = std::stoll(fields[2]);
+		section->BytesDownloaded = std::stoll(fields[3]);
+		if (fields[4] == L"1") section->DownloadStatus = DownloadStatus::Finished;
+		section->SharedFile = fields[5] == L"1";
+		section->FileOrigin = std::stoll(fields[6]);
+		*nextSection = std::stoi(fields[7]);
+		if (fields.size() == 12 && !ParseRanges(fields[11], section->Ranges)) throw std::invalid_argument("ranges");
+	}
+	catch (...)
+	{
+		delete section;
+		return NULL;
+	}
+	section->LastModified = fields[8];
+	section->Url = fields[9];
+	section->FileName = fields[10];
+	return section;
+};
+
+bool Download::ParseRanges(std::wstring text, std::vector<ByteRange>& ranges)
+{
+	ranges.clear();
+	size_t start = 0;
+	while (start < text.length())
+	{
+		size_t end = text.find(L',', start);
+		if (end == std::wstring::npos) end = text.length();
+		std::wstring spec = text.substr(start, end - start);
+		size_t dash = spec.find(L'-');
+		if (dash == std::wstring::npos || dash + 1 == spec.length()) return false;
+		ByteRange range;
+		try
+		{
+			// -n is the last n bytes of the file
+			range.Start = dash == 0 ? -std::stoll(spec.substr(1)) : std::stoll(spec.substr(0, dash));
+			range.End = dash == 0 ? (-1) : std::stoll(spec.substr(dash + 1));
+		}
+		catch (...)
+		{
+			return false;
+		}
+		if (dash == 0 ? range.Start >= 0 : (range.Start < 0 || range.End < range.Start)) return false;
+		ranges.push_back(range);
+		start = end + 1;
+	}
+	if (ranges.empty()) return false;
+	// sorted and merged, so every wanted byte is counted once
+	DownloadSection::SortRanges(ranges);
+	return true;
+};
+
+std::wstring Download::FormatRanges(std::vector<ByteRange>& ranges)
+{
+	std::wstring text;
+	for (ByteRange range : ranges)
+	{
+		if (!text.empty()) text += L',';
+		if (range.Start < 0) text += std::to_wstring(range.Start);
+		else text += std::to_wstring(range.Start) + L'-' + std::to_wstring(range.End);
+	}
+	return text;
+};
+
+void Download::FlushSharedFile()
+{
+	// sections with files of their own are checked against the file size when resumed,
+	// but a shared output file is preallocated, so its data has to reach the disk before the manifest does
+	for (DownloadSection* section : Sections)
+	{
+		if (!section->SharedFile) continue;
+		HANDLE hFile = CreateFileW(section->FileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (INVALID_HANDLE_VALUE == hFile) return;
+		FlushFileBuffers(hFile);
+		CloseHandle(hFile);
+		return;
+	}
+};
+
+bool Download::SaveManifest()
+{
+	if (ManifestFileName.empty() || !SummarySection) return false;
+	// until the output file is created there is nothing to resume, a manifest would only be left behind
+	if (DirectWrite && !Sections.empty() && GetFileAttributesW(Sections[0]->FileName.c_str()) == INVALID_FILE_ATTRIBUTES) return false;
+	// progress is recorded before the data is flushed, so the manifest never counts bytes that are not on disk
+	std::wstring manifest = L"download\t" + DownloadFolder;
+	manifest += L'\t' + std::to_wstring(NoDownloader);
+	manifest += AutoNoDownloader ? L"\t1" : L"\t0";
+	manifest += DirectWrite ? L"\t1" : L"\t0";
+	manifest += FilePerRange ? L"\t1" : L"\t0";
+	if (!RepairFileName.empty()) manifest += L'\t' + RepairFileName;
+	manifest += L'\n';
+	manifest += SectionToManifestLine(L"summary", SummarySection, (-1));
+	for (std::wstring mirror : Mirrors)
+	{
+		manifest += L"mirror\t" + mirror + L'\n';
+	}
+	for (DownloadSection* section : Sections)
+	{
+		int nextSection = (-1);
+		for (int i = 0; i < (int)Sections.size(); i++)
+		{
+			if (Sections[i] == section->NextSection) nextSection = i;
+		}
+		manifest += SectionToManifestLine(L"section", section, nextSection);
+	}
+	FlushSharedFile();
+
+	// write a new copy and replace the old one with it, a crash leaves one of them intact
+	std::string content = manifestHeader + '\n' + Util::ToUtf8(manifest);
+	std::wstring tempFileName = ManifestFileName + L".tmp";
+	HANDLE hFile = CreateFileW(tempFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return false;
+	DWORD dwNumberOfBytesWritten = 0;
+	BOOL bResults = WriteFile(hFile, content.c_str(), (DWORD)content.length(), &dwNumberOfBytesWritten, NULL);
+	if (bResults) bResults = FlushFileBuffers(hFile);
+	CloseHandle(hFile);
+	if (bResults) bResults = MoveFileExW(tempFileName.c_str(), ManifestFileName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	if (!bResults) DeleteFileW(tempFileName.c_str());
+	return bResults;
+};
+
+void Download::DeleteManifest()
+{
+	if (ManifestFileName.empty()) return;
+	DeleteFileW(ManifestFileName.c_str());
+	DeleteFileW((ManifestFileName + L".tmp").c_str());
+};
+
+Download* Download::LoadManifest(std::wstring manifestFileName)
+{
+	HANDLE hFile = CreateFileW(manifestFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return NULL;
+	std::string content;
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = 0;
+	BOOL bResults = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= maxManifestSize;
+	if (bResults)
+	{
+		DWORD dwNumberOfBytesRead = 0;
+		content.resize((size_t)fileSize.QuadPart);
+		bResults = ReadFile(hFile, &content[0], (DWORD)fileSize.QuadPart, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead == fileSize.QuadPart;
+	}
+	CloseHandle(hFile);
+	if (!bResults || content.compare(0, manifestHeader.length() + 1, manifestHeader + '\n') != 0) return NULL;
+
+	Download* d = new Download();
+	std::vector<int> nextSections;
+	std::wstring lines = Util::FromUtf8(content.substr(manifestHeader.length() + 1));
+	size_t lineStart = 0;
+	while (bResults && lineStart < lines.length())
+	{
+		size_t lineEnd = lines.find(L'\n', lineStart);
+		// a line without its end was never completely written
+		if (lineEnd == std::wstring::npos) bResults = FALSE;
+		if (!bResults) break;
+		std::vector<std::wstring> fields;
+		size_t fieldStart = lineStart;
+		while (true)
+		{
+			size_t fieldEnd = lines.find(L'\t', fieldStart);
+			if (fieldEnd == std::wstring::npos || fieldEnd > lineEnd) fieldEnd = lineEnd;
+			fields.push_back(lines.substr(fieldStart, fieldEnd - fieldStart));
+			if (fieldEnd == lineEnd) break;
+			fieldStart = fieldEnd + 1;
+		}
+		lineStart = lineEnd + 1;
+
+		if (fields[0] == L"download" && fields.size() >= 5 && fields.size() <= 7)
+		{
+			d->DownloadFolder = fields[1];
+			d->NoDownloader = (int)wcstol(fields[2].c_str(), NULL, 10);
+			d->AutoNoDownloader = fields[3] == L"1";
+			d->DirectWrite = fields[4] == L"1";
+			d->FilePerRange = fields.size() >= 6 && fields[5] == L"1";
+			if (fields.size() == 7) d->RepairFileName = fields[6];
+		}
+		else if (fields[0] == L"summary" && !d->SummarySection)
+		{
+			int nextSection = (-1);
+			d->SummarySection = SectionFromManifestLine(fields, &nextSection);
+			bResults = d->SummarySection != NULL;
+		}
+		else if (fields[0] == L"mirror" && fields.size() == 2)
+		{
+			d->Mirrors.push_back(fields[1]);
+		}
+		else if (fields[0] == L"section")
+		{
+			int nextSection = (-1);
+			DownloadSection* section = SectionFromManifestLine(fields, &nextSection);
+			bResults = section != NULL;
+			if (section)
+			{
+				d->Sections.push_back(section);
+				nextSections.push_back(nextSection);
+			}
+		}
+		else bResults = FALSE;
+	}
+	if (bResults) bResults = d->SummarySection && !d->Sections.empty();
+	for (int i = 0; bResults && i < (int)d->Sections.size(); i++)
+	{
+		int nextSection = nextSections[i];
+		if (nextSection >= (int)d->Sections.size() || nextSection == i) bResults = FALSE;
+		else if (nextSection >= 0) d->Sections[i]->NextSection = d->Sections[nextSection];
+	}
+	if (!bResults)
+	{
+		delete d;
+		return NULL;
+	}
+	d->ManifestFileName = manifestFileName;
+	return d;
+};
+
+std::wstring Download::FindManifest(std::wstring downloadFolder, std::wstring url, long long start, long long end, std::wstring ranges, std::wstring repairFileName)
+{
+	std::wstring manifestFileName;
+	WIN32_FIND_DATAW findData;
+	HANDLE hFind = FindFirstFileW(Util::CombinePathAndFileName(downloadFolder, L"*.partial.manifest").c_str(), &findData);
+	if (INVALID_HANDLE_VALUE == hFind) return manifestFileName;
+	do
+	{
+		std::wstring fileName = Util::CombinePathAndFileName(downloadFolder, findData.cFileName);
+		Download* d = LoadManifest(fileName);
+		if (d)
+		{
+			DownloadSection* ss = d->SummarySection;
+			// without the output file there is nothing left to resume
+			bool outputFileExists = !d->DirectWrite || GetFileAttributesW(d->Sections[0]->FileName.c_str()) != INVALID_FILE_ATTRIBUTES;
+			std::vector<ByteRange> wanted;
+			if (!ranges.empty()) ParseRanges(ranges, wanted);
+			bool sameRanges = wanted.size() == ss->Ranges.size();
+			for (size_t i = 0; sameRanges && i < wanted.size(); i++)
+			{
+				sameRanges = wanted[i].Start == ss->Ranges[i].Start && wanted[i].End == ss->Ranges[i].End;
+			}
+			if (ss->Url == url && ss->Start == start && ss->End == end && sameRanges && d->RepairFileName == repairFileName)
+			{
+				if (outputFileExists) manifestFileName = fileName;
+				// the manifest of an attempt that never got its output file would otherwise stay forever
+				else d->DeleteManifest();
+			}
+			delete d;
+		}
+	} while (manifestFileName.empty() && FindNextFileW(hFind, &findData));
+	FindClose(hFind);
+	return manifestFileName;
+};
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+#include "DownloadSection.h"
+#include "ZipArchive.h"
+#include <vector>
+
+// a stretch of an older copy of the file which is the same in the file being downloaded
+struct SeedBlock
+{
+	long long SeedOffset;
+	long long Offset;
+	long long Length;
+};
+
+class Download
+{
+private:
+	static const std::string manifestHeader;
+	static const long long maxManifestSize = 1048576;
+	static std::wstring SectionToManifestLine(std::wstring recordType, DownloadSection* section, int nextSection);
+	static DownloadSection* SectionFromManifestLine(std::vector<std::wstring>& fields, int* nextSection);
+	void FlushSharedFile();
+public:
+	std::vector<DownloadSection*> Sections;
+	DownloadSection* SummarySection = NULL;
+	// more URLs of the same file as SummarySection->Url, sections are spread over all of them
+	std::vector<std::wstring> Mirrors;
+	std::wstring DownloadFolder;
+	// connections to use, or to start with when AutoNoDownloader is set
+	int NoDownloader = 5;
+	// let the scheduler add connections while they still speed the download up
+	bool AutoNoDownloader = false;
+	int MaxNoDownloader = 64;
+	// sections are not split below this size
+	long long MinSectionSize = 5242880;
+	// bytes per second for all connections of the download together, zero for no limit. Can be changed while downloading.
+	long long MaxBytesPerSecond = 0;
+	bool DirectWrite = false;
+	// a sparse download ends up as one file per range, instead of one file with the ranges at their offsets
+	bool FilePerRange = false;
+	// an existing copy of the file, fixed in place: only the blocks which differ from the downloaded data are written
+	std::wstring RepairFileName;
+	// BLAKE3 digest the finished file has to match, hex or base64. Not kept in the manifest.
+	std::wstring ExpectedDigest;
+	// hashes of the pieces of the file from a Metalink file, corrupt pieces are downloaded again. Not kept in the manifest.
+	PieceList Pieces;
+	// an older copy of the file, these stretches of it are copied into the output instead of being downloaded.
+	// Not kept in the manifest, copied again when the download is resumed.
+	std::wstring SeedFileName;
+	std::vector<SeedBlock> SeedBlocks;
+	// SHA-1 the finished file has to match, none if empty
+	std::vector<BYTE> ExpectedSha1;
+	// members of a ZIP archive whose local headers and data are the ranges of this download, written out as an archive of
+	// just them once it is finished. Not kept in the manifest.
+	std::vector<ZipMember> ZipMembers;
+	// the file is written in order to this handle, a pipe or the standard output, while its sections still download.
+	// Sections get at most StreamWindow bytes ahead of what has been written to it, and the output file gives back
+	// the space of what has been. Not kept in the manifest, a streamed download cannot be resumed.
+	HANDLE StreamHandle = INVALID_HANDLE_VALUE;
+	long long StreamWindow = 0;
+	// crash-safe record of the sections, kept next to the output file so the download survives a restart
+	std::wstring ManifestFileName;
+	~Download();
+	void SetCredentials(std::wstring userName, std::wstring password);
+	void EnableDirectWrite();
+	void EnableRepair(std::wstring fileName);
+	void EnableStreaming(HANDLE hStream, long long window);
+	bool SaveManifest();
+	void DeleteManifest();
+	static Download* LoadManifest(std::wstring manifestFileName);
+	// parses a-b,c-d,-n into sorted ranges, overlapping and adjacent ones merged. -n is the last n bytes of the file.
+	// False if the text is not valid.
+	static bool ParseRanges(std::wstring text, std::vector<ByteRange>& ranges);
+	static std::wstring FormatRanges(std::vector<ByteRange>& ranges);
+	static std::wstring FindManifest(std::wstring downloadFolder, std::wstring url, long long start, long long end, std::wstring ranges = std::wstring(), std::wstring repairFileName = std::wstring());
+};
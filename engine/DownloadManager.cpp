@@ -0,0 +1,349 @@
+#include "DownloadManager.h"
+#include "Util.h"
+#include "Clock.h"
+#include <algorithm>
+
+DownloadManager::DownloadManager()
+{
+	InitializeCriticalSection(&jobsLock);
+	hManagerEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+};
+
+DownloadManager::~DownloadManager()
+{
+	Stop(false, true);
+	for (Job* job : jobs)
+	{
+		delete job->Worker;
+		delete job;
+	}
+	DeleteCriticalSection(&jobsLock);
+	if (hManagerEvent) CloseHandle(hManagerEvent);
+	if (hManagerThread) CloseHandle(hManagerThread);
+};
+
+int DownloadManager::AddDownload(Download* d, int priority)
+{
+	// throws like Scheduler if the download cannot be run
+	Job* job = new Job;
+	try
+	{
+		job->Worker = new Scheduler(d);
+	}
+	catch (...)
+	{
+		delete job;
+		throw;
+	}
+	job->Priority = priority;
+	job->Host = Util::UrlGetHostName(job->Worker->GetUrl());
+	EnterCriticalSection(&jobsLock);
+	job->Id = nextJobId++;
+	jobs.push_back(job);
+	LeaveCriticalSection(&jobsLock);
+	SetEvent(hManagerEvent);
+	return job->Id;
+};
+
+bool DownloadManager::SetPriority(int id, int priority)
+{
+	EnterCriticalSection(&jobsLock);
+	Job* job = FindJob(id);
+	if (job) job->Priority = priority;
+	LeaveCriticalSection(&jobsLock);
+	SetEvent(hManagerEvent);
+	return job != NULL;
+};
+
+bool DownloadManager::SetRateLimit(int id, long long bytesPerSecond)
+{
+	EnterCriticalSection(&jobsLock);
+	Job* job = FindJob(id);
+	if (job) job->Worker->SetRateLimit(bytesPerSecond);
+	LeaveCriticalSection(&jobsLock);
+	// a download at its limit asks for fewer connections
+	SetEvent(hManagerEvent);
+	return job != NULL;
+};
+
+DownloadManager::Job* DownloadManager::FindJob(int id)
+{
+	for (Job* job : jobs)
+	{
+		if (job->Id == id) return job;
+	}
+	return NULL;
+};
+
+bool DownloadManager::IsJobDone(Job* job)
+{
+	if (!job->Started) return false;
+	DownloadStatus status = job->Worker->GetDownloadStatus();
+	return (status == DownloadStatus::Finished || status == DownloadStatus::DownloadError || status == DownloadStatus::LogicalError);
+};
+
+std::vector<DownloadManager::Job*> DownloadManager::GetJobsByPriority()
+{
+	// highest priority first, jobs of the same priority in the order they were added
+	std::vector<Job*> sortedJobs = jobs;
+	std::stable_sort(sortedJobs.begin(), sortedJobs.end(), [](Job* a, Job* b) { return a->Priority > b->Priority; });
+	return sortedJobs;
+};
+
+void DownloadManager::StartQueuedJobs()
+{
+	// every running job needs at least one connection slot, of all slots and of the slots of its server
+	int activeJobs = 0;
+	std::map<std::wstring, int> hostJobs;
+	for (Job* job : jobs)
+	{
+		if (!job->Started || IsJobDone(job)) continue;
+		activeJobs++;
+		hostJobs[job->Host]++;
+	}
+	for (Job* job : GetJobsByPriority())
+	{
+		if (activeJobs >= MaxActiveDownloads || activeJobs >= MaxConnections) return;
+		if (job->Started || hostJobs[job->Host] >= MaxConnectionsPerHost) continue;
+		job->Started = true;
+		activeJobs++;
+		hostJobs[job->Host]++;
+	}
+};
+
+void DownloadManager::DistributeConnections()
+{
+	std::vector<Job*> activeJobs;
+	std::map<Job*, int> demand;
+	int freeConnections = MaxConnections;
+	std::map<std::wstring, int> freeHostConnections;
+	for (Job* job : GetJobsByPriority())
+	{
+		job->Connections = 0;
+		if (!job->Started || IsJobDone(job)) continue;
+		activeJobs.push_back(job);
+		// a job which has just been started asks for one connection until it knows more about the file
+		demand[job] = std::max(job->Worker->GetConnectionDemand(), 1);
+		if (freeHostConnections.find(job->Host) == freeHostConnections.end()) freeHostConnections[job->Host] = MaxConnectionsPerHost;
+	}
+	// one slot for each, then the rest one at a time to jobs of the highest priority which can still use more
+	for (Job* job : activeJobs)
+	{
+		if (freeConnections == 0 || freeHostConnections[job->Host] == 0) continue;
+		job->Connections = 1;
+		freeConnections--;
+		freeHostConnections[job->Host]--;
+	}
+	size_t groupStart = 0;
+	while (groupStart < activeJobs.size() && freeConnections > 0)
+	{
+		size_t groupEnd = groupStart;
+		while (groupEnd < activeJobs.size() && activeJobs[groupEnd]->Priority == activeJobs[groupStart]->Priority) groupEnd++;
+		bool granted = true;
+		while (granted && freeConnections > 0)
+		{
+			granted = false;
+			for (size_t i = groupStart; i < groupEnd && freeConnections > 0; i++)
+			{
+				Job* job = activeJobs[i];
+				if (job->Connections == 0 || job->Connections >= demand[job] || freeHostConnections[job->Host] == 0) continue;
+				job->Connections++;
+				freeConnections--;
+				freeHostConnections[job->Host]--;
+				granted = true;
+			}
+		}
+		groupStart = groupEnd;
+	}
+	for (Job* job : activeJobs)
+	{
+		// connections above a lowered limit finish their sections, the job just does not start new ones
+		job->Worker->SetConnectionLimit(job->Connections);
+	}
+};
+
+void DownloadManager::Rebalance()
+{
+	EnterCriticalSection(&jobsLock);
+	StartQueuedJobs();
+	DistributeConnections();
+	for (Job* job : jobs)
+	{
+		// jobs just let in, and jobs paused by Stop when the manager starts again
+		if (job->Started && job->Connections > 0 && job->Worker->GetDownloadStatus() == DownloadStatus::Stopped) job->Worker->Start();
+	}
+	LeaveCriticalSection(&jobsLock);
+};
+
+std::vector<int> DownloadManager::GetDownloadIds()
+{
+	std::vector<int> ids;
+	EnterCriticalSection(&jobsLock);
+	for (Job* job : jobs)
+	{
+		ids.push_back(job->Id);
+	}
+	LeaveCriticalSection(&jobsLock);
+	return ids;
+};
+
+Scheduler* DownloadManager::GetScheduler(int id)
+{
+	EnterCriticalSection(&jobsLock);
+	Job* job = FindJob(id);
+	Scheduler* worker = job ? job->Worker : NULL;
+	LeaveCriticalSection(&jobsLock);
+	return worker;
+};
+
+DownloadStatus DownloadManager::GetDownloadStatus(int id)
+{
+	DownloadStatus status = DownloadStatus::LogicalError;
+	EnterCriticalSection(&jobsLock);
+	Job* job = FindJob(id);
+	if (job) status = job->Worker->GetDownloadStatus();
+	LeaveCriticalSection(&jobsLock);
+	return status;
+};
+
+std::wstring DownloadManager::GetDownloadStatusDescription(int id)
+{
+	std::wstring statusStr;
+	EnterCriticalSection(&jobsLock);
+	Job* job = FindJob(id);
+	if (job)
+	{
+		if (!job->Started) statusStr.append(L"Queued.\r\n");
+		statusStr.append(job->Worker->GetDownloadStatusDescription());
+	}
+	LeaveCriticalSection(&jobsLock);
+	return statusStr;
+};
+
+std::wstring DownloadManager::GetStatusDescription()
+{
+	int queued = 0, downloading = 0, finished = 0, failed = 0, connections = 0;
+	std::wstring jobsStr;
+	EnterCriticalSection(&jobsLock);
+	for (Job* job : jobs)
+	{
+		DownloadStatus status = job->Worker->GetDownloadStatus();
+		jobsStr.append(L"#");
+		jobsStr.append(std::to_wstring(job->Id));
+		jobsStr.append(L" ");
+		jobsStr.append(Util::UrlGetFileName(job->Worker->GetUrl()));
+		if (!job->Started)
+		{
+			queued++;
+			jobsStr.append(L": queued");
+		}
+		else if (status == DownloadStatus::Finished)
+		{
+			finished++;
+			jobsStr.append(L": finished");
+		}
+		else if (IsJobDone(job))
+		{
+			failed++;
+			jobsStr.append(L": failed");
+		}
+		else
+		{
+			downloading++;
+			connections += job->Connections;
+			jobsStr.append(L": ");
+			jobsStr.append(std::to_wstring(job->Connections));
+			jobsStr.append(L" connections");
+		}
+		jobsStr.append(L", ");
+		jobsStr.append(std::to_wstring(job->Worker->GetBytesDownloaded()));
+		jobsStr.append(L" bytes downloaded.\r\n");
+	}
+	LeaveCriticalSection(&jobsLock);
+	std::wstring statusStr;
+	statusStr.append(L"Downloads: ");
+	statusStr.append(std::to_wstring(queued));
+	statusStr.append(L" queued, ");
+	statusStr.append(std::to_wstring(downloading));
+	statusStr.append(L" downloading, ");
+	statusStr.append(std::to_wstring(finished));
+	statusStr.append(L" finished, ");
+	statusStr.append(std::to_wstring(failed));
+	statusStr.append(L" failed, ");
+	statusStr.append(std::to_wstring(connections));
+	statusStr.append(L" of ");
+	statusStr.append(std::to_wstring(MaxConnections));
+	statusStr.append(L" connections granted.\r\n");
+	statusStr.append(jobsStr);
+	return statusStr;
+};
+
+bool DownloadManager::IsFinished()
+{
+	bool finished = true;
+	EnterCriticalSection(&jobsLock);
+	for (Job* job : jobs)
+	{
+		if (!IsJobDone(job)) finished = false;
+	}
+	LeaveCriticalSection(&jobsLock);
+	return finished;
+};
+
+bool DownloadManager::IsManagerThreadAlive()
+{
+	if (!hManagerThread) return false;
+	DWORD result = WaitForSingleObject(hManagerThread, 0);
+	return !(result == WAIT_OBJECT_0);
+};
+
+DWORD __stdcall DownloadManager::ManagerThreadProc(LPVOID lParam)
+{
+	DownloadManager* m = (DownloadManager*)lParam;
+	m->ManagerThreadStart();
+	return 0;
+};
+
+void DownloadManager::ManagerThreadStart()
+{
+	while (true)
+	{
+		if (managerStopFlag) return;
+		Rebalance();
+		Clock::Wait(hManagerEvent, managerInterval);
+		if (IsFinished()) return;
+	}
+};
+
+void DownloadManager::Start()
+{
+	if (IsManagerThreadAlive()) return;
+	managerStopFlag = false;
+	if (hManagerThread) CloseHandle(hManagerThread);
+	hManagerThread = CreateThread(NULL, 0, ManagerThreadProc, this, 0, NULL);
+};
+
+void DownloadManager::Stop(bool cancel, bool wait)
+{
+	// the manager thread is stopped first, so it does not start jobs again behind our back
+	managerStopFlag = true;
+	SetEvent(hManagerEvent);
+	if (IsManagerThreadAlive()) WaitForSingleObject(hManagerThread, INFINITE);
+	EnterCriticalSection(&jobsLock);
+	for (Job* job : jobs)
+	{
+		if (job->Started) job->Worker->Stop(cancel, wait);
+	}
+	LeaveCriticalSection(&jobsLock);
+};
+
+void DownloadManager::WaitForFinish()
+{
+	if (IsManagerThreadAlive()) WaitForSingleObject(hManagerThread, INFINITE);
+	EnterCriticalSection(&jobsLock);
+	for (Job* job : jobs)
+	{
+		job->Worker->WaitForFinish();
+	}
+	LeaveCriticalSection(&jobsLock);
+};
\ No newline at end of file
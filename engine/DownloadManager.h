@@ -0,0 +1,61 @@
+#pragma once
+#include "Scheduler.h"
+#include <map>
+#include <vector>
+
+// Runs many downloads at once. Connection slots are shared by all of them, with a global limit and a limit per server,
+// and are handed out again whenever a download finishes or can use fewer. Downloads with a higher priority are started
+// and given connections first, downloads of the same priority share the rest evenly.
+class DownloadManager
+{
+private:
+	// longest wait between two rounds of rebalancing
+	static const DWORD managerInterval = 500;
+	struct Job
+	{
+		int Id = 0;
+		int Priority = 0;
+		std::wstring Host;
+		Scheduler* Worker = NULL;
+		bool Started = false;
+		// connection slots granted in the last round
+		int Connections = 0;
+	};
+	std::vector<Job*> jobs;
+	int nextJobId = 1;
+	CRITICAL_SECTION jobsLock;
+	bool managerStopFlag = false;
+	HANDLE hManagerThread = NULL;
+	HANDLE hManagerEvent = NULL;
+	Job* FindJob(int id);
+	std::vector<Job*> GetJobsByPriority();
+	bool IsJobDone(Job* job);
+	void StartQueuedJobs();
+	void DistributeConnections();
+	void Rebalance();
+	bool IsManagerThreadAlive();
+	static DWORD WINAPI ManagerThreadProc(LPVOID lParam);
+	void ManagerThreadStart();
+public:
+	// downloads running at the same time, the others wait in the queue
+	int MaxActiveDownloads = 4;
+	// connection slots shared by all downloads
+	int MaxConnections = 32;
+	int MaxConnectionsPerHost = 8;
+	int AddDownload(Download* d, int priority = 0);
+	bool SetPriority(int id, int priority);
+	// bytes per second for one download, zero for no limit. Limits per server and for all downloads are set on RateLimiter.
+	bool SetRateLimit(int id, long long bytesPerSecond);
+	std::vector<int> GetDownloadIds();
+	// downloads are never removed, the scheduler lives as long as the manager
+	Scheduler* GetScheduler(int id);
+	DownloadStatus GetDownloadStatus(int id);
+	std::wstring GetDownloadStatusDescription(int id);
+	std::wstring GetStatusDescription();
+	bool IsFinished();
+	void Start();
+	void Stop(bool cancel, bool wait);
+	void WaitForFinish();
+	DownloadManager();
+	~DownloadManager();
+};
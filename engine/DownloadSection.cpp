@@ -0,0 +1,196 @@
+#include "DownloadSection.h"
+#include "Util.h"
+#include <windows.h>
+#include <algorithm>
+#include <climits>
+
+DownloadSection::DownloadSection()
+{
+	WCHAR lpBuffer[MAX_PATH + 1];
+	std::wstring tempFolder;
+	if (GetTempPathW(MAX_PATH + 1, lpBuffer))
+	{
+		tempFolder = lpBuffer;
+	}
+	FileName = tempFolder + Util::CreateGuid();
+};
+
+DownloadSection* DownloadSection::Copy()
+{
+	DownloadSection* newSection = new DownloadSection();
+	newSection->Url = Url;
+	newSection->Start = Start;
+	newSection->End = End;
+	newSection->UserName = UserName;
+	newSection->Password = Password;
+	newSection->Ranges = Ranges;
+	if (SharedFile)
+	{
+		newSection->FileName = FileName;
+		newSection->SharedFile = true;
+		newSection->FileOrigin = FileOrigin;
+	}
+
+	return newSection;
+};
+
+DownloadSection* DownloadSection::Split(double parentShare)
+{
+	long long _BytesDownloaded = BytesDownloaded;
+	// parentShare is the part of the remaining bytes this section keeps
+	if (!Ranges.empty()) return SplitAt(GetOffset(_BytesDownloaded + (long long)((GetTotal() - 1 - _BytesDownloaded) * parentShare)));
+	return SplitAt(Start + _BytesDownloaded + (long long)((End - (Start + _BytesDownloaded)) * parentShare));
+};
+
+DownloadSection* DownloadSection::SplitAt(long long position)
+{
+	DownloadSection* newSection = new DownloadSection();
+	newSection->Url = Url;
+	newSection->Start = position;
+	newSection->End = End;
+	if (newSection->Start > newSection->End)
+	{
+		delete newSection;
+		return nullptr;
+	}
+	newSection->UserName = UserName;
+	newSection->Password = Password;
+	newSection->LastModified = LastModified;
+	newSection->ETag = ETag;
+	newSection->EntityLength = EntityLength;
+	newSection->SingleRangeRequests = SingleRangeRequests;
+	for (ByteRange range : Ranges)
+	{
+		if (range.End < position) continue;
+		if (range.Start < position) range.Start = position;
+		newSection->Ranges.push_back(range);
+	}
+	if (SharedFile)
+	{
+		newSection->FileName = FileName;
+		newSection->SharedFile = true;
+		newSection->FileOrigin = FileOrigin;
+	}
+	newSection->Tag = this;
+	return newSection;
+};
+
+long long DownloadSection::GetTotal()
+{
+	if (Ranges.empty()) return End - Start + 1;
+	long long total = 0;
+	for (ByteRange range : Ranges)
+	{
+		// End can be reduced by a split, Ranges are not cut along with it
+		if (range.Start < 0) continue;
+		long long first = range.Start > Start ? range.Start : Start;
+		long long last = End >= 0 && range.End > End ? End : range.End;
+		if (last >= first) total += last - first + 1;
+	}
+	return total;
+};
+
+long long DownloadSection::GetWritePosition()
+{
+	if (SharedFile) return GetOffset(BytesDownloaded) - FileOrigin;
+	// a file of its own holds the wanted bytes one after another
+	return BytesDownloaded;
+};
+
+long long DownloadSection::GetOffset(long long bytes)
+{
+	if (Ranges.empty()) return Start + bytes;
+	long long last = Start;
+	for (ByteRange range : Ranges)
+	{
+		long long first = range.Start > Start ? range.Start : Start;
+		if (range.Start < 0 || range.End < first) continue;
+		if (bytes <= range.End - first) return first + bytes;
+		bytes -= range.End - first + 1;
+		last = range.End + 1;
+	}
+	// past the last wanted byte
+	return last + bytes;
+};
+
+long long DownloadSection::GetContiguousBytes(long long bytes)
+{
+	if (Ranges.empty() || !SharedFile) return LLONG_MAX;
+	std::vector<ByteRange> rangesLeft = GetRangesLeft(bytes);
+	if (rangesLeft.empty()) return LLONG_MAX;
+	return rangesLeft[0].End - rangesLeft[0].Start + 1;
+};
+
+std::vector<ByteRange> DownloadSection::GetRangesLeft(long long bytes)
+{
+	std::vector<ByteRange> rangesLeft;
+	if (Ranges.empty())
+	{
+		if (End < 0 || Start + bytes <= End) rangesLeft.push_back({ Start + bytes, End });
+		return rangesLeft;
+	}
+	long long position = GetOffset(bytes);
+	for (ByteRange range : Ranges)
+	{
+		if (range.Start < 0) continue;
+		if (range.Start < position) range.Start = position;
+		if (End >= 0 && range.End > End) range.End = End;
+		if (range.Start > range.End) continue;
+		rangesLeft.push_back(range);
+	}
+	return rangesLeft;
+};
+
+bool DownloadSection::HasUnresolvedRanges()
+{
+	for (ByteRange range : Ranges)
+	{
+		if (range.Start < 0) return true;
+	}
+	return false;
+};
+
+bool DownloadSection::ResolveRanges(long long entityLength)
+{
+	std::vector<ByteRange> resolved;
+	for (ByteRange range : Ranges)
+	{
+		if (range.Start < 0)
+		{
+			range.Start = entityLength + range.Start > 0 ? entityLength + range.Start : 0;
+			range.End = entityLength - 1;
+		}
+		if (range.End > entityLength - 1) range.End = entityLength - 1;
+		if (range.Start <= range.End) resolved.push_back(range);
+	}
+	if (resolved.empty()) return false;
+	SortRanges(resolved);
+	Ranges.swap(resolved);
+	// nothing has been downloaded before the size is known, so the section can still move its start
+	if (BytesDownloaded == 0) Start = Ranges.front().Start;
+	End = Ranges.back().End;
+	return true;
+};
+
+void DownloadSection::SortRanges(std::vector<ByteRange>& ranges)
+{
+	std::vector<ByteRange> merged;
+	std::vector<ByteRange> fromEnd;
+	std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) { return a.Start < b.Start; });
+	for (ByteRange range : ranges)
+	{
+		// the longest range from the end of the file holds all shorter ones
+		if (range.Start < 0)
+		{
+			if (fromEnd.empty()) fromEnd.push_back(range);
+			continue;
+		}
+		if (!merged.empty() && range.Start <= merged.back().End + 1)
+		{
+			if (range.End > merged.back().End) merged.back().End = range.End;
+		}
+		else merged.push_back(range);
+	}
+	merged.insert(merged.end(), fromEnd.begin(), fromEnd.end());
+	ranges.swap(merged);
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include "DownloadStatus.h"
+#include "TreeHash.h"
+#include "PieceHash.h"
+#include <string>
+#include <vector>
+#include <ctime>
+
+// inclusive byte positions in the file on the server. A negative Start is the last -Start bytes of the file,
+// whose position is only known once the server has told the size of the file.
+struct ByteRange
+{
+	long long Start;
+	long long End;
+};
+
+class DownloadSection
+{
+public:
+	std::wstring Url;
+	std::wstring FileName;
+	// FileName is the output file shared by all sections, data goes to its absolute offset
+	bool SharedFile = false;
+	long long FileOrigin = 0;
+	::DownloadStatus DownloadStatus = ::DownloadStatus::Stopped;
+	long long Start = 0;
+	long long End = 0;
+	long long BytesDownloaded = 0;
+	// the only parts of Start..End to download, sorted and not overlapping, ranges from the end of the file last.
+	// All of it if empty. BytesDownloaded then counts wanted bytes only.
+	std::vector<ByteRange> Ranges;
+	// the server ignored a request for several ranges, ask for one at a time
+	bool SingleRangeRequests = false;
+	// bytes a repair found different in the file and rewrote, and where. The ranges are only read once the transfer is over.
+	long long BytesRepaired = 0;
+	std::vector<ByteRange> RepairedRanges;
+	// BLAKE3 tree of the bytes this section has written, combined with the other sections into the hash of the file
+	TreeHash Hash;
+	// BLAKE3 digest of the whole file from a Repr-Digest or Digest header of the server, empty if it sent none
+	std::wstring ServerDigest;
+	// hash of the piece being received and the position of its next byte, -1 if the section has not received the start of a piece
+	PieceHash PieceCheck;
+	long long PieceCheckPosition = (-1);
+	std::wstring HttpStatusCode;
+	std::wstring UserName;
+	std::wstring Password;
+	std::wstring Error;
+	std::wstring LastModified = L"NOTSET";
+	// validators of the content the section belongs to, responses have to match them
+	std::wstring ETag;
+	// size of the whole file on the server, -1 if not known yet
+	long long EntityLength = (-1);
+	// the mirror Scheduler last sent the section to, -1 if it has not chosen one
+	int MirrorIndex = (-1);
+	time_t LastStatusChange = 0;
+	// bytes per second, smoothed by Scheduler
+	double Throughput = 0;
+	long long ThroughputSampleBytes = 0;
+	unsigned long long ThroughputSampleTime = 0;
+	DownloadSection* NextSection = NULL;
+	void* Tag = NULL;
+	DownloadSection();
+	DownloadSection* Copy();
+	DownloadSection* Split(double parentShare = 0.5);
+	DownloadSection* SplitAt(long long position);
+
+	long long GetTotal();
+	long long GetWritePosition();
+	// position in the file on the server of the wanted byte with this index
+	long long GetOffset(long long bytes);
+	// wanted bytes from this index on which follow each other in the file without a gap
+	long long GetContiguousBytes(long long bytes);
+	// the ranges still to download after this many wanted bytes, the first one cut at the position reached
+	std::vector<ByteRange> GetRangesLeft(long long bytes);
+	// some ranges are counted from the end of the file
+	bool HasUnresolvedRanges();
+	// turns ranges from the end of the file into positions and drops what lies beyond it, End becomes the end of the last range.
+	// False if no range is left in the file, the ranges are then kept as they were.
+	bool ResolveRanges(long long entityLength);
+	// sorts ranges and merges the ones which overlap or touch, keeping ranges from the end of the file last
+	static void SortRanges(std::vector<ByteRange>& ranges);
+};
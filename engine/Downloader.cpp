@@ -0,0 +1,1171 @@
+#include "Downloader.h"
+#include "Clock.h"
+#include "Util.h"
+#include <ctime>
+#include <cwctype>
+#include <stdexcept>
+#include <strsafe.h>
+#include <shlwapi.h>
+
+const std::wstring Downloader::userAgentString = L"Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/92.0.4515.131 Safari/537.36";
+
+void Downloader::ResetDownloadStatus()
+{
+	if (Section->DownloadStatus == DownloadStatus::PrepareToDownload || Section->DownloadStatus == DownloadStatus::Downloading)
+	{
+		Section->DownloadStatus = DownloadStatus::Stopped;
+	}
+};
+
+Downloader::Downloader(DownloadSection* section, HANDLE hStatusChangedEvent)
+{
+	if (!section) throw std::runtime_error("Parameter section cannot be null: Downloader(DownloadSection* section)");
+	Section = section;
+	this->hStatusChangedEvent = hStatusChangedEvent;
+	ResetDownloadStatus();
+	InitializeCriticalSection(&transferLock);
+	// signaled while no request handle of this downloader is alive
+	hTransferIdleEvent = CreateEventW(NULL, TRUE, TRUE, NULL);
+	ConnectionPool::OpenSession(userAgentString, HttpStatusCallback);
+};
+
+bool Downloader::IsTransferActive()
+{
+	DWORD result = WaitForSingleObject(hTransferIdleEvent, 0);
+	return !(result == WAIT_OBJECT_0);
+};
+
+bool Downloader::CheckDownloadSectionAgainstLogicalErrors()
+{
+	if (Section->Start < 0)
+	{
+		SetDownloadError(L"Download start position less than zero.", DownloadStatus::LogicalError);
+		return false;
+	}
+	if (Section->End >= 0 && Section->Start > Section->End)
+	{
+		SetDownloadError(L"Download start position greater than end position.", DownloadStatus::LogicalError);
+		return false;
+	}
+	if (Section->Url.empty() || Section->FileName.empty())
+	{
+		SetDownloadError(L"Download URL or target file name missing.", DownloadStatus::LogicalError);
+		return false;
+	}
+	return true;
+};
+
+bool Downloader::ChangeDownloadSection(DownloadSection* section)
+{
+	if (IsBusy() || IsTransferActive()) return false;
+	Section = section;
+	ResetDownloadStatus();
+	return true;
+};
+
+bool Downloader::IsBusy()
+{
+	DownloadStatus ds = Section->DownloadStatus;
+	return (ds == DownloadStatus::PrepareToDownload || ds == DownloadStatus::Downloading);
+};
+
+void Downloader::StopDownloading()
+{
+	if (!IsBusy()) return;
+	EnterTransfer();
+	downloadStopFlag = true;
+	// cancel the request in flight, it may be waiting for a stalled connection
+	if (hRequest && IsBusy()) FinishTransfer(DownloadStatus::Stopped);
+	LeaveTransfer();
+};
+
+bool Downloader::ConstructHttpRequest()
+{
+	BOOL bResults = FALSE;
+	HINTERNET hConnect = NULL;
+	HINTERNET hNewRequest = NULL;
+	DWORD_PTR dwContext = (DWORD_PTR)this;
+	DWORD dwSslFlags =
+		SECURITY_FLAG_IGNORE_UNKNOWN_CA |
+		SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE |
+		SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
+		SECURITY_FLAG_IGNORE_CERT_DATE_INVALID;
+	const WCHAR* ppwszAcceptTypes[] = { L"*/*", NULL };
+	WCHAR* hostName = NULL;
+	WCHAR* urlPath = NULL;
+	DWORD dwOptionValue = WINHTTP_DISABLE_REDIRECTS;
+	URL_COMPONENTS urlComp;
+	std::wstring range = L"Range: bytes=";
+
+	// Initialize the URL_COMPONENTS structure.
+	ZeroMemory(&urlComp, sizeof(urlComp));
+	urlComp.dwStructSize = sizeof(urlComp);
+	// Set required component lengths to non-zero 
+	// so that they are cracked.
+	urlComp.dwSchemeLength = (DWORD)-1;
+	urlComp.dwHostNameLength = (DWORD)-1;
+	urlComp.dwUrlPathLength = (DWORD)-1;
+	urlComp.dwExtraInfoLength = (DWORD)-1;
+
+	bResults = WinHttpCrackUrl(Section->Url.c_str(), 0, 0, &urlComp);
+
+	if (bResults)
+	{
+		int bufferSize = urlComp.dwHostNameLength + 1;
+		hostName = new WCHAR[bufferSize];
+		StringCbCopyW(hostName, bufferSize * sizeof(WCHAR), urlComp.lpszHostName);
+
+		bufferSize = urlComp.dwUrlPathLength + urlComp.dwExtraInfoLength + 1;
+		urlPath = new WCHAR[bufferSize];
+		StringCbCopyW(urlPath, bufferSize * sizeof(WCHAR), urlComp.lpszUrlPath);
+		// a redirect may lead to another server with its own limit
+		hostBucket = RateLimiter::GetHostBucket(Util::UrlGetHostName(Section->Url));
+	}
+
+	if (bResults && !ConnectionPool::OpenSession(userAgentString, HttpStatusCallback))
+	{
+		bResults = FALSE;
+		SetDownloadError(L"There is no valid HTTP session.");
+	}
+
+	if (bResults)
+	{
+		// Specify an HTTP server. The handle is shared with other downloaders and owned by the pool.
+		hConnect = ConnectionPool::GetConnection(hostName, urlComp.nPort);
+		if (!hConnect) bResults = FALSE;
+	}
+
+	if (bResults)
+	{
+		// Create an HTTP request handle.
+		hNewRequest = WinHttpOpenRequest(hConnect, L"GET", urlPath,
+			NULL, WINHTTP_NO_REFERER,
+			ppwszAcceptTypes,
+			urlComp.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE | WINHTTP_FLAG_REFRESH : WINHTTP_FLAG_REFRESH);
+		if (!hNewRequest) bResults = FALSE;
+	}
+
+	// the context routes status callbacks of this request, including its handle closing, to this downloader
+	if (bResults)
+	{
+		bResults = WinHttpSetOption(hNewRequest, WINHTTP_OPTION_CONTEXT_VALUE, &dwContext, sizeof(dwContext));
+		if (bResults)
+		{
+			OnRequestHandleOpened();
+		}
+		else
+		{
+			WinHttpCloseHandle(hNewRequest);
+			hNewRequest = NULL;
+		}
+	}
+
+	// the old request (if redirected) is closed only after the new one is counted,
+	// so this downloader never looks idle in the middle of a transfer
+	if (bResults)
+	{
+		CleanUpHttpConnection();
+		hRequest = hNewRequest;
+		connectingTime = 0;
+	}
+
+	// Ignore ssl errors
+	if (bResults)
+		bResults = WinHttpSetOption(
+			hRequest,
+			WINHTTP_OPTION_SECURITY_FLAGS,
+			&dwSslFlags,
+			sizeof(dwSslFlags));
+	// Disable redirects
+	if (bResults)
+		bResults = WinHttpSetOption(
+			hRequest,
+			WINHTTP_OPTION_DISABLE_FEATURE,
+			&dwOptionValue,
+			sizeof(dwOptionValue));
+
+	// authenticate with server
+	if (bResults && !Section->UserName.empty() && !Section->Password.empty())
+	{
+		bResults = WinHttpSetCredentials(hRequest, WINHTTP_AUTH_TARGET_SERVER,
+			WINHTTP_AUTH_SCHEME_BASIC, Section->UserName.c_str(), Section->Password.c_str(), NULL);
+	}
+
+	// set range header
+	if (bResults)
+	{
+		long long _start = Section->Start + Section->BytesDownloaded;
+		if (!Section->Ranges.empty())
+		{
+			range += GetSparseRangeHeader();
+		}
+		else
+		{
+			range += std::to_wstring(_start);
+			range += L'-';
+			if (Section->End >= 0)
+			{
+				range += std::to_wstring(Section->End);
+			}
+		}
+		bResults = WinHttpAddRequestHeaders(hRequest,
+			range.c_str(),
+			(ULONG)-1L,
+			WINHTTP_ADDREQ_FLAG_ADD);
+	}
+
+	if (!bResults)
+	{
+		if (Section->Error.empty()) SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	}
+	if (hostName) delete[] hostName;
+	if (urlPath) delete[] urlPath;
+
+	return bResults;
+};
+
+std::wstring Downloader::GetSparseRangeHeader()
+{
+	requestStartBytes = Section->BytesDownloaded;
+	if (Section->HasUnresolvedRanges())
+	{
+		// ranges from the end of the file need its size first, which the response to a single range tells
+		ByteRange first = Section->Ranges.front();
+		requestedRanges = 1;
+		if (first.Start < 0)
+		{
+			// the parser learns which bytes these are once the size is known
+			rangesParser.Reset(std::vector<ByteRange>());
+			return std::to_wstring(first.Start);
+		}
+		rangesParser.Reset({ first });
+		return std::to_wstring(first.Start) + L'-' + std::to_wstring(first.End);
+	}
+	// the ranges left are coalesced where they lie close together, the parser drops the bytes between them
+	std::vector<ByteRange> rangesLeft = Section->GetRangesLeft(Section->BytesDownloaded);
+	std::vector<ByteRange> covered;
+	std::wstring range;
+	int maxRanges = Section->SingleRangeRequests ? 1 : maxRangesPerRequest;
+	ByteRange current = {};
+	requestedRanges = 0;
+	for (ByteRange wanted : rangesLeft)
+	{
+		if (requestedRanges > 0 && wanted.Start - current.End - 1 <= rangeMergeGap)
+		{
+			current.End = wanted.End;
+		}
+		else
+		{
+			if (requestedRanges == maxRanges) break;
+			if (requestedRanges > 0) range += std::to_wstring(current.Start) + L'-' + std::to_wstring(current.End) + L',';
+			current = wanted;
+			requestedRanges++;
+		}
+		covered.push_back(wanted);
+	}
+	range += std::to_wstring(current.Start) + L'-' + std::to_wstring(current.End);
+	rangesParser.Reset(covered);
+	return range;
+};
+
+std::wstring Downloader::GetResponseHeaderValue(DWORD dwInfoLevel, LPCWSTR pwszName)
+{
+	std::wstring ret;
+	if (!hRequest) return ret;
+	DWORD dwSize = 0;
+	WCHAR* lpOutBuffer = NULL;
+
+	WinHttpQueryHeaders(hRequest, dwInfoLevel,
+		pwszName, NULL,
+		&dwSize, WINHTTP_NO_HEADER_INDEX);
+
+	if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+	{
+		lpOutBuffer = new WCHAR[dwSize / sizeof(WCHAR)];
+
+		if (WinHttpQueryHeaders(hRequest,
+			dwInfoLevel,
+			pwszName,
+			lpOutBuffer, &dwSize,
+			WINHTTP_NO_HEADER_INDEX))
+		{
+			ret = lpOutBuffer;
+		}
+
+		delete[] lpOutBuffer;
+	}
+
+	return ret;
+};
+
+void Downloader::ReadDigestHeader()
+{
+	// Repr-Digest holds the digest of the whole file also in answers to range requests, the older Digest header is used like it.
+	// Both list algorithm=value pairs, only BLAKE3 can be checked against the hash of the sections.
+	LPCWSTR headerNames[] = { L"Repr-Digest", L"Digest" };
+	for (LPCWSTR headerName : headerNames)
+	{
+		std::wstring value = GetResponseHeaderValue(WINHTTP_QUERY_CUSTOM, headerName);
+		size_t itemStart = 0;
+		while (itemStart < value.length())
+		{
+			size_t itemEnd = value.find(L',', itemStart);
+			if (itemEnd == std::wstring::npos) itemEnd = value.length();
+			std::wstring item = value.substr(itemStart, itemEnd - itemStart);
+			size_t equals = item.find(L'=');
+			if (equals != std::wstring::npos)
+			{
+				std::wstring algorithm = item.substr(0, equals);
+				algorithm.erase(0, algorithm.find_first_not_of(L" \t"));
+				for (wchar_t& c : algorithm) c = towlower(c);
+				if (algorithm == L"blake3")
+				{
+					std::wstring digest = item.substr(equals + 1);
+					digest.erase(0, digest.find_first_not_of(L" \t"));
+					digest.erase(digest.find_last_not_of(L" \t") + 1);
+					Section->ServerDigest = digest;
+					return;
+				}
+			}
+			itemStart = itemEnd + 1;
+		}
+	}
+};
+
+void Downloader::CheckPieces(long long offset, const BYTE* data, DWORD length)
+{
+	// a piece is hashed from its first byte on, the ones this section started receiving in the middle are checked from the file later
+	while (length > 0)
+	{
+		long long index = offset / Pieces->PieceLength;
+		if (index >= (long long)Pieces->Hashes.size()) return;
+		long long pieceEnd = Pieces->GetPieceEnd(index);
+		if (Section->PieceCheckPosition != offset)
+		{
+			Section->PieceCheckPosition = (-1);
+			if (offset == index * Pieces->PieceLength)
+			{
+				Section->PieceCheck.Reset(Pieces->HashType);
+				Section->PieceCheckPosition = offset;
+			}
+		}
+		DWORD count = pieceEnd - offset < length ? (DWORD)(pieceEnd - offset) : length;
+		if (count == 0) return;
+		if (Section->PieceCheckPosition >= 0)
+		{
+			Section->PieceCheck.Update(data, count);
+			Section->PieceCheckPosition += count;
+			if (Section->PieceCheckPosition == pieceEnd)
+			{
+				Pieces->Check(index, Section->PieceCheck.Finish());
+				Section->PieceCheckPosition = (-1);
+			}
+		}
+		offset += count;
+		data += count;
+		length -= count;
+	}
+};
+
+bool Downloader::SyncDownloadSectionAgainstHTTPResponse()
+{
+	if (!hRequest) return false;
+
+	std::wstring statusCode = Section->HttpStatusCode;
+	std::wstring lastModified = GetResponseHeaderValue(WINHTTP_QUERY_LAST_MODIFIED);
+	std::wstring eTag = GetResponseHeaderValue(WINHTTP_QUERY_ETAG);
+	std::wstring sContentLength = GetResponseHeaderValue(WINHTTP_QUERY_CONTENT_LENGTH);
+	long long contentLength = 0;
+	long long entityLength = (-1);
+	if (statusCode.empty())
+	{
+		SetDownloadError(L"HTTP status code missing.");
+		return false;
+	}
+	if (sContentLength.empty()) contentLength = (-1);
+	else if (!StrToInt64ExW(sContentLength.c_str(), STIF_DEFAULT, &contentLength))
+	{
+		SetDownloadError(L"Invalid format for content length.");
+		return false;
+	}
+
+	if (statusCode == L"416")
+	{
+		std::wstring range = GetResponseHeaderValue(WINHTTP_QUERY_CONTENT_RANGE);
+		SetDownloadError(L"Requested range not satisfiable. Content-Range: " + range);
+		return false;
+	}
+	if (statusCode != L"200" && statusCode != L"206")
+	{
+		SetDownloadError(L"HTTP request not successful. Maybe try again later. Status: " + statusCode);
+		return false;
+	}
+	if (statusCode == L"206")
+	{
+		// Content-Range: bytes first-last/size, the size may be *
+		std::wstring range = GetResponseHeaderValue(WINHTTP_QUERY_CONTENT_RANGE);
+		size_t indexSize = range.find(L'/');
+		LONGLONG ll = 0;
+		if (indexSize != std::wstring::npos && StrToInt64ExW(range.substr(indexSize + 1).c_str(), STIF_DEFAULT, &ll)) entityLength = ll;
+	}
+	else if (contentLength != (-1)) entityLength = contentLength;
+	// the same ETag is enough, mirrors of a file often report different modification times
+	bool sameETag = !Section->ETag.empty() && Section->ETag == eTag;
+	if (Section->LastModified != L"NOTSET" && Section->LastModified != lastModified && !sameETag)
+	{
+		SetDownloadError(L"Content changed since last time you download it. Please re-download this file.");
+		return false;
+	}
+	if (Section->EntityLength >= 0 && entityLength >= 0 && Section->EntityLength != entityLength)
+	{
+		SetDownloadError(L"File size on server differs from the file being downloaded. Size: " + std::to_wstring(entityLength));
+		return false;
+	}
+	if (!Section->Ranges.empty())
+	{
+		// a sparse section is only ever downloaded in ranges
+		if (statusCode == L"200")
+		{
+			SetDownloadError(L"Server does not support ranges, which are needed to download parts of the file.");
+			return false;
+		}
+		if (Section->HasUnresolvedRanges())
+		{
+			if (entityLength < 0)
+			{
+				SetDownloadError(L"File size unknown, ranges from the end of the file cannot be located.");
+				return false;
+			}
+			if (!Section->ResolveRanges(entityLength))
+			{
+				// retrying would not change anything
+				SetDownloadError(L"Requested ranges lie beyond the end of the file. Size: " + std::to_wstring(entityLength), DownloadStatus::LogicalError);
+				return false;
+			}
+			if (rangesParser.IsComplete()) rangesParser.Reset(Section->GetRangesLeft(Section->BytesDownloaded));
+		}
+		if (!SyncRangesParserAgainstHTTPResponse()) return false;
+	}
+	else if (statusCode == L"200")
+	{
+		// if requested section is not from the beginning and server does not support resuming
+		if (Section->Start > 0)
+		{
+			SetDownloadError(L"Server does not support resuming, however requested section is not from the beginning of file.");
+			return false;
+		}
+		if (contentLength != (-1))
+		{
+			if (Section->End < 0) Section->End = contentLength - 1;
+			else if (contentLength < Section->GetTotal())
+			{
+				SetDownloadError(L"Content length returned from server is smaller than the section requested. Content length: " + sContentLength);
+				return false;
+			}
+		}
+		Section->BytesDownloaded = 0;
+	}
+	else if (statusCode == L"206")
+	{
+		if (contentLength == (-1))
+		{
+			SetDownloadError(L"HTTP Content-Length missing.");
+			return false;
+		}
+		if (Section->End >= 0 && Section->Start + Section->BytesDownloaded + contentLength - 1 != Section->End)
+		{
+			SetDownloadError(L"Content length from server does not match requested download section. Content length: " + sContentLength);
+			return false;
+		}
+		// if it is a new download and all goes well
+		if (Section->End < 0)
+		{
+			Section->End = Section->Start + contentLength - 1;
+		}
+	}
+	Section->LastModified = lastModified;
+	Section->ETag = eTag;
+	if (entityLength >= 0) Section->EntityLength = entityLength;
+
+	return true;
+};
+
+bool Downloader::SyncRangesParserAgainstHTTPResponse()
+{
+	// a server may answer several ranges with one part if it has merged them, so the response tells which it is
+	std::string boundary = ByteRangesParser::GetBoundary(Util::ToUtf8(GetResponseHeaderValue(WINHTTP_QUERY_CONTENT_TYPE)));
+	if (!boundary.empty())
+	{
+		rangesParser.StartMultipart(boundary);
+		return true;
+	}
+	std::wstring range = GetResponseHeaderValue(WINHTTP_QUERY_CONTENT_RANGE);
+	long long first = 0, last = 0;
+	if (!ByteRangesParser::ParseContentRange(Util::ToUtf8(range), first, last))
+	{
+		SetDownloadError(L"Content-Range missing or invalid in response to a range request. Content-Range: " + range);
+		return false;
+	}
+	rangesParser.StartPart(first, last);
+	return true;
+};
+
+void Downloader::StartDownloading()
+{
+	if (IsBusy()) return;
+	if (IsTransferActive()) return;
+	downloadStopFlag = false;
+	if (Section->DownloadStatus == DownloadStatus::Finished) return;
+	if (!CheckDownloadSectionAgainstLogicalErrors()) return;
+	if (Section->DownloadStatus == DownloadStatus::DownloadError)
+	{
+		if (Clock::Time() - Section->LastStatusChange < 10) return;
+	}
+	Section->HttpStatusCode = L"";
+	Section->Error = L"";
+	VerifyBytesDownloadedAgainstFile();
+	if (Section->End >= 0 && Section->BytesDownloaded >= Section->GetTotal())
+	{
+		SetDownloadStatus(DownloadStatus::Finished);
+		return;
+	}
+	if (!BufferPool::Allocate())
+	{
+		SetDownloadError(L"Not enough memory for transfer buffers.");
+		return;
+	}
+	writeSlot = 0;
+	queuedBuffers = 0;
+	queuedBytes = 0;
+	writeOffset = 0;
+	readPending = false;
+	waitingForBuffer = false;
+	waitingForTokens = false;
+	waitingForStream = false;
+	responseEnded = false;
+	redirectCount = 0;
+	EnterTransfer();
+	Section->DownloadStatus = DownloadStatus::PrepareToDownload;
+	// the rest of the transfer happens in WinHTTP status callbacks
+	if (!ConstructHttpRequest() || !SendHttpRequest()) FailTransfer();
+	LeaveTransfer();
+};
+
+bool Downloader::SendHttpRequest()
+{
+	return WinHttpSendRequest(hRequest,
+		WINHTTP_NO_ADDITIONAL_HEADERS,
+		0, WINHTTP_NO_REQUEST_DATA, 0,
+		0, (DWORD_PTR)this);
+};
+
+void Downloader::WaitForFinish()
+{
+	WaitForSingleObject(hTransferIdleEvent, INFINITE);
+	downloadStopFlag = false;
+};
+
+void Downloader::DeleteInternetSession()
+{
+	ConnectionPool::Close();
+};
+
+void Downloader::SetDownloadStatus(DownloadStatus status)
+{
+	Section->DownloadStatus = status;
+	if (hStatusChangedEvent) SetEvent(hStatusChangedEvent);
+};
+
+void Downloader::SetDownloadError(std::wstring errorMessage, DownloadStatus status)
+{
+	Section->Error = errorMessage;
+	Section->LastStatusChange = Clock::Time();
+	SetDownloadStatus(status);
+};
+
+void Downloader::CleanUpHttpConnection()
+{
+	// the request is closed by LeaveTransfer, late callbacks of it are ignored from now on.
+	// If its response has been read completely, WinHTTP keeps the connection for the next request.
+	if (hRequest) handlesToClose.push_back(hRequest);
+	hRequest = NULL;
+	// stop waiting for a buffer, unless the callback handing one over is already on its way
+	if (waitingForBuffer && BufferPool::CancelWait(this))
+	{
+		waitingForBuffer = false;
+		OnRequestHandleClosing();
+	}
+	if (waitingForTokens && RateLimiter::CancelWait(this))
+	{
+		waitingForTokens = false;
+		OnRequestHandleClosing();
+	}
+	if (waitingForStream)
+	{
+		waitingForStream = false;
+		OnRequestHandleClosing();
+	}
+};
+
+void Downloader::EnterTransfer()
+{
+	EnterCriticalSection(&transferLock);
+	transferLockDepth++;
+};
+
+void Downloader::LeaveTransfer()
+{
+	std::vector<HINTERNET> handles;
+	// WinHTTP may call back on the same thread from inside its functions, only the outermost caller closes handles
+	if (--transferLockDepth == 0) handles.swap(handlesToClose);
+	LeaveCriticalSection(&transferLock);
+	// closing the last request may let this downloader be reused or deleted on another thread,
+	// so members must not be touched after this point
+	for (HINTERNET h : handles) WinHttpCloseHandle(h);
+};
+
+void Downloader::VerifyBytesDownloadedAgainstFile()
+{
+	if (Section->BytesDownloaded == 0) return;
+	HANDLE hExistingFile = CreateFileW(Section->FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hExistingFile)
+	{
+		Section->BytesDownloaded = 0;
+		return;
+	}
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = 0;
+	if (GetFileSizeEx(hExistingFile, &fileSize))
+	{
+		// shared output file may be preallocated, so it only needs to cover what has been written.
+		// after a restart BytesDownloaded comes from the manifest, which only counts bytes already flushed to the file.
+		if (Section->SharedFile ? fileSize.QuadPart < Section->GetWritePosition() : fileSize.QuadPart != Section->BytesDownloaded)
+		{
+			Section->BytesDownloaded = 0;
+		}
+	}
+	else
+	{
+		Section->BytesDownloaded = 0;
+	}
+	CloseHandle(hExistingFile);
+};
+
+bool Downloader::OpenTargetFile()
+{
+	// every write goes to the position of its data, in the shared output file or in the file of this section.
+	// Writes are overlapped and complete on the thread pool, so receiving goes on while the disk is busy.
+	DWORD dwShareMode = Section->SharedFile ? FILE_SHARE_READ | FILE_SHARE_WRITE : 0;
+	if (Repair)
+	{
+		// a repair reads before it writes, on a thread pool thread of its own, so the file is used synchronously
+		hFile = CreateFileW(Section->FileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (!compareBuffer) compareBuffer = new BYTE[repairReadSize];
+		return INVALID_HANDLE_VALUE != hFile;
+	}
+	hFile = CreateFileW(Section->FileName.c_str(), GENERIC_WRITE, dwShareMode, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return false;
+	writeIo = CreateThreadpoolIo(hFile, WriteCompleteCallback, this, NULL);
+	if (!writeIo)
+	{
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	return true;
+};
+
+void Downloader::CloseTargetFile()
+{
+	if (writePending)
+	{
+		// data not written yet is dropped, the write on its way closes the file when it completes
+		queuedBuffers = 1;
+		queuedBytes = writeLength;
+		closeFileWhenWritten = true;
+		return;
+	}
+	queuedBuffers = 0;
+	queuedBytes = 0;
+	writeOffset = 0;
+	closeFileWhenWritten = false;
+	if (writeIo) CloseThreadpoolIo(writeIo);
+	writeIo = NULL;
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+};
+
+void Downloader::ReadNextChunk()
+{
+	// one read at a time, into the next buffer which is not waiting to be written
+	if (readPending || waitingForBuffer || waitingForTokens || waitingForStream || responseEnded || queuedBuffers == bufferCount) return;
+	if (StreamLimit && Section->Start + Section->BytesDownloaded + queuedBytes >= *StreamLimit)
+	{
+		// the stream is a whole window behind, the scheduler lets the read go on once it has caught up
+		waitingForStream = true;
+		OnRequestHandleOpened();
+		return;
+	}
+	int slot = (writeSlot + queuedBuffers) % bufferCount;
+	if (!buffers[slot]) buffers[slot] = BufferPool::Lease(BufferAvailableCallback, this);
+	if (!buffers[slot])
+	{
+		// the memory budget is used up, receiving pauses until another transfer returns a buffer.
+		// The wait keeps this downloader busy like an open request.
+		waitingForBuffer = true;
+		OnRequestHandleOpened();
+		return;
+	}
+	if (!RateLimiter::Acquire(hostBucket, RateBucket, TokensAvailableCallback, this))
+	{
+		// over the rate limit, the limiter calls back once the read may go on. The buffer stays leased.
+		waitingForTokens = true;
+		OnRequestHandleOpened();
+		return;
+	}
+	readPending = true;
+	// a limited transfer reads in smaller steps, so it does not receive in bursts
+	if (!WinHttpReadData(hRequest, buffers[slot], RateLimiter::GetReadSize(hostBucket, RateBucket, BufferPool::BufferSize), NULL))
+	{
+		readPending = false;
+		FailTransfer();
+	}
+};
+
+void Downloader::WriteNextChunk()
+{
+	// buffers are written one after another in the order they were received,
+	// so BytesDownloaded always counts data which is in the file without gaps
+	if (writePending || queuedBuffers == 0) return;
+	LARGE_INTEGER position;
+	position.QuadPart = Section->GetWritePosition();
+	writeFileOffset = Section->GetOffset(Section->BytesDownloaded);
+	// bytes of a sparse section go to the stretches of the file they belong to, one write for each
+	writeLength = bufferLength[writeSlot] - writeOffset;
+	long long contiguousBytes = Section->GetContiguousBytes(Section->BytesDownloaded);
+	if (contiguousBytes < writeLength) writeLength = (DWORD)contiguousBytes;
+	ZeroMemory(&writeOverlapped, sizeof(writeOverlapped));
+	writeOverlapped.Offset = position.LowPart;
+	writeOverlapped.OffsetHigh = position.HighPart;
+	writePending = true;
+	// a write on its way keeps this downloader busy like an open request
+	OnRequestHandleOpened();
+	if (Repair)
+	{
+		if (!TrySubmitThreadpoolCallback(RepairCallback, this, NULL))
+		{
+			writePending = false;
+			OnRequestHandleClosing();
+			FailTransfer();
+		}
+		return;
+	}
+	StartThreadpoolIo(writeIo);
+	if (!WriteFile(hFile, buffers[writeSlot] + writeOffset, writeLength, NULL, &writeOverlapped) && GetLastError() != ERROR_IO_PENDING)
+	{
+		DWORD dwError = GetLastError();
+		CancelThreadpoolIo(writeIo);
+		writePending = false;
+		OnRequestHandleClosing();
+		SetLastError(dwError);
+		FailTransfer();
+	}
+};
+
+DWORD Downloader::RepairChunk()
+{
+	// runs while the write is pending, nothing else touches the buffer being written or the file meanwhile
+	LPBYTE data = buffers[writeSlot] + writeOffset;
+	long long position = ((long long)writeOverlapped.OffsetHigh << 32) | writeOverlapped.Offset;
+	DWORD done = 0;
+	while (done < writeLength)
+	{
+		DWORD length = writeLength - done > repairReadSize ? repairReadSize : writeLength - done;
+		if (!RepairBlocks(position + done, data + done, length)) return GetLastError() == NO_ERROR ? ERROR_WRITE_FAULT : GetLastError();
+		done += length;
+	}
+	return NO_ERROR;
+};
+
+bool Downloader::RepairBlocks(long long position, LPBYTE data, DWORD length)
+{
+	LARGE_INTEGER li;
+	li.QuadPart = position;
+	DWORD bytesRead = 0;
+	if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !ReadFile(hFile, compareBuffer, length, &bytesRead, NULL)) return false;
+	// runs of differing blocks are written at once. Beyond the end of the file everything differs.
+	DWORD runStart = 0, runLength = 0;
+	DWORD blockStart = 0;
+	while (blockStart <= length)
+	{
+		DWORD blockLength = 0;
+		bool differs = false;
+		if (blockStart < length)
+		{
+			blockLength = repairBlockSize - (DWORD)((position + blockStart) % repairBlockSize);
+			if (blockLength > length - blockStart) blockLength = length - blockStart;
+			// memcmp is vectorized by the compiler and the C runtime
+			differs = blockStart + blockLength > bytesRead || memcmp(data + blockStart, compareBuffer + blockStart, blockLength) != 0;
+		}
+		if (differs)
+		{
+			if (runLength == 0) runStart = blockStart;
+			runLength += blockLength;
+		}
+		else if (runLength > 0)
+		{
+			DWORD bytesWritten = 0;
+			li.QuadPart = position + runStart;
+			if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !WriteFile(hFile, data + runStart, runLength, &bytesWritten, NULL)) return false;
+			if (bytesWritten != runLength)
+			{
+				SetLastError(ERROR_WRITE_FAULT);
+				return false;
+			}
+			std::vector<ByteRange>& repaired = Section->RepairedRanges;
+			if (!repaired.empty() && repaired.back().End + 1 == li.QuadPart) repaired.back().End += runLength;
+			else repaired.push_back({ li.QuadPart, li.QuadPart + runLength - 1 });
+			Section->BytesRepaired += runLength;
+			runLength = 0;
+		}
+		if (blockStart == length) break;
+		blockStart += blockLength;
+	}
+	return true;
+};
+
+void Downloader::ReturnBuffers()
+{
+	for (int i = 0; i < bufferCount; i++)
+	{
+		BufferPool::Return(buffers[i]);
+		buffers[i] = NULL;
+	}
+};
+
+void Downloader::FailTransfer()
+{
+	if (Section->Error.empty()) SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	CloseTargetFile();
+	CleanUpHttpConnection();
+};
+
+void Downloader::FinishTransfer(DownloadStatus status)
+{
+	CloseTargetFile();
+	SetDownloadStatus(status);
+	CleanUpHttpConnection();
+};
+
+void Downloader::CompleteTransfer()
+{
+	long long currentEnd = Section->End;
+	if (!Section->Ranges.empty() && Section->BytesDownloaded < Section->GetTotal() && Section->BytesDownloaded > requestStartBytes && !downloadStopFlag)
+	{
+		// the server sent fewer ranges than asked for, or the request could not hold them all. Ask for the rest, the file stays open.
+		responseEnded = false;
+		if (!ConstructHttpRequest() || !SendHttpRequest()) FailTransfer();
+		return;
+	}
+	if (currentEnd >= 0 && Section->BytesDownloaded < Section->GetTotal())
+	{
+		CloseTargetFile();
+		SetDownloadError(L"Download stream reached the end, but not enough data transmitted.");
+		CleanUpHttpConnection();
+		return;
+	}
+	if (Section->HttpStatusCode == L"200" && Section->End < 0)
+	{
+		Section->End = Section->BytesDownloaded - 1;
+	}
+	FinishTransfer(DownloadStatus::Finished);
+};
+
+void CALLBACK Downloader::HttpStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DWORD dwInternetStatus, LPVOID lpvStatusInformation, DWORD dwStatusInformationLength)
+{
+	Downloader* d = (Downloader*)dwContext;
+	// session and connection handles carry no context
+	if (!d) return;
+	if (dwInternetStatus == WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING)
+	{
+		d->OnRequestHandleClosing();
+		return;
+	}
+	d->EnterTransfer();
+	// late notification of a request which has already been closed or cancelled
+	if (hInternet != d->hRequest)
+	{
+		d->LeaveTransfer();
+		return;
+	}
+	switch (dwInternetStatus)
+	{
+	case WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER:
+		d->connectingTime = Clock::Now();
+		break;
+	case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+		d->OnSendRequestComplete();
+		break;
+	case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
+		d->OnHeadersAvailable();
+		break;
+	case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
+		d->OnReadComplete(dwStatusInformationLength);
+		break;
+	case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
+		d->OnRequestError(((WINHTTP_ASYNC_RESULT*)lpvStatusInformation)->dwError);
+		break;
+	}
+	d->LeaveTransfer();
+};
+
+void CALLBACK Downloader::RepairCallback(PTP_CALLBACK_INSTANCE, PVOID Context)
+{
+	Downloader* d = (Downloader*)Context;
+	// the disk is read and written outside the lock, so receiving goes on meanwhile
+	DWORD dwError = d->RepairChunk();
+	d->EnterTransfer();
+	d->OnWriteComplete(dwError, dwError == NO_ERROR ? d->writeLength : 0);
+	d->LeaveTransfer();
+	// this may let the downloader be reused or deleted, it must not be touched afterwards
+	d->OnRequestHandleClosing();
+};
+
+void CALLBACK Downloader::WriteCompleteCallback(PTP_CALLBACK_INSTANCE, PVOID Context, PVOID, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred, PTP_IO)
+{
+	Downloader* d = (Downloader*)Context;
+	d->EnterTransfer();
+	d->OnWriteComplete(IoResult, (DWORD)NumberOfBytesTransferred);
+	d->LeaveTransfer();
+	// this may let the downloader be reused or deleted, it must not be touched afterwards
+	d->OnRequestHandleClosing();
+};
+
+void Downloader::OnSendRequestComplete()
+{
+	if (connectingTime) ConnectionPool::ReportNewConnection(Clock::Now() - connectingTime);
+	else ConnectionPool::ReportReusedConnection();
+	if (!WinHttpReceiveResponse(hRequest, NULL)) FailTransfer();
+};
+
+void Downloader::OnHeadersAvailable()
+{
+	Section->HttpStatusCode = GetResponseHeaderValue(WINHTTP_QUERY_STATUS_CODE);
+	// handle redirects
+	if ((Section->HttpStatusCode == L"301" || Section->HttpStatusCode == L"302" ||
+		Section->HttpStatusCode == L"307" || Section->HttpStatusCode == L"308") && redirectCount < 5)
+	{
+		std::wstring location = GetResponseHeaderValue(WINHTTP_QUERY_LOCATION);
+		if (location.empty())
+		{
+			SetDownloadError(L"Redirect Location header is missing.");
+			FailTransfer();
+			return;
+		}
+		redirectCount++;
+		Section->Url = location;
+		if (!ConstructHttpRequest() || !SendHttpRequest()) FailTransfer();
+		return;
+	}
+	// the server ignored a request for several ranges and sends the whole file, ask for one range at a time instead
+	if (Section->HttpStatusCode == L"200" && !Section->Ranges.empty() && requestedRanges > 1)
+	{
+		Section->SingleRangeRequests = true;
+		if (!ConstructHttpRequest() || !SendHttpRequest()) FailTransfer();
+		return;
+	}
+	if (!SyncDownloadSectionAgainstHTTPResponse())
+	{
+		FailTransfer();
+		return;
+	}
+	if (HashData) ReadDigestHeader();
+	if (downloadStopFlag)
+	{
+		FinishTransfer(DownloadStatus::Stopped);
+		return;
+	}
+	// a sparse section keeps its file open over the requests for the rest of its ranges
+	if (hFile == INVALID_HANDLE_VALUE && !OpenTargetFile())
+	{
+		FailTransfer();
+		return;
+	}
+	SetDownloadStatus(DownloadStatus::Downloading);
+	ReadNextChunk();
+};
+
+void Downloader::OnReadComplete(DWORD dwNumberOfBytesRead)
+{
+	readPending = false;
+	RateLimiter::Consume(hostBucket, RateBucket, dwNumberOfBytesRead);
+	long long currentEnd = Section->End;
+	long long bytesReceived = Section->BytesDownloaded + queuedBytes;
+	// zero bytes means the response has ended
+	if (dwNumberOfBytesRead == 0) responseEnded = true;
+	else
+	{
+		bool sparse = !Section->Ranges.empty();
+		if (sparse)
+		{
+			// only the wanted bytes are kept, at the start of the buffer
+			dwNumberOfBytesRead = rangesParser.Parse(buffers[(writeSlot + queuedBuffers) % bufferCount], dwNumberOfBytesRead);
+			if (rangesParser.HasFailed())
+			{
+				SetDownloadError(L"Invalid multipart/byteranges response.");
+				FailTransfer();
+				return;
+			}
+			// what is left of the response cannot be used, the rest is asked for again once the data is written
+			if (rangesParser.IsDone() || rangesParser.HasMissedData()) responseEnded = true;
+		}
+		// End can be reduced by Scheduler thread. Do not write into the range of the next section.
+		if ((Section->SharedFile || sparse) && currentEnd >= 0)
+		{
+			long long bytesLeft = Section->GetTotal() - bytesReceived;
+			if (bytesLeft < 0) bytesLeft = 0;
+			if (dwNumberOfBytesRead > bytesLeft) dwNumberOfBytesRead = (DWORD)bytesLeft;
+		}
+		if (dwNumberOfBytesRead > 0)
+		{
+			bufferLength[(writeSlot + queuedBuffers) % bufferCount] = dwNumberOfBytesRead;
+			queuedBuffers++;
+			queuedBytes += dwNumberOfBytesRead;
+		}
+		if (currentEnd >= 0 && bytesReceived + dwNumberOfBytesRead >= Section->GetTotal())
+		{
+			// the closing boundary of a sparse response is read too, so the connection can be reused
+			if (!sparse || !rangesParser.IsComplete()) responseEnded = true;
+		}
+	}
+	if (!responseEnded && downloadStopFlag)
+	{
+		FinishTransfer(DownloadStatus::Stopped);
+		return;
+	}
+	// receive the next chunk while this one is being written
+	ReadNextChunk();
+	if (hRequest) WriteNextChunk();
+	if (hRequest && responseEnded && queuedBuffers == 0) CompleteTransfer();
+};
+
+void Downloader::OnWriteComplete(DWORD dwError, DWORD dwNumberOfBytesWritten)
+{
+	DWORD dwLength = writeLength;
+	writePending = false;
+	// the bytes are hashed once they are in the file, so the hash covers what BytesDownloaded counts
+	if (dwError == NO_ERROR && HashData) Section->Hash.Update(writeFileOffset, buffers[writeSlot] + writeOffset, dwNumberOfBytesWritten);
+	if (dwError == NO_ERROR && Pieces) CheckPieces(writeFileOffset, buffers[writeSlot] + writeOffset, dwNumberOfBytesWritten);
+	writeOffset += dwLength;
+	queuedBytes -= dwLength;
+	if (writeOffset >= bufferLength[writeSlot])
+	{
+		BufferPool::Return(buffers[writeSlot]);
+		buffers[writeSlot] = NULL;
+		writeSlot = (writeSlot + 1) % bufferCount;
+		queuedBuffers--;
+		writeOffset = 0;
+	}
+	if (dwError == NO_ERROR) Section->BytesDownloaded += dwNumberOfBytesWritten;
+	// the transfer ended while this write was on its way
+	if (closeFileWhenWritten)
+	{
+		CloseTargetFile();
+		return;
+	}
+	if (dwError != NO_ERROR || dwNumberOfBytesWritten != dwLength)
+	{
+		SetLastError(dwError == NO_ERROR ? ERROR_WRITE_FAULT : dwError);
+		FailTransfer();
+		return;
+	}
+	// the first data makes a section eligible for splitting
+	if (Section->BytesDownloaded == dwNumberOfBytesWritten && hStatusChangedEvent) SetEvent(hStatusChangedEvent);
+	if (responseEnded && queuedBuffers == 0)
+	{
+		CompleteTransfer();
+		return;
+	}
+	WriteNextChunk();
+	// a read may have been waiting for a free buffer
+	if (hRequest) ReadNextChunk();
+};
+
+void CALLBACK Downloader::BufferAvailableCallback(PTP_CALLBACK_INSTANCE, PVOID Context)
+{
+	Downloader* d = (Downloader*)Context;
+	d->EnterTransfer();
+	d->OnBufferAvailable();
+	d->LeaveTransfer();
+	// this may let the downloader be reused or deleted, it must not be touched afterwards
+	d->OnRequestHandleClosing();
+};
+
+void Downloader::OnBufferAvailable()
+{
+	waitingForBuffer = false;
+	if (hRequest) ReadNextChunk();
+};
+
+void CALLBACK Downloader::TokensAvailableCallback(PTP_CALLBACK_INSTANCE, PVOID Context)
+{
+	Downloader* d = (Downloader*)Context;
+	d->EnterTransfer();
+	d->OnTokensAvailable();
+	d->LeaveTransfer();
+	// this may let the downloader be reused or deleted, it must not be touched afterwards
+	d->OnRequestHandleClosing();
+};
+
+void Downloader::OnTokensAvailable()
+{
+	waitingForTokens = false;
+	if (hRequest) ReadNextChunk();
+};
+
+void Downloader::OnStreamLimitMoved()
+{
+	EnterTransfer();
+	bool resumed = waitingForStream && StreamLimit && Section->Start + Section->BytesDownloaded + queuedBytes < *StreamLimit;
+	if (resumed)
+	{
+		waitingForStream = false;
+		if (hRequest) ReadNextChunk();
+	}
+	LeaveTransfer();
+	// this may let the downloader be reused, as after any other wait
+	if (resumed) OnRequestHandleClosing();
+};
+
+void Downloader::OnRequestError(DWORD dwError)
+{
+	SetLastError(dwError);
+	FailTransfer();
+};
+
+void Downloader::OnRequestHandleOpened()
+{
+	if (InterlockedIncrement(&openRequests) == 1) ResetEvent(hTransferIdleEvent);
+};
+
+void Downloader::OnRequestHandleClosing()
+{
+	// a new request is only opened while another one is alive, or after this event is set,
+	// so the count cannot go up again before the event is set here
+	if (InterlockedDecrement(&openRequests) == 0)
+	{
+		// nothing can read into or write from the buffers any more, other transfers may use them
+		ReturnBuffers();
+		SetEvent(hTransferIdleEvent);
+	}
+};
+
+Downloader::~Downloader()
+{
+	// callbacks of a closing request may still be on their way
+	WaitForSingleObject(hTransferIdleEvent, INFINITE);
+	CloseHandle(hTransferIdleEvent);
+	DeleteCriticalSection(&transferLock);
+	ReturnBuffers();
+	if (compareBuffer) delete[] compareBuffer;
+};
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+#include "DownloadSection.h"
+#include "ConnectionPool.h"
+#include "BufferPool.h"
+#include "RateLimiter.h"
+#include "ByteRangesParser.h"
+#include <windows.h>
+#include <winhttp.h>
+#include <vector>
+
+class Downloader
+{
+private:
+	static const std::wstring userAgentString;
+	// received data goes through a ring of buffers leased from BufferPool, so the next read runs while earlier buffers are written
+	static const int bufferCount = 4;
+	// a sparse section asks for at most this many ranges in one request
+	static const int maxRangesPerRequest = 32;
+	// wanted ranges closer than this are asked for as one, the bytes between them are dropped
+	static const long long rangeMergeGap = 8192;
+	// a repair compares the file in blocks of this size, aligned to the file, and rewrites the ones which differ
+	static const DWORD repairBlockSize = 4096;
+	// and reads what the file holds in pieces of this size
+	static const DWORD repairReadSize = 65536;
+	LPBYTE compareBuffer = NULL;
+	bool downloadStopFlag = false;
+	int redirectCount = 0;
+	// number of request handles not yet reported closed by WinHTTP, and of file writes not yet completed
+	LONG openRequests = 0;
+	HANDLE hTransferIdleEvent = NULL;
+	// set whenever the status of the section changes, so the owner can react without polling
+	HANDLE hStatusChangedEvent = NULL;
+	// serializes status callbacks with starting and stopping the transfer
+	CRITICAL_SECTION transferLock;
+	int transferLockDepth = 0;
+	// handles released while transferLock is held, closed once it is left
+	std::vector<HINTERNET> handlesToClose;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	PTP_IO writeIo = NULL;
+	OVERLAPPED writeOverlapped = {};
+	LPBYTE buffers[bufferCount] = {};
+	DWORD bufferLength[bufferCount] = {};
+	// buffers from writeSlot on hold received data in order, the first one of them may be being written
+	int writeSlot = 0;
+	int queuedBuffers = 0;
+	long long queuedBytes = 0;
+	// a buffer of a sparse section is written in pieces, one for each stretch of the file it belongs to
+	DWORD writeOffset = 0;
+	DWORD writeLength = 0;
+	// position in the file on the server of the bytes being written, BytesDownloaded may be cut back meanwhile
+	long long writeFileOffset = 0;
+	bool readPending = false;
+	// the next read waits for BufferPool to hand out a buffer
+	bool waitingForBuffer = false;
+	// the next read waits for the rate limit to let it go
+	bool waitingForTokens = false;
+	// the next read waits for the stream of the download to catch up
+	bool waitingForStream = false;
+	// rate limit of the server the current request goes to
+	RateLimiter::Bucket* hostBucket = NULL;
+	bool writePending = false;
+	// the response has been read up to the end of the section, what is queued still has to be written
+	bool responseEnded = false;
+	// the transfer is over, the file is closed as soon as the write on its way completes
+	bool closeFileWhenWritten = false;
+	HINTERNET hRequest = NULL;
+	// ranges asked for by the current request of a sparse section, and the bytes downloaded when it was sent
+	int requestedRanges = 0;
+	long long requestStartBytes = 0;
+	ByteRangesParser rangesParser;
+	// when the current request started connecting to the server, zero if it went out on a pooled connection
+	ULONGLONG connectingTime = 0;
+	void ResetDownloadStatus();
+	bool IsTransferActive();
+	bool CheckDownloadSectionAgainstLogicalErrors();
+	bool ConstructHttpRequest();
+	std::wstring GetSparseRangeHeader();
+	bool SendHttpRequest();
+	std::wstring GetResponseHeaderValue(DWORD dwInfoLevel, LPCWSTR pwszName = WINHTTP_HEADER_NAME_BY_INDEX);
+	void ReadDigestHeader();
+	void CheckPieces(long long offset, const BYTE* data, DWORD length);
+	bool SyncDownloadSectionAgainstHTTPResponse();
+	bool SyncRangesParserAgainstHTTPResponse();
+	bool OpenTargetFile();
+	void CloseTargetFile();
+	void ReadNextChunk();
+	void WriteNextChunk();
+	DWORD RepairChunk();
+	bool RepairBlocks(long long position, LPBYTE data, DWORD length);
+	void ReturnBuffers();
+	void CleanUpHttpConnection();
+	void EnterTransfer();
+	void LeaveTransfer();
+	void SetDownloadStatus(DownloadStatus status);
+	void SetDownloadError(std::wstring errorMessage, DownloadStatus status = DownloadStatus::DownloadError);
+	void FailTransfer();
+	void FinishTransfer(DownloadStatus status);
+	void CompleteTransfer();
+	static void CALLBACK HttpStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DWORD dwInternetStatus, LPVOID lpvStatusInformation, DWORD dwStatusInformationLength);
+	void OnSendRequestComplete();
+	void OnHeadersAvailable();
+	void OnReadComplete(DWORD dwNumberOfBytesRead);
+	static void CALLBACK RepairCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+	static void CALLBACK WriteCompleteCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PVOID Overlapped, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred, PTP_IO Io);
+	void OnWriteComplete(DWORD dwError, DWORD dwNumberOfBytesWritten);
+	static void CALLBACK BufferAvailableCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+	void OnBufferAvailable();
+	static void CALLBACK TokensAvailableCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+	void OnTokensAvailable();
+	void OnRequestError(DWORD dwError);
+	void OnRequestHandleOpened();
+	void OnRequestHandleClosing();
+	void VerifyBytesDownloadedAgainstFile();
+public:
+	DownloadSection* Section = NULL;
+	// rate limit of the download this downloader works for, none if NULL
+	RateLimiter::Bucket* RateBucket = NULL;
+	// the file already holds the data, maybe damaged. Only blocks which differ from the downloaded data are written.
+	bool Repair = false;
+	// the bytes are hashed on their way to the file, for the hash of the whole file
+	bool HashData = false;
+	// pieces of the file with their hashes, every piece received from its first to its last byte is checked. None if NULL.
+	PieceList* Pieces = NULL;
+	// offset of the file the stream of the download has room up to, receiving pauses there. None if NULL.
+	volatile long long* StreamLimit = NULL;
+	Downloader(DownloadSection* section, HANDLE hStatusChangedEvent = NULL);
+	bool ChangeDownloadSection(DownloadSection* section);
+	bool IsBusy();
+	void StopDownloading();
+	void StartDownloading();
+	void WaitForFinish();
+	// lets a read paused at StreamLimit go on once the limit has moved past it
+	void OnStreamLimitMoved();
+	static void DeleteInternetSession();
+	~Downloader();
+};
@@ -0,0 +1,211 @@
+#include "Metalink.h"
+#include "Util.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+
+bool Metalink::NextTag(std::string& xml, size_t& position, std::string& text, Tag& tag)
+{
+	// returns the text before the next element tag and the tag, skipping declarations, comments and CDATA-less markup
+	text.clear();
+	while (position < xml.length())
+	{
+		size_t open = xml.find('<', position);
+		if (open == std::string::npos) return false;
+		text += xml.substr(position, open - position);
+		if (xml.compare(open, 4, "<!--") == 0)
+		{
+			size_t close = xml.find("-->", open + 4);
+			if (close == std::string::npos) return false;
+			position = close + 3;
+			continue;
+		}
+		size_t close = xml.find('>', open);
+		if (close == std::string::npos) return false;
+		position = close + 1;
+		if (xml[open + 1] == '?' || xml[open + 1] == '!') continue;
+		std::string content = xml.substr(open + 1, close - open - 1);
+		tag = Tag();
+		if (!content.empty() && content[0] == '/')
+		{
+			tag.Closing = true;
+			content.erase(0, 1);
+		}
+		if (!content.empty() && content.back() == '/')
+		{
+			tag.Empty = true;
+			content.pop_back();
+		}
+		size_t nameEnd = content.find_first_of(" \t\r\n");
+		tag.Name = content.substr(0, nameEnd);
+		if (nameEnd != std::string::npos) tag.Attributes = content.substr(nameEnd);
+		// names in a namespace prefix are taken as they are, both versions have one namespace only
+		size_t colon = tag.Name.find(':');
+		if (colon != std::string::npos) tag.Name.erase(0, colon + 1);
+		return true;
+	}
+	return false;
+};
+
+std::string Metalink::GetAttribute(std::string& attributes, std::string name)
+{
+	size_t position = 0;
+	while ((position = attributes.find(name, position)) != std::string::npos)
+	{
+		size_t equals = attributes.find_first_not_of(" \t\r\n", position + name.length());
+		bool startsName = position == 0 || isspace((unsigned char)attributes[position - 1]);
+		position += name.length();
+		if (!startsName || equals == std::string::npos || attributes[equals] != '=') continue;
+		size_t quote = attributes.find_first_not_of(" \t\r\n", equals + 1);
+		if (quote == std::string::npos || (attributes[quote] != '"' && attributes[quote] != '\'')) return std::string();
+		size_t end = attributes.find(attributes[quote], quote + 1);
+		if (end == std::string::npos) return std::string();
+		return DecodeText(attributes.substr(quote + 1, end - quote - 1));
+	}
+	return std::string();
+};
+
+std::string Metalink::DecodeText(std::string text)
+{
+	static const char* entities[][2] = { { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" } };
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == std::string::npos) return std::string();
+	text = text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+	for (auto& entity : entities)
+	{
+		size_t position = 0;
+		while ((position = text.find(entity[0], position)) != std::string::npos)
+		{
+			text.replace(position, strlen(entity[0]), entity[1]);
+			position++;
+		}
+	}
+	return text;
+};
+
+bool Metalink::ParseHex(std::string text, std::vector<BYTE>& bytes)
+{
+	bytes.clear();
+	if (text.empty() || text.length() % 2 != 0) return false;
+	for (size_t i = 0; i < text.length(); i += 2)
+	{
+		if (!isxdigit((unsigned char)text[i]) || !isxdigit((unsigned char)text[i + 1])) return false;
+		bytes.push_back((BYTE)strtoul(text.substr(i, 2).c_str(), NULL, 16));
+	}
+	return true;
+};
+
+bool Metalink::Parse(std::string xml, std::wstring& error)
+{
+	// version 4 has file/url with a priority, lower first, and file/pieces/hash in order.
+	// Version 3 has file/resources/url with a preference, higher first, and file/verification/pieces/hash with a piece number.
+	std::vector<std::string> path;
+	std::vector<std::pair<long long, std::wstring>> urls;
+	std::string text;
+	Tag tag;
+	size_t position = 0;
+	int files = 0;
+	long long nextPiece = 0;
+	long long pieceIndex = 0;
+	std::string urlAttributes;
+	while (NextTag(xml, position, text, tag))
+	{
+		bool inFirstFile = files == 1 && std::find(path.begin(), path.end(), "file") != path.end();
+		if (!tag.Closing)
+		{
+			if (tag.Name == "file" && ++files == 1) FileName = Util::FromUtf8(GetAttribute(tag.Attributes, "name"));
+			if (inFirstFile && tag.Name == "pieces")
+			{
+				std::string type = GetAttribute(tag.Attributes, "type");
+				for (char& c : type) c = (char)tolower((unsigned char)c);
+				if (type == "sha1") type = "sha-1";
+				if (type == "sha256") type = "sha-256";
+				Pieces.HashType = Util::FromUtf8(type);
+				Pieces.PieceLength = strtoll(GetAttribute(tag.Attributes, "length").c_str(), NULL, 10);
+			}
+			if (inFirstFile && tag.Name == "hash" && !path.empty() && path.back() == "pieces")
+			{
+				std::string piece = GetAttribute(tag.Attributes, "piece");
+				pieceIndex = piece.empty() ? nextPiece : strtoll(piece.c_str(), NULL, 10);
+				nextPiece = pieceIndex + 1;
+			}
+			if (tag.Name == "url") urlAttributes = tag.Attributes;
+			if (!tag.Empty) path.push_back(tag.Name);
+			continue;
+		}
+		if (path.empty() || path.back() != tag.Name) break;
+		path.pop_back();
+		if (!inFirstFile) continue;
+		if (tag.Name == "size" && path.back() == "file") Pieces.FileSize = strtoll(DecodeText(text).c_str(), NULL, 10);
+		else if (tag.Name == "url")
+		{
+			std::wstring url = Util::FromUtf8(DecodeText(text));
+			std::string priority = GetAttribute(urlAttributes, "priority");
+			std::string preference = GetAttribute(urlAttributes, "preference");
+			long long order = !priority.empty() ? strtoll(priority.c_str(), NULL, 10) : !preference.empty() ? 100 - strtoll(preference.c_str(), NULL, 10) : 999999;
+			// the engine speaks HTTP only
+			if (url.compare(0, 7, L"http://") == 0 || url.compare(0, 8, L"https://") == 0) urls.push_back(std::make_pair(order, url));
+		}
+		else if (tag.Name == "hash" && path.back() == "pieces")
+		{
+			std::vector<BYTE> digest;
+			if (pieceIndex < 0 || pieceIndex > 10000000 || !ParseHex(DecodeText(text), digest))
+			{
+				error = L"Invalid piece hash in Metalink file.";
+				return false;
+			}
+			if (Pieces.Hashes.size() <= (size_t)pieceIndex) Pieces.Hashes.resize((size_t)pieceIndex + 1);
+			Pieces.Hashes[(size_t)pieceIndex] = digest;
+		}
+	}
+	std::stable_sort(urls.begin(), urls.end(), [](const std::pair<long long, std::wstring>& a, const std::pair<long long, std::wstring>& b) { return a.first < b.first; });
+	for (auto& url : urls) Urls.push_back(url.second);
+	if (files == 0 || Urls.empty())
+	{
+		error = L"Metalink file has no HTTP URL of a file.";
+		return false;
+	}
+	if (Pieces.Hashes.empty()) return true;
+	size_t hashSize = Pieces.HashType == L"sha-1" ? 20 : 32;
+	bool piecesValid = PieceHash::IsSupported(Pieces.HashType) && Pieces.PieceLength > 0;
+	for (std::vector<BYTE>& digest : Pieces.Hashes)
+	{
+		if (digest.size() != hashSize) piecesValid = false;
+	}
+	if (piecesValid && Pieces.FileSize >= 0) piecesValid = (long long)Pieces.Hashes.size() == (Pieces.FileSize + Pieces.PieceLength - 1) / Pieces.PieceLength;
+	if (!piecesValid)
+	{
+		error = L"Pieces of the Metalink file are not hashed with SHA-1 or SHA-256, or do not cover the file.";
+		return false;
+	}
+	Pieces.States.assign(Pieces.Hashes.size(), PieceList::Unchecked);
+	return true;
+};
+
+bool Metalink::Load(std::wstring metalinkFileName, std::wstring& error)
+{
+	HANDLE hFile = CreateFileW(metalinkFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		error = L"Metalink file cannot be opened.";
+		return false;
+	}
+	std::string content;
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = 0;
+	BOOL bResults = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= maxMetalinkSize;
+	if (bResults)
+	{
+		DWORD dwNumberOfBytesRead = 0;
+		content.resize((size_t)fileSize.QuadPart);
+		bResults = ReadFile(hFile, &content[0], (DWORD)fileSize.QuadPart, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead == fileSize.QuadPart;
+	}
+	CloseHandle(hFile);
+	if (!bResults)
+	{
+		error = L"Metalink file cannot be read.";
+		return false;
+	}
+	return Parse(content, error);
+};
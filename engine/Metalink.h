@@ -0,0 +1,31 @@
+#pragma once
+#include "PieceHash.h"
+#include <string>
+#include <vector>
+
+// A Metalink file, RFC 5854 or the older version 3 format: the URLs a file can be downloaded from, its size and the hashes
+// of its pieces. Only the first file it describes is used.
+class Metalink
+{
+private:
+	static const long long maxMetalinkSize = 16777216;
+	struct Tag
+	{
+		std::string Name;
+		std::string Attributes;
+		bool Closing = false;
+		bool Empty = false;
+	};
+	static bool NextTag(std::string& xml, size_t& position, std::string& text, Tag& tag);
+	static std::string GetAttribute(std::string& attributes, std::string name);
+	static std::string DecodeText(std::string text);
+	static bool ParseHex(std::string text, std::vector<BYTE>& bytes);
+public:
+	std::wstring FileName;
+	// in the order of preference given by the file
+	std::vector<std::wstring> Urls;
+	PieceList Pieces;
+	// false with error telling why if the file cannot be read or describes no usable download
+	bool Load(std::wstring metalinkFileName, std::wstring& error);
+	bool Parse(std::string xml, std::wstring& error);
+};
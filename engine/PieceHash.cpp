@@ -0,0 +1,190 @@
+#include "PieceHash.h"
+#include <cstring>
+
+static const DWORD sha256Constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline DWORD RotateLeft(DWORD x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline DWORD RotateRight(DWORD x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline DWORD ReadBigEndian(const BYTE* p)
+{
+	return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | (DWORD)p[3];
+}
+
+PieceHash::PieceHash()
+{
+	Reset(L"sha-256");
+};
+
+bool PieceHash::IsSupported(std::wstring type)
+{
+	return type == L"sha-1" || type == L"sha-256";
+};
+
+bool PieceHash::Reset(std::wstring type)
+{
+	static const DWORD sha1Start[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	static const DWORD sha256Start[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	if (!IsSupported(type)) return false;
+	sha256 = type == L"sha-256";
+	if (sha256) memcpy(state, sha256Start, sizeof(sha256Start));
+	else memcpy(state, sha1Start, sizeof(sha1Start));
+	blockLength = 0;
+	length = 0;
+	return true;
+};
+
+void PieceHash::TransformSha1(const BYTE* data)
+{
+	DWORD w[80];
+	for (int i = 0; i < 16; i++) w[i] = ReadBigEndian(data + i * 4);
+	for (int i = 16; i < 80; i++) w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	DWORD a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int i = 0; i < 80; i++)
+	{
+		DWORD f, k;
+		if (i < 20) f = (b & c) | (~b & d), k = 0x5A827999;
+		else if (i < 40) f = b ^ c ^ d, k = 0x6ED9EBA1;
+		else if (i < 60) f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+		else f = b ^ c ^ d, k = 0xCA62C1D6;
+		DWORD t = RotateLeft(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = RotateLeft(b, 30);
+		b = a;
+		a = t;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+};
+
+void PieceHash::TransformSha256(const BYTE* data)
+{
+	DWORD w[64];
+	for (int i = 0; i < 16; i++) w[i] = ReadBigEndian(data + i * 4);
+	for (int i = 16; i < 64; i++)
+	{
+		DWORD s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		DWORD s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	DWORD v[8];
+	memcpy(v, state, sizeof(v));
+	for (int i = 0; i < 64; i++)
+	{
+		DWORD s1 = RotateRight(v[4], 6) ^ RotateRight(v[4], 11) ^ RotateRight(v[4], 25);
+		DWORD ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		DWORD t1 = v[7] + s1 + ch + sha256Constants[i] + w[i];
+		DWORD s0 = RotateRight(v[0], 2) ^ RotateRight(v[0], 13) ^ RotateRight(v[0], 22);
+		DWORD maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		DWORD t2 = s0 + maj;
+		memmove(v + 1, v, sizeof(DWORD) * 7);
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i = 0; i < 8; i++) state[i] += v[i];
+};
+
+void PieceHash::Update(const BYTE* data, DWORD dataLength)
+{
+	length += dataLength;
+	while (dataLength > 0)
+	{
+		if (blockLength == 0 && dataLength >= sizeof(block))
+		{
+			// whole blocks are hashed where they are
+			if (sha256) TransformSha256(data);
+			else TransformSha1(data);
+			data += sizeof(block);
+			dataLength -= sizeof(block);
+			continue;
+		}
+		DWORD count = sizeof(block) - blockLength < dataLength ? sizeof(block) - blockLength : dataLength;
+		memcpy(block + blockLength, data, count);
+		blockLength += count;
+		data += count;
+		dataLength -= count;
+		if (blockLength == sizeof(block))
+		{
+			if (sha256) TransformSha256(block);
+			else TransformSha1(block);
+			blockLength = 0;
+		}
+	}
+};
+
+std::vector<BYTE> PieceHash::Finish()
+{
+	// padding is a one bit, zeros and the length in bits at the end of the last block
+	unsigned long long bits = length * 8;
+	BYTE padding[72] = { 0x80 };
+	DWORD paddingLength = blockLength < 56 ? 56 - blockLength : 120 - blockLength;
+	for (int i = 0; i < 8; i++) padding[paddingLength + i] = (BYTE)(bits >> (56 - 8 * i));
+	Update(padding, paddingLength + 8);
+	std::vector<BYTE> digest;
+	for (int i = 0; i < (sha256 ? 8 : 5); i++)
+	{
+		for (int j = 3; j >= 0; j--) digest.push_back((BYTE)(state[i] >> (8 * j)));
+	}
+	return digest;
+};
+
+void PieceList::Check(long long index, std::vector<BYTE> digest)
+{
+	SetState(index, digest == Hashes[(size_t)index] ? Good : Corrupt);
+};
+
+void PieceList::SetState(long long index, PieceState state)
+{
+	InterlockedExchange(&States[(size_t)index], state);
+};
+
+PieceList::PieceState PieceList::GetState(long long index)
+{
+	return (PieceState)InterlockedCompareExchange(&States[(size_t)index], 0, 0);
+};
+
+long long PieceList::GetPieceEnd(long long index)
+{
+	long long end = (index + 1) * PieceLength;
+	if (FileSize >= 0 && end > FileSize) end = FileSize;
+	return end;
+};
+
+void PieceList::CheckFile(HANDLE hFile, long long index, LPBYTE buffer, DWORD bufferLength)
+{
+	PieceHash hash;
+	hash.Reset(HashType);
+	LARGE_INTEGER li;
+	li.QuadPart = index * PieceLength;
+	long long bytesLeft = GetPieceEnd(index) - li.QuadPart;
+	BOOL bResults = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN);
+	while (bResults && bytesLeft > 0)
+	{
+		DWORD dwNumberOfBytesRead = 0;
+		bResults = ReadFile(hFile, buffer, bytesLeft < bufferLength ? (DWORD)bytesLeft : bufferLength, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead > 0;
+		if (bResults) hash.Update(buffer, dwNumberOfBytesRead);
+		bytesLeft -= dwNumberOfBytesRead;
+	}
+	if (bResults) Check(index, hash.Finish());
+	else SetState(index, Corrupt);
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+
+// SHA-1 and SHA-256, the hashes Metalink files give for the pieces of a file
+class PieceHash
+{
+private:
+	bool sha256 = true;
+	DWORD state[8];
+	BYTE block[64];
+	DWORD blockLength = 0;
+	unsigned long long length = 0;
+	void TransformSha1(const BYTE* data);
+	void TransformSha256(const BYTE* data);
+public:
+	PieceHash();
+	// sha-1 or sha-256 as Metalink names them, false for anything else
+	bool Reset(std::wstring type);
+	void Update(const BYTE* data, DWORD dataLength);
+	std::vector<BYTE> Finish();
+	static bool IsSupported(std::wstring type);
+};
+
+// the pieces of a file with their hashes, and what has been found out about each of them.
+// States are changed by downloaders and the scheduler at the same time, always with InterlockedExchange.
+struct PieceList
+{
+	enum PieceState : LONG { Unchecked, Good, Corrupt, Refetching, Failed };
+	long long PieceLength = 0;
+	// from the Metalink file, -1 if it does not tell
+	long long FileSize = (-1);
+	std::wstring HashType;
+	std::vector<std::vector<BYTE>> Hashes;
+	std::vector<LONG> States;
+	// the piece at this position has been received from its first to its last byte
+	void Check(long long index, std::vector<BYTE> digest);
+	void SetState(long long index, PieceState state);
+	PieceState GetState(long long index);
+	// position after the last byte of the piece, at most the end of the file if its size is known
+	long long GetPieceEnd(long long index);
+	// reads the piece from a file holding it at its offset, a piece the file ends in is corrupt
+	void CheckFile(HANDLE hFile, long long index, LPBYTE buffer, DWORD bufferLength);
+};
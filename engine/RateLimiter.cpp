@@ -0,0 +1,257 @@
+#include "RateLimiter.h"
+#include "Clock.h"
+
+SRWLOCK RateLimiter::limiterLock = SRWLOCK_INIT;
+RateLimiter::Bucket RateLimiter::globalBucket;
+std::map<std::wstring, RateLimiter::Bucket*> RateLimiter::hostBuckets;
+std::deque<RateLimiter::Waiter> RateLimiter::waiters;
+HANDLE RateLimiter::hLimiterThread = NULL;
+HANDLE RateLimiter::hLimiterEvent = NULL;
+long long RateLimiter::throttledReads = 0;
+
+void RateLimiter::Refill(Bucket* bucket, ULONGLONG now)
+{
+	if (bucket->Rate <= 0 || bucket->RefillTime == 0)
+	{
+		bucket->Tokens = 0;
+		bucket->RefillTime = now;
+		return;
+	}
+	if (now <= bucket->RefillTime) return;
+	bucket->Tokens += (double)bucket->Rate * (now - bucket->RefillTime) / 1000;
+	double burst = (double)bucket->Rate * burstTime / 1000;
+	if (bucket->Tokens > burst) bucket->Tokens = burst;
+	bucket->RefillTime = now;
+};
+
+// returns false if the rate has not changed
+bool RateLimiter::SetRate(Bucket* bucket, long long bytesPerSecond)
+{
+	if (bytesPerSecond < 0) bytesPerSecond = 0;
+	if (bucket->Rate == bytesPerSecond) return false;
+	Refill(bucket, Clock::Now());
+	bucket->Rate = bytesPerSecond;
+	// debt of a stricter limit must not hold a transfer back for long after the limit is raised
+	double burst = (double)bucket->Rate * burstTime / 1000;
+	if (bucket->Tokens < -burst) bucket->Tokens = -burst;
+	if (bucket->Rate == 0) bucket->Tokens = 0;
+	return true;
+};
+
+ULONGLONG RateLimiter::GetWaitTime(Bucket* bucket, ULONGLONG now)
+{
+	if (!bucket || bucket->Rate <= 0) return 0;
+	Refill(bucket, now);
+	if (bucket->Tokens >= 0) return 0;
+	// milliseconds until the debt is paid, rounded up
+	return (ULONGLONG)(-bucket->Tokens * 1000 / bucket->Rate) + 1;
+};
+
+ULONGLONG RateLimiter::GetWaitTime(Bucket* hostBucket, Bucket* downloadBucket, ULONGLONG now)
+{
+	ULONGLONG wait = GetWaitTime(&globalBucket, now);
+	ULONGLONG hostWait = GetWaitTime(hostBucket, now);
+	ULONGLONG downloadWait = GetWaitTime(downloadBucket, now);
+	if (hostWait > wait) wait = hostWait;
+	if (downloadWait > wait) wait = downloadWait;
+	return wait;
+};
+
+long long RateLimiter::GetEffectiveRate(Bucket* hostBucket, Bucket* downloadBucket)
+{
+	long long rate = globalBucket.Rate;
+	if (hostBucket && hostBucket->Rate > 0 && (rate <= 0 || hostBucket->Rate < rate)) rate = hostBucket->Rate;
+	if (downloadBucket && downloadBucket->Rate > 0 && (rate <= 0 || downloadBucket->Rate < rate)) rate = downloadBucket->Rate;
+	return rate;
+};
+
+void RateLimiter::SetGlobalLimit(long long bytesPerSecond)
+{
+	SetLimit(&globalBucket, bytesPerSecond);
+};
+
+long long RateLimiter::GetGlobalLimit()
+{
+	AcquireSRWLockShared(&limiterLock);
+	long long rate = globalBucket.Rate;
+	ReleaseSRWLockShared(&limiterLock);
+	return rate;
+};
+
+void RateLimiter::SetHostLimit(std::wstring host, long long bytesPerSecond)
+{
+	SetLimit(GetHostBucket(host), bytesPerSecond);
+};
+
+long long RateLimiter::GetHostLimit(std::wstring host)
+{
+	long long rate = 0;
+	AcquireSRWLockShared(&limiterLock);
+	auto it = hostBuckets.find(host);
+	if (it != hostBuckets.end()) rate = it->second->Rate;
+	ReleaseSRWLockShared(&limiterLock);
+	return rate;
+};
+
+void RateLimiter::SetLimit(Bucket* bucket, long long bytesPerSecond)
+{
+	if (!bucket) return;
+	AcquireSRWLockExclusive(&limiterLock);
+	bool changed = SetRate(bucket, bytesPerSecond);
+	HANDLE hEvent = hLimiterEvent;
+	ReleaseSRWLockExclusive(&limiterLock);
+	// waiters may be able to go on earlier, or have to wait longer
+	if (changed && hEvent) SetEvent(hEvent);
+};
+
+RateLimiter::Bucket* RateLimiter::GetHostBucket(std::wstring host)
+{
+	AcquireSRWLockExclusive(&limiterLock);
+	Bucket*& bucket = hostBuckets[host];
+	if (!bucket) bucket = new Bucket;
+	Bucket* ret = bucket;
+	ReleaseSRWLockExclusive(&limiterLock);
+	return ret;
+};
+
+long long RateLimiter::GetEffectiveLimit(Bucket* hostBucket, Bucket* downloadBucket)
+{
+	AcquireSRWLockShared(&limiterLock);
+	long long rate = GetEffectiveRate(hostBucket, downloadBucket);
+	ReleaseSRWLockShared(&limiterLock);
+	return rate;
+};
+
+DWORD RateLimiter::GetReadSize(Bucket* hostBucket, Bucket* downloadBucket, DWORD bufferSize)
+{
+	long long rate = GetEffectiveLimit(hostBucket, downloadBucket);
+	if (rate <= 0) return bufferSize;
+	long long size = rate * (long long)readTime / 1000;
+	if (size < minReadSize) size = minReadSize;
+	if (size > bufferSize) size = bufferSize;
+	return (DWORD)size;
+};
+
+bool RateLimiter::Acquire(Bucket* hostBucket, Bucket* downloadBucket, PTP_SIMPLE_CALLBACK callback, PVOID context)
+{
+	bool bResults = false;
+	AcquireSRWLockExclusive(&limiterLock);
+	if (GetWaitTime(hostBucket, downloadBucket, Clock::Now()) == 0)
+	{
+		bResults = true;
+	}
+	else if (StartLimiterThread())
+	{
+		// called on the thread pool once the buckets have refilled, the caller then asks again
+		waiters.push_back({ callback, context, hostBucket, downloadBucket });
+		throttledReads++;
+	}
+	else
+	{
+		// without the limiter thread nobody would wake the transfer, let it go unthrottled
+		bResults = true;
+	}
+	HANDLE hEvent = hLimiterEvent;
+	ReleaseSRWLockExclusive(&limiterLock);
+	if (!bResults) SetEvent(hEvent);
+	return bResults;
+};
+
+void RateLimiter::Consume(Bucket* hostBucket, Bucket* downloadBucket, DWORD bytes)
+{
+	if (bytes == 0) return;
+	AcquireSRWLockExclusive(&limiterLock);
+	ULONGLONG now = Clock::Now();
+	Bucket* buckets[] = { &globalBucket, hostBucket, downloadBucket };
+	for (Bucket* bucket : buckets)
+	{
+		if (!bucket || bucket->Rate <= 0) continue;
+		Refill(bucket, now);
+		bucket->Tokens -= bytes;
+	}
+	ReleaseSRWLockExclusive(&limiterLock);
+};
+
+bool RateLimiter::CancelWait(PVOID context)
+{
+	bool bResults = false;
+	AcquireSRWLockExclusive(&limiterLock);
+	for (auto it = waiters.begin(); it != waiters.end(); it++)
+	{
+		if (it->Context == context)
+		{
+			waiters.erase(it);
+			bResults = true;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&limiterLock);
+	// false means the callback has already been submitted and is on its way
+	return bResults;
+};
+
+bool RateLimiter::StartLimiterThread()
+{
+	// called with limiterLock held. The thread runs for the rest of the process, like the pools.
+	if (hLimiterThread) return true;
+	if (!hLimiterEvent) hLimiterEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+	if (!hLimiterEvent) return false;
+	hLimiterThread = CreateThread(NULL, 0, LimiterThreadProc, NULL, 0, NULL);
+	return hLimiterThread != NULL;
+};
+
+DWORD __stdcall RateLimiter::LimiterThreadProc(LPVOID)
+{
+	LimiterThreadStart();
+	return 0;
+};
+
+void RateLimiter::LimiterThreadStart()
+{
+	while (true)
+	{
+		DWORD timeout = INFINITE;
+		std::deque<Waiter> ready;
+		AcquireSRWLockExclusive(&limiterLock);
+		ULONGLONG now = Clock::Now();
+		auto it = waiters.begin();
+		while (it != waiters.end())
+		{
+			ULONGLONG wait = GetWaitTime(it->HostBucket, it->DownloadBucket, now);
+			if (wait == 0)
+			{
+				ready.push_back(*it);
+				it = waiters.erase(it);
+				continue;
+			}
+			if (wait < timeout) timeout = (DWORD)wait;
+			it++;
+		}
+		ReleaseSRWLockExclusive(&limiterLock);
+		for (Waiter& waiter : ready)
+		{
+			TrySubmitThreadpoolCallback(waiter.Callback, waiter.Context, NULL);
+		}
+		Clock::Wait(hLimiterEvent, timeout);
+	}
+};
+
+std::wstring RateLimiter::GetStatisticsDescription()
+{
+	std::wstring statusStr;
+	AcquireSRWLockShared(&limiterLock);
+	if (globalBucket.Rate > 0)
+	{
+		statusStr.append(L"All downloads limited to ");
+		statusStr.append(std::to_wstring(globalBucket.Rate / 1024));
+		statusStr.append(L" KB/s.\r\n");
+	}
+	if (throttledReads > 0)
+	{
+		statusStr.append(L"Reads waited for the rate limit ");
+		statusStr.append(std::to_wstring(throttledReads));
+		statusStr.append(L" times.\r\n");
+	}
+	ReleaseSRWLockShared(&limiterLock);
+	return statusStr;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <windows.h>
+#include <deque>
+#include <map>
+#include <string>
+
+// Token buckets limiting how fast data is received: one shared by all transfers, one per server and one per download.
+// Tokens are bytes refilled at the rate of their bucket. A read may start while none of its buckets is in debt and pays
+// for what it received afterwards, so a read bigger than the tokens left only delays the next one. Throttled transfers
+// are called back by the limiter thread when their buckets have refilled, nothing polls in the meantime.
+class RateLimiter
+{
+public:
+	struct Bucket
+	{
+		// bytes per second, zero for no limit
+		long long Rate = 0;
+		double Tokens = 0;
+		ULONGLONG RefillTime = 0;
+	};
+private:
+	// idle buckets save up at most this many milliseconds of tokens
+	static const ULONGLONG burstTime = 250;
+	// reads of a limited transfer ask for about this many milliseconds of its rate, so data arrives evenly
+	static const ULONGLONG readTime = 125;
+	static const DWORD minReadSize = 4096;
+	struct Waiter
+	{
+		PTP_SIMPLE_CALLBACK Callback;
+		PVOID Context;
+		Bucket* HostBucket;
+		Bucket* DownloadBucket;
+	};
+	static SRWLOCK limiterLock;
+	static Bucket globalBucket;
+	// by host name and port, never removed so transfers can keep pointers to them
+	static std::map<std::wstring, Bucket*> hostBuckets;
+	static std::deque<Waiter> waiters;
+	static HANDLE hLimiterThread;
+	static HANDLE hLimiterEvent;
+	static long long throttledReads;
+	static void Refill(Bucket* bucket, ULONGLONG now);
+	static bool SetRate(Bucket* bucket, long long bytesPerSecond);
+	static ULONGLONG GetWaitTime(Bucket* bucket, ULONGLONG now);
+	static ULONGLONG GetWaitTime(Bucket* hostBucket, Bucket* downloadBucket, ULONGLONG now);
+	static long long GetEffectiveRate(Bucket* hostBucket, Bucket* downloadBucket);
+	static bool StartLimiterThread();
+	static DWORD WINAPI LimiterThreadProc(LPVOID lParam);
+	static void LimiterThreadStart();
+public:
+	// limits can be changed at any time, transfers in progress follow them from their next read
+	static void SetGlobalLimit(long long bytesPerSecond);
+	static long long GetGlobalLimit();
+	static void SetHostLimit(std::wstring host, long long bytesPerSecond);
+	static long long GetHostLimit(std::wstring host);
+	static void SetLimit(Bucket* bucket, long long bytesPerSecond);
+	static Bucket* GetHostBucket(std::wstring host);
+	static long long GetEffectiveLimit(Bucket* hostBucket, Bucket* downloadBucket);
+	static DWORD GetReadSize(Bucket* hostBucket, Bucket* downloadBucket, DWORD bufferSize);
+	static bool Acquire(Bucket* hostBucket, Bucket* downloadBucket, PTP_SIMPLE_CALLBACK callback, PVOID context);
+	static void Consume(Bucket* hostBucket, Bucket* downloadBucket, DWORD bytes);
+	static bool CancelWait(PVOID context);
+	static std::wstring GetStatisticsDescription();
+};
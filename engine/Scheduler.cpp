@@ -0,0 +1,2095 @@
+#include "Scheduler.h"
+#include "Util.h"
+#include "ConnectionPool.h"
+#include "BufferPool.h"
+#include "Clock.h"
+#include <stdexcept>
+#include <ctime>
+#include <shlwapi.h>
+#include <winioctl.h>
+
+Scheduler::Scheduler(Download* d)
+{
+	if (!d || !d->SummarySection || d->Sections.empty())
+	{
+		throw std::runtime_error("Invalid state of parameter d: Scheduler(Download* d)");
+	}
+	if (d->NoDownloader <= 0 || d->NoDownloader > d->MaxNoDownloader)
+	{
+		throw std::out_of_range("Number of download threads is out of range.");
+	}
+	// the ranges of a sparse download are written at their offsets, there is nothing to join
+	if (!d->SummarySection->Ranges.empty() && !d->DirectWrite)
+	{
+		throw std::invalid_argument("A download of byte ranges has to be written directly to its output file.");
+	}
+	// pieces are checked and downloaded again where they are in the output file
+	if (!d->Pieces.Hashes.empty() && (!d->DirectWrite || d->FilePerRange || d->Sections[0]->FileOrigin != 0))
+	{
+		throw std::invalid_argument("Pieces can only be checked in a download written directly to its output file from its start.");
+	}
+	// the blocks of a seed file are copied to where they are in the output file
+	if (!d->SeedBlocks.empty() && (!d->DirectWrite || d->FilePerRange))
+	{
+		throw std::invalid_argument("Blocks of a seed file can only be copied into a download written directly to its output file.");
+	}
+	// the members of a ZIP archive are copied out of the sparse output file
+	if (!d->ZipMembers.empty() && (!d->DirectWrite || d->FilePerRange))
+	{
+		throw std::invalid_argument("Members of a ZIP archive can only be downloaded written directly to their output file.");
+	}
+	// the stream is copied in order out of the output file, which then only holds what has not gone to it yet
+	if (d->StreamWindow > 0 && (!d->DirectWrite || !d->SummarySection->Ranges.empty() || !d->RepairFileName.empty() ||
+		!d->Pieces.Hashes.empty() || !d->SeedBlocks.empty() || !d->ZipMembers.empty() || d->StreamHandle == INVALID_HANDLE_VALUE))
+	{
+		throw std::invalid_argument("Only a download written directly to its output file, without ranges, can be streamed.");
+	}
+	download = d;
+	noDownloader = download->NoDownloader;
+	Mirror primary;
+	primary.Url = download->SummarySection->Url;
+	mirrors.push_back(primary);
+	for (std::wstring url : download->Mirrors)
+	{
+		bool listed = url.empty();
+		for (Mirror& mirror : mirrors)
+		{
+			if (mirror.Url == url) listed = true;
+		}
+		if (listed) continue;
+		Mirror mirror;
+		mirror.Url = url;
+		mirrors.push_back(mirror);
+	}
+	if (download->SummarySection->DownloadStatus == DownloadStatus::Downloading)
+	{
+		download->SummarySection->DownloadStatus = DownloadStatus::Stopped;
+	}
+	hostBucket = RateLimiter::GetHostBucket(Util::UrlGetHostName(download->SummarySection->Url));
+	RateLimiter::SetLimit(&rateBucket, download->MaxBytesPerSecond);
+	InitializeCriticalSection(&sectionsLock);
+	hSchedulerEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+	hStreamEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+};
+
+Scheduler::~Scheduler()
+{
+	for (Downloader* dl : downloaders)
+	{
+		if (dl) delete dl;
+	}
+	if (sectionBeingEvaluated) delete sectionBeingEvaluated;
+	for (DownloadSection* ds : endGameSections) delete ds;
+	for (DownloadSection* ds : retiredEndGameSections) delete ds;
+	for (DownloadSection* ds : pieceSections) delete ds;
+	if (download) delete download;
+	DeleteCriticalSection(&sectionsLock);
+	if (hSchedulerEvent) CloseHandle(hSchedulerEvent);
+	if (hStreamEvent) CloseHandle(hStreamEvent);
+};
+
+int Scheduler::FindFreeDownloader()
+{
+	// downloaders above a lowered limit are not stopped, they just are not reused until enough have finished
+	if (CountBusyDownloaders() >= GetConnectionLimit()) return (-1);
+	for (int i = 0; i < (int)downloaders.size(); i++)
+	{
+		if (!downloaders[i] || !downloaders[i]->IsBusy()) return i;
+	}
+	downloaders.push_back(NULL);
+	return (int)downloaders.size() - 1;
+};
+
+int Scheduler::CountBusyDownloaders()
+{
+	int busyDownloaders = 0;
+	for (Downloader* dl : downloaders)
+	{
+		if (dl && dl->IsBusy()) busyDownloaders++;
+	}
+	return busyDownloaders;
+};
+
+int Scheduler::GetConnectionLimit()
+{
+	int limit = connectionLimit;
+	return (limit > 0 && limit < noDownloader) ? limit : noDownloader;
+};
+
+void Scheduler::StopDownloading()
+{
+	for (Downloader* dl : downloaders)
+	{
+		if (dl)
+		{
+			dl->StopDownloading();
+		}
+	}
+	for (Downloader* dl : downloaders)
+	{
+		if (dl)
+		{
+			dl->WaitForFinish();
+		}
+	}
+};
+
+int Scheduler::FindDownloaderBySection(DownloadSection* ds)
+{
+	for (int i = 0; i < (int)downloaders.size(); i++)
+	{
+		if (downloaders[i] && downloaders[i]->Section == ds) return i;
+	}
+	return (-1);
+};
+
+void Scheduler::DownloadSectionWithFreeDownloaderIfPossible(DownloadSection* ds)
+{
+	int freeDownloaderIndex = FindFreeDownloader();
+	if (freeDownloaderIndex >= 0)
+	{
+		AssignMirror(ds);
+		if (!downloaders[freeDownloaderIndex])
+		{
+			downloaders[freeDownloaderIndex] = new Downloader(ds, hSchedulerEvent);
+			downloaders[freeDownloaderIndex]->RateBucket = &rateBucket;
+			downloaders[freeDownloaderIndex]->Repair = !download->RepairFileName.empty();
+			downloaders[freeDownloaderIndex]->HashData = IsHashing();
+			if (!download->Pieces.Hashes.empty()) downloaders[freeDownloaderIndex]->Pieces = &download->Pieces;
+			if (download->StreamWindow > 0) downloaders[freeDownloaderIndex]->StreamLimit = &streamLimit;
+		}
+		else
+		{
+			downloaders[freeDownloaderIndex]->ChangeDownloadSection(ds);
+		}
+		downloaders[freeDownloaderIndex]->StartDownloading();
+	}
+};
+
+void Scheduler::AutoDownloadSection(DownloadSection* ds)
+{
+	int downloaderIndex = FindDownloaderBySection(ds);
+	if (downloaderIndex >= 0)
+	{
+		AssignMirror(ds);
+		downloaders[downloaderIndex]->StartDownloading();
+	}
+	else
+	{
+		DownloadSectionWithFreeDownloaderIfPossible(ds);
+	}
+};
+
+void Scheduler::UpdateMirrors()
+{
+	if (mirrors.size() < 2) return;
+	std::vector<DownloadSection*> sections = download->Sections;
+	sections.insert(sections.end(), endGameSections.begin(), endGameSections.end());
+	sections.insert(sections.end(), pieceSections.begin(), pieceSections.end());
+	if (sectionBeingEvaluated) sections.push_back(sectionBeingEvaluated);
+
+	// the first section receiving data tells what the content is
+	for (DownloadSection* ds : sections)
+	{
+		if (contentKnown) break;
+		if (ds->DownloadStatus != DownloadStatus::Downloading) continue;
+		contentKnown = true;
+		rangesSupported = ds->HttpStatusCode == L"206";
+		contentLength = ds->EntityLength;
+		contentLastModified = ds->LastModified;
+		contentETag = ds->ETag;
+	}
+
+	std::set<DownloadSection*> stillFailed;
+	std::vector<int> measuredSections(mirrors.size(), 0);
+	for (Mirror& mirror : mirrors)
+	{
+		mirror.Throughput = 0;
+		mirror.Sections = 0;
+	}
+	for (DownloadSection* ds : sections)
+	{
+		if (ds->MirrorIndex < 0) continue;
+		Mirror& mirror = mirrors[ds->MirrorIndex];
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::DownloadError)
+		{
+			// each failure counts once against the mirror
+			stillFailed.insert(ds);
+			if (failedSections.count(ds)) continue;
+			mirror.Failures++;
+			mirror.ErrorScore += 1;
+			// a successful status with a failed section means other content, or no support for ranges
+			if (!mirror.Validated && (ds->HttpStatusCode == L"200" || ds->HttpStatusCode == L"206")) mirror.Rejected = true;
+			// a mirror which refuses the request does not have the file
+			if (IsRefusedStatus(ds->HttpStatusCode)) mirror.Rejected = true;
+			continue;
+		}
+		if (status != DownloadStatus::PrepareToDownload && status != DownloadStatus::Downloading) continue;
+		mirror.Sections++;
+		if (status != DownloadStatus::Downloading) continue;
+		// the response has been checked against the content, so the mirror serves the same file
+		mirror.Validated = true;
+		if (ds->Throughput > 0)
+		{
+			mirror.Throughput += ds->Throughput;
+			measuredSections[ds->MirrorIndex]++;
+		}
+	}
+	failedSections.swap(stillFailed);
+	for (size_t i = 0; i < mirrors.size(); i++)
+	{
+		if (measuredSections[i] > 0) mirrors[i].PerConnection = mirrors[i].Throughput / measuredSections[i];
+	}
+	ULONGLONG now = Clock::Now();
+	if (now - mirrorDecayTime >= mirrorErrorHalfLife)
+	{
+		for (Mirror& mirror : mirrors) mirror.ErrorScore /= 2;
+		mirrorDecayTime = now;
+	}
+	MoveWorkOffSlowMirror();
+};
+
+void Scheduler::MoveWorkOffSlowMirror()
+{
+	ULONGLONG now = Clock::Now();
+	if (!rangesSupported || now - mirrorMoveTime < mirrorMoveInterval) return;
+	int bestMirror = (-1);
+	for (int i = 0; i < (int)mirrors.size(); i++)
+	{
+		if (mirrors[i].Throughput <= 0) continue;
+		if (bestMirror < 0 || mirrors[i].PerConnection > mirrors[bestMirror].PerConnection) bestMirror = i;
+	}
+	if (bestMirror < 0) return;
+	// the slowest section of a mirror far behind the best one, if it has enough left to be worth moving
+	DownloadSection* slowest = NULL;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus != DownloadStatus::Downloading || ds->MirrorIndex < 0 || ds->MirrorIndex == bestMirror || ds->Throughput <= 0) continue;
+		if (mirrors[ds->MirrorIndex].PerConnection >= mirrors[bestMirror].PerConnection * mirrorSlowShare) continue;
+		if (ds->GetTotal() - ds->BytesDownloaded <= download->MinSectionSize) continue;
+		if (!slowest || ds->Throughput < slowest->Throughput) slowest = ds;
+	}
+	if (!slowest) return;
+	int downloaderIndex = FindDownloaderBySection(slowest);
+	if (downloaderIndex < 0) return;
+	// the section resumes where it stopped, on the mirror AssignMirror picks for it
+	mirrors[slowest->MirrorIndex].ErrorScore += 1;
+	slowest->MirrorIndex = (-1);
+	downloaders[downloaderIndex]->StopDownloading();
+	mirrorMoveTime = now;
+	mirrorMoves++;
+};
+
+double Scheduler::GetMirrorScore(int index, double averagePerConnection)
+{
+	Mirror& mirror = mirrors[index];
+	if (mirror.Rejected) return (-1);
+	// one section at a time finds out whether an unproven mirror has the same content
+	if (!mirror.Validated && mirror.Sections > 0) return (-1);
+	double expected = 0;
+	if (mirror.PerConnection > 0)
+	{
+		// a mirror's bandwidth is assumed to be shared by its connections, so mirrors get connections in proportion to their speed
+		int sections = mirror.Sections > 0 ? mirror.Sections : 1;
+		expected = mirror.PerConnection * sections / (mirror.Sections + 1);
+	}
+	else if (mirror.Sections == 0)
+	{
+		// mirrors not tried yet go first
+		expected = averagePerConnection > 0 ? averagePerConnection * 2 : 1;
+	}
+	else expected = averagePerConnection;
+	return expected / (1 + mirror.ErrorScore);
+};
+
+// points a section about to be started at a mirror, keeping the one it has unless that failed
+void Scheduler::AssignMirror(DownloadSection* ds)
+{
+	if (mirrors.size() < 2) return;
+	bool spread = contentKnown && rangesSupported;
+	bool failed = ds->DownloadStatus == DownloadStatus::DownloadError;
+	if (ds->MirrorIndex < 0 && !spread)
+	{
+		// until a response tells what the content is, sections go where their URL points
+		for (int i = 0; i < (int)mirrors.size(); i++)
+		{
+			if (mirrors[i].Url == ds->Url) ds->MirrorIndex = i;
+		}
+	}
+	int current = ds->MirrorIndex;
+	if (current >= 0 && !failed && !mirrors[current].Rejected) return;
+
+	int chosen = (-1);
+	if (spread)
+	{
+		double totalThroughput = 0;
+		int totalSections = 0;
+		for (Mirror& mirror : mirrors)
+		{
+			if (mirror.Throughput <= 0) continue;
+			totalThroughput += mirror.Throughput;
+			totalSections += mirror.Sections;
+		}
+		double averagePerConnection = totalSections > 0 ? totalThroughput / totalSections : 0;
+		double bestScore = (-1);
+		for (int i = 0; i < (int)mirrors.size(); i++)
+		{
+			double score = GetMirrorScore(i, averagePerConnection);
+			if (score > bestScore)
+			{
+				bestScore = score;
+				chosen = i;
+			}
+		}
+	}
+	else if (current >= 0)
+	{
+		// the next mirror which has not been ruled out
+		for (int i = 1; i <= (int)mirrors.size() && chosen < 0; i++)
+		{
+			int next = (current + i) % mirrors.size();
+			if (!mirrors[next].Rejected) chosen = next;
+		}
+	}
+	if (chosen < 0 || chosen == current) return;
+
+	ds->MirrorIndex = chosen;
+	ds->Url = mirrors[chosen].Url;
+	// counted until UpdateMirrors counts again, so sections started in the same round spread out
+	mirrors[chosen].Sections++;
+	if (contentKnown)
+	{
+		// whichever mirror it comes from, the response has to be the content this run started with
+		ds->LastModified = contentLastModified.empty() ? L"NOTSET" : contentLastModified;
+		ds->ETag = contentETag;
+		ds->EntityLength = contentLength;
+	}
+	// another mirror is tried right away instead of after the retry delay of a failed section
+	if (failed) ds->DownloadStatus = DownloadStatus::Stopped;
+};
+
+bool Scheduler::ErrorAndUnstableSectionsExist()
+{
+	for (DownloadSection* ds : download->Sections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::DownloadError ||
+			status == DownloadStatus::LogicalError ||
+			status == DownloadStatus::PrepareToDownload)
+		{
+			return true;
+		}
+	}
+	if (sectionBeingEvaluated) return true;
+	return false;
+};
+
+// client errors fail the same way every time, except a timeout, an unsatisfiable range and too many requests
+bool Scheduler::IsRefusedStatus(std::wstring statusCode)
+{
+	if (statusCode.length() != 3 || statusCode[0] != L'4') return false;
+	return statusCode != L"408" && statusCode != L"416" && statusCode != L"429";
+};
+
+void Scheduler::GiveUpOnRefusedSections()
+{
+	// another mirror may still have the file
+	if (mirrors.size() >= 2)
+	{
+		for (Mirror& mirror : mirrors)
+		{
+			if (!mirror.Rejected) return;
+		}
+	}
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::DownloadError && IsRefusedStatus(ds->HttpStatusCode)) ds->DownloadStatus = DownloadStatus::LogicalError;
+	}
+};
+
+void Scheduler::EvaluateStatusOfJustCreatedSectionIfExists()
+{
+	if (!sectionBeingEvaluated) return;
+
+	DownloadStatus ds = sectionBeingEvaluated->DownloadStatus;
+	if (ds == DownloadStatus::DownloadError || ds == DownloadStatus::LogicalError)
+	{
+		// fail to create new section. Throw this section away.
+		delete sectionBeingEvaluated;
+		sectionBeingEvaluated = NULL;
+		tailTimeSavedBySectionBeingEvaluated = 0;
+		return;
+	}
+	// section creation successful
+	if (ds == DownloadStatus::Downloading || ds == DownloadStatus::Finished)
+	{
+		// add the new section to section chain
+		DownloadSection* parent = (DownloadSection*)sectionBeingEvaluated->Tag;
+		sectionBeingEvaluated->NextSection = parent->NextSection;
+		sectionBeingEvaluated->Tag = NULL;
+
+		EnterCriticalSection(&sectionsLock);
+		// Downloader class has been designed in a way which won't cause havoc if Scheduler class does this
+		parent->NextSection = sectionBeingEvaluated;
+		parent->End = sectionBeingEvaluated->Start - 1;
+		download->Sections.push_back(sectionBeingEvaluated);
+		LeaveCriticalSection(&sectionsLock);
+		tailTimeSaved += tailTimeSavedBySectionBeingEvaluated;
+
+		sectionBeingEvaluated = NULL;
+		tailTimeSavedBySectionBeingEvaluated = 0;
+	}
+};
+
+void Scheduler::UpdateSectionThroughput()
+{
+	ULONGLONG now = Clock::Now();
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus != DownloadStatus::Downloading)
+		{
+			ds->ThroughputSampleTime = 0;
+			continue;
+		}
+		long long bytesDownloaded = ds->BytesDownloaded;
+		if (ds->ThroughputSampleTime == 0)
+		{
+			ds->ThroughputSampleTime = now;
+			ds->ThroughputSampleBytes = bytesDownloaded;
+			continue;
+		}
+		ULONGLONG elapsed = now - ds->ThroughputSampleTime;
+		if (elapsed < throughputSampleInterval) continue;
+		double throughput = (bytesDownloaded - ds->ThroughputSampleBytes) * 1000.0 / elapsed;
+		if (ds->Throughput > 0)
+		{
+			ds->Throughput = throughputSmoothing * throughput + (1 - throughputSmoothing) * ds->Throughput;
+		}
+		else
+		{
+			ds->Throughput = throughput;
+		}
+		ds->ThroughputSampleTime = now;
+		ds->ThroughputSampleBytes = bytesDownloaded;
+	}
+};
+
+double Scheduler::GetAverageThroughput()
+{
+	double totalThroughput = 0;
+	int measuredSections = 0;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Downloading && ds->Throughput > 0)
+		{
+			totalThroughput += ds->Throughput;
+			measuredSections++;
+		}
+	}
+	if (measuredSections == 0) return 0;
+	return totalThroughput / measuredSections;
+};
+
+double Scheduler::GetSectionThroughput(DownloadSection* ds, double averageThroughput)
+{
+	if (ds->DownloadStatus == DownloadStatus::Downloading && ds->Throughput > 0) return ds->Throughput;
+	return averageThroughput;
+};
+
+double Scheduler::GetParentShareOfSplit(DownloadSection* ds, double averageThroughput)
+{
+	// the new connection is expected to run at average speed. The parent keeps the part
+	// it can finish in the same time as the new section finishes the rest.
+	double throughput = GetSectionThroughput(ds, averageThroughput);
+	return throughput / (throughput + averageThroughput);
+};
+
+double Scheduler::EstimateCompletionTime(int splitSectionIndex, double parentShare, double averageThroughput)
+{
+	double completionTime = 0;
+	for (int i = 0; i < (int)download->Sections.size(); i++)
+	{
+		DownloadSection* ds = download->Sections[i];
+		if (ds->DownloadStatus == DownloadStatus::Finished) continue;
+		double bytesLeft = (double)(ds->GetTotal() - ds->BytesDownloaded);
+		double throughput = GetSectionThroughput(ds, averageThroughput);
+		if (bytesLeft <= 0 || throughput <= 0) continue;
+		double timeLeft = bytesLeft / throughput;
+		if (i == splitSectionIndex)
+		{
+			timeLeft = bytesLeft * parentShare / throughput;
+			double newSectionTimeLeft = bytesLeft * (1 - parentShare) / averageThroughput;
+			if (newSectionTimeLeft > timeLeft) timeLeft = newSectionTimeLeft;
+		}
+		if (timeLeft > completionTime) completionTime = timeLeft;
+	}
+	return completionTime;
+};
+
+void Scheduler::PreSplitIfPossible()
+{
+	if (preSplitDone || sectionBeingEvaluated || download->Sections.size() != 1) return;
+	DownloadSection* ds = download->Sections[0];
+	// the first response tells both the file size and whether the server supports ranges
+	if (ds->DownloadStatus != DownloadStatus::Downloading || ds->HttpStatusCode != L"206" || ds->End < 0) return;
+	preSplitDone = true;
+
+	long long position = ds->GetOffset(ds->BytesDownloaded);
+	long long bytesLeft = ds->GetTotal() - ds->BytesDownloaded;
+	// a streamed download is only cut up within its window, the last section reaches to the end of the file
+	if (download->StreamWindow > 0 && streamLimit - position < bytesLeft) bytesLeft = streamLimit - position;
+	long long noSections = noDownloader;
+	if (bytesLeft / noSections < download->MinSectionSize) noSections = bytesLeft / download->MinSectionSize;
+	if (noSections <= 1) return;
+	long long sectionSize = bytesLeft / noSections;
+
+	// cut the rest of the file into equal sections starting at aligned positions, from the end backwards,
+	// and start them all at once instead of waiting for one split after another to be confirmed
+	EnterCriticalSection(&sectionsLock);
+	for (long long i = noSections - 1; i > 0; i--)
+	{
+		// a sparse section is cut by wanted bytes, aligned positions may fall between its ranges.
+		// Sections starting at pieces have every piece checked as it arrives.
+		long long alignment = download->Pieces.PieceLength > 0 ? download->Pieces.PieceLength : sectionAlignment;
+		long long sectionStart = ds->Ranges.empty() ? (position + i * sectionSize) / alignment * alignment : ds->GetOffset(ds->BytesDownloaded + i * sectionSize);
+		if (sectionStart <= position || sectionStart > ds->End) continue;
+		DownloadSection* newSection = ds->SplitAt(sectionStart);
+		if (!newSection) continue;
+		newSection->Tag = NULL;
+		newSection->NextSection = ds->NextSection;
+		ds->NextSection = newSection;
+		ds->End = newSection->Start - 1;
+		download->Sections.push_back(newSection);
+	}
+	LeaveCriticalSection(&sectionsLock);
+};
+
+void Scheduler::CreateNewSectionIfFeasible()
+{
+	if (ErrorAndUnstableSectionsExist() || FindFreeDownloader() == (-1) || IsAtRateLimit()) return;
+	if (download->StreamWindow > 0)
+	{
+		CreateNewSectionInStreamWindow();
+		return;
+	}
+	double averageThroughput = GetAverageThroughput();
+	int biggestBeingDownloadedSection = (-1);
+	long long biggestDownloadingSectionSize = 0;
+	int slowestBeingDownloadedSection = (-1);
+	double longestTimeLeft = 0;
+	// find current biggest downloading section, and the one finishing last among those worth splitting
+	for (int i = 0; i < (int)download->Sections.size(); i++)
+	{
+		DownloadSection* ds = download->Sections[i];
+		if (ds->DownloadStatus == DownloadStatus::Downloading && ds->HttpStatusCode == L"206")
+		{
+			long long bytesDownloaded = ds->BytesDownloaded;
+			if (bytesDownloaded <= 0) continue;
+			long long bytesLeft = ds->GetTotal() - bytesDownloaded;
+			if (bytesLeft > biggestDownloadingSectionSize)
+			{
+				biggestDownloadingSectionSize = bytesLeft;
+				biggestBeingDownloadedSection = i;
+			}
+			if (averageThroughput <= 0) continue;
+			if (bytesLeft * (1 - GetParentShareOfSplit(ds, averageThroughput)) <= download->MinSectionSize) continue;
+			double timeLeft = bytesLeft / GetSectionThroughput(ds, averageThroughput);
+			if (timeLeft > longestTimeLeft)
+			{
+				longestTimeLeft = timeLeft;
+				slowestBeingDownloadedSection = i;
+			}
+		}
+	}
+	if (biggestBeingDownloadedSection < 0) return;
+	// without throughput measurements yet, split the biggest section to two(creating a new download section)
+	// if section size is big enough, and start downloading the new section without adjusting the size of the old section.
+	if (averageThroughput <= 0)
+	{
+		if (biggestDownloadingSectionSize / 2 > download->MinSectionSize)
+		{
+			sectionBeingEvaluated = download->Sections[biggestBeingDownloadedSection]->Split();
+		}
+		return;
+	}
+	if (slowestBeingDownloadedSection < 0) return;
+
+	DownloadSection* ds = download->Sections[slowestBeingDownloadedSection];
+	double parentShare = GetParentShareOfSplit(ds, averageThroughput);
+	double completionTime = EstimateCompletionTime(slowestBeingDownloadedSection, parentShare, averageThroughput);
+	double completionTimeOfHalving = EstimateCompletionTime(
+		biggestDownloadingSectionSize / 2 > download->MinSectionSize ? biggestBeingDownloadedSection : (-1), 0.5, averageThroughput);
+	sectionBeingEvaluated = ds->Split(parentShare);
+	tailTimeSavedBySectionBeingEvaluated = completionTimeOfHalving > completionTime ? completionTimeOfHalving - completionTime : 0;
+};
+
+void Scheduler::CreateNewSectionInStreamWindow()
+{
+	// what lies beyond the window cannot be received yet, so the section with the most bytes left inside it is halved.
+	// Connections gather at the start of the window, which the stream is waiting for.
+	long long limit = streamLimit;
+	int biggestSection = (-1);
+	long long biggestBytesInWindow = 0;
+	for (int i = 0; i < (int)download->Sections.size(); i++)
+	{
+		DownloadSection* ds = download->Sections[i];
+		if (ds->DownloadStatus != DownloadStatus::Downloading || ds->HttpStatusCode != L"206" || ds->BytesDownloaded <= 0) continue;
+		long long last = ds->End < limit - 1 ? ds->End : limit - 1;
+		long long bytesInWindow = last - (ds->Start + ds->BytesDownloaded) + 1;
+		if (bytesInWindow > biggestBytesInWindow)
+		{
+			biggestBytesInWindow = bytesInWindow;
+			biggestSection = i;
+		}
+	}
+	if (biggestSection < 0 || biggestBytesInWindow / 2 <= download->MinSectionSize) return;
+	DownloadSection* ds = download->Sections[biggestSection];
+	long long position = ds->Start + ds->BytesDownloaded;
+	long long splitPosition = (position + biggestBytesInWindow / 2) / sectionAlignment * sectionAlignment;
+	if (splitPosition <= position) splitPosition = position + biggestBytesInWindow / 2;
+	sectionBeingEvaluated = ds->SplitAt(splitPosition);
+};
+
+void Scheduler::StartEndGameIfFeasible()
+{
+	// racing duplicates only works when all copies write to the same place of one output file
+	if (!download->DirectWrite || ErrorAndUnstableSectionsExist() || IsAtRateLimit()) return;
+	int unfinishedSections = 0;
+	for (DownloadSection* ds : download->Sections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::Finished) continue;
+		// a section waiting to be restarted will get a downloader of its own first
+		if (status != DownloadStatus::Downloading) return;
+		unfinishedSections++;
+	}
+	if (unfinishedSections == 0 || unfinishedSections > endGameMaxSections) return;
+
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (FindFreeDownloader() == (-1)) return;
+		if (ds->DownloadStatus != DownloadStatus::Downloading || ds->HttpStatusCode != L"206") continue;
+		// a duplicate winning the race for a section with nothing downloaded would leave it empty
+		if (ds->BytesDownloaded <= 0) continue;
+		// sections which can still be split are left to CreateNewSectionIfFeasible
+		if ((ds->GetTotal() - ds->BytesDownloaded) / 2 > download->MinSectionSize) continue;
+		bool raced = false;
+		for (DownloadSection* duplicate : endGameSections)
+		{
+			if (duplicate->Tag == ds) raced = true;
+		}
+		if (raced) continue;
+		// a split keeping nothing for the parent is a copy of everything the section still has to download
+		DownloadSection* duplicate = ds->Split(0);
+		if (!duplicate) continue;
+		endGameSections.push_back(duplicate);
+		endGameRaces++;
+		DownloadSectionWithFreeDownloaderIfPossible(duplicate);
+	}
+};
+
+void Scheduler::ResolveEndGameRaces()
+{
+	size_t i = 0;
+	while (i < endGameSections.size())
+	{
+		DownloadSection* duplicate = endGameSections[i];
+		DownloadSection* original = (DownloadSection*)duplicate->Tag;
+		DownloadStatus status = duplicate->DownloadStatus;
+		if (original->DownloadStatus == DownloadStatus::Finished)
+		{
+			// original section won, cancel the duplicate
+			int downloaderIndex = FindDownloaderBySection(duplicate);
+			if (downloaderIndex >= 0) downloaders[downloaderIndex]->StopDownloading();
+		}
+		else if (status == DownloadStatus::Finished)
+		{
+			// duplicate won. Cancel the original section and let it end where the duplicate started,
+			// the same way a new section is added to the chain after a split.
+			double throughput = original->Throughput;
+			long long bytesLeft = original->GetTotal() - original->BytesDownloaded;
+			int downloaderIndex = FindDownloaderBySection(original);
+			if (downloaderIndex >= 0)
+			{
+				// a write still on its way would count its bytes after the section has been cut
+				downloaders[downloaderIndex]->StopDownloading();
+				downloaders[downloaderIndex]->WaitForFinish();
+			}
+			duplicate->NextSection = original->NextSection;
+			duplicate->Tag = NULL;
+
+			EnterCriticalSection(&sectionsLock);
+			original->NextSection = duplicate;
+			original->End = duplicate->Start - 1;
+			if (original->BytesDownloaded > original->GetTotal()) original->BytesDownloaded = original->GetTotal();
+			download->Sections.push_back(duplicate);
+			LeaveCriticalSection(&sectionsLock);
+
+			endGameWins++;
+			if (throughput > 0 && bytesLeft > 0) endGameTimeSaved += bytesLeft / throughput;
+			endGameSections.erase(endGameSections.begin() + i);
+			continue;
+		}
+		else if (status == DownloadStatus::PrepareToDownload || status == DownloadStatus::Downloading)
+		{
+			// still racing
+			i++;
+			continue;
+		}
+		// the race is over, or the duplicate failed and the original section carries on alone
+		retiredEndGameSections.push_back(duplicate);
+		endGameSections.erase(endGameSections.begin() + i);
+	}
+};
+
+void Scheduler::TryDownloadingAllUnfinishedSections()
+{
+	if (sectionBeingEvaluated && sectionBeingEvaluated->DownloadStatus == DownloadStatus::Stopped)
+	{
+		AutoDownloadSection(sectionBeingEvaluated);
+	}
+	for (DownloadSection* ds : download->Sections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::Stopped || status == DownloadStatus::DownloadError)
+		{
+			AutoDownloadSection(ds);
+		}
+	}
+	for (DownloadSection* ds : pieceSections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::Stopped || status == DownloadStatus::DownloadError)
+		{
+			AutoDownloadSection(ds);
+		}
+	}
+};
+
+void Scheduler::RefetchCorruptPieces()
+{
+	if (download->Pieces.Hashes.empty()) return;
+	// the file size is known once the last section in the chain has got its end position from server
+	DownloadSection* last = download->Sections[0];
+	while (last->NextSection) last = last->NextSection;
+	for (long long i = 0; i < (long long)download->Pieces.Hashes.size(); i++)
+	{
+		if (download->Pieces.GetState(i) != PieceList::Corrupt) continue;
+		if (pieceDownloads[(size_t)i] >= maxPieceDownloads)
+		{
+			download->Pieces.SetState(i, PieceList::Failed);
+			continue;
+		}
+		// only the piece is downloaded again, into its place in the output file
+		DownloadSection* ds = download->Sections[0]->Copy();
+		ds->Start = i * download->Pieces.PieceLength;
+		ds->End = download->Pieces.GetPieceEnd(i) - 1;
+		if (last->End >= 0 && ds->End > last->End) ds->End = last->End;
+		ds->Ranges.clear();
+		ds->LastModified = download->Sections[0]->LastModified;
+		ds->ETag = download->Sections[0]->ETag;
+		ds->EntityLength = download->Sections[0]->EntityLength;
+		download->Pieces.SetState(i, PieceList::Refetching);
+		pieceDownloads[(size_t)i]++;
+		piecesRefetched++;
+		EnterCriticalSection(&sectionsLock);
+		pieceSections.push_back(ds);
+		LeaveCriticalSection(&sectionsLock);
+		DownloadSectionWithFreeDownloaderIfPossible(ds);
+	}
+};
+
+// pieces lying partly outside the bytes being downloaded cannot be checked
+bool Scheduler::IsPieceWanted(long long index)
+{
+	DownloadSection* summary = download->SummarySection;
+	long long start = index * download->Pieces.PieceLength;
+	long long end = download->Pieces.GetPieceEnd(index) - 1;
+	if (summary->Ranges.empty()) return start >= summary->Start && (summary->End < 0 || end <= summary->End);
+	for (ByteRange& range : summary->Ranges)
+	{
+		if (start >= range.Start && end <= range.End) return true;
+	}
+	return false;
+};
+
+bool Scheduler::CheckUncheckedPieces()
+{
+	if (download->Pieces.Hashes.empty()) return false;
+	// pieces not received from their first byte by one section, or received before a restart, are read from the file
+	for (Downloader* dl : downloaders)
+	{
+		if (dl) dl->WaitForFinish();
+	}
+	DownloadSection* last = download->Sections[0];
+	while (last->NextSection) last = last->NextSection;
+	long long fileSize = last->End + 1;
+	if (download->SummarySection->Ranges.empty() && download->Pieces.FileSize >= 0 && download->Pieces.FileSize != fileSize)
+	{
+		SetDownloadError(L"The file is " + std::to_wstring(fileSize) + L" bytes long on the server, its pieces are of a file of " +
+			std::to_wstring(download->Pieces.FileSize) + L" bytes.", DownloadStatus::LogicalError);
+		return false;
+	}
+	// the last piece ends with the file
+	if (download->SummarySection->Ranges.empty()) download->Pieces.FileSize = fileSize;
+	HANDLE hFile = CreateFileW(download->Sections[0]->FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return false;
+	LPBYTE buffer = new BYTE[fileReadSize];
+	bool corruptFound = false;
+	for (long long i = 0; i < (long long)download->Pieces.Hashes.size(); i++)
+	{
+		PieceList::PieceState state = download->Pieces.GetState(i);
+		if ((state != PieceList::Unchecked && state != PieceList::Refetching) || !IsPieceWanted(i)) continue;
+		download->Pieces.CheckFile(hFile, i, buffer, fileReadSize);
+	}
+	// including pieces found corrupt by the last downloaders since the scheduler last looked
+	for (long long i = 0; i < (long long)download->Pieces.Hashes.size(); i++)
+	{
+		if (download->Pieces.GetState(i) == PieceList::Corrupt) corruptFound = true;
+	}
+	delete[] buffer;
+	CloseHandle(hFile);
+	return corruptFound;
+};
+
+void Scheduler::PreallocateOutputFileIfPossible()
+{
+	// a file being repaired is already there, its size is set when finished
+	if (!download->DirectWrite || outputFilePreallocated || !download->RepairFileName.empty()) return;
+	DownloadSection* ds = download->Sections[0];
+	if (!download->SummarySection->Ranges.empty() || download->StreamWindow > 0)
+	{
+		// the gaps between the ranges of a sparse download should take no disk space, so nothing is reserved.
+		// A streamed download punches holes where the file has been streamed.
+		HANDLE hFile = CreateFileW(ds->FileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (INVALID_HANDLE_VALUE == hFile) return;
+		DWORD bytesReturned = 0;
+		// not fatal either, the holes are then filled with zeros
+		DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytesReturned, NULL);
+		CloseHandle(hFile);
+		outputFilePreallocated = true;
+		return;
+	}
+	// file size is known once the last section in the chain has got its end position from server
+	while (ds->NextSection) ds = ds->NextSection;
+	long long currentEnd = ds->End;
+	if (currentEnd < 0) return;
+
+	HANDLE hFile = CreateFileW(ds->FileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile) return;
+	FILE_ALLOCATION_INFO allocationInfo;
+	allocationInfo.AllocationSize.QuadPart = currentEnd - ds->FileOrigin + 1;
+	// failing to reserve space is not fatal, the file will just grow as sections write into it
+	SetFileInformationByHandle(hFile, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+	CloseHandle(hFile);
+	outputFilePreallocated = true;
+};
+
+void Scheduler::MeasureRampUpTime()
+{
+	if (rampUpTime) return;
+	int downloadingSections = 0;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Downloading) downloadingSections++;
+	}
+	if (downloadingSections >= GetConnectionLimit()) rampUpTime = Clock::Now() - startTime;
+};
+
+void Scheduler::TuneNoDownloaderIfAuto()
+{
+	if (!download->AutoNoDownloader) return;
+	ULONGLONG now = Clock::Now();
+	long long bytesDownloaded = 0;
+	for (DownloadSection* ds : download->Sections) bytesDownloaded += ds->BytesDownloaded;
+	if (autoTuneTime == 0 || bytesDownloaded < autoTuneBytes)
+	{
+		autoTuneTime = now;
+		autoTuneStatusTime = Clock::Time();
+		autoTuneBytes = bytesDownloaded;
+		return;
+	}
+	if (now - autoTuneTime < autoTuneInterval) return;
+
+	// aggregate throughput of the round that just ended
+	double throughput = (bytesDownloaded - autoTuneBytes) * 1000.0 / (now - autoTuneTime);
+	bool serverErrors = false;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::DownloadError && ds->LastStatusChange >= autoTuneStatusTime) serverErrors = true;
+	}
+	autoTuneTime = now;
+	autoTuneStatusTime = Clock::Time();
+	autoTuneBytes = bytesDownloaded;
+
+	if (serverErrors)
+	{
+		// server is refusing connections or failing requests, back off and stay there for a while
+		if (noDownloader > 1) noDownloader--;
+		autoTuneSteppedUp = false;
+		autoTuneHold = autoTuneHoldRounds;
+	}
+	else if (autoTuneSteppedUp && throughput < autoTuneThroughput * (1 + autoTuneMinGain))
+	{
+		// the last connection added did not make the download meaningfully faster
+		if (noDownloader > 1) noDownloader--;
+		autoTuneSteppedUp = false;
+		autoTuneHold = autoTuneHoldRounds;
+	}
+	else if (autoTuneHold > 0)
+	{
+		autoTuneHold--;
+		autoTuneSteppedUp = false;
+	}
+	else if (noDownloader < download->MaxNoDownloader && CountBusyDownloaders() >= noDownloader && !IsAtRateLimit())
+	{
+		// all allowed connections are in use, see if one more helps
+		noDownloader++;
+		autoTuneSteppedUp = true;
+	}
+	else
+	{
+		autoTuneSteppedUp = false;
+	}
+	autoTuneThroughput = throughput;
+};
+
+void Scheduler::SaveManifestIfDue()
+{
+	ULONGLONG now = Clock::Now();
+	if (download->Sections.size() == manifestSectionCount && now - manifestSaveTime < manifestSaveInterval) return;
+	download->SaveManifest();
+	manifestSaveTime = now;
+	manifestSectionCount = download->Sections.size();
+};
+
+// true when the download already receives about as fast as its rate limits allow
+bool Scheduler::IsAtRateLimit()
+{
+	long long limit = RateLimiter::GetEffectiveLimit(hostBucket, &rateBucket);
+	if (limit <= 0) return false;
+	double throughput = 0;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Downloading) throughput += ds->Throughput;
+	}
+	return throughput >= limit * rateLimitSaturation;
+};
+
+void Scheduler::ProcessSections()
+{
+	// the limit may have been changed while downloading
+	RateLimiter::SetLimit(&rateBucket, download->MaxBytesPerSecond);
+	MoveStreamLimit();
+	// before a failed new section is thrown away, so its failure counts against its mirror
+	UpdateMirrors();
+	EvaluateStatusOfJustCreatedSectionIfExists();
+	PreallocateOutputFileIfPossible();
+	UpdateSectionThroughput();
+	ResolveEndGameRaces();
+	RefetchCorruptPieces();
+	GiveUpOnRefusedSections();
+	PreSplitIfPossible();
+	CreateNewSectionIfFeasible();
+	StartEndGameIfFeasible();
+	TryDownloadingAllUnfinishedSections();
+	MeasureRampUpTime();
+	TuneNoDownloaderIfAuto();
+	SaveManifestIfDue();
+};
+
+bool Scheduler::IsSchedulerThreadAlive()
+{
+	if (!hDownloadThread) return false;
+	DWORD result = WaitForSingleObject(hDownloadThread, 0);
+	return !(result == WAIT_OBJECT_0);
+};
+
+void Scheduler::CleanTempFiles()
+{
+	// the file being repaired is not ours to delete
+	if (!download->RepairFileName.empty())
+	{
+		download->DeleteManifest();
+		return;
+	}
+	for (DownloadSection* ds : download->Sections)
+	{
+		DeleteFileW(ds->FileName.c_str());
+	}
+	if (sectionBeingEvaluated)
+	{
+		DeleteFileW(sectionBeingEvaluated->FileName.c_str());
+	}
+	download->DeleteManifest();
+};
+
+void Scheduler::WaitForFinish()
+{
+	if (IsSchedulerThreadAlive())
+	{
+		WaitForSingleObject(hDownloadThread, INFINITE);
+		CloseHandle(hDownloadThread);
+		hDownloadThread = NULL;
+	}
+};
+
+bool Scheduler::IsDownloadHalted()
+{
+	for (DownloadSection* ds : download->Sections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::Stopped || status == DownloadStatus::DownloadError ||
+			status == DownloadStatus::PrepareToDownload || status == DownloadStatus::Downloading)
+			return false;
+	}
+	if (sectionBeingEvaluated) return false;
+	for (DownloadSection* ds : pieceSections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::Stopped || status == DownloadStatus::DownloadError ||
+			status == DownloadStatus::PrepareToDownload || status == DownloadStatus::Downloading)
+			return false;
+	}
+	// duplicates still running have to be cancelled before the output file is finished
+	for (DownloadSection* ds : endGameSections)
+	{
+		DownloadStatus status = ds->DownloadStatus;
+		if (status == DownloadStatus::PrepareToDownload || status == DownloadStatus::Downloading)
+			return false;
+	}
+	return true;
+};
+
+DWORD __stdcall Scheduler::DownloadThreadProc(LPVOID lParam)
+{
+	Scheduler* s = (Scheduler*)lParam;
+	s->DownloadThreadStart();
+	s->StopStream();
+	return 0;
+};
+
+void Scheduler::DownloadThreadStart()
+{
+	download->SummarySection->Error = L"";
+	startTime = Clock::Now();
+	rampUpTime = 0;
+	manifestSaveTime = 0;
+	manifestSectionCount = 0;
+	noDownloader = download->NoDownloader;
+	autoTuneTime = 0;
+	autoTuneThroughput = 0;
+	autoTuneSteppedUp = false;
+	autoTuneHold = 0;
+	contentKnown = false;
+	rangesSupported = false;
+	failedSections.clear();
+	// what is in the file from earlier runs is checked again at the end
+	download->Pieces.States.assign(download->Pieces.Hashes.size(), PieceList::Unchecked);
+	pieceDownloads.assign(download->Pieces.Hashes.size(), 1);
+	if (!CopySeedBlocks())
+	{
+		SetDownloadError(L"Blocks of the seed file could not be copied. Error occurred: " + std::to_wstring(GetLastError()));
+		return;
+	}
+	if (!StartStream())
+	{
+		SetDownloadError(L"Streaming could not be started. Error occurred: " + std::to_wstring(GetLastError()));
+		return;
+	}
+	mirrorMoveTime = Clock::Now();
+	mirrorDecayTime = mirrorMoveTime;
+	for (Mirror& mirror : mirrors)
+	{
+		std::wstring url = mirror.Url;
+		mirror = Mirror();
+		mirror.Url = url;
+	}
+
+	while (true)
+	{
+		// if there is download stop request from other thread
+		if (downloadStopFlag)
+		{
+			StopDownloading();
+			download->SaveManifest();
+			download->SummarySection->DownloadStatus = DownloadStatus::Stopped;
+			return;
+		}
+		// nobody reads the rest of the file
+		if (streamFailed)
+		{
+			StopDownloading();
+			SetDownloadError(L"Writing to the stream failed. Error occurred: " + std::to_wstring(streamError));
+			return;
+		}
+		ProcessSections();
+		// react as soon as a downloader changes status, the timeout keeps sampling and retries going
+		Clock::Wait(hSchedulerEvent, schedulerInterval);
+		// corrupt pieces found in the file are downloaded again before the download ends
+		if (IsDownloadHalted() && !CheckUncheckedPieces()) break;
+	}
+	download->SaveManifest();
+	// the server's answer says more than the sections it left behind
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus != DownloadStatus::LogicalError || !IsRefusedStatus(ds->HttpStatusCode)) continue;
+		SetDownloadError(ds->Error, DownloadStatus::LogicalError);
+		return;
+	}
+	// if there is section with logical error
+	if (ErrorAndUnstableSectionsExist())
+	{
+		SetDownloadError(L"There are sections that are in invalid states. Download cannot continue. Try re-download this file.");
+		return;
+	}
+	if (download->SummarySection->DownloadStatus == DownloadStatus::LogicalError) return;
+	for (long long i = 0; i < (long long)download->Pieces.Hashes.size(); i++)
+	{
+		if (download->Pieces.GetState(i) != PieceList::Failed) continue;
+		SetDownloadError(L"Piece at " + std::to_wstring(i * download->Pieces.PieceLength) + L" is still corrupt after " +
+			std::to_wstring(maxPieceDownloads) + L" downloads.", DownloadStatus::LogicalError);
+		return;
+	}
+	if (JoinSectionsToFile())
+	{
+		CleanTempFiles();
+		if (VerifyDigest() && VerifySha1()) download->SummarySection->DownloadStatus = DownloadStatus::Finished;
+	}
+};
+
+// only a whole file has a digest, not a part or a set of ranges of it
+bool Scheduler::IsHashing()
+{
+	// a streamed file is not kept, parts of it could not be read again
+	return download->SummarySection->Start == 0 && download->SummarySection->Ranges.empty() && !download->FilePerRange && download->StreamWindow == 0;
+};
+
+bool Scheduler::VerifyDigest()
+{
+	digest.clear();
+	digestBytesRead = 0;
+	if (!IsHashing()) return true;
+	// writes of stopped downloaders may still complete and add to the hashes of their sections
+	for (Downloader* dl : downloaders)
+	{
+		if (dl) dl->WaitForFinish();
+	}
+	std::wstring expected = download->ExpectedDigest;
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (expected.empty()) expected = ds->ServerDigest;
+	}
+	// every section and end-game duplicate has hashed what it wrote, the parts no one has are read from the file
+	std::vector<TreeHash*> hashes;
+	for (DownloadSection* ds : download->Sections) hashes.push_back(&ds->Hash);
+	for (DownloadSection* ds : endGameSections) hashes.push_back(&ds->Hash);
+	for (DownloadSection* ds : retiredEndGameSections) hashes.push_back(&ds->Hash);
+	// pieces downloaded again replaced bytes the sections have hashed, so the file is read instead
+	if (piecesRefetched > 0) hashes.clear();
+	BYTE fileDigest[TreeHash::DigestSize];
+	BOOL bResults = FALSE;
+	HANDLE hFile = CreateFileW(download->SummarySection->FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE != hFile)
+	{
+		bResults = TreeHash::Combine(hashes, download->SummarySection->End + 1, hFile, fileDigest, &digestBytesRead);
+		CloseHandle(hFile);
+	}
+	if (bResults) digest = TreeHash::ToHex(fileDigest, TreeHash::DigestSize);
+	if (expected.empty()) return true;
+	BYTE expectedDigest[TreeHash::DigestSize];
+	if (!TreeHash::ParseDigest(expected, expectedDigest))
+	{
+		SetDownloadError(L"The expected digest is not a BLAKE3 digest: " + expected, DownloadStatus::LogicalError);
+		return false;
+	}
+	if (!bResults)
+	{
+		SetDownloadError(L"The file could not be read to check its digest. Error occurred: " + std::to_wstring(GetLastError()));
+		return false;
+	}
+	if (memcmp(fileDigest, expectedDigest, TreeHash::DigestSize) != 0)
+	{
+		SetDownloadError(L"The file does not match its digest " + expected + L", its BLAKE3 is " + digest + L'.', DownloadStatus::LogicalError);
+		return false;
+	}
+	return true;
+};
+
+// the blocks an older copy of the file has in common with it are copied before the rest is downloaded.
+// Done again when resuming, as it is not known how far an earlier run got.
+bool Scheduler::CopySeedBlocks()
+{
+	seedBytesCopied = 0;
+	if (download->SeedBlocks.empty()) return true;
+	HANDLE hSeed = CreateFileW(download->SeedFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hSeed) return false;
+	HANDLE hDest = CreateFileW(download->Sections[0]->FileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hDest)
+	{
+		CloseHandle(hSeed);
+		return false;
+	}
+	LPBYTE buffer = new BYTE[fileReadSize];
+	BOOL bResults = TRUE;
+	for (SeedBlock& block : download->SeedBlocks)
+	{
+		if (downloadStopFlag) break;
+		LARGE_INTEGER li;
+		li.QuadPart = block.SeedOffset;
+		bResults = SetFilePointerEx(hSeed, li, NULL, FILE_BEGIN);
+		li.QuadPart = block.Offset - download->Sections[0]->FileOrigin;
+		bResults = bResults && SetFilePointerEx(hDest, li, NULL, FILE_BEGIN);
+		long long bytesLeft = block.Length;
+		while (bResults && bytesLeft > 0)
+		{
+			DWORD dwNumberOfBytesRead = 0;
+			DWORD dwNumberOfBytesWritten = 0;
+			bResults = ReadFile(hSeed, buffer, bytesLeft < fileReadSize ? (DWORD)bytesLeft : fileReadSize, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead > 0;
+			bResults = bResults && WriteFile(hDest, buffer, dwNumberOfBytesRead, &dwNumberOfBytesWritten, NULL) && dwNumberOfBytesWritten == dwNumberOfBytesRead;
+			if (bResults) seedBytesCopied += dwNumberOfBytesRead;
+			bytesLeft -= dwNumberOfBytesRead;
+		}
+		if (!bResults) break;
+	}
+	delete[] buffer;
+	CloseHandle(hDest);
+	CloseHandle(hSeed);
+	return bResults;
+};
+
+bool Scheduler::VerifySha1()
+{
+	if (download->ExpectedSha1.empty()) return true;
+	HANDLE hFile = CreateFileW(download->SummarySection->FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		SetDownloadError(L"The file could not be read to check its SHA-1. Error occurred: " + std::to_wstring(GetLastError()));
+		return false;
+	}
+	PieceHash hash;
+	hash.Reset(L"sha-1");
+	LPBYTE buffer = new BYTE[fileReadSize];
+	DWORD dwNumberOfBytesRead = 0;
+	BOOL bResults = TRUE;
+	while ((bResults = ReadFile(hFile, buffer, fileReadSize, &dwNumberOfBytesRead, NULL)) && dwNumberOfBytesRead > 0)
+	{
+		hash.Update(buffer, dwNumberOfBytesRead);
+	}
+	delete[] buffer;
+	CloseHandle(hFile);
+	if (!bResults)
+	{
+		SetDownloadError(L"The file could not be read to check its SHA-1. Error occurred: " + std::to_wstring(GetLastError()));
+		return false;
+	}
+	if (hash.Finish() != download->ExpectedSha1)
+	{
+		SetDownloadError(L"The file does not match the SHA-1 of its index.", DownloadStatus::LogicalError);
+		return false;
+	}
+	return true;
+};
+
+bool Scheduler::JoinSectionsToFile()
+{
+	DownloadSection* ds = download->Sections[0];
+	HANDLE hDest = INVALID_HANDLE_VALUE;
+	HANDLE hSection = INVALID_HANDLE_VALUE;
+	LPBYTE buffer = NULL;
+	BOOL bResults = FALSE;
+	std::wstring fileNameWithPath;
+	if (!download->RepairFileName.empty()) return FinishRepair();
+	if (download->StreamWindow > 0) return CloseStreamOutput();
+	if (!download->DownloadFolder.empty() && PathFileExistsW(download->DownloadFolder.c_str()))
+	{
+		// the ranges of a sparse download go to files in a folder of this name
+		std::wstring fileNameOnly = Util::UrlGetFileName(ds->Url) + (download->FilePerRange ? L".ranges" : L"");
+		fileNameWithPath = Util::CombinePathAndFileName(download->DownloadFolder, fileNameOnly);
+		if (PathFileExistsW(fileNameWithPath.c_str()))
+		{
+			fileNameOnly = std::to_wstring(time(NULL)) + L'_' + fileNameOnly;
+			fileNameWithPath = Util::CombinePathAndFileName(download->DownloadFolder, fileNameOnly);
+		}
+	}
+	else
+	{
+		SetDownloadError(L"Download folder is not present.");
+		return false;
+	}
+	if (download->DirectWrite && download->FilePerRange) return SplitOutputFileByRange(fileNameWithPath);
+	if (download->DirectWrite && !download->ZipMembers.empty()) return WriteZipArchive(fileNameWithPath);
+	if (download->DirectWrite) return RenameOutputFile(fileNameWithPath);
+
+	// joining takes one buffer of the pool, it may have to wait for other downloads to return one
+	bResults = BufferPool::Allocate() && (buffer = BufferPool::LeaseWait()) != NULL;
+	long long totalFileSize = 0;
+	if (bResults)
+	{
+		hDest = CreateFileW(fileNameWithPath.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		bResults = !(INVALID_HANDLE_VALUE == hDest);
+	}
+
+	if (bResults)
+	{
+		while (true)
+		{
+			if (ds->DownloadStatus == DownloadStatus::Finished)
+			{
+				totalFileSize += ds->GetTotal();
+				hSection = CreateFileW(ds->FileName.c_str(), FILE_GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+				if (INVALID_HANDLE_VALUE == hSection)
+				{
+					bResults = FALSE;
+				}
+				if (bResults)
+				{
+					long long bytesRead = 0;
+					while (true)
+					{
+						DWORD bytesToReadThisTime = (ds->GetTotal() - bytesRead >= BufferPool::BufferSize) ? BufferPool::BufferSize : (DWORD)(ds->GetTotal() - bytesRead);
+						// reached the end
+						if (bytesToReadThisTime == 0) break;
+						DWORD bytesReadThisTime = 0, bytesWrittenThisTime = 0;
+						bResults = ReadFile(hSection, buffer, bytesToReadThisTime, &bytesReadThisTime, NULL);
+						if (bResults)
+						{
+							bytesRead += bytesReadThisTime;
+							bResults = WriteFile(hDest, buffer, bytesReadThisTime, &bytesWrittenThisTime, NULL);
+						}
+						if (!bResults) break;
+					}
+				}
+				if (bResults)
+				{
+					CloseHandle(hSection);
+				}
+			}
+			if (bResults)
+			{
+				if (ds->NextSection) ds = ds->NextSection;
+				else break;
+			}
+			if (!bResults) break;
+		}
+	}
+	if (bResults)
+	{
+		CloseHandle(hDest);
+		download->SummarySection->FileName = fileNameWithPath;
+		download->SummarySection->End = download->SummarySection->Start + totalFileSize - 1;
+		download->SummarySection->BytesDownloaded = totalFileSize;
+	}
+	if (!bResults)
+	{
+		if (download->SummarySection->Error.empty()) SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+		if (hSection != INVALID_HANDLE_VALUE) CloseHandle(hSection);
+		if (hDest != INVALID_HANDLE_VALUE) CloseHandle(hDest);
+	}
+	BufferPool::Return(buffer);
+	return bResults;
+};
+
+bool Scheduler::RenameOutputFile(std::wstring fileNameWithPath)
+{
+	DownloadSection* ds = download->Sections[0];
+	std::wstring sharedFileName = ds->FileName;
+	long long fileOrigin = ds->FileOrigin;
+	long long totalFileSize = 0;
+	long long bytesDownloaded = 0;
+	while (ds)
+	{
+		// a sparse download leaves holes in the file, it ends where the last section does
+		if (ds->DownloadStatus == DownloadStatus::Finished)
+		{
+			bytesDownloaded += ds->GetTotal();
+			if (ds->End - ds->FileOrigin + 1 > totalFileSize) totalFileSize = ds->End - ds->FileOrigin + 1;
+		}
+		ds = ds->NextSection;
+	}
+
+	// cut off the preallocated space that has not been used
+	BOOL bResults = FALSE;
+	HANDLE hFile = CreateFileW(sharedFileName.c_str(), GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE != hFile)
+	{
+		FILE_END_OF_FILE_INFO endOfFileInfo;
+		endOfFileInfo.EndOfFile.QuadPart = totalFileSize;
+		bResults = SetFileInformationByHandle(hFile, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo));
+		CloseHandle(hFile);
+	}
+	if (bResults)
+	{
+		bResults = MoveFileExW(sharedFileName.c_str(), fileNameWithPath.c_str(), MOVEFILE_WRITE_THROUGH);
+	}
+	if (bResults)
+	{
+		download->SummarySection->FileName = fileNameWithPath;
+		download->SummarySection->End = fileOrigin + totalFileSize - 1;
+		download->SummarySection->BytesDownloaded = bytesDownloaded;
+	}
+	else
+	{
+		SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	}
+	return bResults;
+};
+
+bool Scheduler::FinishRepair()
+{
+	DownloadSection* ds = download->Sections[0];
+	long long totalFileSize = 0;
+	long long bytesDownloaded = 0;
+	while (ds)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Finished)
+		{
+			bytesDownloaded += ds->GetTotal();
+			if (ds->End + 1 > totalFileSize) totalFileSize = ds->End + 1;
+		}
+		ds = ds->NextSection;
+	}
+
+	BOOL bResults = TRUE;
+	// a repaired whole file must not keep what lies beyond the end of the file on the server
+	if (download->SummarySection->Ranges.empty() && download->SummarySection->Start == 0)
+	{
+		bResults = FALSE;
+		HANDLE hFile = CreateFileW(download->RepairFileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (INVALID_HANDLE_VALUE != hFile)
+		{
+			FILE_END_OF_FILE_INFO endOfFileInfo;
+			endOfFileInfo.EndOfFile.QuadPart = totalFileSize;
+			bResults = SetFileInformationByHandle(hFile, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo));
+			CloseHandle(hFile);
+		}
+	}
+	if (bResults)
+	{
+		download->SummarySection->FileName = download->RepairFileName;
+		download->SummarySection->End = totalFileSize - 1;
+		download->SummarySection->BytesDownloaded = bytesDownloaded;
+	}
+	else
+	{
+		SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	}
+	return bResults;
+};
+
+bool Scheduler::SplitOutputFileByRange(std::wstring folderNameWithPath)
+{
+	// every range of the sparse output file is copied to a file named first-last in the folder,
+	// the ranges of all sections together with the ones cut apart by splits joined again
+	DownloadSection* ds = download->Sections[0];
+	std::wstring sharedFileName = ds->FileName;
+	long long fileOrigin = ds->FileOrigin;
+	std::vector<ByteRange> ranges;
+	for (; ds; ds = ds->NextSection)
+	{
+		for (ByteRange range : ds->GetRangesLeft(0)) ranges.push_back(range);
+	}
+	DownloadSection::SortRanges(ranges);
+
+	HANDLE hSource = INVALID_HANDLE_VALUE;
+	HANDLE hDest = INVALID_HANDLE_VALUE;
+	LPBYTE buffer = NULL;
+	long long bytesDownloaded = 0;
+	BOOL bResults = CreateDirectoryW(folderNameWithPath.c_str(), NULL);
+	if (bResults) bResults = BufferPool::Allocate() && (buffer = BufferPool::LeaseWait()) != NULL;
+	if (bResults)
+	{
+		hSource = CreateFileW(sharedFileName.c_str(), FILE_GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		bResults = !(INVALID_HANDLE_VALUE == hSource);
+	}
+	for (size_t i = 0; bResults && i < ranges.size(); i++)
+	{
+		std::wstring rangeFileName = Util::CombinePathAndFileName(folderNameWithPath, std::to_wstring(ranges[i].Start) + L'-' + std::to_wstring(ranges[i].End));
+		hDest = CreateFileW(rangeFileName.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		bResults = !(INVALID_HANDLE_VALUE == hDest);
+		LARGE_INTEGER position;
+		position.QuadPart = ranges[i].Start - fileOrigin;
+		if (bResults) bResults = SetFilePointerEx(hSource, position, NULL, FILE_BEGIN);
+		long long bytesLeft = ranges[i].End - ranges[i].Start + 1;
+		while (bResults && bytesLeft > 0)
+		{
+			DWORD bytesToReadThisTime = bytesLeft >= BufferPool::BufferSize ? BufferPool::BufferSize : (DWORD)bytesLeft;
+			DWORD bytesReadThisTime = 0, bytesWrittenThisTime = 0;
+			bResults = ReadFile(hSource, buffer, bytesToReadThisTime, &bytesReadThisTime, NULL);
+			// the file has to hold every range, a short read means it does not
+			if (bResults && bytesReadThisTime == 0)
+			{
+				SetLastError(ERROR_HANDLE_EOF);
+				bResults = FALSE;
+			}
+			if (bResults) bResults = WriteFile(hDest, buffer, bytesReadThisTime, &bytesWrittenThisTime, NULL);
+			bytesLeft -= bytesReadThisTime;
+			bytesDownloaded += bytesReadThisTime;
+		}
+		if (hDest != INVALID_HANDLE_VALUE) CloseHandle(hDest);
+		hDest = INVALID_HANDLE_VALUE;
+	}
+	if (!bResults && download->SummarySection->Error.empty()) SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	if (hSource != INVALID_HANDLE_VALUE) CloseHandle(hSource);
+	BufferPool::Return(buffer);
+	if (bResults)
+	{
+		DeleteFileW(sharedFileName.c_str());
+		download->SummarySection->FileName = folderNameWithPath;
+		download->SummarySection->BytesDownloaded = bytesDownloaded;
+	}
+	return bResults;
+};
+
+bool Scheduler::WriteZipArchive(std::wstring fileNameWithPath)
+{
+	// the local headers and data of the members are at their offsets in the sparse output file,
+	// they are copied one after another into a new archive with a central directory of just them
+	DownloadSection* ds = download->Sections[0];
+	std::wstring sharedFileName = ds->FileName;
+	HANDLE hSource = INVALID_HANDLE_VALUE;
+	HANDLE hDest = INVALID_HANDLE_VALUE;
+	LPBYTE buffer = NULL;
+	long long bytesWritten = 0;
+	BOOL bResults = BufferPool::Allocate() && (buffer = BufferPool::LeaseWait()) != NULL;
+	if (bResults)
+	{
+		hSource = CreateFileW(sharedFileName.c_str(), FILE_GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		bResults = !(INVALID_HANDLE_VALUE == hSource);
+	}
+	if (bResults)
+	{
+		hDest = CreateFileW(fileNameWithPath.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		bResults = !(INVALID_HANDLE_VALUE == hDest);
+	}
+	if (bResults) bResults = ZipArchive::WriteArchive(hSource, ds->FileOrigin, download->ZipMembers, hDest, buffer, BufferPool::BufferSize, bytesWritten);
+	if (!bResults && download->SummarySection->Error.empty()) SetDownloadError(L"Error occurred: " + std::to_wstring(GetLastError()));
+	if (hSource != INVALID_HANDLE_VALUE) CloseHandle(hSource);
+	if (hDest != INVALID_HANDLE_VALUE) CloseHandle(hDest);
+	BufferPool::Return(buffer);
+	if (bResults)
+	{
+		DeleteFileW(sharedFileName.c_str());
+		download->SummarySection->FileName = fileNameWithPath;
+		download->SummarySection->End = download->SummarySection->Start + bytesWritten - 1;
+		download->SummarySection->BytesDownloaded = bytesWritten;
+	}
+	else DeleteFileW(fileNameWithPath.c_str());
+	return bResults;
+};
+
+bool Scheduler::StartStream()
+{
+	if (download->StreamWindow <= 0) return true;
+	streamPosition = download->SummarySection->Start;
+	streamLimit = streamPosition + download->StreamWindow;
+	streamLimitNotified = streamLimit;
+	streamFinishing = false;
+	streamFailed = false;
+	streamError = 0;
+	hStreamThread = CreateThread(NULL, 0, StreamThreadProc, this, 0, NULL);
+	return hStreamThread != NULL;
+};
+
+DWORD __stdcall Scheduler::StreamThreadProc(LPVOID lParam)
+{
+	Scheduler* s = (Scheduler*)lParam;
+	s->StreamThreadStart();
+	return 0;
+};
+
+void Scheduler::StreamThreadStart()
+{
+	// the output file is written by the downloaders at the same time, it is opened for writing too to punch holes into it
+	std::wstring sharedFileName = download->Sections[0]->FileName;
+	long long fileOrigin = download->Sections[0]->FileOrigin;
+	HANDLE hFile = CreateFileW(sharedFileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	LPBYTE buffer = new BYTE[fileReadSize];
+	BOOL bResults = !(INVALID_HANDLE_VALUE == hFile);
+	while (bResults)
+	{
+		// once the download is over one more round writes what is left
+		bool finishing = streamFinishing || downloadStopFlag;
+		long long contiguousEnd = GetContiguousEnd();
+		while (bResults && streamPosition < contiguousEnd)
+		{
+			DWORD bytesToRead = contiguousEnd - streamPosition < fileReadSize ? (DWORD)(contiguousEnd - streamPosition) : fileReadSize;
+			DWORD dwNumberOfBytesRead = 0, dwNumberOfBytesWritten = 0;
+			LARGE_INTEGER li;
+			li.QuadPart = streamPosition - fileOrigin;
+			bResults = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) &&
+				ReadFile(hFile, buffer, bytesToRead, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead == bytesToRead;
+			bResults = bResults && WriteFile(download->StreamHandle, buffer, bytesToRead, &dwNumberOfBytesWritten, NULL) && dwNumberOfBytesWritten == bytesToRead;
+			if (!bResults) break;
+			// the space of what has been streamed is given back, the file keeps no more than the window.
+			// Not fatal, the file just keeps its size where holes cannot be made.
+			FILE_ZERO_DATA_INFORMATION zeroData;
+			zeroData.FileOffset.QuadPart = streamPosition - fileOrigin;
+			zeroData.BeyondFinalZero.QuadPart = streamPosition - fileOrigin + bytesToRead;
+			DWORD bytesReturned = 0;
+			DeviceIoControl(hFile, FSCTL_SET_ZERO_DATA, &zeroData, sizeof(zeroData), NULL, 0, &bytesReturned, NULL);
+			streamPosition += bytesToRead;
+			// sections waiting at the end of the window may go on
+			streamLimit = streamPosition + download->StreamWindow;
+			SetEvent(hSchedulerEvent);
+		}
+		if (!bResults || finishing) break;
+		Clock::Wait(hStreamEvent, streamInterval);
+	}
+	if (!bResults)
+	{
+		streamError = GetLastError();
+		streamFailed = true;
+		SetEvent(hSchedulerEvent);
+	}
+	delete[] buffer;
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+};
+
+// the end of the start of the file which sections have written without a gap
+long long Scheduler::GetContiguousEnd()
+{
+	EnterCriticalSection(&sectionsLock);
+	DownloadSection* ds = download->Sections[0];
+	long long contiguousEnd = ds->Start;
+	for (; ds; ds = ds->NextSection)
+	{
+		long long bytesDownloaded = ds->BytesDownloaded;
+		// End may have been cut back by a split, the bytes beyond it belong to the next section
+		if (ds->End >= 0 && bytesDownloaded > ds->GetTotal()) bytesDownloaded = ds->GetTotal();
+		contiguousEnd = ds->Start + bytesDownloaded;
+		if (ds->DownloadStatus != DownloadStatus::Finished) break;
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return contiguousEnd;
+};
+
+void Scheduler::MoveStreamLimit()
+{
+	long long limit = streamLimit;
+	if (download->StreamWindow <= 0 || limit == streamLimitNotified) return;
+	streamLimitNotified = limit;
+	for (Downloader* dl : downloaders)
+	{
+		if (dl) dl->OnStreamLimitMoved();
+	}
+};
+
+bool Scheduler::FinishStream()
+{
+	if (!hStreamThread) return true;
+	streamFinishing = true;
+	SetEvent(hStreamEvent);
+	WaitForSingleObject(hStreamThread, INFINITE);
+	CloseHandle(hStreamThread);
+	hStreamThread = NULL;
+	return !streamFailed;
+};
+
+// a streamed download which did not finish leaves nothing to resume, the stream has had the start of the file
+void Scheduler::StopStream()
+{
+	if (!hStreamThread) return;
+	FinishStream();
+	CleanTempFiles();
+};
+
+bool Scheduler::CloseStreamOutput()
+{
+	// the stream thread writes the rest of the file, which is all holes afterwards
+	long long contiguousEnd = GetContiguousEnd();
+	if (!FinishStream() || streamPosition != contiguousEnd)
+	{
+		SetDownloadError(L"Writing to the stream failed. Error occurred: " + std::to_wstring(streamError));
+		return false;
+	}
+	DeleteFileW(download->Sections[0]->FileName.c_str());
+	download->SummarySection->FileName.clear();
+	download->SummarySection->End = contiguousEnd - 1;
+	download->SummarySection->BytesDownloaded = contiguousEnd - download->SummarySection->Start;
+	return true;
+};
+
+void Scheduler::SetDownloadError(std::wstring errorMessage, DownloadStatus status)
+{
+	download->SummarySection->Error = errorMessage;
+	download->SummarySection->LastStatusChange = Clock::Time();
+	download->SummarySection->DownloadStatus = status;
+};
+
+bool Scheduler::IsDownloadResumable()
+{
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->HttpStatusCode == L"200")
+		{
+			LeaveCriticalSection(&sectionsLock);
+			return false;
+		}
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return true;
+};
+
+DownloadStatus Scheduler::GetDownloadStatus()
+{
+	return download->SummarySection->DownloadStatus;
+};
+
+std::wstring Scheduler::GetUrl()
+{
+	return download->SummarySection->Url;
+};
+
+// the output file, known once the download has finished
+std::wstring Scheduler::GetFileName()
+{
+	return download->SummarySection->FileName;
+};
+
+// the download's error, or while failed sections are being retried the error of one of them
+std::wstring Scheduler::GetError()
+{
+	std::wstring error = download->SummarySection->Error;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (!error.empty()) break;
+		if (ds->DownloadStatus == DownloadStatus::DownloadError || ds->DownloadStatus == DownloadStatus::LogicalError) error = ds->Error;
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return error;
+};
+
+// not meaningful while the size is still unknown
+long long Scheduler::GetTotalSize()
+{
+	long long totalFileSize = 0;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		totalFileSize += ds->GetTotal();
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return totalFileSize;
+};
+
+long long Scheduler::GetBytesDownloaded()
+{
+	long long bytesDownloaded = 0;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		bytesDownloaded += ds->BytesDownloaded;
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return bytesDownloaded;
+};
+
+// counted from the merged ranges, an end-game duplicate and its original may both have rewritten a block
+long long Scheduler::GetBytesRepaired()
+{
+	long long bytesRepaired = 0;
+	for (ByteRange range : GetRepairedRanges())
+	{
+		bytesRepaired += range.End - range.Start + 1;
+	}
+	return bytesRepaired;
+};
+
+// where a repair rewrote the file, complete once the download is over
+std::vector<ByteRange> Scheduler::GetRepairedRanges()
+{
+	std::vector<ByteRange> ranges;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		ranges.insert(ranges.end(), ds->RepairedRanges.begin(), ds->RepairedRanges.end());
+	}
+	// end-game duplicates may have won the race for some of the blocks
+	for (DownloadSection* ds : endGameSections)
+	{
+		ranges.insert(ranges.end(), ds->RepairedRanges.begin(), ds->RepairedRanges.end());
+	}
+	for (DownloadSection* ds : retiredEndGameSections)
+	{
+		ranges.insert(ranges.end(), ds->RepairedRanges.begin(), ds->RepairedRanges.end());
+	}
+	for (DownloadSection* ds : pieceSections)
+	{
+		ranges.insert(ranges.end(), ds->RepairedRanges.begin(), ds->RepairedRanges.end());
+	}
+	LeaveCriticalSection(&sectionsLock);
+	DownloadSection::SortRanges(ranges);
+	return ranges;
+};
+
+// BLAKE3 of the file in hex, known once the download has finished
+std::wstring Scheduler::GetDigest()
+{
+	return digest;
+};
+
+// bytes copied from the seed file instead of being downloaded
+long long Scheduler::GetBytesReused()
+{
+	return seedBytesCopied;
+};
+
+// written to the stream of the download so far
+long long Scheduler::GetBytesStreamed()
+{
+	return hStreamThread || streamPosition > 0 ? streamPosition - download->SummarySection->Start : 0;
+};
+
+// corrupt pieces downloaded again, a piece counted once for each time
+int Scheduler::GetPiecesRefetched()
+{
+	return piecesRefetched;
+};
+
+int Scheduler::GetActiveConnections()
+{
+	int connections = 0;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Downloading) connections++;
+	}
+	LeaveCriticalSection(&sectionsLock);
+	return connections;
+};
+
+int Scheduler::GetConnectionDemand()
+{
+	if (GetDownloadStatus() != DownloadStatus::Downloading) return 0;
+	// in auto mode one more than the current number, so tuning can find out whether it helps
+	int demand = noDownloader;
+	if (download->AutoNoDownloader && demand < download->MaxNoDownloader && !IsAtRateLimit()) demand++;
+	int unfinishedSections = 0;
+	bool splittable = false;
+	EnterCriticalSection(&sectionsLock);
+	for (DownloadSection* ds : download->Sections)
+	{
+		if (ds->DownloadStatus == DownloadStatus::Finished) continue;
+		unfinishedSections++;
+		if (ds->End < 0 && ds->HttpStatusCode != L"200") splittable = true;
+		if (ds->End >= 0 && (ds->GetTotal() - ds->BytesDownloaded) / 2 > download->MinSectionSize) splittable = true;
+	}
+	LeaveCriticalSection(&sectionsLock);
+	// near the end only the sections left and their end-game duplicates can use a connection
+	if (!splittable)
+	{
+		int endGameSections = unfinishedSections < endGameMaxSections ? unfinishedSections : endGameMaxSections;
+		if (unfinishedSections + endGameSections < demand) demand = unfinishedSections + endGameSections;
+	}
+	return demand < 1 ? 1 : demand;
+};
+
+void Scheduler::SetConnectionLimit(int limit)
+{
+	connectionLimit = limit;
+	SetEvent(hSchedulerEvent);
+};
+
+// zero removes the limit, a running download follows it from its next read
+void Scheduler::SetRateLimit(long long bytesPerSecond)
+{
+	download->MaxBytesPerSecond = bytesPerSecond;
+	RateLimiter::SetLimit(&rateBucket, bytesPerSecond);
+	SetEvent(hSchedulerEvent);
+};
+
+std::wstring Scheduler::GetDownloadStatusDescription()
+{
+	long long totalFileSize = 0;
+	long long bytesDownloaded = 0;
+	std::wstring statusStr;
+
+	DownloadStatus dStatus = GetDownloadStatus();
+	if (dStatus == DownloadStatus::Stopped)
+	{
+		statusStr.append(L"Download status: Paused.\r\n");
+	}
+	if (dStatus == DownloadStatus::Downloading)
+	{
+		statusStr.append(L"Download status: Downloading.\r\n");
+	}
+	if (dStatus == DownloadStatus::DownloadError)
+	{
+		statusStr.append(L"Download status: Error Occurred.\r\n");
+	}
+	if (dStatus == DownloadStatus::Finished)
+	{
+		statusStr.append(L"Download status: Successfully Finished.\r\n");
+	}
+
+	EnterCriticalSection(&sectionsLock);
+
+	for (DownloadSection* ds : download->Sections)
+	{
+		DownloadStatus sStatus = ds->DownloadStatus;
+		if (sStatus == DownloadStatus::LogicalError || sStatus == DownloadStatus::DownloadError)
+		{
+			statusStr.append(L"Section Error: ");
+			statusStr.append(ds->Error);
+			statusStr.append(L"\r\n");
+		}
+		totalFileSize += ds->GetTotal();
+		bytesDownloaded += ds->BytesDownloaded;
+	}
+
+	LeaveCriticalSection(&sectionsLock);
+
+	if (dStatus == DownloadStatus::DownloadError)
+	{
+		statusStr.append(L"Download Error: ");
+		statusStr.append(download->SummarySection->Error);
+		statusStr.append(L"\r\n");
+	}
+	if (totalFileSize > 0 && bytesDownloaded > totalFileSize) bytesDownloaded = totalFileSize;
+	statusStr.append(L"Total ");
+	statusStr.append(std::to_wstring(totalFileSize));
+	statusStr.append(L" bytes, ");
+	statusStr.append(std::to_wstring(bytesDownloaded));
+	statusStr.append(L" bytes downloaded.\r\n");
+	if (totalFileSize > 0)
+	{
+		long long percentage = bytesDownloaded * 100 / totalFileSize;
+		statusStr.append(std::to_wstring(percentage));
+		statusStr.append(L"% completed.\r\n");
+	}
+	if (!download->RepairFileName.empty())
+	{
+		statusStr.append(L"Repairing ");
+		statusStr.append(download->RepairFileName);
+		statusStr.append(L", ");
+		statusStr.append(std::to_wstring(GetBytesRepaired()));
+		statusStr.append(L" bytes differed and were rewritten.\r\n");
+	}
+	if (!digest.empty())
+	{
+		statusStr.append(L"BLAKE3 ");
+		statusStr.append(digest);
+		statusStr.append(L", hashed while downloading, ");
+		statusStr.append(std::to_wstring(digestBytesRead));
+		statusStr.append(L" bytes read again.\r\n");
+	}
+	if (seedBytesCopied > 0)
+	{
+		statusStr.append(L"Copied ");
+		statusStr.append(std::to_wstring(seedBytesCopied));
+		statusStr.append(L" bytes from seed file ");
+		statusStr.append(download->SeedFileName);
+		statusStr.append(L".\r\n");
+	}
+	if (piecesRefetched > 0)
+	{
+		statusStr.append(L"Re-fetched ");
+		statusStr.append(std::to_wstring(piecesRefetched));
+		statusStr.append(L" corrupt pieces.\r\n");
+	}
+	if (tailTimeSaved >= 1)
+	{
+		statusStr.append(L"Throughput-aware splitting saved about ");
+		statusStr.append(std::to_wstring((long long)tailTimeSaved));
+		statusStr.append(L" seconds.\r\n");
+	}
+	if (rampUpTime > 0)
+	{
+		statusStr.append(L"Ramped up to ");
+		statusStr.append(std::to_wstring(noDownloader));
+		statusStr.append(L" connections in ");
+		statusStr.append(std::to_wstring(rampUpTime));
+		statusStr.append(L" ms.\r\n");
+	}
+	if (download->AutoNoDownloader)
+	{
+		statusStr.append(L"Number of connections is tuned automatically, currently ");
+		statusStr.append(std::to_wstring(noDownloader));
+		statusStr.append(L".\r\n");
+	}
+	statusStr.append(ConnectionPool::GetStatisticsDescription());
+	statusStr.append(BufferPool::GetStatisticsDescription());
+	if (download->MaxBytesPerSecond > 0)
+	{
+		statusStr.append(L"Download limited to ");
+		statusStr.append(std::to_wstring(download->MaxBytesPerSecond / 1024));
+		statusStr.append(L" KB/s.\r\n");
+	}
+	statusStr.append(RateLimiter::GetStatisticsDescription());
+	for (int i = 0; mirrors.size() > 1 && i < (int)mirrors.size(); i++)
+	{
+		Mirror& mirror = mirrors[i];
+		statusStr.append(L"Mirror ");
+		statusStr.append(mirror.Url);
+		if (mirror.Rejected)
+		{
+			statusStr.append(L": not used, it does not serve the same file.\r\n");
+			continue;
+		}
+		statusStr.append(L": ");
+		statusStr.append(std::to_wstring(mirror.Sections));
+		statusStr.append(L" connections, ");
+		statusStr.append(std::to_wstring((long long)mirror.Throughput / 1024));
+		statusStr.append(L" KB/s, ");
+		statusStr.append(std::to_wstring(mirror.Failures));
+		statusStr.append(L" failures.\r\n");
+	}
+	if (mirrorMoves > 0)
+	{
+		statusStr.append(L"Moved ");
+		statusStr.append(std::to_wstring(mirrorMoves));
+		statusStr.append(L" sections off slow mirrors.\r\n");
+	}
+	if (endGameRaces > 0)
+	{
+		statusStr.append(L"End-game raced ");
+		statusStr.append(std::to_wstring(endGameRaces));
+		statusStr.append(L" sections, duplicates won ");
+		statusStr.append(std::to_wstring(endGameWins));
+		statusStr.append(L" times and saved about ");
+		statusStr.append(std::to_wstring((long long)endGameTimeSaved));
+		statusStr.append(L" seconds.\r\n");
+	}
+
+	return statusStr;
+};
+
+void Scheduler::Start()
+{
+	DownloadStatus status = GetDownloadStatus();
+	if (status == DownloadStatus::Finished || status == DownloadStatus::Downloading) return;
+	if (IsSchedulerThreadAlive()) return;
+	downloadStopFlag = false;
+	if (hDownloadThread) CloseHandle(hDownloadThread);
+	hDownloadThread = CreateThread(NULL, 0, DownloadThreadProc, this, 0, NULL);
+	if (hDownloadThread)
+	{
+		download->SummarySection->DownloadStatus = DownloadStatus::Downloading;
+	}
+};
+
+void Scheduler::Stop(bool cancel, bool wait)
+{
+	if (GetDownloadStatus() == DownloadStatus::Downloading)
+	{
+		downloadStopFlag = true;
+		SetEvent(hSchedulerEvent);
+		if (cancel)
+		{
+			WaitForFinish();
+			CleanTempFiles();
+		}
+		else
+		{
+			if (wait)
+			{
+				WaitForFinish();
+			}
+		}
+	}
+	else if (cancel) CleanTempFiles();
+};
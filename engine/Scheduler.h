@@ -0,0 +1,206 @@
+#pragma once
+#include "Download.h"
+#include "Downloader.h"
+#include <set>
+
+class Scheduler
+{
+private:
+	static const unsigned long long throughputSampleInterval = 500;
+	static constexpr double throughputSmoothing = 0.3;
+	static const long long sectionAlignment = 1048576;
+	static const int endGameMaxSections = 2;
+	// a piece still corrupt after this many downloads fails the download
+	static const int maxPieceDownloads = 4;
+	// size of the reads checking pieces of the output file, copying from the seed file and hashing the finished file
+	static const DWORD fileReadSize = 1048576;
+	// longest wait between two rounds of ProcessSections when no downloader reports anything
+	static const DWORD schedulerInterval = 500;
+	// auto tuning measures aggregate throughput over this many milliseconds before changing the number of connections
+	static const ULONGLONG autoTuneInterval = 3000;
+	// an added connection has to raise aggregate throughput by this much to be kept
+	static constexpr double autoTuneMinGain = 0.1;
+	// rounds to wait after a plateau or server errors before trying more connections again
+	static const int autoTuneHoldRounds = 10;
+	// at this share of the rate limit more connections cannot make the download faster
+	static constexpr double rateLimitSaturation = 0.9;
+	// work is moved off a mirror whose connections get less than this share of the best mirror's
+	static constexpr double mirrorSlowShare = 0.25;
+	// at most one section is moved to another mirror this often
+	static const ULONGLONG mirrorMoveInterval = 5000;
+	// failures and moved work count against a mirror, half as much after this many milliseconds
+	static const ULONGLONG mirrorErrorHalfLife = 10000;
+	struct Mirror
+	{
+		std::wstring Url;
+		// has served a response matching the content being downloaded
+		bool Validated = false;
+		// served other content or refused ranges before ever being validated, not used again
+		bool Rejected = false;
+		// of its sections receiving data right now, and the sections using it
+		double Throughput = 0;
+		int Sections = 0;
+		// bytes per second of one of its connections when last measured
+		double PerConnection = 0;
+		int Failures = 0;
+		double ErrorScore = 0;
+	};
+	// SummarySection->Url first, then download->Mirrors
+	std::vector<Mirror> mirrors;
+	// the content being downloaded as told by the first response of this run, mirrors have to match it
+	bool contentKnown = false;
+	bool rangesSupported = false;
+	long long contentLength = (-1);
+	std::wstring contentLastModified;
+	std::wstring contentETag;
+	// sections whose failure has been counted against their mirror
+	std::set<DownloadSection*> failedSections;
+	ULONGLONG mirrorMoveTime = 0;
+	ULONGLONG mirrorDecayTime = 0;
+	int mirrorMoves = 0;
+	std::vector<Downloader*> downloaders;
+	// connections allowed right now, download->NoDownloader unless it is tuned automatically
+	int noDownloader = 0;
+	// connections granted by a DownloadManager sharing them among downloads, zero when running on its own
+	int connectionLimit = 0;
+	// shared by the downloaders of this download, follows download->MaxBytesPerSecond
+	RateLimiter::Bucket rateBucket;
+	RateLimiter::Bucket* hostBucket = NULL;
+	// the manifest is rewritten at least this often in milliseconds while downloading, and whenever sections are added
+	static const ULONGLONG manifestSaveInterval = 5000;
+	ULONGLONG manifestSaveTime = 0;
+	size_t manifestSectionCount = 0;
+	ULONGLONG autoTuneTime = 0;
+	time_t autoTuneStatusTime = 0;
+	long long autoTuneBytes = 0;
+	double autoTuneThroughput = 0;
+	bool autoTuneSteppedUp = false;
+	int autoTuneHold = 0;
+	Download* download = NULL;
+	DownloadSection* sectionBeingEvaluated = NULL;
+	bool downloadStopFlag = false;
+	bool outputFilePreallocated = false;
+	bool preSplitDone = false;
+	// estimated seconds of completion time removed by throughput-aware splitting, compared with halving the biggest section
+	double tailTimeSaved = 0;
+	double tailTimeSavedBySectionBeingEvaluated = 0;
+	// duplicates of the last sections racing their original section, which is kept in Tag
+	std::vector<DownloadSection*> endGameSections;
+	// losing or failed duplicates, kept until downloaders no longer refer to them
+	std::vector<DownloadSection*> retiredEndGameSections;
+	int endGameRaces = 0;
+	int endGameWins = 0;
+	double endGameTimeSaved = 0;
+	// BLAKE3 of the finished file in hex, and how much of the file had to be read again for it
+	std::wstring digest;
+	long long digestBytesRead = 0;
+	// sections downloading corrupt pieces again, outside the section chain since they overwrite bytes of it
+	std::vector<DownloadSection*> pieceSections;
+	// downloads of each piece so far, the first included
+	std::vector<int> pieceDownloads;
+	int piecesRefetched = 0;
+	// copied from the seed file instead of being downloaded
+	long long seedBytesCopied = 0;
+	// a thread of its own copies the start of the file to the stream as it comes in, so a slow reader does not hold up
+	// scheduling. It has written up to streamPosition, sections receive up to streamLimit, both offsets of the file.
+	static const DWORD streamInterval = 100;
+	HANDLE hStreamThread = NULL;
+	HANDLE hStreamEvent = NULL;
+	long long streamPosition = 0;
+	volatile long long streamLimit = 0;
+	// the limit paused downloaders were last told about
+	long long streamLimitNotified = 0;
+	// the download is over, the stream thread writes what is left and ends
+	bool streamFinishing = false;
+	bool streamFailed = false;
+	DWORD streamError = 0;
+	HANDLE hDownloadThread = NULL;
+	// auto reset event set by downloaders on section status changes, and by Stop
+	HANDLE hSchedulerEvent = NULL;
+	ULONGLONG startTime = 0;
+	// milliseconds from start until all allowed connections were downloading, zero until reached
+	ULONGLONG rampUpTime = 0;
+	CRITICAL_SECTION sectionsLock;
+	int FindFreeDownloader();
+	void StopDownloading();
+	int FindDownloaderBySection(DownloadSection* ds);
+	void DownloadSectionWithFreeDownloaderIfPossible(DownloadSection* ds);
+	void AutoDownloadSection(DownloadSection* ds);
+	void UpdateMirrors();
+	void MoveWorkOffSlowMirror();
+	double GetMirrorScore(int index, double averagePerConnection);
+	void AssignMirror(DownloadSection* ds);
+	bool ErrorAndUnstableSectionsExist();
+	static bool IsRefusedStatus(std::wstring statusCode);
+	void GiveUpOnRefusedSections();
+	void EvaluateStatusOfJustCreatedSectionIfExists();
+	void UpdateSectionThroughput();
+	double GetAverageThroughput();
+	double GetSectionThroughput(DownloadSection* ds, double averageThroughput);
+	double GetParentShareOfSplit(DownloadSection* ds, double averageThroughput);
+	double EstimateCompletionTime(int splitSectionIndex, double parentShare, double averageThroughput);
+	void PreSplitIfPossible();
+	void CreateNewSectionIfFeasible();
+	void CreateNewSectionInStreamWindow();
+	void StartEndGameIfFeasible();
+	void ResolveEndGameRaces();
+	void TryDownloadingAllUnfinishedSections();
+	void RefetchCorruptPieces();
+	bool CheckUncheckedPieces();
+	bool IsPieceWanted(long long index);
+	void PreallocateOutputFileIfPossible();
+	void MeasureRampUpTime();
+	int CountBusyDownloaders();
+	int GetConnectionLimit();
+	bool IsAtRateLimit();
+	void TuneNoDownloaderIfAuto();
+	void SaveManifestIfDue();
+	void ProcessSections();
+	bool IsSchedulerThreadAlive();
+	bool IsDownloadHalted();
+	static DWORD WINAPI DownloadThreadProc(LPVOID lParam);
+	void DownloadThreadStart();
+	static DWORD WINAPI StreamThreadProc(LPVOID lParam);
+	void StreamThreadStart();
+	bool StartStream();
+	bool FinishStream();
+	void StopStream();
+	long long GetContiguousEnd();
+	void MoveStreamLimit();
+	bool CloseStreamOutput();
+	bool JoinSectionsToFile();
+	bool RenameOutputFile(std::wstring fileNameWithPath);
+	bool SplitOutputFileByRange(std::wstring folderNameWithPath);
+	bool WriteZipArchive(std::wstring fileNameWithPath);
+	bool FinishRepair();
+	bool IsHashing();
+	bool VerifyDigest();
+	bool CopySeedBlocks();
+	bool VerifySha1();
+	void SetDownloadError(std::wstring errorMessage, DownloadStatus status = DownloadStatus::DownloadError);
+public:
+	bool IsDownloadResumable();
+	DownloadStatus GetDownloadStatus();
+	std::wstring GetDownloadStatusDescription();
+	std::wstring GetUrl();
+	std::wstring GetFileName();
+	std::wstring GetError();
+	long long GetTotalSize();
+	long long GetBytesDownloaded();
+	long long GetBytesRepaired();
+	std::vector<ByteRange> GetRepairedRanges();
+	std::wstring GetDigest();
+	int GetPiecesRefetched();
+	long long GetBytesReused();
+	long long GetBytesStreamed();
+	int GetActiveConnections();
+	int GetConnectionDemand();
+	void SetConnectionLimit(int limit);
+	void SetRateLimit(long long bytesPerSecond);
+	void Start();
+	void Stop(bool cancel, bool wait);
+	void WaitForFinish();
+	void CleanTempFiles();
+	Scheduler(Download* d);
+	~Scheduler();
+};
@@ -0,0 +1,336 @@
+#include "TreeHash.h"
+#include <cstring>
+
+static const DWORD iv[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+static const int messagePermutation[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+static const DWORD flagChunkStart = 1;
+static const DWORD flagChunkEnd = 2;
+static const DWORD flagParent = 4;
+static const DWORD flagRoot = 8;
+
+static inline DWORD RotateRight(DWORD x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline void G(DWORD* s, int a, int b, int c, int d, DWORD x, DWORD y)
+{
+	s[a] = s[a] + s[b] + x;
+	s[d] = RotateRight(s[d] ^ s[a], 16);
+	s[c] = s[c] + s[d];
+	s[b] = RotateRight(s[b] ^ s[c], 12);
+	s[a] = s[a] + s[b] + y;
+	s[d] = RotateRight(s[d] ^ s[a], 8);
+	s[c] = s[c] + s[d];
+	s[b] = RotateRight(s[b] ^ s[c], 7);
+}
+
+void TreeHash::Compress(const DWORD cv[8], const BYTE block[blockSize], long long counter, DWORD blockLength, DWORD flags, DWORD out[8])
+{
+	DWORD m[16], s[16];
+	for (int i = 0; i < 16; i++)
+	{
+		m[i] = (DWORD)block[i * 4] | ((DWORD)block[i * 4 + 1] << 8) | ((DWORD)block[i * 4 + 2] << 16) | ((DWORD)block[i * 4 + 3] << 24);
+	}
+	for (int i = 0; i < 8; i++) s[i] = cv[i];
+	for (int i = 0; i < 4; i++) s[i + 8] = iv[i];
+	s[12] = (DWORD)counter;
+	s[13] = (DWORD)((unsigned long long)counter >> 32);
+	s[14] = blockLength;
+	s[15] = flags;
+	for (int round = 0; round < 7; round++)
+	{
+		G(s, 0, 4, 8, 12, m[0], m[1]);
+		G(s, 1, 5, 9, 13, m[2], m[3]);
+		G(s, 2, 6, 10, 14, m[4], m[5]);
+		G(s, 3, 7, 11, 15, m[6], m[7]);
+		G(s, 0, 5, 10, 15, m[8], m[9]);
+		G(s, 1, 6, 11, 12, m[10], m[11]);
+		G(s, 2, 7, 8, 13, m[12], m[13]);
+		G(s, 3, 4, 9, 14, m[14], m[15]);
+		if (round == 6) break;
+		DWORD permuted[16];
+		for (int i = 0; i < 16; i++) permuted[i] = m[messagePermutation[i]];
+		memcpy(m, permuted, sizeof(m));
+	}
+	for (int i = 0; i < 8; i++) out[i] = s[i] ^ s[i + 8];
+};
+
+void TreeHash::HashChunk(const BYTE* data, DWORD length, long long chunk, bool isRoot, DWORD out[8])
+{
+	// every block of a chunk carries the index of the chunk, an empty file is one empty block
+	DWORD cv[8];
+	memcpy(cv, iv, sizeof(cv));
+	DWORD offset = 0;
+	do
+	{
+		BYTE block[blockSize] = {};
+		DWORD blockLength = length - offset > blockSize ? blockSize : length - offset;
+		memcpy(block, data + offset, blockLength);
+		DWORD flags = offset == 0 ? flagChunkStart : 0;
+		if (offset + blockLength == length) flags |= flagChunkEnd | (isRoot ? flagRoot : 0);
+		Compress(cv, block, chunk, blockLength, flags, cv);
+		offset += blockLength;
+	} while (offset < length);
+	memcpy(out, cv, sizeof(cv));
+};
+
+void TreeHash::HashParent(const DWORD left[8], const DWORD right[8], bool isRoot, DWORD out[8])
+{
+	BYTE block[blockSize];
+	for (int i = 0; i < 16; i++)
+	{
+		DWORD word = i < 8 ? left[i] : right[i - 8];
+		for (int j = 0; j < 4; j++) block[i * 4 + j] = (BYTE)(word >> (8 * j));
+	}
+	Compress(iv, block, 0, blockSize, flagParent | (isRoot ? flagRoot : 0), out);
+};
+
+void TreeHash::PushNode(Node node)
+{
+	// the first chunk stays in head, so no node starts there and none can turn out to be the root of the tree
+	nodes.push_back(node);
+	while (nodes.size() >= 2)
+	{
+		Node& left = nodes[nodes.size() - 2];
+		Node& right = nodes.back();
+		if (left.Level != right.Level || left.Chunk + (1LL << left.Level) != right.Chunk || left.Chunk % (2LL << left.Level) != 0) break;
+		Node joined;
+		joined.Chunk = left.Chunk;
+		joined.Level = left.Level + 1;
+		HashParent(left.Cv, right.Cv, false, joined.Cv);
+		nodes.pop_back();
+		nodes.back() = joined;
+	}
+};
+
+void TreeHash::Reset()
+{
+	start = end = (-1);
+	head.clear();
+	tail.clear();
+	nodes.clear();
+};
+
+long long TreeHash::GetStart()
+{
+	return start;
+};
+
+long long TreeHash::GetEnd()
+{
+	return end;
+};
+
+void TreeHash::Update(long long offset, const BYTE* data, DWORD length)
+{
+	if (end != offset || start < 0)
+	{
+		Reset();
+		start = end = offset;
+	}
+	long long headEnd = start == 0 ? chunkSize : (start + chunkSize - 1) / chunkSize * chunkSize;
+	while (length > 0)
+	{
+		DWORD count;
+		if (end < headEnd)
+		{
+			count = headEnd - end < length ? (DWORD)(headEnd - end) : length;
+			head.insert(head.end(), data, data + count);
+		}
+		else if (tail.empty() && length >= chunkSize)
+		{
+			// whole chunks are hashed where they are
+			count = chunkSize;
+			Node node;
+			node.Chunk = end / chunkSize;
+			node.Level = 0;
+			HashChunk(data, chunkSize, node.Chunk, false, node.Cv);
+			PushNode(node);
+		}
+		else
+		{
+			count = chunkSize - (DWORD)tail.size() < length ? chunkSize - (DWORD)tail.size() : length;
+			tail.insert(tail.end(), data, data + count);
+			if (tail.size() == chunkSize)
+			{
+				Node node;
+				node.Chunk = (end + count) / chunkSize - 1;
+				node.Level = 0;
+				HashChunk(tail.data(), chunkSize, node.Chunk, false, node.Cv);
+				PushNode(node);
+				tail.clear();
+			}
+		}
+		data += count;
+		length -= count;
+		end += count;
+	}
+};
+
+bool TreeHash::GetChunkBytes(std::vector<TreeHash*>& hashes, HANDLE hFile, long long offset, DWORD length, LPBYTE bytes)
+{
+	// the bytes of a chunk cut apart by the ends of sections are kept by the sections on both sides
+	std::vector<bool> covered(length, false);
+	DWORD coveredCount = 0;
+	for (TreeHash* hash : hashes)
+	{
+		Piece pieces[2] = { { hash->start, hash->head }, { hash->end - (long long)hash->tail.size(), hash->tail } };
+		for (Piece& piece : pieces)
+		{
+			for (size_t i = 0; i < piece.Bytes.size(); i++)
+			{
+				long long index = piece.Offset + (long long)i - offset;
+				if (index < 0 || index >= length || covered[(size_t)index]) continue;
+				bytes[index] = piece.Bytes[i];
+				covered[(size_t)index] = true;
+				coveredCount++;
+			}
+		}
+	}
+	if (coveredCount == length) return true;
+	LARGE_INTEGER li;
+	li.QuadPart = offset;
+	DWORD bytesRead = 0;
+	return SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) && ReadFile(hFile, bytes, length, &bytesRead, NULL) && bytesRead == length;
+};
+
+bool TreeHash::HashSubtree(std::vector<TreeHash*>& hashes, HANDLE hFile, long long fileSize, long long chunk, long long chunks, bool isRoot, DWORD out[8])
+{
+	// a subtree of 2^n chunks at a multiple of 2^n may have been hashed by a section already
+	int level = 0;
+	while ((1LL << level) < chunks) level++;
+	if (!isRoot && (1LL << level) == chunks && chunk % chunks == 0)
+	{
+		for (TreeHash* hash : hashes)
+		{
+			for (Node& node : hash->nodes)
+			{
+				if (node.Chunk != chunk || node.Level != level) continue;
+				memcpy(out, node.Cv, sizeof(node.Cv));
+				return true;
+			}
+		}
+	}
+	if (chunks == 1)
+	{
+		BYTE bytes[chunkSize];
+		long long offset = chunk * chunkSize;
+		DWORD length = fileSize - offset < chunkSize ? (DWORD)(fileSize - offset) : chunkSize;
+		if (!GetChunkBytes(hashes, hFile, offset, length, bytes)) return false;
+		HashChunk(bytes, length, chunk, isRoot, out);
+		return true;
+	}
+	// the left subtree holds the largest power of two chunks that leaves some for the right one
+	long long leftChunks = 1;
+	while (leftChunks * 2 < chunks) leftChunks *= 2;
+	DWORD left[8], right[8];
+	if (!HashSubtree(hashes, hFile, fileSize, chunk, leftChunks, false, left)) return false;
+	if (!HashSubtree(hashes, hFile, fileSize, chunk + leftChunks, chunks - leftChunks, false, right)) return false;
+	HashParent(left, right, isRoot, out);
+	return true;
+};
+
+bool TreeHash::Combine(std::vector<TreeHash*> hashes, long long fileSize, HANDLE hFile, BYTE digest[DigestSize], long long* bytesRead)
+{
+	*bytesRead = 0;
+	// parts of the file no section has hashed, because they were downloaded before a restart or their data was
+	// written again from another position, are read and hashed here
+	std::vector<TreeHash> gapHashes;
+	std::vector<std::pair<long long, long long>> gaps;
+	long long position = 0;
+	while (position < fileSize)
+	{
+		long long coveredTo = position;
+		for (TreeHash* hash : hashes)
+		{
+			if (hash->start >= 0 && hash->start <= position && hash->end > coveredTo) coveredTo = hash->end;
+		}
+		if (coveredTo > position)
+		{
+			position = coveredTo;
+			continue;
+		}
+		long long gapEnd = fileSize;
+		for (TreeHash* hash : hashes)
+		{
+			if (hash->start > position && hash->start < gapEnd) gapEnd = hash->start;
+		}
+		gaps.push_back(std::make_pair(position, gapEnd));
+		position = gapEnd;
+	}
+	gapHashes.resize(gaps.size());
+	std::vector<BYTE> buffer;
+	for (size_t i = 0; i < gaps.size(); i++)
+	{
+		if (buffer.empty()) buffer.resize(1048576);
+		LARGE_INTEGER li;
+		li.QuadPart = gaps[i].first;
+		if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN)) return false;
+		for (long long offset = gaps[i].first; offset < gaps[i].second;)
+		{
+			DWORD length = gaps[i].second - offset < (long long)buffer.size() ? (DWORD)(gaps[i].second - offset) : (DWORD)buffer.size();
+			DWORD bytesReadThisTime = 0;
+			if (!ReadFile(hFile, buffer.data(), length, &bytesReadThisTime, NULL) || bytesReadThisTime != length) return false;
+			gapHashes[i].Update(offset, buffer.data(), length);
+			offset += length;
+		}
+		*bytesRead += gaps[i].second - gaps[i].first;
+		hashes.push_back(&gapHashes[i]);
+	}
+	DWORD out[8];
+	long long chunks = fileSize == 0 ? 1 : (fileSize + chunkSize - 1) / chunkSize;
+	if (!HashSubtree(hashes, hFile, fileSize, 0, chunks, true, out)) return false;
+	for (int i = 0; i < 32; i++) digest[i] = (BYTE)(out[i / 4] >> (8 * (i % 4)));
+	return true;
+};
+
+std::wstring TreeHash::ToHex(const BYTE* data, DWORD length)
+{
+	static const wchar_t digits[] = L"0123456789abcdef";
+	std::wstring hex;
+	for (DWORD i = 0; i < length; i++)
+	{
+		hex += digits[data[i] >> 4];
+		hex += digits[data[i] & 15];
+	}
+	return hex;
+};
+
+bool TreeHash::ParseDigest(std::wstring text, BYTE digest[DigestSize])
+{
+	// hex as printed by b3sum, or base64 as in Digest headers, where it may be wrapped in colons
+	if (text.size() >= 2 && text.front() == L':' && text.back() == L':') text = text.substr(1, text.size() - 2);
+	if (text.size() == DigestSize * 2)
+	{
+		for (DWORD i = 0; i < DigestSize * 2; i++)
+		{
+			wchar_t c = text[i];
+			int value = c >= L'0' && c <= L'9' ? c - L'0' : c >= L'a' && c <= L'f' ? c - L'a' + 10 : c >= L'A' && c <= L'F' ? c - L'A' + 10 : (-1);
+			if (value < 0) return false;
+			if (i % 2 == 0) digest[i / 2] = (BYTE)(value << 4);
+			else digest[i / 2] |= (BYTE)value;
+		}
+		return true;
+	}
+	static const std::wstring alphabet = L"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::vector<BYTE> bytes;
+	DWORD bits = 0;
+	int bitCount = 0;
+	for (wchar_t c : text)
+	{
+		if (c == L'=') break;
+		size_t value = alphabet.find(c);
+		if (value == std::wstring::npos) return false;
+		bits = (bits << 6) | (DWORD)value;
+		bitCount += 6;
+		if (bitCount >= 8)
+		{
+			bitCount -= 8;
+			bytes.push_back((BYTE)(bits >> bitCount));
+		}
+	}
+	if (bytes.size() != DigestSize) return false;
+	memcpy(digest, bytes.data(), DigestSize);
+	return true;
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+
+// BLAKE3 of a file computed piece by piece while its sections arrive, in any order.
+// BLAKE3 cuts the file in chunks of 1 KB and hashes them into a binary tree, whose subtrees of 2^n chunks
+// starting at a multiple of 2^n are the same whatever else the file holds. Every section keeps such subtrees
+// of the part it has received, and the bytes of the chunks cut apart at its ends; Combine puts the subtrees
+// of all sections together into the hash of the file, reading only the parts no section has hashed.
+class TreeHash
+{
+private:
+	static const DWORD chunkSize = 1024;
+	static const DWORD blockSize = 64;
+	struct Node
+	{
+		// first chunk, and 2^Level chunks below the node
+		long long Chunk;
+		int Level;
+		DWORD Cv[8];
+	};
+	struct Piece
+	{
+		long long Offset;
+		std::vector<BYTE> Bytes;
+	};
+	// position in the file of the first and after the last hashed byte, -1 if nothing has been hashed
+	long long start = (-1);
+	long long end = (-1);
+	// bytes before the first chunk boundary, and the first chunk of the file which can only be hashed when its size is known
+	std::vector<BYTE> head;
+	// bytes of the last chunk, which is not complete yet
+	std::vector<BYTE> tail;
+	// complete subtrees in file order, neighbours of the same size are joined as soon as they can
+	std::vector<Node> nodes;
+	static void Compress(const DWORD cv[8], const BYTE block[blockSize], long long counter, DWORD blockLength, DWORD flags, DWORD out[8]);
+	static void HashChunk(const BYTE* data, DWORD length, long long chunk, bool root, DWORD out[8]);
+	static void HashParent(const DWORD left[8], const DWORD right[8], bool root, DWORD out[8]);
+	void PushNode(Node node);
+	static bool GetChunkBytes(std::vector<TreeHash*>& hashes, HANDLE hFile, long long offset, DWORD length, LPBYTE bytes);
+	static bool HashSubtree(std::vector<TreeHash*>& hashes, HANDLE hFile, long long fileSize, long long chunk, long long chunks, bool root, DWORD out[8]);
+public:
+	static const DWORD DigestSize = 32;
+	void Reset();
+	long long GetStart();
+	long long GetEnd();
+	// the bytes at this position in the file. Bytes which do not follow the ones hashed before start the hash again there.
+	void Update(long long offset, const BYTE* data, DWORD length);
+	// the hash of the file of this size from the parts the hashes have covered, the rest is read from hFile.
+	// bytesRead tells how much had to be read. False if the file could not be read.
+	static bool Combine(std::vector<TreeHash*> hashes, long long fileSize, HANDLE hFile, BYTE digest[DigestSize], long long* bytesRead);
+	static std::wstring ToHex(const BYTE* data, DWORD length);
+	// hex or base64 digest into bytes, false if it is neither or has another size
+	static bool ParseDigest(std::wstring text, BYTE digest[DigestSize]);
+};
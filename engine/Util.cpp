@@ -0,0 +1,101 @@
+#include "Util.h"
+#include <tuple>
+#include <cwctype>
+#include <windows.h>
+
+#ifdef _WIN32
+static const wchar_t PathSeparator = L'\\';
+#else
+static const wchar_t PathSeparator = L'/';
+#endif
+
+std::wstring Util::CreateGuid()
+{
+	UUID uuid;
+	RPC_WSTR szUuid = NULL;
+	std::wstring guid;
+	std::ignore = UuidCreate(&uuid);
+	std::ignore = UuidToStringW(&uuid, &szUuid);
+	guid = (WCHAR*)szUuid;
+	RpcStringFreeW(&szUuid);
+	return guid;
+};
+
+std::wstring Util::UrlGetFileName(std::wstring url)
+{
+	size_t indexSlash = url.find_last_of(L"/\\");
+	if (indexSlash != std::wstring::npos)
+	{
+		url.erase(0, indexSlash + 1);
+		size_t indexQuestionMark = url.find_first_of(L'?');
+		if (indexQuestionMark != std::wstring::npos)
+		{
+			url = url.substr(0, indexQuestionMark);
+		}
+	}
+	if (url.length() == 0)
+	{
+		url = L"download_file";
+	}
+	for (size_t i = 0; i < url.length(); i++)
+	{
+		wchar_t c = url[i];
+		if (c == L'\\' || c == L'/' ||
+			c == L':' || c == L'*' ||
+			c == L'?' || c == L'"' ||
+			c == L'<' || c == L'>' ||
+			c == L'|')
+			url[i] = L'_';
+	}
+	return url;
+};
+
+std::wstring Util::UrlGetHostName(std::wstring url)
+{
+	// host and port of the URL in lower case, without user name and password
+	size_t indexScheme = url.find(L"://");
+	if (indexScheme != std::wstring::npos) url.erase(0, indexScheme + 3);
+	size_t indexPath = url.find_first_of(L"/?#");
+	if (indexPath != std::wstring::npos) url = url.substr(0, indexPath);
+	size_t indexAt = url.find_last_of(L'@');
+	if (indexAt != std::wstring::npos) url.erase(0, indexAt + 1);
+	for (size_t i = 0; i < url.length(); i++)
+	{
+		url[i] = towlower(url[i]);
+	}
+	return url;
+};
+
+std::wstring Util::CombinePathAndFileName(std::wstring path, std::wstring file)
+{
+	if (path.length() > 0)
+	{
+		if (path[path.length() - 1] == L'\\' || path[path.length() - 1] == L'/')
+		{
+			return path + file;
+		}
+		else
+		{
+			return path + PathSeparator + file;
+		}
+	}
+	return file;
+};
+
+std::string Util::ToUtf8(std::wstring str)
+{
+	if (str.empty()) return std::string();
+	int size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.length(), NULL, 0, NULL, NULL);
+	std::string ret(size, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.length(), &ret[0], size, NULL, NULL);
+	return ret;
+};
+
+std::wstring Util::FromUtf8(std::string str)
+{
+	if (str.empty()) return std::wstring();
+	int size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), NULL, 0);
+	std::wstring ret(size, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), &ret[0], size);
+	return ret;
+};
\ No newline at end of file
@@ -6,5 +6,8 @@ class Util
 public:
 	static std::wstring CreateGuid();
 	static std::wstring UrlGetFileName(std::wstring url);
+	static std::wstring UrlGetHostName(std::wstring url);
 	static std::wstring CombinePathAndFileName(std::wstring path, std::wstring file);
+	static std::string ToUtf8(std::wstring str);
+	static std::wstring FromUtf8(std::string str);
 };
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "ZipArchive.h"
+#include "Util.h"
+#include <algorithm>
+
+static const DWORD endRecordSignature = 0x06054b50;
+static const DWORD zip64LocatorSignature = 0x07064b50;
+static const DWORD zip64EndRecordSignature = 0x06064b50;
+static const DWORD directoryRecordSignature = 0x02014b50;
+
+static bool CopyFileRange(HANDLE hSource, long long position, long long length, HANDLE hDest, LPBYTE buffer, DWORD bufferLength)
+{
+	LARGE_INTEGER li;
+	li.QuadPart = position;
+	BOOL bResults = SetFilePointerEx(hSource, li, NULL, FILE_BEGIN);
+	while (bResults && length > 0)
+	{
+		DWORD dwNumberOfBytesRead = 0, dwNumberOfBytesWritten = 0;
+		bResults = ReadFile(hSource, buffer, length < bufferLength ? (DWORD)length : bufferLength, &dwNumberOfBytesRead, NULL);
+		// the member has to be in the file whole, a short read means it is not
+		if (bResults && dwNumberOfBytesRead == 0)
+		{
+			SetLastError(ERROR_HANDLE_EOF);
+			bResults = FALSE;
+		}
+		if (bResults) bResults = WriteFile(hDest, buffer, dwNumberOfBytesRead, &dwNumberOfBytesWritten, NULL);
+		length -= dwNumberOfBytesRead;
+	}
+	return bResults;
+}
+
+static bool WriteString(HANDLE hDest, const std::string& data)
+{
+	DWORD dwNumberOfBytesWritten = 0;
+	return WriteFile(hDest, data.data(), (DWORD)data.length(), &dwNumberOfBytesWritten, NULL) && dwNumberOfBytesWritten == data.length();
+}
+
+WORD ZipArchive::ReadWord(const std::string& data, size_t position)
+{
+	return (WORD)((BYTE)data[position] | ((BYTE)data[position + 1] << 8));
+};
+
+DWORD ZipArchive::ReadDword(const std::string& data, size_t position)
+{
+	return (DWORD)ReadWord(data, position) | ((DWORD)ReadWord(data, position + 2) << 16);
+};
+
+long long ZipArchive::ReadQword(const std::string& data, size_t position)
+{
+	return (long long)((unsigned long long)ReadDword(data, position) | ((unsigned long long)ReadDword(data, position + 4) << 32));
+};
+
+void ZipArchive::WriteWord(std::string& data, WORD value)
+{
+	data.push_back((char)(value & 0xFF));
+	data.push_back((char)(value >> 8));
+};
+
+void ZipArchive::WriteDword(std::string& data, DWORD value)
+{
+	WriteWord(data, (WORD)(value & 0xFFFF));
+	WriteWord(data, (WORD)(value >> 16));
+};
+
+void ZipArchive::WriteQword(std::string& data, long long value)
+{
+	WriteDword(data, (DWORD)((unsigned long long)value & 0xFFFFFFFF));
+	WriteDword(data, (DWORD)((unsigned long long)value >> 32));
+};
+
+bool ZipArchive::ParseTail(const std::string& tail, long long archiveSize, std::wstring& error)
+{
+	long long tailStart = archiveSize - (long long)tail.length();
+	// the end of central directory record is the last one in the file, its comment runs up to the end of the file
+	size_t position = std::string::npos;
+	for (size_t i = tail.length() >= endRecordSize ? tail.length() - endRecordSize + 1 : 0; i > 0; i--)
+	{
+		if (ReadDword(tail, i - 1) == endRecordSignature && i - 1 + endRecordSize + ReadWord(tail, i - 1 + 20) <= tail.length())
+		{
+			position = i - 1;
+			break;
+		}
+	}
+	if (position == std::string::npos)
+	{
+		error = L"Not a ZIP archive.";
+		return false;
+	}
+	if (ReadWord(tail, position + 4) != 0 || ReadWord(tail, position + 6) != 0)
+	{
+		error = L"ZIP archives split over several files are not supported.";
+		return false;
+	}
+	MemberCount = ReadWord(tail, position + 10);
+	DirectorySize = ReadDword(tail, position + 12);
+	DirectoryOffset = ReadDword(tail, position + 16);
+	long long directoryEnd = tailStart + position;
+
+	// a ZIP64 archive has its sizes in another record, found through the locator right before this one
+	if (position >= zip64LocatorSize && ReadDword(tail, position - zip64LocatorSize) == zip64LocatorSignature)
+	{
+		long long recordOffset = ReadQword(tail, position - zip64LocatorSize + 8);
+		// the offset is wrong by the length of data prepended to the archive, the record is then right before the locator
+		size_t recordPosition = std::string::npos;
+		if (recordOffset >= tailStart && recordOffset - tailStart + zip64EndRecordSize <= (long long)tail.length() &&
+			ReadDword(tail, (size_t)(recordOffset - tailStart)) == zip64EndRecordSignature)
+		{
+			recordPosition = (size_t)(recordOffset - tailStart);
+		}
+		else if (position >= zip64LocatorSize + zip64EndRecordSize &&
+			ReadDword(tail, position - zip64LocatorSize - zip64EndRecordSize) == zip64EndRecordSignature)
+		{
+			recordPosition = position - zip64LocatorSize - zip64EndRecordSize;
+		}
+		if (recordPosition == std::string::npos)
+		{
+			error = L"ZIP64 end of central directory record not found.";
+			return false;
+		}
+		MemberCount = ReadQword(tail, recordPosition + 32);
+		DirectorySize = ReadQword(tail, recordPosition + 40);
+		DirectoryOffset = ReadQword(tail, recordPosition + 48);
+		directoryEnd = tailStart + recordPosition;
+	}
+
+	prependedBytes = directoryEnd - DirectorySize - DirectoryOffset;
+	if (prependedBytes < 0 || DirectorySize < 0 || MemberCount < 0)
+	{
+		error = L"Invalid ZIP archive.";
+		return false;
+	}
+	DirectoryOffset += prependedBytes;
+	return true;
+};
+
+bool ZipArchive::ParseDirectory(const std::string& directory, std::wstring& error)
+{
+	Members.clear();
+	size_t position = 0;
+	while (position + directoryRecordSize <= directory.length() && ReadDword(directory, position) == directoryRecordSignature)
+	{
+		ZipMember member;
+		size_t nameLength = ReadWord(directory, position + 28);
+		size_t extraLength = ReadWord(directory, position + 30);
+		size_t recordLength = directoryRecordSize + nameLength + extraLength + ReadWord(directory, position + 32);
+		if (position + recordLength > directory.length()) break;
+		member.Record = directory.substr(position, recordLength);
+		member.Name = Util::FromUtf8(member.Record.substr(directoryRecordSize, nameLength));
+		member.CompressedSize = ReadDword(member.Record, 20);
+		member.UncompressedSize = ReadDword(member.Record, 24);
+		member.LocalHeaderOffset = ReadDword(member.Record, 42);
+		member.OffsetField = 42;
+
+		// sizes and offsets too large for their fields are in the ZIP64 extra field, in this order, only the ones that are too large
+		size_t extra = directoryRecordSize + nameLength;
+		while (extra + 4 <= directoryRecordSize + nameLength + extraLength)
+		{
+			WORD id = ReadWord(member.Record, extra);
+			size_t size = ReadWord(member.Record, extra + 2);
+			if (id == 0x0001)
+			{
+				size_t field = extra + 4;
+				if (member.UncompressedSize == 0xFFFFFFFF && field + 8 <= extra + 4 + size)
+				{
+					member.UncompressedSize = ReadQword(member.Record, field);
+					field += 8;
+				}
+				if (member.CompressedSize == 0xFFFFFFFF && field + 8 <= extra + 4 + size)
+				{
+					member.CompressedSize = ReadQword(member.Record, field);
+					field += 8;
+				}
+				if (member.LocalHeaderOffset == 0xFFFFFFFF && field + 8 <= extra + 4 + size)
+				{
+					member.LocalHeaderOffset = ReadQword(member.Record, field);
+					member.OffsetField = field;
+					member.Zip64Offset = true;
+				}
+				break;
+			}
+			extra += 4 + size;
+		}
+		member.LocalHeaderOffset += prependedBytes;
+		if (member.LocalHeaderOffset < prependedBytes || member.LocalHeaderOffset >= DirectoryOffset)
+		{
+			error = L"Invalid ZIP archive: member " + member.Name + L" lies outside the archive.";
+			return false;
+		}
+		Members.push_back(member);
+		position += recordLength;
+	}
+	// the number of members only fits 16 bits in an archive which is not ZIP64
+	if (Members.empty() || (MemberCount != 0xFFFF && (long long)Members.size() != MemberCount))
+	{
+		error = L"Invalid ZIP central directory.";
+		return false;
+	}
+
+	// a member ends where the next one starts, the last one where the central directory does
+	std::vector<ZipMember*> byOffset;
+	for (ZipMember& member : Members) byOffset.push_back(&member);
+	std::sort(byOffset.begin(), byOffset.end(), [](const ZipMember* a, const ZipMember* b) { return a->LocalHeaderOffset < b->LocalHeaderOffset; });
+	for (size_t i = 0; i < byOffset.size(); i++)
+	{
+		byOffset[i]->End = i + 1 < byOffset.size() ? byOffset[i + 1]->LocalHeaderOffset : DirectoryOffset;
+	}
+	return true;
+};
+
+std::vector<ByteRange> ZipArchive::GetRanges(std::vector<ZipMember>& members)
+{
+	std::vector<ByteRange> ranges;
+	for (ZipMember& member : members)
+	{
+		// members sharing their data with others have nothing of their own
+		if (member.End > member.LocalHeaderOffset) ranges.push_back({ member.LocalHeaderOffset, member.End - 1 });
+	}
+	DownloadSection::SortRanges(ranges);
+	return ranges;
+};
+
+bool ZipArchive::WriteArchive(HANDLE hSource, long long sourceOrigin, std::vector<ZipMember> members, HANDLE hDest, LPBYTE buffer, DWORD bufferLength, long long& bytesWritten)
+{
+	// members are written in the order they had in the archive, so none moves further from the start and its offset still fits its field
+	std::sort(members.begin(), members.end(), [](const ZipMember& a, const ZipMember& b) { return a.LocalHeaderOffset < b.LocalHeaderOffset; });
+	std::string directory;
+	long long memberCount = 0;
+	bytesWritten = 0;
+	for (ZipMember& member : members)
+	{
+		if (member.End <= member.LocalHeaderOffset) continue;
+		std::string offset;
+		if (member.Zip64Offset) WriteQword(offset, bytesWritten);
+		else WriteDword(offset, (DWORD)bytesWritten);
+		std::string record = member.Record;
+		record.replace(member.OffsetField, offset.length(), offset);
+		directory += record;
+		memberCount++;
+		if (!CopyFileRange(hSource, member.LocalHeaderOffset - sourceOrigin, member.End - member.LocalHeaderOffset, hDest, buffer, bufferLength)) return false;
+		bytesWritten += member.End - member.LocalHeaderOffset;
+	}
+
+	long long directoryOffset = bytesWritten;
+	std::string end;
+	if (memberCount >= 0xFFFF || directoryOffset >= 0xFFFFFFFF || (long long)directory.length() >= 0xFFFFFFFF)
+	{
+		WriteDword(end, zip64EndRecordSignature);
+		WriteQword(end, zip64EndRecordSize - 12);
+		WriteWord(end, 45);
+		WriteWord(end, 45);
+		WriteDword(end, 0);
+		WriteDword(end, 0);
+		WriteQword(end, memberCount);
+		WriteQword(end, memberCount);
+		WriteQword(end, (long long)directory.length());
+		WriteQword(end, directoryOffset);
+		WriteDword(end, zip64LocatorSignature);
+		WriteDword(end, 0);
+		WriteQword(end, directoryOffset + (long long)directory.length());
+		WriteDword(end, 1);
+	}
+	WriteDword(end, endRecordSignature);
+	WriteWord(end, 0);
+	WriteWord(end, 0);
+	WriteWord(end, (WORD)(memberCount >= 0xFFFF ? 0xFFFF : memberCount));
+	WriteWord(end, (WORD)(memberCount >= 0xFFFF ? 0xFFFF : memberCount));
+	WriteDword(end, (DWORD)(directory.length() >= 0xFFFFFFFF ? 0xFFFFFFFF : directory.length()));
+	WriteDword(end, (DWORD)(directoryOffset >= 0xFFFFFFFF ? 0xFFFFFFFF : directoryOffset));
+	WriteWord(end, 0);
+	if (!WriteString(hDest, directory) || !WriteString(hDest, end)) return false;
+	bytesWritten += (long long)(directory.length() + end.length());
+	return true;
+};
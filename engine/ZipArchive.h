@@ -0,0 +1,54 @@
+#pragma once
+#include "DownloadSection.h"
+#include <string>
+#include <vector>
+
+// a member of a ZIP archive as its central directory describes it
+struct ZipMember
+{
+	std::wstring Name;
+	long long LocalHeaderOffset = 0;
+	// where its local header, data and data descriptor end: at the next member or the central directory
+	long long End = 0;
+	long long CompressedSize = 0;
+	long long UncompressedSize = 0;
+	// its record in the central directory as it is, written again with the new position of the member
+	std::string Record;
+	// position of the local header offset in Record, 4 bytes, or 8 bytes if it is in the ZIP64 extra field
+	size_t OffsetField = 0;
+	bool Zip64Offset = false;
+};
+
+// the central directory of a ZIP archive, read from its end, so that single members can be downloaded without the rest.
+// Offsets are positions in the file, data prepended to the archive taken into account.
+class ZipArchive
+{
+private:
+	static const DWORD endRecordSize = 22;
+	static const DWORD zip64LocatorSize = 20;
+	static const DWORD zip64EndRecordSize = 56;
+	static const DWORD directoryRecordSize = 46;
+	// data before the archive, self-extracting archives have a program there. Offsets in the archive do not count it.
+	long long prependedBytes = 0;
+	static WORD ReadWord(const std::string& data, size_t position);
+	static DWORD ReadDword(const std::string& data, size_t position);
+	static long long ReadQword(const std::string& data, size_t position);
+	static void WriteWord(std::string& data, WORD value);
+	static void WriteDword(std::string& data, DWORD value);
+	static void WriteQword(std::string& data, long long value);
+public:
+	// bytes at the end of an archive which hold its end of central directory records, whatever the length of its comment
+	static const DWORD TailSize = 65535 + endRecordSize + zip64LocatorSize + zip64EndRecordSize;
+	long long DirectoryOffset = (-1);
+	long long DirectorySize = (-1);
+	long long MemberCount = 0;
+	std::vector<ZipMember> Members;
+	// the last bytes of the archive, at most TailSize of them
+	bool ParseTail(const std::string& tail, long long archiveSize, std::wstring& error);
+	bool ParseDirectory(const std::string& directory, std::wstring& error);
+	// the local headers and data of these members
+	static std::vector<ByteRange> GetRanges(std::vector<ZipMember>& members);
+	// writes an archive of just these members, whose bytes are at their offsets less sourceOrigin in hSource.
+	// The members are copied through the buffer, the bytes written are counted in bytesWritten.
+	static bool WriteArchive(HANDLE hSource, long long sourceOrigin, std::vector<ZipMember> members, HANDLE hDest, LPBYTE buffer, DWORD bufferLength, long long& bytesWritten);
+};
@@ -0,0 +1,319 @@
+#include "ZsyncIndex.h"
+#include "Util.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+static inline DWORD RotateLeft(DWORD x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline DWORD HashWeak(DWORD weak, DWORD bits)
+{
+	return (weak * 2654435761u) >> (32 - bits);
+}
+
+void ZsyncIndex::Md4(const BYTE* data, DWORD length, BYTE digest[16])
+{
+	static const int shifts[3][4] = { { 3, 7, 11, 19 }, { 3, 5, 9, 13 }, { 3, 9, 11, 15 } };
+	static const int order[3][16] = {
+		{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+		{ 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 },
+		{ 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 } };
+	static const DWORD constants[3] = { 0, 0x5a827999, 0x6ed9eba1 };
+	DWORD state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	// whole blocks of 64 bytes are hashed where they are, the rest with the padding: a one bit, zeros and the length in bits
+	BYTE tail[128] = { 0 };
+	DWORD tailStart = length / 64 * 64;
+	DWORD tailLength = length - tailStart < 56 ? 64 : 128;
+	memcpy(tail, data + tailStart, length - tailStart);
+	tail[length - tailStart] = 0x80;
+	unsigned long long bits = (unsigned long long)length * 8;
+	for (int i = 0; i < 8; i++) tail[tailLength - 8 + i] = (BYTE)(bits >> (8 * i));
+	for (DWORD offset = 0; offset < tailStart + tailLength; offset += 64)
+	{
+		const BYTE* block = offset < tailStart ? data + offset : tail + (offset - tailStart);
+		DWORD x[16];
+		for (int i = 0; i < 16; i++)
+		{
+			x[i] = (DWORD)block[i * 4] | ((DWORD)block[i * 4 + 1] << 8) | ((DWORD)block[i * 4 + 2] << 16) | ((DWORD)block[i * 4 + 3] << 24);
+		}
+		DWORD v[4] = { state[0], state[1], state[2], state[3] };
+		for (int round = 0; round < 3; round++)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				// the word changed goes round a, d, c, b, the other three follow it in the order a, b, c, d
+				int target = (4 - i % 4) % 4;
+				DWORD b = v[(target + 1) % 4], c = v[(target + 2) % 4], d = v[(target + 3) % 4];
+				DWORD f;
+				if (round == 0) f = (b & c) | (~b & d);
+				else if (round == 1) f = (b & c) | (b & d) | (c & d);
+				else f = b ^ c ^ d;
+				v[target] = RotateLeft(v[target] + f + x[order[round][i]] + constants[round], shifts[round][i % 4]);
+			}
+		}
+		for (int i = 0; i < 4; i++) state[i] += v[i];
+	}
+	for (int i = 0; i < 16; i++) digest[i] = (BYTE)(state[i / 4] >> (8 * (i % 4)));
+};
+
+// the weak checksum of zsync: the sum of the bytes, and the sum of the bytes weighted by their distance from the end,
+// both in 16 bits. Only the last bytes of them are kept in the index.
+void ZsyncIndex::WeakSums(const BYTE* data, WORD& a, WORD& b)
+{
+	a = 0;
+	b = 0;
+	for (DWORD i = 0; i < BlockSize; i++)
+	{
+		a += data[i];
+		b += (WORD)((BlockSize - i) * data[i]);
+	}
+};
+
+bool ZsyncIndex::IsBlockAt(long long index, const BYTE* data, DWORD weak)
+{
+	if (blocks[(size_t)index].Weak != weak) return false;
+	BYTE strong[16];
+	Md4(data, BlockSize, strong);
+	return memcmp(strong, blocks[(size_t)index].Strong, StrongBytes) == 0;
+};
+
+bool ZsyncIndex::Parse(std::string& content, std::wstring& error)
+{
+	// header lines of the form name: value up to an empty line, then the checksums of each block
+	size_t position = 0;
+	bool headerEnded = false;
+	while (position < content.length())
+	{
+		size_t lineEnd = content.find('\n', position);
+		if (lineEnd == std::string::npos) break;
+		std::string line = content.substr(position, lineEnd - position);
+		position = lineEnd + 1;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty())
+		{
+			headerEnded = true;
+			break;
+		}
+		size_t colon = line.find(": ");
+		if (colon == std::string::npos) continue;
+		std::string name = line.substr(0, colon);
+		std::string value = line.substr(colon + 2);
+		if (name == "Blocksize") BlockSize = strtoul(value.c_str(), NULL, 10);
+		else if (name == "Length") Length = strtoll(value.c_str(), NULL, 10);
+		else if (name == "URL") Urls.push_back(Util::FromUtf8(value));
+		else if (name == "SHA-1")
+		{
+			Sha1.clear();
+			for (size_t i = 0; i + 1 < value.length(); i += 2) Sha1.push_back((BYTE)strtoul(value.substr(i, 2).c_str(), NULL, 16));
+			if (Sha1.size() != 20) Sha1.clear();
+		}
+		else if (name == "Hash-Lengths")
+		{
+			SequenceMatches = atoi(value.c_str());
+			size_t comma = value.find(',');
+			WeakBytes = comma == std::string::npos ? 0 : atoi(value.c_str() + comma + 1);
+			comma = comma == std::string::npos ? comma : value.find(',', comma + 1);
+			StrongBytes = comma == std::string::npos ? 0 : atoi(value.c_str() + comma + 1);
+		}
+	}
+	if (!headerEnded || BlockSize == 0 || BlockSize > seedReadSize || Length <= 0 ||
+		SequenceMatches < 1 || SequenceMatches > 2 || WeakBytes < 1 || WeakBytes > 4 || StrongBytes < 3 || StrongBytes > 16)
+	{
+		error = L"Invalid zsync index.";
+		return false;
+	}
+	long long blockCount = (Length + BlockSize - 1) / BlockSize;
+	size_t blockEntrySize = WeakBytes + StrongBytes;
+	if ((long long)(content.length() - position) < blockCount * (long long)blockEntrySize)
+	{
+		error = L"The zsync index ends before the checksums of all blocks.";
+		return false;
+	}
+	weakMask = 0xFFFFFFFF >> (8 * (4 - WeakBytes));
+	blocks.resize((size_t)blockCount);
+	for (Block& block : blocks)
+	{
+		// the kept bytes are the last ones of the sum and the weighted sum, both big-endian
+		const BYTE* entry = (const BYTE*)content.data() + position;
+		block.Weak = 0;
+		for (int i = 0; i < WeakBytes; i++) block.Weak = (block.Weak << 8) | entry[i];
+		memset(block.Strong, 0, sizeof(block.Strong));
+		memcpy(block.Strong, entry + WeakBytes, StrongBytes);
+		position += blockEntrySize;
+	}
+	return true;
+};
+
+bool ZsyncIndex::Load(std::wstring indexFileName, std::wstring& error)
+{
+	HANDLE hFile = CreateFileW(indexFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		error = L"zsync index cannot be opened.";
+		return false;
+	}
+	std::string content;
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = 0;
+	BOOL bResults = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= maxIndexSize;
+	if (bResults)
+	{
+		DWORD dwNumberOfBytesRead = 0;
+		content.resize((size_t)fileSize.QuadPart);
+		bResults = ReadFile(hFile, &content[0], (DWORD)fileSize.QuadPart, &dwNumberOfBytesRead, NULL) && dwNumberOfBytesRead == fileSize.QuadPart;
+	}
+	CloseHandle(hFile);
+	if (!bResults)
+	{
+		error = L"zsync index cannot be read.";
+		return false;
+	}
+	return Parse(content, error);
+};
+
+bool ZsyncIndex::MatchSeed(std::wstring seedFileName, std::vector<SeedBlock>& seedBlocks, std::vector<ByteRange>& ranges, std::wstring& error)
+{
+	HANDLE hSeed = CreateFileW(seedFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hSeed)
+	{
+		error = L"Seed file cannot be opened.";
+		return false;
+	}
+	// the last block is always downloaded, so the download is never empty and ends where the file ends
+	long long matchableBlocks = (Length - 1) / BlockSize;
+	std::vector<long long> found(blocks.size(), -1);
+	// blocks sorted by weak checksum, and a table of bits telling in one look whether a weak checksum is worth searching for
+	std::vector<std::pair<DWORD, long long>> weakIndex;
+	std::vector<bool> weakTable((size_t)1 << weakTableBits, false);
+	for (long long i = 0; i < matchableBlocks; i++)
+	{
+		weakIndex.push_back(std::make_pair(blocks[(size_t)i].Weak, i));
+		weakTable[HashWeak(blocks[(size_t)i].Weak, weakTableBits)] = true;
+	}
+	std::sort(weakIndex.begin(), weakIndex.end());
+
+	// the window is rolled over the seed one byte at a time, and jumps a block ahead after a match.
+	// Two blocks are kept ahead of it in the buffer, for confirming a match with the block after it.
+	std::vector<BYTE> buffer(seedReadSize + 2 * BlockSize);
+	long long bufferOffset = 0;
+	DWORD bufferLength = 0;
+	DWORD position = 0;
+	bool seedEnded = false;
+	// weak checksums of the window and, when blocks have to match in pairs, of the one after it
+	bool weakValid = false, nextWeakValid = false;
+	WORD a = 0, b = 0, nextA = 0, nextB = 0;
+	BOOL bResults = TRUE;
+	while (true)
+	{
+		if (!seedEnded && position + 2 * BlockSize + 1 > bufferLength)
+		{
+			memmove(&buffer[0], &buffer[position], bufferLength - position);
+			bufferOffset += position;
+			bufferLength -= position;
+			position = 0;
+			DWORD dwNumberOfBytesRead = 0;
+			bResults = ReadFile(hSeed, &buffer[bufferLength], (DWORD)buffer.size() - bufferLength, &dwNumberOfBytesRead, NULL);
+			if (!bResults) break;
+			if (dwNumberOfBytesRead == 0) seedEnded = true;
+			bufferLength += dwNumberOfBytesRead;
+			continue;
+		}
+		if (position + BlockSize > bufferLength) break;
+		const BYTE* data = &buffer[position];
+		if (!weakValid)
+		{
+			WeakSums(data, a, b);
+			weakValid = true;
+		}
+		bool nextInBuffer = position + 2 * BlockSize <= bufferLength;
+		if (SequenceMatches > 1 && !nextWeakValid && nextInBuffer)
+		{
+			WeakSums(data + BlockSize, nextA, nextB);
+			nextWeakValid = true;
+		}
+		DWORD weak = (((DWORD)a << 16) | b) & weakMask;
+		DWORD nextWeak = (((DWORD)nextA << 16) | nextB) & weakMask;
+		bool matched = false;
+		if (weakTable[HashWeak(weak, weakTableBits)])
+		{
+			auto candidates = std::equal_range(weakIndex.begin(), weakIndex.end(), std::make_pair(weak, (long long)0),
+				[](const std::pair<DWORD, long long>& x, const std::pair<DWORD, long long>& y) { return x.first < y.first; });
+			for (auto candidate = candidates.first; candidate != candidates.second; candidate++)
+			{
+				long long i = candidate->second;
+				if (found[(size_t)i] >= 0) continue;
+				// with few checksum bytes kept, a block only counts when the one before or after it matches as well
+				bool previous = SequenceMatches == 1 || (i > 0 && found[(size_t)i - 1] == bufferOffset + position - BlockSize);
+				bool next = !previous && nextWeakValid && i + 1 < matchableBlocks && blocks[(size_t)i + 1].Weak == nextWeak;
+				if (!previous && !next) continue;
+				if (!IsBlockAt(i, data, weak) || (!previous && !IsBlockAt(i + 1, data + BlockSize, nextWeak))) continue;
+				found[(size_t)i] = bufferOffset + position;
+				matched = true;
+			}
+		}
+		if (matched)
+		{
+			// the window after the match is the one after it so far
+			position += BlockSize;
+			weakValid = nextWeakValid;
+			a = nextA;
+			b = nextB;
+			nextWeakValid = false;
+			continue;
+		}
+		if (position + BlockSize >= bufferLength) break;
+		BYTE oldByte = data[0];
+		BYTE newByte = data[BlockSize];
+		a += newByte - oldByte;
+		b += a - (WORD)(BlockSize * oldByte);
+		if (nextWeakValid && position + 2 * BlockSize < bufferLength)
+		{
+			nextA += data[2 * BlockSize] - newByte;
+			nextB += nextA - (WORD)(BlockSize * newByte);
+		}
+		else nextWeakValid = false;
+		position++;
+	}
+	CloseHandle(hSeed);
+	if (!bResults)
+	{
+		error = L"Seed file cannot be read. Error occurred: " + std::to_wstring(GetLastError());
+		return false;
+	}
+
+	// blocks found one after another in the seed are copied at once, the others are downloaded
+	seedBlocks.clear();
+	ranges.clear();
+	for (long long i = 0; i < (long long)blocks.size(); i++)
+	{
+		long long offset = i * BlockSize;
+		long long length = std::min((long long)BlockSize, Length - offset);
+		if (found[(size_t)i] >= 0)
+		{
+			if (!seedBlocks.empty() && seedBlocks.back().Offset + seedBlocks.back().Length == offset && seedBlocks.back().SeedOffset + seedBlocks.back().Length == found[(size_t)i])
+			{
+				seedBlocks.back().Length += length;
+			}
+			else
+			{
+				SeedBlock seedBlock;
+				seedBlock.SeedOffset = found[(size_t)i];
+				seedBlock.Offset = offset;
+				seedBlock.Length = length;
+				seedBlocks.push_back(seedBlock);
+			}
+		}
+		else if (!ranges.empty() && ranges.back().End + 1 == offset) ranges.back().End = offset + length - 1;
+		else
+		{
+			ByteRange range;
+			range.Start = offset;
+			range.End = offset + length - 1;
+			ranges.push_back(range);
+		}
+	}
+	return true;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include "Download.h"
+#include <string>
+#include <vector>
+
+// the block checksums of a file in the format of zsync: a weak checksum which can be rolled over a file one byte at a time,
+// and a part of the MD4 of each block. Blocks of an older copy of the file with the same checksums need not be downloaded.
+class ZsyncIndex
+{
+private:
+	static const long long maxIndexSize = 268435456;
+	// bits of the table telling quickly that no block has a weak checksum
+	static const DWORD weakTableBits = 20;
+	// seed data is read in pieces of this size
+	static const DWORD seedReadSize = 16777216;
+	struct Block
+	{
+		DWORD Weak;
+		BYTE Strong[16];
+	};
+	std::vector<Block> blocks;
+	DWORD weakMask = 0;
+	void WeakSums(const BYTE* data, WORD& a, WORD& b);
+	bool IsBlockAt(long long index, const BYTE* data, DWORD weak);
+	static void Md4(const BYTE* data, DWORD length, BYTE digest[16]);
+public:
+	DWORD BlockSize = 0;
+	long long Length = (-1);
+	// blocks which have to match one after another before they are taken, 1 or 2
+	int SequenceMatches = 1;
+	int WeakBytes = 4;
+	int StrongBytes = 16;
+	// as given in the index, possibly relative to where the index is
+	std::vector<std::wstring> Urls;
+	std::vector<BYTE> Sha1;
+	// false with error telling why if the index cannot be read
+	bool Load(std::wstring indexFileName, std::wstring& error);
+	bool Parse(std::string& content, std::wstring& error);
+	// finds the blocks of the file in the seed file. The blocks which are not there end up in ranges, the last block always.
+	bool MatchSeed(std::wstring seedFileName, std::vector<SeedBlock>& seedBlocks, std::vector<ByteRange>& ranges, std::wstring& error);
+};
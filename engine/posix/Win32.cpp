@@ -0,0 +1,1001 @@
+#include <windows.h>
+#include <psapi.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <winioctl.h>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cwctype>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	thread_local DWORD lastError = NO_ERROR;
+
+	// every HANDLE handed out points to one of these
+	struct Object
+	{
+		virtual ~Object() {}
+		virtual DWORD Wait(DWORD dwMilliseconds)
+		{
+			lastError = ERROR_INVALID_HANDLE;
+			return WAIT_FAILED;
+		}
+	};
+
+	struct Event : Object
+	{
+		std::mutex Lock;
+		std::condition_variable Signaled;
+		bool ManualReset = false;
+		bool State = false;
+
+		DWORD Wait(DWORD dwMilliseconds) override
+		{
+			std::unique_lock<std::mutex> lock(Lock);
+			// polling only looks at the state, wait_for would still go through the condition variable
+			if (dwMilliseconds == 0)
+			{
+				if (!State) return WAIT_TIMEOUT;
+			}
+			else if (dwMilliseconds == INFINITE)
+			{
+				Signaled.wait(lock, [this] { return State; });
+			}
+			else if (!Signaled.wait_for(lock, std::chrono::milliseconds(dwMilliseconds), [this] { return State; }))
+			{
+				return WAIT_TIMEOUT;
+			}
+			if (!ManualReset) State = false;
+			return WAIT_OBJECT_0;
+		}
+	};
+
+	// shared with the thread itself, so closing the handle does not have to wait for the thread
+	struct ThreadState
+	{
+		std::mutex Lock;
+		std::condition_variable Exited;
+		bool Finished = false;
+	};
+
+	struct Thread : Object
+	{
+		std::shared_ptr<ThreadState> State;
+
+		DWORD Wait(DWORD dwMilliseconds) override
+		{
+			std::unique_lock<std::mutex> lock(State->Lock);
+			if (dwMilliseconds == 0) return State->Finished ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+			if (dwMilliseconds == INFINITE)
+			{
+				State->Exited.wait(lock, [this] { return State->Finished; });
+				return WAIT_OBJECT_0;
+			}
+			return State->Exited.wait_for(lock, std::chrono::milliseconds(dwMilliseconds), [this] { return State->Finished; }) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+		}
+	};
+
+	struct File : Object
+	{
+		int Fd = -1;
+		PTP_IO Io = NULL;
+		~File() override;
+	};
+
+	struct Find : Object
+	{
+		DIR* Dir = NULL;
+		std::string Folder;
+		std::string Pattern;
+		~Find() override { if (Dir) closedir(Dir); }
+	};
+
+	// work items run on a pool that grows while every worker is busy, since writes block
+	class ThreadPool
+	{
+	private:
+		std::mutex lock;
+		std::condition_variable workAvailable;
+		std::deque<std::function<void()>> work;
+		size_t threads = 0;
+		size_t idle = 0;
+		static const size_t maxThreads = 64;
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (true)
+			{
+				idle++;
+				workAvailable.wait(guard, [this] { return !work.empty(); });
+				idle--;
+				std::function<void()> item = std::move(work.front());
+				work.pop_front();
+				guard.unlock();
+				item();
+				guard.lock();
+			}
+		};
+
+	public:
+		void Submit(std::function<void()> item)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			work.push_back(std::move(item));
+			if (idle < work.size() && threads < maxThreads)
+			{
+				threads++;
+				std::thread([this] { Run(); }).detach();
+			}
+			else
+			{
+				workAvailable.notify_one();
+			}
+		};
+	};
+
+	// never destroyed, workers may still be running while the process exits
+	ThreadPool& Pool()
+	{
+		static ThreadPool* pool = new ThreadPool();
+		return *pool;
+	}
+
+	DWORD ErrorFromErrno(int error)
+	{
+		switch (error)
+		{
+		case 0: return NO_ERROR;
+		case ENOENT: return ERROR_FILE_NOT_FOUND;
+		case ENOTDIR: return ERROR_PATH_NOT_FOUND;
+		case EACCES:
+		case EPERM:
+		case EISDIR:
+		case EROFS: return ERROR_ACCESS_DENIED;
+		case EEXIST: return ERROR_FILE_EXISTS;
+		case EBADF: return ERROR_INVALID_HANDLE;
+		case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
+		case ENOSPC:
+		case EDQUOT: return ERROR_DISK_FULL;
+		case EINVAL: return ERROR_INVALID_PARAMETER;
+		case ENOTSUP: return ERROR_NOT_SUPPORTED;
+		default: return ERROR_GEN_FAILURE;
+		}
+	}
+
+	BOOL FailWithErrno()
+	{
+		lastError = ErrorFromErrno(errno);
+		return FALSE;
+	}
+
+	bool IsHandle(HANDLE h)
+	{
+		return h != NULL && h != INVALID_HANDLE_VALUE;
+	}
+
+	template <typename T> T* HandleAs(HANDLE h)
+	{
+		T* object = IsHandle(h) ? dynamic_cast<T*>((Object*)h) : NULL;
+		if (!object) lastError = ERROR_INVALID_HANDLE;
+		return object;
+	}
+
+	// wchar_t holds whole code points on every POSIX platform we build for
+	std::string EncodeUtf8(const wchar_t* text, size_t length)
+	{
+		std::string result;
+		result.reserve(length);
+		for (size_t i = 0; i < length; i++)
+		{
+			uint32_t c = (uint32_t)text[i];
+			if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) c = 0xFFFD;
+			if (c < 0x80)
+			{
+				result += (char)c;
+			}
+			else if (c < 0x800)
+			{
+				result += (char)(0xC0 | (c >> 6));
+				result += (char)(0x80 | (c & 0x3F));
+			}
+			else if (c < 0x10000)
+			{
+				result += (char)(0xE0 | (c >> 12));
+				result += (char)(0x80 | ((c >> 6) & 0x3F));
+				result += (char)(0x80 | (c & 0x3F));
+			}
+			else
+			{
+				result += (char)(0xF0 | (c >> 18));
+				result += (char)(0x80 | ((c >> 12) & 0x3F));
+				result += (char)(0x80 | ((c >> 6) & 0x3F));
+				result += (char)(0x80 | (c & 0x3F));
+			}
+		}
+		return result;
+	}
+
+	std::wstring DecodeUtf8(const char* text, size_t length)
+	{
+		std::wstring result;
+		result.reserve(length);
+		size_t i = 0;
+		while (i < length)
+		{
+			unsigned char b = (unsigned char)text[i];
+			uint32_t c;
+			size_t extra;
+			if (b < 0x80) { c = b; extra = 0; }
+			else if ((b & 0xE0) == 0xC0) { c = b & 0x1F; extra = 1; }
+			else if ((b & 0xF0) == 0xE0) { c = b & 0x0F; extra = 2; }
+			else if ((b & 0xF8) == 0xF0) { c = b & 0x07; extra = 3; }
+			else { result += (wchar_t)0xFFFD; i++; continue; }
+
+			size_t j = 1;
+			for (; j <= extra && i + j < length && ((unsigned char)text[i + j] & 0xC0) == 0x80; j++)
+			{
+				c = (c << 6) | ((unsigned char)text[i + j] & 0x3F);
+			}
+			if (j <= extra)
+			{
+				// truncated sequence
+				result += (wchar_t)0xFFFD;
+				i += j;
+				continue;
+			}
+			result += (wchar_t)c;
+			i += j;
+		}
+		return result;
+	}
+
+	std::string ToPath(LPCWSTR path)
+	{
+		return EncodeUtf8(path, wcslen(path));
+	}
+}
+
+struct _TP_IO
+{
+	File* Owner;
+	PTP_WIN32_IO_CALLBACK Callback;
+	PVOID Context;
+};
+
+File::~File()
+{
+	if (Io) Io->Owner = NULL;
+	if (Fd >= 0) close(Fd);
+}
+
+DWORD GetLastError()
+{
+	return lastError;
+}
+
+void SetLastError(DWORD dwErrCode)
+{
+	lastError = dwErrCode;
+}
+
+BOOL CloseHandle(HANDLE hObject)
+{
+	if (!IsHandle(hObject))
+	{
+		lastError = ERROR_INVALID_HANDLE;
+		return FALSE;
+	}
+	delete (Object*)hObject;
+	return TRUE;
+}
+
+ULONGLONG GetTickCount64()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (ULONGLONG)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void Sleep(DWORD dwMilliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(dwMilliseconds));
+}
+
+void InitializeCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	// critical sections can be entered again by the thread that owns them
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lpCriticalSection->Mutex, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+}
+
+void DeleteCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_destroy(&lpCriticalSection->Mutex);
+}
+
+void EnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_lock(&lpCriticalSection->Mutex);
+}
+
+void LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_unlock(&lpCriticalSection->Mutex);
+}
+
+void InitializeSRWLock(PSRWLOCK SRWLock)
+{
+	pthread_mutex_init(&SRWLock->Mutex, NULL);
+}
+
+void AcquireSRWLockExclusive(PSRWLOCK SRWLock)
+{
+	pthread_mutex_lock(&SRWLock->Mutex);
+}
+
+void ReleaseSRWLockExclusive(PSRWLOCK SRWLock)
+{
+	pthread_mutex_unlock(&SRWLock->Mutex);
+}
+
+void AcquireSRWLockShared(PSRWLOCK SRWLock)
+{
+	pthread_mutex_lock(&SRWLock->Mutex);
+}
+
+void ReleaseSRWLockShared(PSRWLOCK SRWLock)
+{
+	pthread_mutex_unlock(&SRWLock->Mutex);
+}
+
+void InitializeConditionVariable(PCONDITION_VARIABLE ConditionVariable)
+{
+	pthread_cond_init(&ConditionVariable->Cond, NULL);
+}
+
+BOOL SleepConditionVariableSRW(PCONDITION_VARIABLE ConditionVariable, PSRWLOCK SRWLock, DWORD dwMilliseconds, ULONG Flags)
+{
+	if (dwMilliseconds == INFINITE)
+	{
+		pthread_cond_wait(&ConditionVariable->Cond, &SRWLock->Mutex);
+		return TRUE;
+	}
+
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += dwMilliseconds / 1000;
+	deadline.tv_nsec += (long)(dwMilliseconds % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	if (pthread_cond_timedwait(&ConditionVariable->Cond, &SRWLock->Mutex, &deadline) == ETIMEDOUT)
+	{
+		lastError = ERROR_TIMEOUT;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void WakeConditionVariable(PCONDITION_VARIABLE ConditionVariable)
+{
+	pthread_cond_signal(&ConditionVariable->Cond);
+}
+
+void WakeAllConditionVariable(PCONDITION_VARIABLE ConditionVariable)
+{
+	pthread_cond_broadcast(&ConditionVariable->Cond);
+}
+
+HANDLE CreateEventW(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bManualReset, BOOL bInitialState, LPCWSTR lpName)
+{
+	Event* e = new Event();
+	e->ManualReset = bManualReset;
+	e->State = bInitialState;
+	return (Object*)e;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+	Event* e = HandleAs<Event>(hEvent);
+	if (!e) return FALSE;
+	std::lock_guard<std::mutex> lock(e->Lock);
+	e->State = true;
+	if (e->ManualReset) e->Signaled.notify_all();
+	else e->Signaled.notify_one();
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+	Event* e = HandleAs<Event>(hEvent);
+	if (!e) return FALSE;
+	std::lock_guard<std::mutex> lock(e->Lock);
+	e->State = false;
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
+{
+	if (!IsHandle(hHandle))
+	{
+		lastError = ERROR_INVALID_HANDLE;
+		return WAIT_FAILED;
+	}
+	return ((Object*)hHandle)->Wait(dwMilliseconds);
+}
+
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES lpThreadAttributes, size_t dwStackSize, LPTHREAD_START_ROUTINE lpStartAddress, LPVOID lpParameter, DWORD dwCreationFlags, LPDWORD lpThreadId)
+{
+	Thread* t = new Thread();
+	t->State = std::make_shared<ThreadState>();
+	std::shared_ptr<ThreadState> state = t->State;
+	try
+	{
+		std::thread([state, lpStartAddress, lpParameter]
+			{
+				lpStartAddress(lpParameter);
+				std::lock_guard<std::mutex> lock(state->Lock);
+				state->Finished = true;
+				state->Exited.notify_all();
+			}).detach();
+	}
+	catch (const std::system_error&)
+	{
+		delete t;
+		lastError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	if (lpThreadId) *lpThreadId = 0;
+	return (Object*)t;
+}
+
+BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
+{
+	Pool().Submit([pfns, pv] { pfns(NULL, pv); });
+	return TRUE;
+}
+
+PTP_IO CreateThreadpoolIo(HANDLE fl, PTP_WIN32_IO_CALLBACK pfnio, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
+{
+	File* f = HandleAs<File>(fl);
+	if (!f) return NULL;
+	PTP_IO io = new _TP_IO{ f, pfnio, pv };
+	f->Io = io;
+	return io;
+}
+
+void StartThreadpoolIo(PTP_IO pio)
+{
+	// completions are posted by WriteFile itself
+}
+
+void CancelThreadpoolIo(PTP_IO pio)
+{
+}
+
+void CloseThreadpoolIo(PTP_IO pio)
+{
+	if (pio->Owner) pio->Owner->Io = NULL;
+	delete pio;
+}
+
+HANDLE CreateFileW(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+{
+	bool read = (dwDesiredAccess & (GENERIC_READ | 0x1)) != 0;
+	bool write = (dwDesiredAccess & (GENERIC_WRITE | 0x2)) != 0;
+	int flags = O_CLOEXEC | (read && write ? O_RDWR : (write ? O_WRONLY : O_RDONLY));
+	switch (dwCreationDisposition)
+	{
+	case CREATE_NEW: flags |= O_CREAT | O_EXCL; break;
+	case CREATE_ALWAYS: flags |= O_CREAT | O_TRUNC; break;
+	case OPEN_ALWAYS: flags |= O_CREAT; break;
+	case TRUNCATE_EXISTING: flags |= O_TRUNC; break;
+	case OPEN_EXISTING: break;
+	default:
+		lastError = ERROR_INVALID_PARAMETER;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	int fd = open(ToPath(lpFileName).c_str(), flags, 0666);
+	if (fd < 0)
+	{
+		FailWithErrno();
+		return INVALID_HANDLE_VALUE;
+	}
+	// directories open fine for reading on POSIX but not on Windows
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISDIR(info.st_mode))
+	{
+		close(fd);
+		lastError = ERROR_ACCESS_DENIED;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	File* f = new File();
+	f->Fd = fd;
+	lastError = NO_ERROR;
+	return (Object*)f;
+}
+
+BOOL ReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+
+	off_t offset = lpOverlapped ? (off_t)(((ULONGLONG)lpOverlapped->OffsetHigh << 32) | lpOverlapped->Offset) : 0;
+	DWORD total = 0;
+	while (total < nNumberOfBytesToRead)
+	{
+		ssize_t n = lpOverlapped ?
+			pread(f->Fd, (char*)lpBuffer + total, nNumberOfBytesToRead - total, offset + total) :
+			read(f->Fd, (char*)lpBuffer + total, nNumberOfBytesToRead - total);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return FailWithErrno();
+		}
+		if (n == 0) break;
+		total += (DWORD)n;
+	}
+	if (lpNumberOfBytesRead) *lpNumberOfBytesRead = total;
+	return TRUE;
+}
+
+static DWORD WriteAll(int fd, const char* buffer, DWORD length, bool positioned, off_t offset, DWORD* written)
+{
+	*written = 0;
+	while (*written < length)
+	{
+		ssize_t n = positioned ?
+			pwrite(fd, buffer + *written, length - *written, offset + *written) :
+			write(fd, buffer + *written, length - *written);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			return ErrorFromErrno(errno);
+		}
+		*written += (DWORD)n;
+	}
+	return NO_ERROR;
+}
+
+BOOL WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+
+	off_t offset = lpOverlapped ? (off_t)(((ULONGLONG)lpOverlapped->OffsetHigh << 32) | lpOverlapped->Offset) : 0;
+	if (lpOverlapped && f->Io)
+	{
+		// bound to a thread pool io: complete on a worker like an overlapped write would
+		PTP_IO io = f->Io;
+		int fd = f->Fd;
+		Pool().Submit([io, fd, lpBuffer, nNumberOfBytesToWrite, offset, lpOverlapped]
+			{
+				DWORD written;
+				DWORD result = WriteAll(fd, (const char*)lpBuffer, nNumberOfBytesToWrite, true, offset, &written);
+				io->Callback(NULL, io->Context, lpOverlapped, result, written, io);
+			});
+		lastError = ERROR_IO_PENDING;
+		return FALSE;
+	}
+
+	DWORD written;
+	DWORD result = WriteAll(f->Fd, (const char*)lpBuffer, nNumberOfBytesToWrite, lpOverlapped != NULL, offset, &written);
+	if (lpNumberOfBytesWritten) *lpNumberOfBytesWritten = written;
+	if (result != NO_ERROR)
+	{
+		lastError = result;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL SetFilePointerEx(HANDLE hFile, LARGE_INTEGER liDistanceToMove, PLARGE_INTEGER lpNewFilePointer, DWORD dwMoveMethod)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+
+	int whence = dwMoveMethod == FILE_END ? SEEK_END : (dwMoveMethod == FILE_CURRENT ? SEEK_CUR : SEEK_SET);
+	off_t position = lseek(f->Fd, (off_t)liDistanceToMove.QuadPart, whence);
+	if (position < 0) return FailWithErrno();
+	if (lpNewFilePointer) lpNewFilePointer->QuadPart = position;
+	return TRUE;
+}
+
+BOOL GetFileSizeEx(HANDLE hFile, PLARGE_INTEGER lpFileSize)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+
+	struct stat info;
+	if (fstat(f->Fd, &info) != 0) return FailWithErrno();
+	lpFileSize->QuadPart = info.st_size;
+	return TRUE;
+}
+
+BOOL SetFileInformationByHandle(HANDLE hFile, FILE_INFO_BY_HANDLE_CLASS FileInformationClass, LPVOID lpFileInformation, DWORD dwBufferSize)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+
+	if (FileInformationClass == FileEndOfFileInfo)
+	{
+		FILE_END_OF_FILE_INFO* info = (FILE_END_OF_FILE_INFO*)lpFileInformation;
+		if (ftruncate(f->Fd, (off_t)info->EndOfFile.QuadPart) != 0) return FailWithErrno();
+		return TRUE;
+	}
+	if (FileInformationClass == FileAllocationInfo)
+	{
+#ifdef __linux__
+		// reserve the blocks without changing the size, fine to skip where the file system cannot
+		FILE_ALLOCATION_INFO* info = (FILE_ALLOCATION_INFO*)lpFileInformation;
+		if (info->AllocationSize.QuadPart > 0 && fallocate(f->Fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)info->AllocationSize.QuadPart) != 0)
+		{
+			if (errno == ENOSPC) return FailWithErrno();
+		}
+#endif
+		return TRUE;
+	}
+	lastError = ERROR_INVALID_PARAMETER;
+	return FALSE;
+}
+
+BOOL FlushFileBuffers(HANDLE hFile)
+{
+	File* f = HandleAs<File>(hFile);
+	if (!f) return FALSE;
+	if (fsync(f->Fd) != 0) return FailWithErrno();
+	return TRUE;
+}
+
+HANDLE GetStdHandle(DWORD nStdHandle)
+{
+	int stdFd = nStdHandle == STD_INPUT_HANDLE ? 0 : (nStdHandle == STD_OUTPUT_HANDLE ? 1 : (nStdHandle == STD_ERROR_HANDLE ? 2 : -1));
+	int fd = stdFd < 0 ? -1 : fcntl(stdFd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		lastError = ERROR_INVALID_HANDLE;
+		return INVALID_HANDLE_VALUE;
+	}
+	File* f = new File();
+	f->Fd = fd;
+	return (Object*)f;
+}
+
+BOOL DeleteFileW(LPCWSTR lpFileName)
+{
+	if (unlink(ToPath(lpFileName).c_str()) != 0) return FailWithErrno();
+	return TRUE;
+}
+
+BOOL MoveFileExW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileName, DWORD dwFlags)
+{
+	std::string from = ToPath(lpExistingFileName);
+	std::string to = ToPath(lpNewFileName);
+	struct stat info;
+	if (!(dwFlags & MOVEFILE_REPLACE_EXISTING) && lstat(to.c_str(), &info) == 0)
+	{
+		lastError = ERROR_ALREADY_EXISTS;
+		return FALSE;
+	}
+	if (rename(from.c_str(), to.c_str()) != 0) return FailWithErrno();
+
+	if (dwFlags & MOVEFILE_WRITE_THROUGH)
+	{
+		// the rename itself is only durable once the folder entry is flushed
+		size_t slash = to.find_last_of('/');
+		std::string folder = slash == std::string::npos ? "." : (slash == 0 ? "/" : to.substr(0, slash));
+		int fd = open(folder.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			fsync(fd);
+			close(fd);
+		}
+	}
+	return TRUE;
+}
+
+DWORD GetFileAttributesW(LPCWSTR lpFileName)
+{
+	struct stat info;
+	if (stat(ToPath(lpFileName).c_str(), &info) != 0)
+	{
+		FailWithErrno();
+		return INVALID_FILE_ATTRIBUTES;
+	}
+	return S_ISDIR(info.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+BOOL CreateDirectoryW(LPCWSTR lpPathName, LPSECURITY_ATTRIBUTES lpSecurityAttributes)
+{
+	if (mkdir(ToPath(lpPathName).c_str(), 0777) != 0) return FailWithErrno();
+	return TRUE;
+}
+
+BOOL DeviceIoControl(HANDLE hDevice, DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize, LPVOID lpOutBuffer, DWORD nOutBufferSize, LPDWORD lpBytesReturned, LPOVERLAPPED lpOverlapped)
+{
+	if (!HandleAs<File>(hDevice)) return FALSE;
+	if (lpBytesReturned) *lpBytesReturned = 0;
+	if (dwIoControlCode == FSCTL_SET_SPARSE) return TRUE;
+	if (dwIoControlCode == FSCTL_SET_ZERO_DATA && lpInBuffer && nInBufferSize >= sizeof(FILE_ZERO_DATA_INFORMATION))
+	{
+		FILE_ZERO_DATA_INFORMATION* info = (FILE_ZERO_DATA_INFORMATION*)lpInBuffer;
+		long long length = info->BeyondFinalZero.QuadPart - info->FileOffset.QuadPart;
+		if (length <= 0) return TRUE;
+#ifdef __linux__
+		if (fallocate(HandleAs<File>(hDevice)->Fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)info->FileOffset.QuadPart, (off_t)length) == 0) return TRUE;
+		if (errno != EOPNOTSUPP) return FailWithErrno();
+#endif
+		// without holes the range is written with zeros, as Windows does on a file which is not sparse
+		std::vector<char> zeros((size_t)(length < 65536 ? length : 65536), 0);
+		for (long long position = 0; position < length; position += zeros.size())
+		{
+			DWORD written = 0;
+			DWORD chunk = (DWORD)(length - position < (long long)zeros.size() ? length - position : (long long)zeros.size());
+			DWORD result = WriteAll(HandleAs<File>(hDevice)->Fd, zeros.data(), chunk, true, (off_t)(info->FileOffset.QuadPart + position), &written);
+			if (result != NO_ERROR)
+			{
+				lastError = result;
+				return FALSE;
+			}
+		}
+		return TRUE;
+	}
+	lastError = ERROR_INVALID_PARAMETER;
+	return FALSE;
+}
+
+DWORD GetTempPathW(DWORD nBufferLength, LPWSTR lpBuffer)
+{
+	const char* folder = getenv("TMPDIR");
+	std::string path = folder && *folder ? folder : "/tmp";
+	if (path.back() != '/') path += '/';
+	std::wstring result = DecodeUtf8(path.data(), path.size());
+	if (result.size() + 1 > nBufferLength) return (DWORD)result.size() + 1;
+	wcscpy(lpBuffer, result.c_str());
+	return (DWORD)result.size();
+}
+
+static BOOL NextMatch(Find* find, LPWIN32_FIND_DATAW lpFindFileData)
+{
+	dirent* entry;
+	while ((entry = readdir(find->Dir)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+		if (fnmatch(find->Pattern.c_str(), entry->d_name, 0) != 0) continue;
+
+		ZeroMemory(lpFindFileData, sizeof(WIN32_FIND_DATAW));
+		struct stat info;
+		if (stat((find->Folder + "/" + entry->d_name).c_str(), &info) == 0)
+		{
+			lpFindFileData->dwFileAttributes = S_ISDIR(info.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+			lpFindFileData->nFileSizeHigh = (DWORD)((ULONGLONG)info.st_size >> 32);
+			lpFindFileData->nFileSizeLow = (DWORD)info.st_size;
+		}
+		std::wstring name = DecodeUtf8(entry->d_name, strlen(entry->d_name));
+		wcsncpy(lpFindFileData->cFileName, name.c_str(), MAX_PATH - 1);
+		return TRUE;
+	}
+	lastError = ERROR_NO_MORE_FILES;
+	return FALSE;
+}
+
+HANDLE FindFirstFileW(LPCWSTR lpFileName, LPWIN32_FIND_DATAW lpFindFileData)
+{
+	std::string path = ToPath(lpFileName);
+	size_t slash = path.find_last_of('/');
+
+	Find* find = new Find();
+	find->Folder = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+	find->Pattern = slash == std::string::npos ? path : path.substr(slash + 1);
+	find->Dir = opendir(find->Folder.c_str());
+	if (!find->Dir)
+	{
+		FailWithErrno();
+		delete find;
+		return INVALID_HANDLE_VALUE;
+	}
+	if (!NextMatch(find, lpFindFileData))
+	{
+		delete find;
+		lastError = ERROR_FILE_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+	return (Object*)find;
+}
+
+BOOL FindNextFileW(HANDLE hFindFile, LPWIN32_FIND_DATAW lpFindFileData)
+{
+	Find* find = HandleAs<Find>(hFindFile);
+	if (!find) return FALSE;
+	return NextMatch(find, lpFindFileData);
+}
+
+BOOL FindClose(HANDLE hFindFile)
+{
+	return CloseHandle(hFindFile);
+}
+
+LPVOID VirtualAlloc(LPVOID lpAddress, size_t dwSize, DWORD flAllocationType, DWORD flProtect)
+{
+	void* memory = mmap(lpAddress, dwSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		lastError = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	return memory;
+}
+
+HANDLE GetCurrentProcess()
+{
+	return INVALID_HANDLE_VALUE;
+}
+
+BOOL GetProcessMemoryInfo(HANDLE Process, PROCESS_MEMORY_COUNTERS* ppsmemCounters, DWORD cb)
+{
+	ZeroMemory(ppsmemCounters, cb);
+	ppsmemCounters->cb = cb;
+
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return FailWithErrno();
+#ifdef __APPLE__
+	ppsmemCounters->PeakWorkingSetSize = (size_t)usage.ru_maxrss;
+#else
+	ppsmemCounters->PeakWorkingSetSize = (size_t)usage.ru_maxrss * 1024;
+#endif
+
+#ifdef __linux__
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		unsigned long size, resident;
+		if (fscanf(statm, "%lu %lu", &size, &resident) == 2)
+		{
+			ppsmemCounters->WorkingSetSize = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+		fclose(statm);
+	}
+#endif
+	return TRUE;
+}
+
+int MultiByteToWideChar(UINT CodePage, DWORD dwFlags, LPCSTR lpMultiByteStr, int cbMultiByte, LPWSTR lpWideCharStr, int cchWideChar)
+{
+	// a length of -1 converts the terminating null as well
+	size_t length = cbMultiByte < 0 ? strlen(lpMultiByteStr) + 1 : (size_t)cbMultiByte;
+	std::wstring result = DecodeUtf8(lpMultiByteStr, length);
+	if (cchWideChar == 0) return (int)result.size();
+	if ((size_t)cchWideChar < result.size())
+	{
+		lastError = ERROR_INSUFFICIENT_BUFFER;
+		return 0;
+	}
+	wmemcpy(lpWideCharStr, result.data(), result.size());
+	return (int)result.size();
+}
+
+int WideCharToMultiByte(UINT CodePage, DWORD dwFlags, LPCWSTR lpWideCharStr, int cchWideChar, LPSTR lpMultiByteStr, int cbMultiByte, LPCSTR lpDefaultChar, BOOL* lpUsedDefaultChar)
+{
+	size_t length = cchWideChar < 0 ? wcslen(lpWideCharStr) + 1 : (size_t)cchWideChar;
+	std::string result = EncodeUtf8(lpWideCharStr, length);
+	if (lpUsedDefaultChar) *lpUsedDefaultChar = FALSE;
+	if (cbMultiByte == 0) return (int)result.size();
+	if ((size_t)cbMultiByte < result.size())
+	{
+		lastError = ERROR_INSUFFICIENT_BUFFER;
+		return 0;
+	}
+	memcpy(lpMultiByteStr, result.data(), result.size());
+	return (int)result.size();
+}
+
+RPC_STATUS UuidCreate(UUID* Uuid)
+{
+	// random version 4 identifier
+	static std::mutex lock;
+	static std::mt19937_64 generator(std::random_device{}());
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (int i = 0; i < 16; i += 8)
+		{
+			uint64_t bits = generator();
+			memcpy(Uuid->Data + i, &bits, 8);
+		}
+	}
+	Uuid->Data[6] = (BYTE)((Uuid->Data[6] & 0x0F) | 0x40);
+	Uuid->Data[8] = (BYTE)((Uuid->Data[8] & 0x3F) | 0x80);
+	return RPC_S_OK;
+}
+
+RPC_STATUS UuidToStringW(const UUID* Uuid, RPC_WSTR* StringUuid)
+{
+	static const wchar_t digits[] = L"0123456789abcdef";
+	WCHAR* text = new WCHAR[37];
+	WCHAR* p = text;
+	for (int i = 0; i < 16; i++)
+	{
+		if (i == 4 || i == 6 || i == 8 || i == 10) *p++ = L'-';
+		*p++ = digits[Uuid->Data[i] >> 4];
+		*p++ = digits[Uuid->Data[i] & 0x0F];
+	}
+	*p = L'\0';
+	*StringUuid = text;
+	return RPC_S_OK;
+}
+
+RPC_STATUS RpcStringFreeW(RPC_WSTR* String)
+{
+	delete[] * String;
+	*String = NULL;
+	return RPC_S_OK;
+}
+
+BOOL PathFileExistsW(LPCWSTR pszPath)
+{
+	return access(ToPath(pszPath).c_str(), F_OK) == 0;
+}
+
+BOOL StrToInt64ExW(LPCWSTR pszString, DWORD dwFlags, LONGLONG* pllRet)
+{
+	const wchar_t* p = pszString;
+	while (iswspace(*p)) p++;
+	bool negative = false;
+	if (*p == L'-' || *p == L'+') negative = *p++ == L'-';
+
+	int base = 10;
+	if ((dwFlags & STIF_SUPPORT_HEX) && p[0] == L'0' && (p[1] == L'x' || p[1] == L'X'))
+	{
+		base = 16;
+		p += 2;
+	}
+	if (!iswxdigit(*p) || (base == 10 && !iswdigit(*p))) return FALSE;
+
+	ULONGLONG value = 0;
+	for (;; p++)
+	{
+		int digit;
+		if (*p >= L'0' && *p <= L'9') digit = *p - L'0';
+		else if (base == 16 && *p >= L'a' && *p <= L'f') digit = *p - L'a' + 10;
+		else if (base == 16 && *p >= L'A' && *p <= L'F') digit = *p - L'A' + 10;
+		else break;
+		value = value * base + digit;
+	}
+	*pllRet = negative ? -(LONGLONG)value : (LONGLONG)value;
+	return TRUE;
+}
+
+HRESULT StringCbCopyW(LPWSTR pszDest, size_t cbDest, LPCWSTR pszSrc)
+{
+	size_t capacity = cbDest / sizeof(WCHAR);
+	if (capacity == 0) return STRSAFE_E_INVALID_PARAMETER;
+
+	size_t i = 0;
+	for (; i < capacity - 1 && pszSrc[i]; i++) pszDest[i] = pszSrc[i];
+	pszDest[i] = L'\0';
+	return pszSrc[i] ? STRSAFE_E_INSUFFICIENT_BUFFER : S_OK;
+}
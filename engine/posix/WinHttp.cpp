@@ -0,0 +1,1475 @@
+#include <winhttp.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cwctype>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef PD_WITH_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace
+{
+	const size_t maxHeaderSize = 65536;
+	const int maxEvents = 64;
+	// how often the event loop looks for requests whose timeout has passed
+	const DWORD timeoutCheckInterval = 250;
+
+	std::string Narrow(const std::wstring& text)
+	{
+		std::string result;
+		int size = WideCharToMultiByte(CP_UTF8, 0, text.data(), (int)text.size(), NULL, 0, NULL, NULL);
+		if (size <= 0) return result;
+		result.resize(size);
+		WideCharToMultiByte(CP_UTF8, 0, text.data(), (int)text.size(), &result[0], size, NULL, NULL);
+		return result;
+	}
+
+	std::wstring Widen(const std::string& text)
+	{
+		std::wstring result;
+		int size = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.size(), NULL, 0);
+		if (size <= 0) return result;
+		result.resize(size);
+		MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.size(), &result[0], size);
+		return result;
+	}
+
+	bool EqualsIgnoreCase(const std::string& a, const char* b)
+	{
+		return strcasecmp(a.c_str(), b) == 0;
+	}
+
+	std::string Trim(const std::string& text)
+	{
+		size_t start = text.find_first_not_of(" \t");
+		if (start == std::string::npos) return std::string();
+		size_t end = text.find_last_not_of(" \t\r");
+		return text.substr(start, end - start + 1);
+	}
+
+	std::string Base64(const std::string& data)
+	{
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string result;
+		size_t i = 0;
+		for (; i + 2 < data.size(); i += 3)
+		{
+			uint32_t n = ((uint8_t)data[i] << 16) | ((uint8_t)data[i + 1] << 8) | (uint8_t)data[i + 2];
+			result += alphabet[(n >> 18) & 63];
+			result += alphabet[(n >> 12) & 63];
+			result += alphabet[(n >> 6) & 63];
+			result += alphabet[n & 63];
+		}
+		if (i + 1 == data.size())
+		{
+			uint32_t n = (uint8_t)data[i] << 16;
+			result += alphabet[(n >> 18) & 63];
+			result += alphabet[(n >> 12) & 63];
+			result += "==";
+		}
+		else if (i + 2 == data.size())
+		{
+			uint32_t n = ((uint8_t)data[i] << 16) | ((uint8_t)data[i + 1] << 8);
+			result += alphabet[(n >> 18) & 63];
+			result += alphabet[(n >> 12) & 63];
+			result += alphabet[(n >> 6) & 63];
+			result += '=';
+		}
+		return result;
+	}
+
+	// request targets go out as UTF-8 with anything outside printable ASCII escaped
+	std::string EscapeTarget(const std::wstring& path)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		std::string utf8 = Narrow(path);
+		std::string result;
+		for (unsigned char c : utf8)
+		{
+			if (c <= 0x20 || c >= 0x7F)
+			{
+				result += '%';
+				result += digits[c >> 4];
+				result += digits[c & 0x0F];
+			}
+			else result += (char)c;
+		}
+		return result;
+	}
+
+	enum class HandleType { Session, Connection, Request };
+
+	struct InternetHandle
+	{
+		HandleType Type;
+		std::atomic<int> References{ 1 };
+		explicit InternetHandle(HandleType type) : Type(type) {}
+		virtual ~InternetHandle() {}
+		// children keep their parents alive, as closing a parent handle does not invalidate them
+		void AddRef() { References++; }
+		void Release() { if (--References == 0) delete this; }
+	};
+
+	struct Socket
+	{
+		int Fd = -1;
+		bool Secure = false;
+		// registered with the event loop; closing the descriptor drops it from there
+		bool Watched = false;
+#ifdef PD_WITH_OPENSSL
+		SSL* Ssl = NULL;
+#endif
+		~Socket()
+		{
+#ifdef PD_WITH_OPENSSL
+			if (Ssl) SSL_free(Ssl);
+#endif
+			if (Fd >= 0) close(Fd);
+		}
+	};
+
+	struct Session : InternetHandle
+	{
+		std::string UserAgent;
+		WINHTTP_STATUS_CALLBACK Callback = NULL;
+		DWORD NotificationFlags = 0;
+		Session() : InternetHandle(HandleType::Session) {}
+	};
+
+	struct Connection : InternetHandle
+	{
+		Session* Owner;
+		std::wstring HostName;
+		INTERNET_PORT Port;
+		// kept-alive sockets ready for the next request to this server
+		std::mutex IdleLock;
+		std::vector<Socket*> IdleSockets;
+
+		Connection(Session* owner) : InternetHandle(HandleType::Connection), Owner(owner) { owner->AddRef(); }
+		~Connection() override
+		{
+			for (Socket* s : IdleSockets) delete s;
+			Owner->Release();
+		}
+	};
+
+	enum class OperationType { Send, Receive, Read };
+
+	struct Operation
+	{
+		OperationType Type;
+		LPVOID Buffer;
+		DWORD Size;
+	};
+
+	// what a request is doing on the event loop, all but Idle and Resolving wait for its socket
+	enum class Step { Idle, Resolving, Connecting, Handshaking, Sending, ReceivingHead, ReadingBody };
+
+	struct Request : InternetHandle
+	{
+		Connection* Owner;
+		std::wstring Path;
+		bool Secure = false;
+		bool Refresh = false;
+		bool VerifyCertificate = true;
+		DWORD_PTR Context = 0;
+		DWORD ConnectTimeout = 60000;
+		DWORD SendTimeout = 30000;
+		DWORD ReceiveTimeout = 30000;
+		std::string Authorization;
+		std::string Headers;
+		std::string Body;
+
+		// operations wait here until the event loop gets to them, one after another.
+		// Nothing posts the request to the loop any more once Closing is set under this lock.
+		std::mutex Lock;
+		std::deque<Operation> Operations;
+		std::atomic<bool> Closing{ false };
+		// in the ready list of the loop and posted by WinHttpCloseHandle, guarded by the loop lock
+		bool Posted = false;
+		bool ClosePosted = false;
+		// the loop finishes the request once it gets to the post of WinHttpCloseHandle, nothing refers to it afterwards
+		bool Finishing = false;
+		bool Tracked = false;
+
+		// the rest is only touched on the event loop thread
+		Step State = Step::Idle;
+		Operation Current = { OperationType::Send, NULL, 0 };
+		ULONGLONG Deadline = 0;
+		std::string Message;
+		size_t Sent = 0;
+		addrinfo* Addresses = NULL;
+		addrinfo* NextAddress = NULL;
+		DWORD ConnectError = ERROR_WINHTTP_CANNOT_CONNECT;
+
+		Socket* Stream = NULL;
+		bool Reused = false;
+		// the socket is in an unknown state after an interrupted operation
+		bool Broken = false;
+
+		int StatusCode = 0;
+		std::string StatusText;
+		std::vector<std::pair<std::string, std::string>> ResponseHeaders;
+		std::string RawHeaders;
+		bool KeepAlive = false;
+		bool Chunked = false;
+		long long BodyLeft = 0;
+		long long ChunkLeft = -1;
+		bool InTrailers = false;
+		bool BodyComplete = false;
+		// bytes received from the socket but not consumed yet
+		std::string Received;
+		size_t ReceivedOffset = 0;
+
+		Request(Connection* owner) : InternetHandle(HandleType::Request), Owner(owner) { owner->AddRef(); }
+		~Request() override
+		{
+			if (Addresses) freeaddrinfo(Addresses);
+			if (Stream) delete Stream;
+			Owner->Release();
+		}
+	};
+
+	template <typename T> T* HandleAs(HINTERNET h, HandleType type)
+	{
+		InternetHandle* handle = (InternetHandle*)h;
+		if (!handle || handle->Type != type)
+		{
+			SetLastError(ERROR_WINHTTP_INCORRECT_HANDLE_TYPE);
+			return NULL;
+		}
+		return (T*)handle;
+	}
+
+	// one thread waits on the sockets of all requests with epoll and runs every step and callback of them,
+	// so the number of connections does not add threads. Only name lookups go to the thread pool, as they block.
+	class EventLoop
+	{
+	private:
+		std::mutex lock;
+		int epollFd = -1;
+		int wakeFd = -1;
+		std::deque<Request*> ready;
+		// lookups come back with their addresses, each holding a reference of its request
+		std::deque<std::pair<Request*, addrinfo*>> lookups;
+		// requests the loop holds a reference of until their closing notification, only touched on the loop thread
+		std::vector<Request*> requests;
+		ULONGLONG nextTimeoutCheck = 0;
+
+		void Wake();
+		void Run();
+	public:
+		bool Running = false;
+		EventLoop();
+		// has the loop look at the request, for a new operation, a finished lookup or closing
+		void Post(Request* r, bool closing = false);
+		void PostLookup(Request* r, addrinfo* addresses);
+		// the socket of the request is looked at once it is ready for these events, or when the timeout passes
+		void Wait(Request* r, uint32_t events, DWORD timeout);
+		void Forget(Socket* s);
+		void Remove(Request* r);
+	};
+
+	// never destroyed, the loop runs while the process exits
+	EventLoop& Loop()
+	{
+		static EventLoop* loop = new EventLoop();
+		return *loop;
+	}
+
+	void Notify(Request* r, DWORD status, LPVOID info, DWORD length)
+	{
+		// nothing but the closing notification is delivered once the handle is being closed
+		if (r->Closing && status != WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING) return;
+		Session* session = r->Owner->Owner;
+		if (session->Callback && (session->NotificationFlags & status))
+		{
+			session->Callback((HINTERNET)r, r->Context, status, info, length);
+		}
+	}
+
+	void Fail(Request* r, DWORD error)
+	{
+		DWORD_PTR api = API_READ_DATA;
+		if (r->Current.Type == OperationType::Send) api = API_SEND_REQUEST;
+		else if (r->Current.Type == OperationType::Receive) api = API_RECEIVE_RESPONSE;
+		r->Broken = true;
+		r->State = Step::Idle;
+		WINHTTP_ASYNC_RESULT result = { api, error };
+		Notify(r, WINHTTP_CALLBACK_STATUS_REQUEST_ERROR, &result, sizeof(result));
+	}
+
+	std::string HostNameOf(Request* r)
+	{
+		std::string hostName = Narrow(r->Owner->HostName);
+		if (hostName.size() > 1 && hostName.front() == '[' && hostName.back() == ']') hostName = hostName.substr(1, hostName.size() - 2);
+		return hostName;
+	}
+
+#ifdef PD_WITH_OPENSSL
+	SSL_CTX* TlsContext()
+	{
+		static std::once_flag once;
+		static SSL_CTX* context = NULL;
+		std::call_once(once, []
+			{
+				context = SSL_CTX_new(TLS_client_method());
+				if (context) SSL_CTX_set_default_verify_paths(context);
+			});
+		return context;
+	}
+
+	// waits for the socket when OpenSSL asks for it, anything else is a failure
+	DWORD TlsWait(Request* r, int result, DWORD timeout)
+	{
+		switch (SSL_get_error(r->Stream->Ssl, result))
+		{
+		case SSL_ERROR_WANT_READ:
+			Loop().Wait(r, EPOLLIN, timeout);
+			return ERROR_IO_PENDING;
+		case SSL_ERROR_WANT_WRITE:
+			Loop().Wait(r, EPOLLOUT, timeout);
+			return ERROR_IO_PENDING;
+		default:
+			return ERROR_WINHTTP_SECURE_FAILURE;
+		}
+	}
+
+	bool StartHandshake(Request* r)
+	{
+		SSL_CTX* context = TlsContext();
+		if (!context) return false;
+		Socket* s = r->Stream;
+		s->Ssl = SSL_new(context);
+		if (!s->Ssl) return false;
+		std::string hostName = HostNameOf(r);
+		SSL_set_fd(s->Ssl, s->Fd);
+		SSL_set_tlsext_host_name(s->Ssl, hostName.c_str());
+		if (r->VerifyCertificate)
+		{
+			SSL_set_verify(s->Ssl, SSL_VERIFY_PEER, NULL);
+			SSL_set1_host(s->Ssl, hostName.c_str());
+		}
+		return true;
+	}
+#endif
+
+	// sends what is left of the request, ERROR_IO_PENDING means the socket is full for now
+	DWORD SendSome(Request* r)
+	{
+		Socket* s = r->Stream;
+		while (r->Sent < r->Message.size())
+		{
+#ifdef PD_WITH_OPENSSL
+			if (s->Ssl)
+			{
+				int n = SSL_write(s->Ssl, r->Message.data() + r->Sent, (int)(r->Message.size() - r->Sent));
+				if (n > 0) r->Sent += n;
+				else return TlsWait(r, n, r->SendTimeout);
+				continue;
+			}
+#endif
+			ssize_t n = send(s->Fd, r->Message.data() + r->Sent, r->Message.size() - r->Sent, MSG_NOSIGNAL);
+			if (n > 0) r->Sent += n;
+			else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				Loop().Wait(r, EPOLLOUT, r->SendTimeout);
+				return ERROR_IO_PENDING;
+			}
+			else if (n < 0 && errno == EINTR) continue;
+			else return ERROR_WINHTTP_CONNECTION_ERROR;
+		}
+		return NO_ERROR;
+	}
+
+	// receives what is available, zero bytes means the server closed the connection
+	DWORD ReceiveSome(Request* r, char* buffer, size_t size, size_t* received)
+	{
+		Socket* s = r->Stream;
+		while (true)
+		{
+#ifdef PD_WITH_OPENSSL
+			if (s->Ssl)
+			{
+				int n = SSL_read(s->Ssl, buffer, (int)std::min<size_t>(size, INT32_MAX));
+				if (n > 0)
+				{
+					*received = n;
+					return NO_ERROR;
+				}
+				int reason = SSL_get_error(s->Ssl, n);
+				if (reason == SSL_ERROR_ZERO_RETURN || (reason == SSL_ERROR_SYSCALL && n == 0))
+				{
+					*received = 0;
+					return NO_ERROR;
+				}
+				DWORD error = TlsWait(r, n, r->ReceiveTimeout);
+				return error == ERROR_WINHTTP_SECURE_FAILURE ? ERROR_WINHTTP_CONNECTION_ERROR : error;
+			}
+#endif
+			ssize_t n = recv(s->Fd, buffer, size, 0);
+			if (n >= 0)
+			{
+				*received = n;
+				return NO_ERROR;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				Loop().Wait(r, EPOLLIN, r->ReceiveTimeout);
+				return ERROR_IO_PENDING;
+			}
+			if (errno != EINTR) return ERROR_WINHTTP_CONNECTION_ERROR;
+		}
+	}
+
+	size_t Buffered(Request* r)
+	{
+		return r->Received.size() - r->ReceivedOffset;
+	}
+
+	void Consume(Request* r, size_t length)
+	{
+		r->ReceivedOffset += length;
+		if (r->ReceivedOffset == r->Received.size())
+		{
+			r->Received.clear();
+			r->ReceivedOffset = 0;
+		}
+	}
+
+	// appends more of the stream to the receive buffer
+	DWORD Fill(Request* r, size_t* received)
+	{
+		char chunk[16384];
+		DWORD error = ReceiveSome(r, chunk, sizeof(chunk), received);
+		if (error == NO_ERROR) r->Received.append(chunk, *received);
+		return error;
+	}
+
+	// a line is only consumed once it is complete, so a read waiting for the socket can start over
+	DWORD ReadLine(Request* r, std::string* line)
+	{
+		while (true)
+		{
+			size_t end = r->Received.find("\r\n", r->ReceivedOffset);
+			if (end != std::string::npos)
+			{
+				*line = r->Received.substr(r->ReceivedOffset, end - r->ReceivedOffset);
+				Consume(r, end + 2 - r->ReceivedOffset);
+				return NO_ERROR;
+			}
+			if (Buffered(r) > maxHeaderSize) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+			size_t received;
+			DWORD error = Fill(r, &received);
+			if (error != NO_ERROR) return error;
+			if (received == 0) return ERROR_WINHTTP_CONNECTION_ERROR;
+		}
+	}
+
+	const std::string* FindHeader(Request* r, const char* name)
+	{
+		for (auto& header : r->ResponseHeaders)
+		{
+			if (EqualsIgnoreCase(header.first, name)) return &header.second;
+		}
+		return NULL;
+	}
+
+	// reads one response head; a server closing a reused connection right away is reported as closed
+	DWORD ReadResponseHead(Request* r, bool* closed)
+	{
+		*closed = false;
+		size_t end;
+		while ((end = r->Received.find("\r\n\r\n", r->ReceivedOffset)) == std::string::npos)
+		{
+			if (Buffered(r) > maxHeaderSize) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+			size_t received;
+			DWORD error = Fill(r, &received);
+			if (error == ERROR_WINHTTP_CONNECTION_ERROR && Buffered(r) == 0) *closed = true;
+			if (error != NO_ERROR) return error;
+			if (received == 0)
+			{
+				*closed = Buffered(r) == 0;
+				return ERROR_WINHTTP_CONNECTION_ERROR;
+			}
+		}
+
+		std::string head = r->Received.substr(r->ReceivedOffset, end + 2 - r->ReceivedOffset);
+		Consume(r, end + 4 - r->ReceivedOffset);
+
+		size_t lineEnd = head.find("\r\n");
+		std::string statusLine = head.substr(0, lineEnd);
+		if (statusLine.compare(0, 5, "HTTP/") != 0) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+		size_t space = statusLine.find(' ');
+		if (space == std::string::npos) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+		std::string version = statusLine.substr(5, space - 5);
+		r->StatusCode = atoi(statusLine.c_str() + space + 1);
+		size_t textStart = statusLine.find(' ', space + 1);
+		r->StatusText = textStart == std::string::npos ? std::string() : statusLine.substr(textStart + 1);
+		if (r->StatusCode < 100 || r->StatusCode > 999) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+
+		r->ResponseHeaders.clear();
+		r->RawHeaders = head;
+		size_t position = lineEnd + 2;
+		while (position < head.size())
+		{
+			size_t next = head.find("\r\n", position);
+			std::string line = head.substr(position, next - position);
+			position = next + 2;
+			size_t colon = line.find(':');
+			if (colon == std::string::npos) continue;
+			r->ResponseHeaders.emplace_back(Trim(line.substr(0, colon)), Trim(line.substr(colon + 1)));
+		}
+
+		const std::string* connection = FindHeader(r, "Connection");
+		if (version == "1.0") r->KeepAlive = connection && EqualsIgnoreCase(*connection, "keep-alive");
+		else r->KeepAlive = !(connection && EqualsIgnoreCase(*connection, "close"));
+		return NO_ERROR;
+	}
+
+	void DecideFraming(Request* r)
+	{
+		const std::string* transferEncoding = FindHeader(r, "Transfer-Encoding");
+		const std::string* contentLength = FindHeader(r, "Content-Length");
+		r->Chunked = false;
+		r->ChunkLeft = -1;
+		r->InTrailers = false;
+		if (r->StatusCode == 204 || r->StatusCode == 304 || r->StatusCode < 200)
+		{
+			r->BodyLeft = 0;
+		}
+		else if (transferEncoding && strcasestr(transferEncoding->c_str(), "chunked"))
+		{
+			r->Chunked = true;
+		}
+		else if (contentLength)
+		{
+			r->BodyLeft = atoll(contentLength->c_str());
+		}
+		else
+		{
+			// the body runs until the server closes the connection
+			r->BodyLeft = -1;
+			r->KeepAlive = false;
+		}
+		r->BodyComplete = !r->Chunked && r->BodyLeft == 0;
+	}
+
+	Socket* TakeIdleSocket(Request* r)
+	{
+		std::lock_guard<std::mutex> lock(r->Owner->IdleLock);
+		auto& idle = r->Owner->IdleSockets;
+		while (!idle.empty())
+		{
+			Socket* s = idle.back();
+			idle.pop_back();
+			// an idle socket with something to read has been closed by the server
+			pollfd p = { s->Fd, POLLIN, 0 };
+			if (s->Secure == r->Secure && poll(&p, 1, 0) == 0) return s;
+			delete s;
+		}
+		return NULL;
+	}
+
+	void ReleaseStream(Request* r)
+	{
+		if (!r->Stream) return;
+		if (!r->Broken && r->KeepAlive && r->BodyComplete && Buffered(r) == 0)
+		{
+			// an idle socket belongs to no request, the loop must not look at it
+			Loop().Forget(r->Stream);
+			std::lock_guard<std::mutex> lock(r->Owner->IdleLock);
+			r->Owner->IdleSockets.push_back(r->Stream);
+		}
+		else
+		{
+			delete r->Stream;
+		}
+		r->Stream = NULL;
+	}
+
+	void FreeAddresses(Request* r)
+	{
+		if (r->Addresses) freeaddrinfo(r->Addresses);
+		r->Addresses = NULL;
+		r->NextAddress = NULL;
+	}
+
+	std::string BuildRequest(Request* r)
+	{
+		std::string host = Narrow(r->Owner->HostName);
+		if (host.find(':') != std::string::npos && host.front() != '[') host = "[" + host + "]";
+		if (r->Owner->Port != (r->Secure ? INTERNET_DEFAULT_HTTPS_PORT : INTERNET_DEFAULT_HTTP_PORT)) host += ":" + std::to_string(r->Owner->Port);
+
+		std::string message = "GET " + EscapeTarget(r->Path) + " HTTP/1.1\r\n";
+		message += "Host: " + host + "\r\n";
+		if (!r->Owner->Owner->UserAgent.empty()) message += "User-Agent: " + r->Owner->Owner->UserAgent + "\r\n";
+		message += "Accept: */*\r\n";
+		if (!r->Authorization.empty()) message += "Authorization: " + r->Authorization + "\r\n";
+		if (r->Refresh) message += "Pragma: no-cache\r\nCache-Control: no-cache\r\n";
+		message += r->Headers;
+		message += "Connection: Keep-Alive\r\n\r\n";
+		message += r->Body;
+		return message;
+	}
+
+	void CALLBACK ResolveCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+	{
+		Request* r = (Request*)Context;
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* addresses = NULL;
+		if (getaddrinfo(HostNameOf(r).c_str(), std::to_string(r->Owner->Port).c_str(), &hints, &addresses) != 0) addresses = NULL;
+		Loop().PostLookup(r, addresses);
+	}
+
+	void ContinueSend(Request* r);
+
+	void Connected(Request* r)
+	{
+		std::wstring hostName = r->Owner->HostName;
+		Notify(r, WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER, (LPVOID)hostName.c_str(), (DWORD)((hostName.size() + 1) * sizeof(WCHAR)));
+		r->State = Step::Sending;
+		ContinueSend(r);
+	}
+
+	void ContinueHandshake(Request* r)
+	{
+#ifdef PD_WITH_OPENSSL
+		int result = SSL_connect(r->Stream->Ssl);
+		if (result == 1)
+		{
+			Connected(r);
+			return;
+		}
+		DWORD error = TlsWait(r, result, r->ConnectTimeout);
+		if (error != ERROR_IO_PENDING) Fail(r, error);
+#else
+		// built without a TLS library
+		Fail(r, ERROR_WINHTTP_SECURE_FAILURE);
+#endif
+	}
+
+	void SocketConnected(Request* r)
+	{
+		FreeAddresses(r);
+		int noDelay = 1;
+		setsockopt(r->Stream->Fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		if (!r->Secure)
+		{
+			Connected(r);
+			return;
+		}
+		r->State = Step::Handshaking;
+#ifdef PD_WITH_OPENSSL
+		if (!StartHandshake(r))
+		{
+			Fail(r, ERROR_WINHTTP_SECURE_FAILURE);
+			return;
+		}
+#endif
+		ContinueHandshake(r);
+	}
+
+	// tries the addresses of the server one after another
+	void ConnectNext(Request* r)
+	{
+		while (r->NextAddress)
+		{
+			addrinfo* a = r->NextAddress;
+			r->NextAddress = a->ai_next;
+			int fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+			if (fd < 0) continue;
+			r->Stream = new Socket();
+			r->Stream->Fd = fd;
+			r->Stream->Secure = r->Secure;
+			if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+			{
+				SocketConnected(r);
+				return;
+			}
+			if (errno == EINPROGRESS)
+			{
+				r->State = Step::Connecting;
+				Loop().Wait(r, EPOLLOUT, r->ConnectTimeout);
+				return;
+			}
+			delete r->Stream;
+			r->Stream = NULL;
+		}
+		FreeAddresses(r);
+		Fail(r, r->ConnectError);
+	}
+
+	void CheckConnecting(Request* r)
+	{
+		// the loop may look at a request before its socket is ready
+		pollfd p = { r->Stream->Fd, POLLOUT, 0 };
+		if (poll(&p, 1, 0) == 0)
+		{
+			Loop().Wait(r, EPOLLOUT, (DWORD)(r->Deadline > GetTickCount64() ? r->Deadline - GetTickCount64() : 0));
+			return;
+		}
+		int result = 0;
+		socklen_t length = sizeof(result);
+		if (getsockopt(r->Stream->Fd, SOL_SOCKET, SO_ERROR, &result, &length) != 0) result = errno;
+		if (result != 0)
+		{
+			delete r->Stream;
+			r->Stream = NULL;
+			ConnectNext(r);
+			return;
+		}
+		SocketConnected(r);
+	}
+
+	void OnResolved(Request* r, addrinfo* addresses)
+	{
+		r->Addresses = addresses;
+		r->NextAddress = addresses;
+		r->ConnectError = r->Addresses ? ERROR_WINHTTP_CANNOT_CONNECT : ERROR_WINHTTP_NAME_NOT_RESOLVED;
+		ConnectNext(r);
+	}
+
+	// sends the request on a kept-alive connection if there is one, or starts a new one
+	void OpenStream(Request* r, bool allowReuse)
+	{
+		if (r->Stream)
+		{
+			delete r->Stream;
+			r->Stream = NULL;
+		}
+		r->Received.clear();
+		r->ReceivedOffset = 0;
+		r->Broken = false;
+		r->Sent = 0;
+		r->Stream = allowReuse ? TakeIdleSocket(r) : NULL;
+		r->Reused = r->Stream != NULL;
+		if (r->Stream)
+		{
+			r->State = Step::Sending;
+			ContinueSend(r);
+			return;
+		}
+
+		std::wstring hostName = r->Owner->HostName;
+		Notify(r, WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER, (LPVOID)hostName.c_str(), (DWORD)((hostName.size() + 1) * sizeof(WCHAR)));
+		r->State = Step::Resolving;
+		// the request stays alive until the lookup is back, even if it is closed meanwhile
+		r->AddRef();
+		if (!TrySubmitThreadpoolCallback(ResolveCallback, r, NULL))
+		{
+			r->Release();
+			Fail(r, ERROR_NOT_ENOUGH_MEMORY);
+		}
+	}
+
+	// the server may have dropped a kept-alive connection in the meantime, the request is sent again on a new one
+	bool RetryOnNewConnection(Request* r)
+	{
+		if (!r->Reused) return false;
+		OpenStream(r, false);
+		return true;
+	}
+
+	void ContinueReceive(Request* r)
+	{
+		bool closed;
+		DWORD error = ReadResponseHead(r, &closed);
+		// interim responses are skipped
+		while (error == NO_ERROR && r->StatusCode >= 100 && r->StatusCode < 200)
+		{
+			error = ReadResponseHead(r, &closed);
+		}
+		if (error == ERROR_IO_PENDING) return;
+		// a kept-alive connection closed before answering
+		if (error != NO_ERROR && closed && RetryOnNewConnection(r)) return;
+		if (error != NO_ERROR)
+		{
+			Fail(r, error);
+			return;
+		}
+		DecideFraming(r);
+		r->State = Step::Idle;
+		Notify(r, WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE, NULL, 0);
+	}
+
+	void ContinueSend(Request* r)
+	{
+		DWORD error = SendSome(r);
+		if (error == ERROR_IO_PENDING) return;
+		if (error != NO_ERROR && RetryOnNewConnection(r)) return;
+		if (error != NO_ERROR)
+		{
+			Fail(r, error);
+			return;
+		}
+		if (r->Current.Type == OperationType::Receive)
+		{
+			// sent again on a new connection while receiving, the response is still to be read
+			r->State = Step::ReceivingHead;
+			ContinueReceive(r);
+			return;
+		}
+		r->State = Step::Idle;
+		Notify(r, WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE, NULL, 0);
+	}
+
+	// copies body bytes that are already buffered, or receives straight into the caller's buffer
+	DWORD ReadRaw(Request* r, char* buffer, size_t size, size_t* received)
+	{
+		size_t buffered = Buffered(r);
+		if (buffered > 0)
+		{
+			*received = std::min(buffered, size);
+			memcpy(buffer, r->Received.data() + r->ReceivedOffset, *received);
+			Consume(r, *received);
+			return NO_ERROR;
+		}
+		return ReceiveSome(r, buffer, size, received);
+	}
+
+	// every step leaves the framing state consistent, so a read which has to wait for the socket starts over later
+	DWORD ReadBody(Request* r, char* buffer, size_t size, size_t* received)
+	{
+		*received = 0;
+		if (r->BodyComplete || size == 0) return NO_ERROR;
+
+		if (r->Chunked)
+		{
+			std::string line;
+			DWORD error;
+			// the line break after the data of a chunk
+			if (r->ChunkLeft == 0)
+			{
+				error = ReadLine(r, &line);
+				if (error != NO_ERROR) return error;
+				r->ChunkLeft = -1;
+			}
+			if (r->ChunkLeft < 0 && !r->InTrailers)
+			{
+				error = ReadLine(r, &line);
+				if (error != NO_ERROR) return error;
+				char* end;
+				long long chunkSize = strtoll(line.c_str(), &end, 16);
+				if (end == line.c_str() || chunkSize < 0) return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+				if (chunkSize == 0) r->InTrailers = true;
+				else r->ChunkLeft = chunkSize;
+			}
+			if (r->InTrailers)
+			{
+				// skip trailers up to the empty line
+				do
+				{
+					error = ReadLine(r, &line);
+					if (error != NO_ERROR) return error;
+				} while (!line.empty());
+				r->BodyComplete = true;
+				return NO_ERROR;
+			}
+			error = ReadRaw(r, buffer, (size_t)std::min<long long>(size, r->ChunkLeft), received);
+			if (error != NO_ERROR) return error;
+			if (*received == 0) return ERROR_WINHTTP_CONNECTION_ERROR;
+			r->ChunkLeft -= *received;
+			return NO_ERROR;
+		}
+
+		size_t wanted = r->BodyLeft < 0 ? size : (size_t)std::min<long long>(size, r->BodyLeft);
+		DWORD error = ReadRaw(r, buffer, wanted, received);
+		if (error != NO_ERROR) return error;
+		if (*received == 0)
+		{
+			if (r->BodyLeft >= 0) return ERROR_WINHTTP_CONNECTION_ERROR;
+			r->BodyComplete = true;
+			return NO_ERROR;
+		}
+		if (r->BodyLeft > 0)
+		{
+			r->BodyLeft -= *received;
+			if (r->BodyLeft == 0) r->BodyComplete = true;
+		}
+		return NO_ERROR;
+	}
+
+	void ContinueRead(Request* r)
+	{
+		size_t received;
+		DWORD error = ReadBody(r, (char*)r->Current.Buffer, r->Current.Size, &received);
+		if (error == ERROR_IO_PENDING) return;
+		if (error != NO_ERROR)
+		{
+			Fail(r, error);
+			return;
+		}
+		r->State = Step::Idle;
+		Notify(r, WINHTTP_CALLBACK_STATUS_READ_COMPLETE, r->Current.Buffer, (DWORD)received);
+	}
+
+	void StartNextOperation(Request* r)
+	{
+		{
+			std::lock_guard<std::mutex> lock(r->Lock);
+			if (r->Operations.empty()) return;
+			r->Current = r->Operations.front();
+			r->Operations.pop_front();
+		}
+		switch (r->Current.Type)
+		{
+		case OperationType::Send:
+			r->Message = BuildRequest(r);
+			OpenStream(r, true);
+			break;
+		case OperationType::Receive:
+			r->State = Step::ReceivingHead;
+			ContinueReceive(r);
+			break;
+		case OperationType::Read:
+			r->State = Step::ReadingBody;
+			ContinueRead(r);
+			break;
+		}
+	}
+
+	void Finish(Request* r)
+	{
+		// a socket in the middle of an operation cannot be used again
+		if (r->State != Step::Idle) r->Broken = true;
+		FreeAddresses(r);
+		ReleaseStream(r);
+		Loop().Remove(r);
+		HINTERNET handle = (HINTERNET)r;
+		Notify(r, WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING, &handle, sizeof(handle));
+		r->Release();
+	}
+
+	// makes whatever progress the request can make now
+	void Process(Request* r)
+	{
+		switch (r->State)
+		{
+		case Step::Idle: StartNextOperation(r); break;
+		case Step::Resolving: break;
+		case Step::Connecting: CheckConnecting(r); break;
+		case Step::Handshaking: ContinueHandshake(r); break;
+		case Step::Sending: ContinueSend(r); break;
+		case Step::ReceivingHead: ContinueReceive(r); break;
+		case Step::ReadingBody: ContinueRead(r); break;
+		}
+	}
+
+	void TimeOut(Request* r)
+	{
+		if (r->State == Step::Connecting)
+		{
+			// the next address of the server may answer
+			r->ConnectError = ERROR_WINHTTP_TIMEOUT;
+			delete r->Stream;
+			r->Stream = NULL;
+			ConnectNext(r);
+			return;
+		}
+		Fail(r, ERROR_WINHTTP_TIMEOUT);
+	}
+
+	EventLoop::EventLoop()
+	{
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (epollFd < 0 || wakeFd < 0) return;
+		epoll_event e = {};
+		e.events = EPOLLIN;
+		e.data.ptr = NULL;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &e) != 0) return;
+		try
+		{
+			std::thread([this] { Run(); }).detach();
+			Running = true;
+		}
+		catch (const std::system_error&)
+		{
+		}
+	}
+
+	void EventLoop::Wake()
+	{
+		uint64_t one = 1;
+		while (write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR);
+	}
+
+	void EventLoop::Post(Request* r, bool closing)
+	{
+		bool wake;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (closing) r->ClosePosted = true;
+			if (r->Posted) return;
+			r->Posted = true;
+			wake = ready.empty() && lookups.empty();
+			ready.push_back(r);
+		}
+		if (wake) Wake();
+	}
+
+	void EventLoop::PostLookup(Request* r, addrinfo* addresses)
+	{
+		bool wake;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			wake = ready.empty() && lookups.empty();
+			lookups.emplace_back(r, addresses);
+		}
+		if (wake) Wake();
+	}
+
+	void EventLoop::Wait(Request* r, uint32_t events, DWORD timeout)
+	{
+		Socket* s = r->Stream;
+		// one shot, so a socket is only looked at while its request waits for it
+		epoll_event e = {};
+		e.events = events | EPOLLONESHOT;
+		e.data.ptr = r;
+		if (epoll_ctl(epollFd, s->Watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s->Fd, &e) == 0) s->Watched = true;
+		r->Deadline = GetTickCount64() + timeout;
+	}
+
+	void EventLoop::Forget(Socket* s)
+	{
+		if (s->Watched) epoll_ctl(epollFd, EPOLL_CTL_DEL, s->Fd, NULL);
+		s->Watched = false;
+	}
+
+	void EventLoop::Remove(Request* r)
+	{
+		auto it = std::find(requests.begin(), requests.end(), r);
+		if (it != requests.end()) requests.erase(it);
+	}
+
+	void EventLoop::Run()
+	{
+		epoll_event events[maxEvents];
+		std::deque<Request*> posted;
+		std::deque<std::pair<Request*, addrinfo*>> resolved;
+		while (true)
+		{
+			int timeout = (int)timeoutCheckInterval;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (!ready.empty() || !lookups.empty()) timeout = 0;
+			}
+			int n = epoll_wait(epollFd, events, maxEvents, timeout);
+			for (int i = 0; i < n; i++)
+			{
+				if (!events[i].data.ptr)
+				{
+					uint64_t count;
+					while (read(wakeFd, &count, sizeof(count)) < 0 && errno == EINTR);
+					continue;
+				}
+				// a request being closed is also in the ready list, it is finished there
+				Request* r = (Request*)events[i].data.ptr;
+				if (!r->Closing) Process(r);
+			}
+
+			// requests posted meanwhile, also by the callbacks just run, wait for the next round so none holds up the others
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				posted.swap(ready);
+				resolved.swap(lookups);
+				for (Request* r : posted)
+				{
+					r->Posted = false;
+					r->Finishing = r->ClosePosted;
+				}
+			}
+			for (Request* r : posted)
+			{
+				if (!r->Tracked)
+				{
+					r->Tracked = true;
+					requests.push_back(r);
+				}
+				if (r->Finishing) Finish(r);
+				else if (!r->Closing) Process(r);
+			}
+			posted.clear();
+			for (auto& lookup : resolved)
+			{
+				Request* r = lookup.first;
+				if (!r->Closing && r->State == Step::Resolving) OnResolved(r, lookup.second);
+				else if (lookup.second) freeaddrinfo(lookup.second);
+				r->Release();
+			}
+			resolved.clear();
+
+			ULONGLONG now = GetTickCount64();
+			if (now < nextTimeoutCheck) continue;
+			nextTimeoutCheck = now + timeoutCheckInterval;
+			std::vector<Request*> waiting;
+			for (Request* r : requests)
+			{
+				if (r->State != Step::Idle && r->State != Step::Resolving && now >= r->Deadline) waiting.push_back(r);
+			}
+			for (Request* r : waiting) TimeOut(r);
+		}
+	}
+
+	BOOL Queue(HINTERNET hRequest, Operation op)
+	{
+		Request* r = HandleAs<Request>(hRequest, HandleType::Request);
+		if (!r) return FALSE;
+		{
+			std::lock_guard<std::mutex> lock(r->Lock);
+			if (r->Closing)
+			{
+				SetLastError(ERROR_WINHTTP_INCORRECT_HANDLE_STATE);
+				return FALSE;
+			}
+			r->Operations.push_back(op);
+			Loop().Post(r);
+		}
+		return TRUE;
+	}
+}
+
+HINTERNET WinHttpOpen(LPCWSTR pszAgentW, DWORD dwAccessType, LPCWSTR pszProxyW, LPCWSTR pszProxyBypassW, DWORD dwFlags)
+{
+	Session* session = new Session();
+	if (pszAgentW) session->UserAgent = Narrow(pszAgentW);
+	return (HINTERNET)(InternetHandle*)session;
+}
+
+WINHTTP_STATUS_CALLBACK WinHttpSetStatusCallback(HINTERNET hInternet, WINHTTP_STATUS_CALLBACK lpfnInternetCallback, DWORD dwNotificationFlags, DWORD_PTR dwReserved)
+{
+	Session* session = HandleAs<Session>(hInternet, HandleType::Session);
+	if (!session) return NULL;
+	WINHTTP_STATUS_CALLBACK previous = session->Callback;
+	session->Callback = lpfnInternetCallback;
+	session->NotificationFlags = dwNotificationFlags;
+	return previous;
+}
+
+HINTERNET WinHttpConnect(HINTERNET hSession, LPCWSTR pswzServerName, INTERNET_PORT nServerPort, DWORD dwReserved)
+{
+	Session* session = HandleAs<Session>(hSession, HandleType::Session);
+	if (!session) return NULL;
+	Connection* connection = new Connection(session);
+	connection->HostName = pswzServerName;
+	connection->Port = nServerPort;
+	return (HINTERNET)(InternetHandle*)connection;
+}
+
+HINTERNET WinHttpOpenRequest(HINTERNET hConnect, LPCWSTR pwszVerb, LPCWSTR pwszObjectName, LPCWSTR pwszVersion, LPCWSTR pwszReferrer, LPCWSTR* ppwszAcceptTypes, DWORD dwFlags)
+{
+	Connection* connection = HandleAs<Connection>(hConnect, HandleType::Connection);
+	if (!connection) return NULL;
+	// only the GET requests the engine makes are supported
+	if (pwszVerb && wcscmp(pwszVerb, L"GET") != 0)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return NULL;
+	}
+
+	Request* r = new Request(connection);
+	r->Path = pwszObjectName && *pwszObjectName ? pwszObjectName : L"/";
+	// fragments stay on the client
+	size_t fragment = r->Path.find(L'#');
+	if (fragment != std::wstring::npos) r->Path.resize(fragment);
+	if (r->Path.empty() || r->Path[0] == L'?') r->Path.insert(0, L"/");
+	r->Secure = (dwFlags & WINHTTP_FLAG_SECURE) != 0;
+	r->Refresh = (dwFlags & WINHTTP_FLAG_REFRESH) != 0;
+	if (!Loop().Running)
+	{
+		delete r;
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+	// the event loop owns a reference of its own, dropped after the closing notification
+	r->AddRef();
+	Loop().Post(r);
+	return (HINTERNET)(InternetHandle*)r;
+}
+
+BOOL WinHttpSetOption(HINTERNET hInternet, DWORD dwOption, LPVOID lpBuffer, DWORD dwBufferLength)
+{
+	Request* r = HandleAs<Request>(hInternet, HandleType::Request);
+	if (!r) return FALSE;
+	switch (dwOption)
+	{
+	case WINHTTP_OPTION_CONTEXT_VALUE:
+		r->Context = *(DWORD_PTR*)lpBuffer;
+		return TRUE;
+	case WINHTTP_OPTION_SECURITY_FLAGS:
+		r->VerifyCertificate = (*(DWORD*)lpBuffer & (SECURITY_FLAG_IGNORE_UNKNOWN_CA | SECURITY_FLAG_IGNORE_CERT_CN_INVALID)) == 0;
+		return TRUE;
+	case WINHTTP_OPTION_CONNECT_TIMEOUT:
+		r->ConnectTimeout = *(DWORD*)lpBuffer;
+		return TRUE;
+	case WINHTTP_OPTION_SEND_TIMEOUT:
+		r->SendTimeout = *(DWORD*)lpBuffer;
+		return TRUE;
+	case WINHTTP_OPTION_RECEIVE_TIMEOUT:
+		r->ReceiveTimeout = *(DWORD*)lpBuffer;
+		return TRUE;
+	case WINHTTP_OPTION_DISABLE_FEATURE:
+		// redirects are never followed here
+		return TRUE;
+	}
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return FALSE;
+}
+
+BOOL WinHttpSetCredentials(HINTERNET hRequest, DWORD AuthTargets, DWORD AuthScheme, LPCWSTR pwszUserName, LPCWSTR pwszPassword, LPVOID pAuthParams)
+{
+	Request* r = HandleAs<Request>(hRequest, HandleType::Request);
+	if (!r) return FALSE;
+	if (AuthScheme != WINHTTP_AUTH_SCHEME_BASIC)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+	r->Authorization = "Basic " + Base64(Narrow(pwszUserName) + ":" + Narrow(pwszPassword));
+	return TRUE;
+}
+
+BOOL WinHttpAddRequestHeaders(HINTERNET hRequest, LPCWSTR lpszHeaders, DWORD dwHeadersLength, DWORD dwModifiers)
+{
+	Request* r = HandleAs<Request>(hRequest, HandleType::Request);
+	if (!r) return FALSE;
+	std::string headers = Narrow(dwHeadersLength == (DWORD)-1 ? std::wstring(lpszHeaders) : std::wstring(lpszHeaders, dwHeadersLength));
+	while (!headers.empty() && (headers.back() == '\r' || headers.back() == '\n')) headers.pop_back();
+	if (!headers.empty()) r->Headers += headers + "\r\n";
+	return TRUE;
+}
+
+BOOL WinHttpSendRequest(HINTERNET hRequest, LPCWSTR lpszHeaders, DWORD dwHeadersLength, LPVOID lpOptional, DWORD dwOptionalLength, DWORD dwTotalLength, DWORD_PTR dwContext)
+{
+	Request* r = HandleAs<Request>(hRequest, HandleType::Request);
+	if (!r) return FALSE;
+	if (lpszHeaders && !WinHttpAddRequestHeaders(hRequest, lpszHeaders, dwHeadersLength, WINHTTP_ADDREQ_FLAG_ADD)) return FALSE;
+	if (lpOptional) r->Body.assign((const char*)lpOptional, dwOptionalLength);
+	r->Context = dwContext;
+	return Queue(hRequest, { OperationType::Send, NULL, 0 });
+}
+
+BOOL WinHttpReceiveResponse(HINTERNET hRequest, LPVOID lpReserved)
+{
+	return Queue(hRequest, { OperationType::Receive, NULL, 0 });
+}
+
+BOOL WinHttpReadData(HINTERNET hRequest, LPVOID lpBuffer, DWORD dwNumberOfBytesToRead, LPDWORD lpdwNumberOfBytesRead)
+{
+	if (lpdwNumberOfBytesRead) *lpdwNumberOfBytesRead = 0;
+	return Queue(hRequest, { OperationType::Read, lpBuffer, dwNumberOfBytesToRead });
+}
+
+BOOL WinHttpQueryHeaders(HINTERNET hRequest, DWORD dwInfoLevel, LPCWSTR pwszName, LPVOID lpBuffer, LPDWORD lpdwBufferLength, LPDWORD lpdwIndex)
+{
+	Request* r = HandleAs<Request>(hRequest, HandleType::Request);
+	if (!r) return FALSE;
+
+	std::string value;
+	const std::string* header = NULL;
+	switch (dwInfoLevel)
+	{
+	case WINHTTP_QUERY_STATUS_CODE: value = std::to_string(r->StatusCode); break;
+	case WINHTTP_QUERY_STATUS_TEXT: value = r->StatusText; break;
+	case WINHTTP_QUERY_RAW_HEADERS_CRLF: value = r->RawHeaders; break;
+	case WINHTTP_QUERY_CONTENT_TYPE: header = FindHeader(r, "Content-Type"); break;
+	case WINHTTP_QUERY_CONTENT_LENGTH: header = FindHeader(r, "Content-Length"); break;
+	case WINHTTP_QUERY_LAST_MODIFIED: header = FindHeader(r, "Last-Modified"); break;
+	case WINHTTP_QUERY_CONTENT_ENCODING: header = FindHeader(r, "Content-Encoding"); break;
+	case WINHTTP_QUERY_LOCATION: header = FindHeader(r, "Location"); break;
+	case WINHTTP_QUERY_ACCEPT_RANGES: header = FindHeader(r, "Accept-Ranges"); break;
+	case WINHTTP_QUERY_ETAG: header = FindHeader(r, "ETag"); break;
+	case WINHTTP_QUERY_CONTENT_RANGE: header = FindHeader(r, "Content-Range"); break;
+	case WINHTTP_QUERY_CUSTOM: header = FindHeader(r, Narrow(pwszName).c_str()); break;
+	default:
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if (r->StatusCode == 0 || (dwInfoLevel != WINHTTP_QUERY_STATUS_CODE && dwInfoLevel != WINHTTP_QUERY_STATUS_TEXT && dwInfoLevel != WINHTTP_QUERY_RAW_HEADERS_CRLF && !header))
+	{
+		SetLastError(ERROR_WINHTTP_HEADER_NOT_FOUND);
+		return FALSE;
+	}
+	if (header) value = *header;
+
+	// lengths are in bytes, the terminating null is only counted when the buffer is too small
+	std::wstring wide = Widen(value);
+	DWORD needed = (DWORD)((wide.size() + 1) * sizeof(WCHAR));
+	if (!lpBuffer || *lpdwBufferLength < needed)
+	{
+		*lpdwBufferLength = needed;
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+	memcpy(lpBuffer, wide.c_str(), needed);
+	*lpdwBufferLength = needed - sizeof(WCHAR);
+	return TRUE;
+}
+
+BOOL WinHttpCloseHandle(HINTERNET hInternet)
+{
+	InternetHandle* handle = (InternetHandle*)hInternet;
+	if (!handle)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	if (handle->Type == HandleType::Request)
+	{
+		// the event loop drops what the request is doing, sends the closing notification and lets go of it
+		Request* r = (Request*)handle;
+		{
+			std::lock_guard<std::mutex> lock(r->Lock);
+			r->Closing = true;
+			Loop().Post(r, true);
+		}
+	}
+	handle->Release();
+	return TRUE;
+}
+
+BOOL WinHttpCrackUrl(LPCWSTR pwszUrl, DWORD dwUrlLength, DWORD dwFlags, LPURL_COMPONENTS lpUrlComponents)
+{
+	std::wstring url = dwUrlLength ? std::wstring(pwszUrl, dwUrlLength) : std::wstring(pwszUrl);
+	size_t schemeEnd = url.find(L"://");
+	if (schemeEnd == std::wstring::npos)
+	{
+		SetLastError(ERROR_WINHTTP_UNRECOGNIZED_SCHEME);
+		return FALSE;
+	}
+	std::wstring scheme = url.substr(0, schemeEnd);
+	for (wchar_t& c : scheme) c = towlower(c);
+	INTERNET_SCHEME nScheme;
+	if (scheme == L"http") nScheme = INTERNET_SCHEME_HTTP;
+	else if (scheme == L"https") nScheme = INTERNET_SCHEME_HTTPS;
+	else
+	{
+		SetLastError(ERROR_WINHTTP_UNRECOGNIZED_SCHEME);
+		return FALSE;
+	}
+
+	size_t authorityStart = schemeEnd + 3;
+	size_t authorityEnd = url.find_first_of(L"/?#", authorityStart);
+	if (authorityEnd == std::wstring::npos) authorityEnd = url.size();
+
+	size_t hostStart = authorityStart;
+	size_t userStart = 0, userLength = 0, passwordStart = 0, passwordLength = 0;
+	size_t at = url.rfind(L'@', authorityEnd - 1);
+	if (at != std::wstring::npos && at >= authorityStart)
+	{
+		size_t colon = url.find(L':', authorityStart);
+		userStart = authorityStart;
+		if (colon != std::wstring::npos && colon < at)
+		{
+			userLength = colon - authorityStart;
+			passwordStart = colon + 1;
+			passwordLength = at - colon - 1;
+		}
+		else userLength = at - authorityStart;
+		hostStart = at + 1;
+	}
+
+	size_t hostEnd = authorityEnd;
+	size_t portStart = std::wstring::npos;
+	size_t hostOffset = hostStart;
+	if (hostStart < authorityEnd && url[hostStart] == L'[')
+	{
+		size_t bracket = url.find(L']', hostStart);
+		if (bracket == std::wstring::npos || bracket > authorityEnd)
+		{
+			SetLastError(ERROR_WINHTTP_INVALID_URL);
+			return FALSE;
+		}
+		hostOffset = hostStart + 1;
+		hostEnd = bracket;
+		if (bracket + 1 < authorityEnd && url[bracket + 1] == L':') portStart = bracket + 2;
+	}
+	else
+	{
+		size_t colon = url.find(L':', hostStart);
+		if (colon != std::wstring::npos && colon < authorityEnd)
+		{
+			hostEnd = colon;
+			portStart = colon + 1;
+		}
+	}
+	if (hostEnd == hostOffset)
+	{
+		SetLastError(ERROR_WINHTTP_INVALID_URL);
+		return FALSE;
+	}
+
+	INTERNET_PORT port = nScheme == INTERNET_SCHEME_HTTPS ? INTERNET_DEFAULT_HTTPS_PORT : INTERNET_DEFAULT_HTTP_PORT;
+	if (portStart != std::wstring::npos && portStart < authorityEnd)
+	{
+		long value = 0;
+		for (size_t i = portStart; i < authorityEnd; i++)
+		{
+			if (!iswdigit(url[i]) || value > 65535)
+			{
+				SetLastError(ERROR_WINHTTP_INVALID_URL);
+				return FALSE;
+			}
+			value = value * 10 + (url[i] - L'0');
+		}
+		if (value > 65535)
+		{
+			SetLastError(ERROR_WINHTTP_INVALID_URL);
+			return FALSE;
+		}
+		port = (INTERNET_PORT)value;
+	}
+
+	size_t pathEnd = url.find_first_of(L"?#", authorityEnd);
+	if (pathEnd == std::wstring::npos) pathEnd = url.size();
+
+	// components point into the caller's string, or are copied when the caller supplied a buffer
+	LPWSTR base = (LPWSTR)pwszUrl;
+	auto set = [base](LPWSTR* target, DWORD* length, size_t start, size_t count)
+	{
+		if (*length == 0) return;
+		if (*target)
+		{
+			size_t copied = std::min<size_t>(count, *length - 1);
+			wmemcpy(*target, base + start, copied);
+			(*target)[copied] = L'\0';
+			*length = (DWORD)copied;
+		}
+		else
+		{
+			*target = base + start;
+			*length = (DWORD)count;
+		}
+	};
+	lpUrlComponents->nScheme = nScheme;
+	lpUrlComponents->nPort = port;
+	set(&lpUrlComponents->lpszScheme, &lpUrlComponents->dwSchemeLength, 0, schemeEnd);
+	set(&lpUrlComponents->lpszHostName, &lpUrlComponents->dwHostNameLength, hostOffset, hostEnd - hostOffset);
+	set(&lpUrlComponents->lpszUserName, &lpUrlComponents->dwUserNameLength, userStart, userLength);
+	set(&lpUrlComponents->lpszPassword, &lpUrlComponents->dwPasswordLength, passwordStart, passwordLength);
+	set(&lpUrlComponents->lpszUrlPath, &lpUrlComponents->dwUrlPathLength, authorityEnd, pathEnd - authorityEnd);
+	set(&lpUrlComponents->lpszExtraInfo, &lpUrlComponents->dwExtraInfoLength, pathEnd, url.size() - pathEnd);
+	return TRUE;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <windows.h>
+
+typedef struct _PROCESS_MEMORY_COUNTERS
+{
+	DWORD cb;
+	DWORD PageFaultCount;
+	size_t PeakWorkingSetSize;
+	size_t WorkingSetSize;
+	size_t QuotaPeakPagedPoolUsage;
+	size_t QuotaPagedPoolUsage;
+	size_t QuotaPeakNonPagedPoolUsage;
+	size_t QuotaNonPagedPoolUsage;
+	size_t PagefileUsage;
+	size_t PeakPagefileUsage;
+} PROCESS_MEMORY_COUNTERS;
+
+BOOL GetProcessMemoryInfo(HANDLE Process, PROCESS_MEMORY_COUNTERS* ppsmemCounters, DWORD cb);
@@ -0,0 +1,8 @@
+#pragma once
+#include <windows.h>
+
+#define STIF_DEFAULT 0x00000000
+#define STIF_SUPPORT_HEX 0x00000001
+
+BOOL PathFileExistsW(LPCWSTR pszPath);
+BOOL StrToInt64ExW(LPCWSTR pszString, DWORD dwFlags, LONGLONG* pllRet);
@@ -0,0 +1,15 @@
+#pragma once
+#include <windows.h>
+
+// files on POSIX file systems are sparse by nature, unwritten ranges take no space
+#define FSCTL_SET_SPARSE 0x000900c4
+// gives the blocks of a range back to the file system where it can punch holes, the range reads as zeros then
+#define FSCTL_SET_ZERO_DATA 0x000980c8
+
+typedef struct _FILE_ZERO_DATA_INFORMATION
+{
+	LARGE_INTEGER FileOffset;
+	LARGE_INTEGER BeyondFinalZero;
+} FILE_ZERO_DATA_INFORMATION;
+
+BOOL DeviceIoControl(HANDLE hDevice, DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize, LPVOID lpOutBuffer, DWORD nOutBufferSize, LPDWORD lpBytesReturned, LPOVERLAPPED lpOverlapped);
@@ -59,7 +59,7 @@ void StartButton_Click(HWND hDlg)
 		MessageBox(hDlg, L"Download folder does not exist.", L"Information", MB_OK | MB_ICONINFORMATION);
 		return;
 	}
-	if (noDownloader < 1 || noDownloader > 10) noDownloader = 5;
+	if (noDownloader < 0 || noDownloader > 64) noDownloader = 5;
 	if (url.empty())
 	{
 		MessageBox(hDlg, L"Empty URL.", L"Information", MB_OK | MB_ICONINFORMATION);
@@ -76,20 +76,28 @@ void StartButton_Click(HWND hDlg)
 		return;
 	}
 
-	DownloadSection* ds = new DownloadSection;
-	ds->Url = url;
-	ds->Start = start;
-	ds->End = end;
-	ds->UserName = userName;
-	ds->Password = password;
+	// pick up where an earlier run of the same download left off
+	std::wstring manifestFileName = Download::FindManifest(downloadFolder, url, start, end);
+	d = manifestFileName.empty() ? NULL : Download::LoadManifest(manifestFileName);
+	if (!d)
+	{
+		DownloadSection* ds = new DownloadSection;
+		ds->Url = url;
+		ds->Start = start;
+		ds->End = end;
 
-	DownloadSection* ss = ds->Copy();
+		DownloadSection* ss = ds->Copy();
 
-	d = new Download();
-	d->NoDownloader = noDownloader;
-	d->DownloadFolder = downloadFolder;
-	d->SummarySection = ss;
-	d->Sections.push_back(ds);
+		d = new Download();
+		d->DownloadFolder = downloadFolder;
+		d->SummarySection = ss;
+		d->Sections.push_back(ds);
+		d->EnableDirectWrite();
+	}
+	// zero connections means finding out how many the server and the network can take
+	d->AutoNoDownloader = noDownloader == 0;
+	d->NoDownloader = noDownloader == 0 ? 2 : noDownloader;
+	d->SetCredentials(userName, password);
 
 	s = new Scheduler(d);
 	s->Start();
@@ -111,10 +119,11 @@ void PauseButton_Click(HWND hDlg)
 	if (status == DownloadStatus::Stopped)
 	{
 		int noDownloader = (int)GetIntInput(5, GetDlgItemText(hDlg, TXTNODOWNLOADER));
-		if (noDownloader < 1 || noDownloader > 10) noDownloader = 5;
+		if (noDownloader < 0 || noDownloader > 64) noDownloader = 5;
 		std::wstring userName = GetDlgItemText(hDlg, TXTUSERNAME);
 		std::wstring password = GetDlgItemText(hDlg, TXTPASSWORD);
-		d->NoDownloader = noDownloader;
+		d->AutoNoDownloader = noDownloader == 0;
+		d->NoDownloader = noDownloader == 0 ? 2 : noDownloader;
 		d->SetCredentials(userName, password);
 		s->Start();
 	}
@@ -150,7 +159,14 @@ void Window_Closing(HWND hDlg)
 	}
 	if (!canClose)
 	{
-		if (MessageBox(hDlg, L"Download not finished. Do you want to cancel and quit?", L"Question", MB_OKCANCEL | MB_ICONQUESTION) == IDOK)
+		int answer = MessageBox(hDlg, L"Download not finished. Do you want to keep the downloaded part so that it can be resumed later?", L"Question", MB_YESNOCANCEL | MB_ICONQUESTION);
+		if (answer == IDYES)
+		{
+			// the manifest is saved when the scheduler stops, starting the same download again resumes it
+			s->Stop(false, true);
+			canClose = true;
+		}
+		else if (answer == IDNO)
 		{
 			if (status == DownloadStatus::Downloading)
 			{
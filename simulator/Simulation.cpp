@@ -0,0 +1,290 @@
+#include "Simulation.h"
+#include "Clock.h"
+
+std::vector<Simulation::Transfer> Simulation::transfers;
+std::mt19937_64 Simulation::random;
+int Simulation::idleConnections = 0;
+NetworkModel Simulation::Model;
+long long Simulation::FileSize = 0;
+ULONGLONG Simulation::VirtualTime = 0;
+ULONGLONG Simulation::StartTime = 0;
+ULONGLONG Simulation::FinishTime = 0;
+ULONGLONG Simulation::TimeLimit = 86400000;
+bool Simulation::TimedOut = false;
+long long Simulation::BytesReceived = 0;
+int Simulation::PeakConnections = 0;
+double Simulation::ConnectionTime = 0;
+
+void Simulation::Reset(NetworkModel model, long long fileSize, unsigned long long seed)
+{
+	transfers.clear();
+	random.seed(seed);
+	idleConnections = 0;
+	Model = model;
+	FileSize = fileSize;
+	// virtual time keeps going up between runs, sections created by a run never look older than they are
+	StartTime = VirtualTime;
+	FinishTime = VirtualTime;
+	TimedOut = false;
+	BytesReceived = 0;
+	PeakConnections = 0;
+	ConnectionTime = 0;
+};
+
+int Simulation::FindTransfer(Downloader* d)
+{
+	for (int i = 0; i < (int)transfers.size(); i++)
+	{
+		if (transfers[i].Owner == d) return i;
+	}
+	return (-1);
+};
+
+void Simulation::BeginTransfer(Downloader* d)
+{
+	std::uniform_real_distribution<double> uniform(0, 1);
+	Transfer t;
+	t.Owner = d;
+	// an idle keep-alive connection saves the round trip of connecting
+	DWORD roundTrips = 2;
+	if (idleConnections > 0)
+	{
+		idleConnections--;
+		roundTrips = 1;
+	}
+	t.ResponseTime = VirtualTime + roundTrips * Model.Rtt;
+	t.Fails = uniform(random) < Model.RequestFailure;
+	t.Rate = Model.ConnectionRate * (1 + Model.RateSpread * (uniform(random) * 2 - 1));
+	if (t.Rate < 1) t.Rate = 1;
+	t.FailureTime = 0;
+	if (Model.TransferFailureRate > 0)
+	{
+		std::exponential_distribution<double> failure(Model.TransferFailureRate);
+		t.FailureTime = t.ResponseTime + (ULONGLONG)(failure(random) * 1000) + 1;
+	}
+	t.PendingBytes = 0;
+	transfers.push_back(t);
+	if ((int)transfers.size() > PeakConnections) PeakConnections = (int)transfers.size();
+};
+
+void Simulation::EndTransfer(int index, DownloadStatus status, bool keepAlive)
+{
+	DownloadSection* section = transfers[index].Owner->Section;
+	section->DownloadStatus = status;
+	section->LastStatusChange = Clock::Time();
+	if (keepAlive) idleConnections++;
+	transfers.erase(transfers.begin() + index);
+};
+
+bool Simulation::CancelTransfer(Downloader* d)
+{
+	int index = FindTransfer(d);
+	if (index < 0) return false;
+	// cancelling a request closes its connection
+	EndTransfer(index, DownloadStatus::Stopped, false);
+	return true;
+};
+
+bool Simulation::IsTransferring(Downloader* d)
+{
+	return FindTransfer(d) >= 0;
+};
+
+double Simulation::GetLinkShare()
+{
+	double totalRate = 0;
+	for (Transfer& t : transfers)
+	{
+		if (t.ResponseTime <= VirtualTime) totalRate += t.Rate;
+	}
+	if (Model.LinkRate <= 0 || totalRate <= Model.LinkRate) return 1;
+	return Model.LinkRate / totalRate;
+};
+
+DWORD Simulation::Advance(HANDLE hEvent, DWORD dwMilliseconds)
+{
+	// Stop still works through the real event
+	if (hEvent && WaitForSingleObject(hEvent, 0) == WAIT_OBJECT_0) return WAIT_OBJECT_0;
+	ULONGLONG deadline = VirtualTime + dwMilliseconds;
+	bool statusChanged = false;
+	while (!statusChanged && VirtualTime < deadline)
+	{
+		if (VirtualTime - StartTime > TimeLimit) TimedOut = true;
+		if (TimedOut)
+		{
+			// stop everything, sections in LogicalError let the scheduler halt
+			while (!transfers.empty()) EndTransfer(0, DownloadStatus::LogicalError, false);
+			return WAIT_OBJECT_0;
+		}
+		// rates stay the same until the next response, finish or failure, so jump right to it
+		double share = GetLinkShare();
+		ULONGLONG next = deadline;
+		for (Transfer& t : transfers)
+		{
+			if (t.ResponseTime > VirtualTime)
+			{
+				if (t.ResponseTime < next) next = t.ResponseTime;
+				continue;
+			}
+			if (t.FailureTime && t.FailureTime < next) next = t.FailureTime;
+			DownloadSection* section = t.Owner->Section;
+			if (section->End < 0) continue;
+			double bytesLeft = section->GetTotal() - section->BytesDownloaded - t.PendingBytes;
+			ULONGLONG finishTime = VirtualTime + (ULONGLONG)(bytesLeft * 1000 / (t.Rate * share)) + 1;
+			if (finishTime < next) next = finishTime;
+		}
+		double elapsed = (double)(next - VirtualTime);
+		ConnectionTime += transfers.size() * elapsed;
+		ULONGLONG previousTime = VirtualTime;
+		VirtualTime = next;
+
+		int responding = 0;
+		size_t i = 0;
+		while (i < transfers.size())
+		{
+			Transfer& t = transfers[i];
+			DownloadSection* section = t.Owner->Section;
+			if (t.ResponseTime <= previousTime)
+			{
+				// data received since the last step, never past the end the scheduler has set
+				t.PendingBytes += t.Rate * share * elapsed / 1000;
+				long long bytes = (long long)t.PendingBytes;
+				t.PendingBytes -= bytes;
+				long long bytesLeft = section->GetTotal() - section->BytesDownloaded;
+				if (bytes > bytesLeft) bytes = bytesLeft;
+				if (bytes > 0)
+				{
+					section->BytesDownloaded += bytes;
+					BytesReceived += bytes;
+				}
+				if (section->BytesDownloaded >= section->GetTotal())
+				{
+					EndTransfer((int)i, DownloadStatus::Finished, true);
+					FinishTime = VirtualTime;
+					statusChanged = true;
+					continue;
+				}
+				if (t.FailureTime && t.FailureTime <= VirtualTime)
+				{
+					section->Error = L"Simulated connection failure.";
+					EndTransfer((int)i, DownloadStatus::DownloadError, false);
+					statusChanged = true;
+					continue;
+				}
+				responding++;
+			}
+			else if (t.ResponseTime <= VirtualTime)
+			{
+				responding++;
+				if (t.Fails || (Model.ServerMaxConnections > 0 && responding > Model.ServerMaxConnections))
+				{
+					section->HttpStatusCode = t.Fails ? L"500" : L"503";
+					section->Error = L"Simulated server error.";
+					EndTransfer((int)i, DownloadStatus::DownloadError, true);
+					statusChanged = true;
+					continue;
+				}
+				// the first response tells the file size, like Content-Length of a 206
+				section->HttpStatusCode = L"206";
+				if (section->End < 0) section->End = FileSize - 1;
+				section->DownloadStatus = DownloadStatus::Downloading;
+				section->LastStatusChange = Clock::Time();
+				statusChanged = true;
+			}
+			i++;
+		}
+	}
+	return statusChanged ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+};
+
+ULONGLONG Clock::Now()
+{
+	return Simulation::VirtualTime;
+};
+
+time_t Clock::Time()
+{
+	// far enough from zero that sections never changed look old
+	return (time_t)(Simulation::VirtualTime / 1000) + 1000000;
+};
+
+DWORD Clock::Wait(HANDLE hEvent, DWORD dwMilliseconds)
+{
+	return Simulation::Advance(hEvent, dwMilliseconds);
+};
+
+Downloader::Downloader(DownloadSection* section, HANDLE hStatusChangedEvent)
+{
+	Section = section;
+	this->hStatusChangedEvent = hStatusChangedEvent;
+	ResetDownloadStatus();
+};
+
+void Downloader::ResetDownloadStatus()
+{
+	if (Section->DownloadStatus == DownloadStatus::PrepareToDownload || Section->DownloadStatus == DownloadStatus::Downloading)
+	{
+		Section->DownloadStatus = DownloadStatus::Stopped;
+	}
+};
+
+bool Downloader::ChangeDownloadSection(DownloadSection* section)
+{
+	if (IsBusy()) return false;
+	Section = section;
+	ResetDownloadStatus();
+	return true;
+};
+
+bool Downloader::IsBusy()
+{
+	return Simulation::IsTransferring(this);
+};
+
+void Downloader::StopDownloading()
+{
+	Simulation::CancelTransfer(this);
+};
+
+void Downloader::StartDownloading()
+{
+	if (IsBusy()) return;
+	if (Section->DownloadStatus == DownloadStatus::Finished || Section->DownloadStatus == DownloadStatus::LogicalError) return;
+	// same back-off after errors as the real downloader
+	if (Section->DownloadStatus == DownloadStatus::DownloadError)
+	{
+		if (Clock::Time() - Section->LastStatusChange < 10) return;
+	}
+	if (Simulation::TimedOut)
+	{
+		Section->DownloadStatus = DownloadStatus::LogicalError;
+		return;
+	}
+	Section->HttpStatusCode = L"";
+	Section->Error = L"";
+	if (Section->End >= 0 && Section->BytesDownloaded >= Section->GetTotal())
+	{
+		Section->DownloadStatus = DownloadStatus::Finished;
+		return;
+	}
+	Section->DownloadStatus = DownloadStatus::PrepareToDownload;
+	Simulation::BeginTransfer(this);
+};
+
+void Downloader::WaitForFinish()
+{
+};
+
+// simulated downloads are not streamed
+void Downloader::OnStreamLimitMoved()
+{
+};
+
+void Downloader::DeleteInternetSession()
+{
+};
+
+Downloader::~Downloader()
+{
+	Simulation::CancelTransfer(this);
+};
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+#include "Downloader.h"
+#include <vector>
+#include <random>
+
+// network and server seen by simulated connections
+struct NetworkModel
+{
+	// bytes per second of one connection while the link is not full
+	double ConnectionRate = 2097152;
+	// connection rates are spread evenly this much around ConnectionRate, 0.5 means +-50%
+	double RateSpread = 0.5;
+	// bytes per second of the whole link, zero for no limit
+	double LinkRate = 0;
+	// milliseconds of one round trip, a new connection takes two before the response, a reused one takes one
+	DWORD Rtt = 50;
+	// chance of a request failing when its response arrives
+	double RequestFailure = 0.01;
+	// chance per second of a transferring connection breaking
+	double TransferFailureRate = 0.001;
+	// requests above this many concurrent ones get 503, zero for no limit
+	int ServerMaxConnections = 0;
+};
+
+// virtual time and simulated connections behind Clock and Downloader in the simulator
+class Simulation
+{
+private:
+	struct Transfer
+	{
+		Downloader* Owner;
+		// virtual time the response arrives, data flows after it
+		ULONGLONG ResponseTime;
+		// virtual time the connection breaks, zero if it does not
+		ULONGLONG FailureTime;
+		double Rate;
+		// fraction of a byte carried over to the next step
+		double PendingBytes;
+		bool Fails;
+	};
+	static std::vector<Transfer> transfers;
+	static std::mt19937_64 random;
+	static int idleConnections;
+	static int FindTransfer(Downloader* d);
+	static void EndTransfer(int index, DownloadStatus status, bool keepAlive);
+	static double GetLinkShare();
+public:
+	static NetworkModel Model;
+	static long long FileSize;
+	static ULONGLONG VirtualTime;
+	static ULONGLONG StartTime;
+	static ULONGLONG FinishTime;
+	// simulated runs taking longer than this many milliseconds are given up
+	static ULONGLONG TimeLimit;
+	static bool TimedOut;
+	static long long BytesReceived;
+	static int PeakConnections;
+	// connections multiplied by milliseconds, divided by the download time it gives the average number of connections
+	static double ConnectionTime;
+	static void Reset(NetworkModel model, long long fileSize, unsigned long long seed);
+	static void BeginTransfer(Downloader* d);
+	static bool CancelTransfer(Downloader* d);
+	static bool IsTransferring(Downloader* d);
+	static DWORD Advance(HANDLE hEvent, DWORD dwMilliseconds);
+};
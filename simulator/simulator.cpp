@@ -0,0 +1,164 @@
+// Runs the scheduler against simulated connections in virtual time, to compare download policies.
+// Usage: simulator [name=value ...], lists of policy values are separated by commas, e.g. connections=4,8,auto
+#include "Simulation.h"
+#include "Scheduler.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+struct Policy
+{
+	int NoDownloader = 5;
+	bool AutoNoDownloader = false;
+	long long MinSectionSize = 5242880;
+	// end-game only runs with all sections writing into one output file
+	bool DirectWrite = true;
+};
+
+struct PolicyResult
+{
+	std::vector<double> CompletionTimes;
+	double Connections = 0;
+	int PeakConnections = 0;
+	long long WastedBytes = 0;
+	int TimedOut = 0;
+};
+
+std::vector<std::string> SplitList(std::string list)
+{
+	std::vector<std::string> items;
+	size_t start = 0;
+	while (start <= list.length())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos) end = list.length();
+		items.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+	return items;
+}
+
+void RunDownload(Policy& policy, long long fileSize, unsigned long long seed, PolicyResult& result)
+{
+	Simulation::Reset(Simulation::Model, fileSize, seed);
+	DownloadSection* ds = new DownloadSection;
+	ds->Url = L"http://simulated/file";
+	ds->Start = 0;
+	ds->End = (-1);
+	DownloadSection* ss = ds->Copy();
+	Download* d = new Download();
+	d->SummarySection = ss;
+	d->Sections.push_back(ds);
+	d->NoDownloader = policy.NoDownloader;
+	d->AutoNoDownloader = policy.AutoNoDownloader;
+	d->MinSectionSize = policy.MinSectionSize;
+	if (policy.DirectWrite)
+	{
+		// nothing is written, an empty file name keeps the scheduler from preallocating one
+		d->DirectWrite = true;
+		ds->SharedFile = true;
+		ds->FileName = L"";
+	}
+
+	Scheduler* s = new Scheduler(d);
+	s->Start();
+	s->WaitForFinish();
+	bool finished = !Simulation::TimedOut;
+	for (DownloadSection* section : d->Sections)
+	{
+		if (section->DownloadStatus != DownloadStatus::Finished) finished = false;
+	}
+	double completionTime = (Simulation::FinishTime - Simulation::StartTime) / 1000.0;
+	if (finished)
+	{
+		result.CompletionTimes.push_back(completionTime);
+		if (completionTime > 0) result.Connections += Simulation::ConnectionTime / (completionTime * 1000);
+		result.WastedBytes += Simulation::BytesReceived - fileSize;
+	}
+	else result.TimedOut++;
+	if (Simulation::PeakConnections > result.PeakConnections) result.PeakConnections = Simulation::PeakConnections;
+	// the simulated run never writes the file, the scheduler ends it with a join error which is expected here
+	delete s;
+}
+
+int main(int argc, char* argv[])
+{
+	int runs = 100;
+	long long fileSize = 2147483648LL;
+	unsigned long long seed = 1;
+	std::vector<std::string> connectionList = { "5" };
+	std::vector<std::string> minSectionList = { "5242880" };
+	std::vector<std::string> endGameList = { "1" };
+	NetworkModel model;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		size_t equals = option.find('=');
+		std::string name = equals == std::string::npos ? option : option.substr(0, equals);
+		std::string value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+		if (name == "runs") runs = atoi(value.c_str());
+		else if (name == "size") fileSize = atoll(value.c_str());
+		else if (name == "seed") seed = strtoull(value.c_str(), NULL, 10);
+		else if (name == "rate") model.ConnectionRate = atof(value.c_str());
+		else if (name == "spread") model.RateSpread = atof(value.c_str());
+		else if (name == "link") model.LinkRate = atof(value.c_str());
+		else if (name == "rtt") model.Rtt = (DWORD)atoi(value.c_str());
+		else if (name == "requestfailure") model.RequestFailure = atof(value.c_str());
+		else if (name == "transferfailure") model.TransferFailureRate = atof(value.c_str());
+		else if (name == "servermax") model.ServerMaxConnections = atoi(value.c_str());
+		else if (name == "connections") connectionList = SplitList(value);
+		else if (name == "minsection") minSectionList = SplitList(value);
+		else if (name == "endgame") endGameList = SplitList(value);
+		else
+		{
+			printf("Usage: simulator [name=value ...]\n"
+				"  runs, size, seed                 simulated downloads per policy, file size in bytes, first random seed\n"
+				"  rate, spread, link               bytes per second of a connection, its relative spread, of the whole link\n"
+				"  rtt                              milliseconds of a round trip\n"
+				"  requestfailure, transferfailure  chance of a request failing, failures per second of a transfer\n"
+				"  servermax                        concurrent requests before the server answers 503\n"
+				"  connections, minsection, endgame policies to compare, e.g. connections=4,8,auto endgame=0,1\n");
+			return 1;
+		}
+	}
+	if (runs < 1 || fileSize < 1) return 1;
+	Simulation::Model = model;
+
+	printf("%-45s %10s %10s %12s %6s %12s %8s\n", "policy", "avg s", "p90 s", "connections", "peak", "wasted MB", "timeout");
+	for (std::string connections : connectionList)
+	{
+		for (std::string minSection : minSectionList)
+		{
+			for (std::string endGame : endGameList)
+			{
+				Policy policy;
+				policy.AutoNoDownloader = connections == "auto";
+				policy.NoDownloader = policy.AutoNoDownloader ? 2 : atoi(connections.c_str());
+				policy.MinSectionSize = atoll(minSection.c_str());
+				policy.DirectWrite = endGame != "0";
+				if (policy.NoDownloader < 1 || policy.NoDownloader > 64 || policy.MinSectionSize < 1) continue;
+				PolicyResult result;
+				// every policy sees the same sequence of simulated networks
+				for (int run = 0; run < runs; run++) RunDownload(policy, fileSize, seed + run, result);
+
+				std::string name = "connections=" + connections + " minsection=" + minSection + " endgame=" + endGame;
+				size_t finished = result.CompletionTimes.size();
+				double averageTime = 0, p90Time = 0, averageConnections = 0, wastedBytes = 0;
+				if (finished > 0)
+				{
+					std::sort(result.CompletionTimes.begin(), result.CompletionTimes.end());
+					for (double t : result.CompletionTimes) averageTime += t;
+					averageTime /= finished;
+					p90Time = result.CompletionTimes[(finished - 1) * 9 / 10];
+					averageConnections = result.Connections / finished;
+					wastedBytes = (double)result.WastedBytes / finished;
+				}
+				printf("%-45s %10.1f %10.1f %12.1f %6d %12.1f %8d\n", name.c_str(), averageTime, p90Time,
+					averageConnections, result.PeakConnections, wastedBytes / 1048576, result.TimedOut);
+			}
+		}
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,445 @@
+// Local HTTP/1.1 server for reproducible download tests and benchmarks.
+// Usage: testserver <folder> [port] [name=value ...]
+// The options set the profile of every connection, and each of them can be overridden for a single
+// request by the same name in the query string, e.g. /file.bin?bandwidth=1048576&disconnect=5242880
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <ctime>
+
+struct FaultProfile
+{
+	// bytes per second sent on one connection, zero for no limit
+	long long Bandwidth = 0;
+	// milliseconds waited before every response
+	DWORD Latency = 0;
+	// connection is closed after this many bytes of a response body, zero to send it all
+	long long Disconnect = 0;
+	// answer range requests with 200 and the whole file
+	bool NoRange = false;
+	// answer requests for several ranges with 200 and the whole file, single ranges are served
+	bool NoMultiRange = false;
+	// number of redirects before the file is served, cycling through 301, 302, 307 and 308
+	int Redirect = 0;
+	// answer range requests with 416
+	bool Unsatisfiable = false;
+	// send a different Last-Modified with every response
+	bool ChangingLastModified = false;
+	// disconnect, norange and unsatisfiable only apply to every nth request counted over the server
+	int FaultEvery = 1;
+};
+
+struct Connection
+{
+	SOCKET Socket;
+	FaultProfile Profile;
+};
+
+std::wstring folder;
+FaultProfile defaultProfile;
+LONG requestCount = 0;
+const int redirectCodes[] = { 301, 302, 307, 308 };
+const int sendChunkSize = 65536;
+
+bool SetProfileOption(FaultProfile& profile, std::string name, std::string value)
+{
+	long long n = _atoi64(value.c_str());
+	if (name == "bandwidth") profile.Bandwidth = n;
+	else if (name == "latency") profile.Latency = (DWORD)n;
+	else if (name == "disconnect") profile.Disconnect = n;
+	else if (name == "norange") profile.NoRange = n != 0;
+	else if (name == "nomultirange") profile.NoMultiRange = n != 0;
+	else if (name == "redirect") profile.Redirect = (int)n;
+	else if (name == "unsatisfiable") profile.Unsatisfiable = n != 0;
+	else if (name == "lastmodified") profile.ChangingLastModified = value == "changing";
+	else if (name == "faultevery") profile.FaultEvery = n > 0 ? (int)n : 1;
+	else return false;
+	return true;
+}
+
+void ParseQueryString(FaultProfile& profile, std::string query)
+{
+	size_t start = 0;
+	while (start < query.length())
+	{
+		size_t end = query.find('&', start);
+		if (end == std::string::npos) end = query.length();
+		std::string pair = query.substr(start, end - start);
+		size_t equals = pair.find('=');
+		if (equals != std::string::npos) SetProfileOption(profile, pair.substr(0, equals), pair.substr(equals + 1));
+		start = end + 1;
+	}
+}
+
+std::string UrlDecode(std::string str)
+{
+	std::string ret;
+	for (size_t i = 0; i < str.length(); i++)
+	{
+		if (str[i] == '%' && i + 2 < str.length())
+		{
+			ret += (char)strtol(str.substr(i + 1, 2).c_str(), NULL, 16);
+			i += 2;
+		}
+		else ret += str[i];
+	}
+	return ret;
+}
+
+std::string FormatHttpDate(time_t t)
+{
+	tm gmt;
+	char buffer[64];
+	gmtime_s(&gmt, &t);
+	strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+	return buffer;
+}
+
+bool SendAll(SOCKET s, const char* data, int length)
+{
+	while (length > 0)
+	{
+		int sent = send(s, data, length, 0);
+		if (sent <= 0) return false;
+		data += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+bool SendResponseHeader(SOCKET s, int statusCode, std::string reason, std::string headers)
+{
+	std::string response = "HTTP/1.1 " + std::to_string(statusCode) + ' ' + reason + "\r\n" + headers + "\r\n";
+	return SendAll(s, response.c_str(), (int)response.length());
+}
+
+// reads one request header, returns false when the client has closed the connection
+bool ReceiveRequest(SOCKET s, std::string& pending, std::string& request)
+{
+	while (true)
+	{
+		size_t end = pending.find("\r\n\r\n");
+		if (end != std::string::npos)
+		{
+			request = pending.substr(0, end + 4);
+			pending.erase(0, end + 4);
+			return true;
+		}
+		char buffer[4096];
+		int received = recv(s, buffer, sizeof(buffer), 0);
+		if (received <= 0) return false;
+		pending.append(buffer, received);
+		if (pending.length() > 65536) return false;
+	}
+}
+
+std::string GetHeaderValue(std::string request, std::string name)
+{
+	size_t lineStart = request.find("\r\n");
+	while (lineStart != std::string::npos)
+	{
+		lineStart += 2;
+		size_t lineEnd = request.find("\r\n", lineStart);
+		if (lineEnd == std::string::npos) break;
+		std::string line = request.substr(lineStart, lineEnd - lineStart);
+		size_t colon = line.find(':');
+		if (colon != std::string::npos && _stricmp(line.substr(0, colon).c_str(), name.c_str()) == 0)
+		{
+			size_t valueStart = line.find_first_not_of(' ', colon + 1);
+			return valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+		}
+		lineStart = lineEnd;
+	}
+	return std::string();
+}
+
+struct Range
+{
+	long long First;
+	long long Last;
+};
+
+// parses a single "first-last" range spec into absolute positions, returns false if it is invalid
+bool ParseRangeSpec(std::string spec, long long fileSize, long long& first, long long& last, bool& satisfiable)
+{
+	size_t dash = spec.find('-');
+	if (dash == std::string::npos) return false;
+	std::string firstStr = spec.substr(0, dash);
+	std::string lastStr = spec.substr(dash + 1);
+	if (firstStr.empty())
+	{
+		// suffix range, the last n bytes
+		long long suffix = _atoi64(lastStr.c_str());
+		first = suffix >= fileSize ? 0 : fileSize - suffix;
+		last = fileSize - 1;
+		satisfiable = suffix > 0 && fileSize > 0;
+		return true;
+	}
+	first = _atoi64(firstStr.c_str());
+	last = lastStr.empty() ? fileSize - 1 : _atoi64(lastStr.c_str());
+	if (last >= fileSize) last = fileSize - 1;
+	satisfiable = first < fileSize && first <= last;
+	return true;
+}
+
+// parses "bytes=a-b,c-d" into the satisfiable ranges in the order asked for, returns false if there is no valid range header
+bool ParseRanges(std::string range, long long fileSize, std::vector<Range>& ranges)
+{
+	if (range.compare(0, 6, "bytes=") != 0) return false;
+	size_t start = 6;
+	while (start <= range.length())
+	{
+		size_t end = range.find(',', start);
+		if (end == std::string::npos) end = range.length();
+		size_t specStart = range.find_first_not_of(' ', start);
+		long long first = 0, last = 0;
+		bool satisfiable = false;
+		if (specStart == std::string::npos || specStart >= end || !ParseRangeSpec(range.substr(specStart, end - specStart), fileSize, first, last, satisfiable)) return false;
+		if (satisfiable) ranges.push_back({ first, last });
+		start = end + 1;
+	}
+	return true;
+}
+
+// sends part of the file at the bandwidth of the profile, returns false if the connection has to be closed
+bool SendFileRange(SOCKET s, HANDLE hFile, long long first, long long length, FaultProfile& profile, bool fault)
+{
+	LARGE_INTEGER position;
+	position.QuadPart = first;
+	if (!SetFilePointerEx(hFile, position, NULL, FILE_BEGIN)) return false;
+	long long limit = fault && profile.Disconnect > 0 && profile.Disconnect < length ? profile.Disconnect : length;
+	int chunkSize = sendChunkSize;
+	// smaller chunks keep a slow connection smooth instead of sending bursts
+	if (profile.Bandwidth > 0 && profile.Bandwidth / 10 < chunkSize) chunkSize = profile.Bandwidth / 10 > 1024 ? (int)(profile.Bandwidth / 10) : 1024;
+	char* buffer = new char[chunkSize];
+	ULONGLONG startTime = GetTickCount64();
+	long long sent = 0;
+	bool ret = true;
+	while (sent < limit)
+	{
+		DWORD toRead = limit - sent > chunkSize ? chunkSize : (DWORD)(limit - sent);
+		DWORD bytesRead = 0;
+		if (!ReadFile(hFile, buffer, toRead, &bytesRead, NULL) || bytesRead == 0 || !SendAll(s, buffer, bytesRead))
+		{
+			ret = false;
+			break;
+		}
+		sent += bytesRead;
+		if (profile.Bandwidth > 0)
+		{
+			ULONGLONG due = startTime + (ULONGLONG)(sent * 1000 / profile.Bandwidth);
+			ULONGLONG now = GetTickCount64();
+			if (due > now) Sleep((DWORD)(due - now));
+		}
+	}
+	delete[] buffer;
+	return ret && sent == length;
+}
+
+// answers one request, returns false if the connection has to be closed
+bool HandleRequest(SOCKET s, std::string request, FaultProfile profile)
+{
+	LONG requestNumber = InterlockedIncrement(&requestCount);
+	size_t methodEnd = request.find(' ');
+	size_t targetEnd = methodEnd == std::string::npos ? std::string::npos : request.find(' ', methodEnd + 1);
+	if (targetEnd == std::string::npos)
+	{
+		SendResponseHeader(s, 400, "Bad Request", "Content-Length: 0\r\n");
+		return false;
+	}
+	std::string method = request.substr(0, methodEnd);
+	std::string target = request.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+	std::string path = target;
+	std::string query;
+	size_t questionMark = target.find('?');
+	if (questionMark != std::string::npos)
+	{
+		path = target.substr(0, questionMark);
+		query = target.substr(questionMark + 1);
+		ParseQueryString(profile, query);
+	}
+	bool fault = requestNumber % profile.FaultEvery == 0;
+	std::string range = GetHeaderValue(request, "Range");
+	printf("#%ld %s %s %s\n", requestNumber, method.c_str(), target.c_str(), range.c_str());
+
+	if (profile.Latency) Sleep(profile.Latency);
+	if (method != "GET" && method != "HEAD")
+	{
+		return SendResponseHeader(s, 405, "Method Not Allowed", "Content-Length: 0\r\n");
+	}
+	if (profile.Redirect > 0)
+	{
+		// the same request with one redirect less, the last value in the query string wins
+		std::string location = path + '?' + (query.empty() ? std::string() : query + '&') + "redirect=" + std::to_string(profile.Redirect - 1);
+		int statusCode = redirectCodes[(profile.Redirect - 1) % 4];
+		return SendResponseHeader(s, statusCode, "Redirect", "Location: " + location + "\r\nContent-Length: 0\r\n");
+	}
+
+	std::string fileName = UrlDecode(path);
+	if (fileName.find("..") != std::string::npos)
+	{
+		return SendResponseHeader(s, 403, "Forbidden", "Content-Length: 0\r\n");
+	}
+	for (char& c : fileName)
+	{
+		if (c == '/') c = '\\';
+	}
+	std::wstring fileNameWide(fileName.length(), L'\0');
+	fileNameWide.resize(MultiByteToWideChar(CP_UTF8, 0, fileName.c_str(), (int)fileName.length(), &fileNameWide[0], (int)fileNameWide.length()));
+	HANDLE hFile = CreateFileW((folder + fileNameWide).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		return SendResponseHeader(s, 404, "Not Found", "Content-Length: 0\r\n");
+	}
+	LARGE_INTEGER fileSize;
+	FILETIME lastWriteTime;
+	GetFileSizeEx(hFile, &fileSize);
+	GetFileTime(hFile, NULL, NULL, &lastWriteTime);
+	ULARGE_INTEGER fileTime;
+	fileTime.LowPart = lastWriteTime.dwLowDateTime;
+	fileTime.HighPart = lastWriteTime.dwHighDateTime;
+	// seconds between 1601 and 1970
+	time_t lastModified = (time_t)(fileTime.QuadPart / 10000000 - 11644473600LL);
+	if (profile.ChangingLastModified) lastModified = time(NULL) + requestNumber;
+
+	std::string headers = "Accept-Ranges: bytes\r\nLast-Modified: " + FormatHttpDate(lastModified) + "\r\n";
+	long long first = 0, last = fileSize.QuadPart - 1;
+	std::vector<Range> ranges;
+	bool ranged = ParseRanges(range, fileSize.QuadPart, ranges) && !(fault && profile.NoRange);
+	if (ranges.size() > 1 && profile.NoMultiRange) ranged = false;
+	bool satisfiable = !ranges.empty();
+	bool ret = true;
+	if (ranged && (!satisfiable || (fault && profile.Unsatisfiable)))
+	{
+		ret = SendResponseHeader(s, 416, "Range Not Satisfiable",
+			headers + "Content-Range: bytes */" + std::to_string(fileSize.QuadPart) + "\r\nContent-Length: 0\r\n");
+	}
+	else if (ranged && ranges.size() > 1)
+	{
+		// multipart/byteranges, every part with a header of its own
+		std::string boundary = "PARTIALDOWNLOAD_BOUNDARY";
+		std::vector<std::string> partHeaders;
+		long long length = 0;
+		for (Range& part : ranges)
+		{
+			partHeaders.push_back("\r\n--" + boundary + "\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes " +
+				std::to_string(part.First) + '-' + std::to_string(part.Last) + '/' + std::to_string(fileSize.QuadPart) + "\r\n\r\n");
+			length += partHeaders.back().length() + part.Last - part.First + 1;
+		}
+		std::string closing = "\r\n--" + boundary + "--\r\n";
+		length += closing.length();
+		headers += "Content-Type: multipart/byteranges; boundary=" + boundary + "\r\nContent-Length: " + std::to_string(length) + "\r\n";
+		ret = SendResponseHeader(s, 206, "Partial Content", headers);
+		for (size_t i = 0; ret && method == "GET" && i < ranges.size(); i++)
+		{
+			ret = SendAll(s, partHeaders[i].c_str(), (int)partHeaders[i].length()) &&
+				SendFileRange(s, hFile, ranges[i].First, ranges[i].Last - ranges[i].First + 1, profile, fault);
+		}
+		if (ret && method == "GET") ret = SendAll(s, closing.c_str(), (int)closing.length());
+	}
+	else
+	{
+		if (ranged)
+		{
+			first = ranges[0].First;
+			last = ranges[0].Last;
+		}
+		long long length = last - first + 1;
+		headers += "Content-Length: " + std::to_string(length) + "\r\n";
+		if (ranged)
+		{
+			headers += "Content-Range: bytes " + std::to_string(first) + '-' + std::to_string(last) + '/' + std::to_string(fileSize.QuadPart) + "\r\n";
+			ret = SendResponseHeader(s, 206, "Partial Content", headers);
+		}
+		else ret = SendResponseHeader(s, 200, "OK", headers);
+		if (ret && method == "GET" && length > 0) ret = SendFileRange(s, hFile, first, length, profile, fault);
+	}
+	CloseHandle(hFile);
+	return ret;
+}
+
+DWORD WINAPI ConnectionThreadProc(LPVOID lParam)
+{
+	Connection* connection = (Connection*)lParam;
+	std::string pending, request;
+	while (ReceiveRequest(connection->Socket, pending, request))
+	{
+		if (!HandleRequest(connection->Socket, request, connection->Profile)) break;
+		if (_stricmp(GetHeaderValue(request, "Connection").c_str(), "close") == 0) break;
+	}
+	closesocket(connection->Socket);
+	delete connection;
+	return 0;
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+	if (argc < 2)
+	{
+		printf("Usage: testserver <folder> [port] [name=value ...]\n"
+			"  bandwidth=<bytes per second per connection>\n"
+			"  latency=<milliseconds before each response>\n"
+			"  disconnect=<bytes of body sent before the connection is dropped>\n"
+			"  norange=1              answer range requests with 200\n"
+			"  redirect=<count>       redirect before serving, 301/302/307/308 in turn\n"
+			"  unsatisfiable=1        answer range requests with 416\n"
+			"  lastmodified=changing  new Last-Modified with every response\n"
+			"  faultevery=<n>         disconnect, norange and unsatisfiable only on every nth request\n");
+		return 1;
+	}
+	folder = argv[1];
+	if (folder.back() != L'\\') folder += L'\\';
+	int port = 8080;
+	for (int i = 2; i < argc; i++)
+	{
+		std::wstring arg = argv[i];
+		std::string option;
+		for (wchar_t c : arg) option += (char)c;
+		size_t equals = option.find('=');
+		if (equals == std::string::npos) port = atoi(option.c_str());
+		else if (!SetProfileOption(defaultProfile, option.substr(0, equals), option.substr(equals + 1)))
+		{
+			printf("Unknown option %s\n", option.c_str());
+			return 1;
+		}
+	}
+
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return 1;
+	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((u_short)port);
+	inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+	if (listenSocket == INVALID_SOCKET ||
+		bind(listenSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+		listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+	{
+		printf("Cannot listen on port %d: %d\n", port, WSAGetLastError());
+		WSACleanup();
+		return 1;
+	}
+	printf("Serving %ls on http://127.0.0.1:%d/\n", folder.c_str(), port);
+	while (true)
+	{
+		SOCKET s = accept(listenSocket, NULL, NULL);
+		if (s == INVALID_SOCKET) break;
+		Connection* connection = new Connection;
+		connection->Socket = s;
+		connection->Profile = defaultProfile;
+		HANDLE hThread = CreateThread(NULL, 0, ConnectionThreadProc, connection, 0, NULL);
+		if (hThread) CloseHandle(hThread);
+		else
+		{
+			closesocket(s);
+			delete connection;
+		}
+	}
+	closesocket(listenSocket);
+	WSACleanup();
+	return 0;
+}
\ No newline at end of file